@@ -2,29 +2,36 @@
 #define ARM_BUILDER_H
 
 #include "i2c.h"
-#include "pca9685.h"
+#include "i2c_bus.h"
+#include "clock.h"
+#include "pca9685_router.h"
 #include "servo.h"
+#include "motion.h"
+#include "quaternion.h"
+#include "kinematics.h"
+#include "joint_controller.h"
+#include "arm_config.h"
 #include "config.h"
 
 #include <string>
+#include <vector>
+#include <ostream>
 #include <cstdint>  // For uint8_t
-
-// Position/Orientation Structures
-struct Position{
-    float x, y, z;
-};
-struct Orientation{
-    float pitch, yaw, roll;
-};
+#include <functional>
 
 class RoboticArmBuilder
 {
 private:
 	// Objects
+    Clock* clock;         // Time the arm moves on
+    MotionEngine* engine; // Drives all servo motions
     I2C* i2c;            // I2C Object
-    PCA9685* pca; 		// PCA object
+    I2CStatsDump* statsDump; // Prints the bus statistics every I2C_STATS_DUMP_PERIOD_MS, nullptr if off
+    PCA9685Router* boards; // PCA9685 boards and the joint -> (board, channel) routes
     
     Servo* servos[6]; // Array containing pointers to all servos
+    JointController* controllers[6]; // Closed loop controllers, nullptr for open loop joints
+    Kinematics* kinematics; // Forward/inverse kinematics solver
 
     
     // Real-time Characterists
@@ -32,7 +39,12 @@ private:
 
     // Arm Target Position/Orientation
     Position targetPosition;
-    Orientation targetOrientation;
+    Quaternion targetOrientation; // Stored as a unit quaternion, converted at the API boundary
+
+    // Inverse Kinematics
+    IKMode ikMode;        // Solver used by setEE/moveLinear
+    IKResult lastIKResult; // Outcome of the most recent solve
+    float jointOffset[NUM_JOINTS]; // Servo angle (degrees) at joint angle 0
 
     // Robotic Variables
     // <DH TABLE>
@@ -49,22 +61,49 @@ private:
     // Helper Methods
     float radToDeg(float rad); // Converts radians to degrees
     float degToRad(float deg); // Converts degrees to radians
+    Quaternion toQuaternion(const Orientation& orientation); // Converts pitch/yaw/roll (degrees) to a quaternion
+    void solveJoints(const Position& position, const Quaternion& orientation, float theta[NUM_JOINTS]); // IK with the selected solver (radians)
+    void moveJoints(const float theta[NUM_JOINTS]); // Moves all servos to the joint angles and waits for them
     void updateJoints(); // Calculates and updates joint angles based on target position/orientation variables
+    void build(const ArmConfig* config, I2CBus* bus); // Creates the devices and servos, from config.h when config is nullptr, on I2C_DIRECTORY when bus is nullptr
+    std::chrono::microseconds controlTick(); // Motion engine tick for the boards' frame rate
 
 public:
 	// Constructor / Destructor
-    RoboticArmBuilder(); // Builds arm
+    RoboticArmBuilder(); // Builds arm from ARM_CONFIG_FILE in ARM_DATA_DIR, or from config.h if there is none
+    RoboticArmBuilder(const std::string& configPath); // Builds arm from a binary arm config (throws if it does not load)
+    RoboticArmBuilder(I2CBus* bus, Clock* clock);      // As the default, on a given bus and clock (simulated bus, virtual time replays)
     ~RoboticArmBuilder();                      // Resets arm back to default position
 
     // Start Params
     void initStartVector(); // Sets starting postion/orientation
     
     // Arm Control
-    void setAngle(uint8_t motor, float angle, bool wait = true); // Sets a given motor to an angle
+    MotionHandle setAngle(uint8_t motor, float angle, bool wait = true); // Sets a given motor to an angle
     void setEE(Position position, Orientation orientation);
+    void setEE(Position position, Quaternion orientation);
+    void moveLinear(Position position, Orientation orientation); // Straight line move with SLERP'd orientation
+
+    // Closed Loop Control
+    void enableClosedLoop(uint8_t motor, std::function<bool(float&)> feedback); // Trims the motor from feedback (measured servo angle, degrees)
+    void disableClosedLoop(uint8_t motor);
+    bool atTarget(uint8_t motor); // True once the motor has settled on its target
+
+    // Emergency Stop
+    void emergencyStop();      // Latches the emergency stop and cuts all outputs
+    void resetEmergencyStop(); // Clears the latch and re-enables the servos where they stopped
+
+    // PWM Frame Rate
+    void setPWMFrequency(int freq); // Every board, servo and the control tick (call while not moving, throws and changes nothing if a servo's pulses do not fit the frame)
+    void reportResolution(std::ostream& out, const std::vector<int>& frequencies); // Angular resolution per servo at each frame rate
+
+    // Data Files
+    static std::string dataPath(const std::string& path); // path resolved against ARM_DATA_DIR, kept as is when absolute or empty
 
     // Set Arm Characterists
     void setEndSpeed(float speed);  // Sets the target speed of the end effector.
+    void setIKMode(IKMode mode);    // Selects the inverse kinematics solver (default Auto)
+    IKResult getLastIKResult();     // Convergence status of the most recent solve
 
 };
 
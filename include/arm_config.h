@@ -0,0 +1,93 @@
+#ifndef ARM_CONFIG_FILE_H
+#define ARM_CONFIG_FILE_H
+
+#include "calibration.h"
+#include "calibration_fitter.h"
+
+#include <string>
+#include <vector>
+#include <cstdint> // For uint8_t, uint32_t
+
+// Binary arm config format
+#define ARM_CONFIG_MAGIC "ARMC"
+#define ARM_CONFIG_VERSION 1
+
+/* Arm config file header
+ * The file is the header, one JointConfig per joint, then each joint's rising
+ * and falling pulse tables. Everything is stored in the host's byte order and
+ * 4 byte aligned so it can be used straight from the mapping. The checksum is a
+ * CRC-32 of everything after it.
+ */
+struct ArmConfigHeader{
+    char magic[4];      // ARM_CONFIG_MAGIC
+    uint32_t version;   // ARM_CONFIG_VERSION
+    uint32_t size;      // Whole file in bytes
+    uint32_t checksum;  // CRC-32 of bytes [16, size)
+
+    uint32_t numJoints;
+    uint32_t tableSize;     // Pulse table entries per direction
+    uint32_t prescaler;     // PCA9685 prescaler the tables were built for
+    float stepSize;         // PCA9685 tick length at that prescaler (us)
+    float servoSpeed;       // deg/sec
+    float updateResolution; // updates/degree
+};
+
+// One joint's servo, with the values derived from it
+struct JointConfig{
+    uint8_t channel;        // PCA9685 channel
+    int8_t encoderChannel;  // Mux channel of the AS5600 on the joint (-1 for none)
+    uint8_t calibrated;     // 1 if the tables come from a calibration, 0 for the linear map
+    uint8_t reserved;
+    uint16_t minPulse;      // us
+    uint16_t maxPulse;      // us
+    float maxAngle;         // degrees
+    float defaultAngle;     // degrees
+    float jointOffset;      // Servo angle at joint angle 0 (degrees)
+    float angleToPwmSlope;  // us/degree of the linear map
+    float lowerLimit;       // Joint limits for the kinematics (radians)
+    float upperLimit;
+    float hysteresis;       // Mean falling - rising angle (degrees, 0 without a calibration)
+    uint32_t risingOffset;  // Byte offset of the rising table from the start of the file
+    uint32_t fallingOffset; // Byte offset of the falling table
+};
+
+static_assert(sizeof(ArmConfigHeader) == 40, "ArmConfigHeader layout changed, bump ARM_CONFIG_VERSION");
+static_assert(sizeof(JointConfig) == 44, "JointConfig layout changed, bump ARM_CONFIG_VERSION");
+
+/* Arm config loaded from a binary file
+ * The file is memory mapped and checked once (magic, version, size, offsets and
+ * checksum), then the joints and their pulse tables are read in place, so
+ * startup does no parsing, fitting or table building. Throws if the file is
+ * missing or does not pass the checks.
+ */
+class ArmConfig
+{
+private:
+    MappedFile file;
+    const ArmConfigHeader* header;
+    const JointConfig* joints;
+
+    const float* tableAt(uint32_t offset) const;
+
+public:
+    ArmConfig(const std::string& path);
+
+    const ArmConfigHeader& getHeader() const;
+    uint32_t getNumJoints() const;
+    const JointConfig& getJoint(uint32_t joint) const;
+    PrebuiltTables getTables(uint32_t joint) const; // Throws if the joint does not exist
+};
+
+/* Compiles a text arm config into the binary form
+ * The text form is [arm] and [joint] sections of key=value lines (see
+ * arm_config.txt). A joint's curves come from a sweep CSV (sweep=path,
+ * relative to the text config) or from rising=/falling= tables as written by
+ * the calibration fitter, and fall back to the linear map. Throws with the
+ * line number on a malformed line.
+ */
+std::vector<uint8_t> compileArmConfig(const std::string& textPath);
+void writeArmConfig(const std::string& path, const std::vector<uint8_t>& blob);
+
+uint32_t crc32(const uint8_t* data, size_t size);
+
+#endif
@@ -33,6 +33,8 @@ private:
     // Private Variables
     I2C *i2c;        // Pointer to I2C object
     uint8_t address; // I2C slave address
+    uint8_t channel; // I2C mux channel (I2C_DIRECT if not behind a mux)
+    I2CDevice device; // Bound handle register I/O goes through
 
     // Config
     void initConfig(uint16_t config);
@@ -40,11 +42,12 @@ private:
     // Helper Methods
     void writeReg(uint8_t reg, uint8_t value); 						// Writes a value to a register
     uint8_t readReg(uint8_t reg); 									// Reads a value from a register
+    I2CStatus tryReadReg(uint8_t reg, uint8_t& value) noexcept;     // Reads a value from a register without throwing
     void modifyReg(uint8_t reg, uint8_t mask, uint8_t value); 		// Modifies specific bits in a register without overwriting the entire register.
 
 public:
     // Constructor/Destructor
-    AS5600(I2C *i2cPtr, uint16_t config);
+    AS5600(I2C *i2cPtr, uint16_t config, uint8_t muxChannel = I2C_DIRECT); // AS5600s share one address, so more than one needs a mux
 
     // Status
     void checkMagnet(); // Check the status of the magnet, throws error if magnet is not found
@@ -54,8 +57,14 @@ public:
 
     // Angle Reading
     uint16_t getStep(); // Returns the rotational step of the encoder (0 - 4095)
+    I2CStatus tryGetStep(uint16_t& step) noexcept; // As getStep without throwing (the sampling path), step is left alone on failure
     uint16_t getRawStep(); // Returns the rotational step of the encoder (0 - 4095)
+    bool queueStep(I2CBatch& batch, uint8_t (&angle)[2]); // Queues an ANGLE read into a batch the caller submits, false if full
+    static uint16_t stepOf(const uint8_t (&angle)[2]);    // Step of an ANGLE read, once the batch has completed
     float getAngle();   // Returns the angle of the encoder
+
+    // Getters
+    uint8_t getChannel(); // Returns the I2C mux channel
 };
 
 #endif
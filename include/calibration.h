@@ -0,0 +1,128 @@
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdint> // For uint16_t
+
+// Which readings of a calibration sweep to fit
+enum class SweepDirection{
+    Both,    // Average the downward and upward passes
+    Rising,  // Readings reached by increasing the pulse
+    Falling  // Readings reached by decreasing the pulse
+};
+
+// One calibration sweep reading
+struct SweepSample{
+    float pulse;   // Commanded pulse width (us)
+    uint16_t step; // Encoder step reached (0 - 4095)
+};
+
+// "Pulse Width (us),Absolute Step (0-4096)" sweep files, rows in the order they were taken
+std::vector<SweepSample> readSweepCsv(const std::string& path);
+std::vector<SweepSample> readSweepCsv(const std::string& path, uint8_t channel); // One channel of a "Channel,Pulse Width (us),Absolute Step (0-4096)" file
+void writeSweepCsv(const std::string& path, const std::vector<SweepSample>& samples);
+
+/* Measured pulse -> angle curve for one servo
+ * Fitted from a calibration sweep (pulse width, encoder step) such as
+ * samples/sample_S1.csv. Readings at the same pulse are averaged, then a
+ * monotone (non-decreasing) piecewise-linear curve is fitted through them, so
+ * the curve is invertible. Angle 0 is the mean reading at the lowest pulse,
+ * matching Servo's convention of angle 0 at minPulse.
+ */
+class CalibrationCurve
+{
+private:
+    std::vector<float> pulses; // Knot pulse widths, increasing (us)
+    std::vector<float> angles; // Knot angles, non-decreasing (degrees)
+
+public:
+    CalibrationCurve();
+    CalibrationCurve(const std::vector<float>& pulses, const std::vector<float>& angles); // Fits a monotone curve through raw points
+
+    // Fits a sweep (in the order it was taken, so each reading's direction is known)
+    static CalibrationCurve fromSweep(const std::vector<SweepSample>& samples, SweepDirection direction = SweepDirection::Both);
+    static CalibrationCurve fromSweepCsv(const std::string& path, SweepDirection direction = SweepDirection::Both);
+
+    float angleAt(float pulse) const; // Angle a pulse reaches (clamped to the measured range)
+    float pulseAt(float angle) const; // Smallest pulse that reaches an angle (clamped to the measured range)
+
+    bool empty() const;
+    float getMinPulse() const;
+    float getMaxPulse() const;
+    float getMaxAngle() const;
+    size_t size() const; // Number of knots
+    const std::vector<float>& getPulses() const; // Knot pulse widths (us)
+    const std::vector<float>& getAngles() const; // Knot angles (degrees)
+};
+
+/* Direction dependent calibration for one servo
+ * Backlash and hysteresis make a servo stop short of where it would be at the
+ * same pulse approached from the other side. Separate curves for rising and
+ * falling pulses let the pulse for a target be chosen by direction of travel,
+ * so the first approach lands on target from either side.
+ */
+class ServoCalibration
+{
+private:
+    CalibrationCurve rising;  // Angles reached by increasing the pulse
+    CalibrationCurve falling; // Angles reached by decreasing the pulse
+
+public:
+    ServoCalibration();
+    ServoCalibration(const CalibrationCurve& curve); // Same curve both ways
+    ServoCalibration(const CalibrationCurve& rising, const CalibrationCurve& falling);
+
+    // Fits each direction of a down/up sweep
+    static ServoCalibration fromSweep(const std::vector<SweepSample>& samples);
+    static ServoCalibration fromSweepCsv(const std::string& path);
+
+    const CalibrationCurve& getRising() const;
+    const CalibrationCurve& getFalling() const;
+    float getHysteresis() const; // Mean falling - rising angle at the same pulse (degrees)
+    bool empty() const;
+};
+
+/* Angle -> PCA9685 off time lookup table
+ * Built once from any angle -> pulse map, then evaluated in O(1) with linear
+ * interpolation between evenly spaced entries, replacing the per-tick float
+ * pulse math. Entries are in PCA9685 ticks, so the table must be rebuilt if the
+ * PWM frequency changes.
+ */
+class PulseTable
+{
+private:
+    float* ticks;      // Off time at each entry (fractional ticks)
+    int size;          // Number of entries
+    float maxAngle;
+    float entryScale;  // Entries per degree
+
+public:
+    PulseTable();
+    ~PulseTable();
+
+    PulseTable(const PulseTable&) = delete;
+    PulseTable& operator=(const PulseTable&) = delete;
+
+    // pulseOf maps an angle to a pulse width (us), stepSize is the PCA9685 tick length (us)
+    void build(const std::function<float(float)>& pulseOf, float maxAngle, float stepSize, int size);
+
+    void assign(const float* ticks, int size, float maxAngle); // Copies entries built ahead of time (see PrebuiltTables)
+    void rescale(float fromStepSize, float toStepSize);        // Same pulses in the ticks of another step size (PWM frequency)
+
+    uint16_t ticksAt(float angle) const; // Off time for an angle (clamped to 0 - maxAngle)
+    bool empty() const;
+    const float* getTicks() const; // Entries (fractional ticks)
+    int getSize() const;
+};
+
+// Rising/falling pulse table entries built ahead of time, only valid for the PCA9685 step size they were built with
+struct PrebuiltTables{
+    const float* rising;
+    const float* falling;
+    int size;       // Entries per table
+    float stepSize; // PCA9685 tick length the entries are in (us)
+};
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef CALIBRATION_FITTER_H
+#define CALIBRATION_FITTER_H
+
+#include "calibration.h"
+
+#include <string>
+#include <vector>
+#include <cstddef> // For size_t
+
+/* Read-only memory map of a whole file
+ * The sweep parser works straight on the mapped bytes, so a file is never
+ * copied into strings or line buffers.
+ */
+class MappedFile
+{
+private:
+    int fd;
+    const char* data;
+    size_t size;
+
+public:
+    MappedFile(const std::string& path); // Throws if the file cannot be opened or mapped
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* begin() const;
+    const char* end() const;
+    size_t getSize() const;
+};
+
+// One servo's readings from a sweep file
+struct ChannelSweep{
+    int channel; // PCA9685 channel, -1 for a single servo "Pulse Width (us),Absolute Step (0-4096)" file
+    std::vector<SweepSample> samples;
+};
+
+/* Parses sweep CSV bytes without copying them
+ * Takes both the single servo "Pulse Width (us),Absolute Step (0-4096)" form
+ * and the combined "Channel,Pulse Width (us),Absolute Step (0-4096)" form
+ * (picked by the header's column count). Rows keep their order within each
+ * channel. Returns the number of rows read, throws on a malformed row.
+ */
+size_t parseSweepCsv(const char* begin, const char* end, std::vector<ChannelSweep>& sweeps);
+
+// Reference nominal range for the linear pwm/dc correction terms
+struct FitterParams{
+    float nominalMinPulse;  // Pulse the servo is specified to reach angle 0 at (us)
+    float nominalMaxPulse;  // Pulse the servo is specified to reach its full range at (us)
+};
+
+/* Everything fitted from one servo's sweep
+ * - minPulse/maxPulse/maxAngle: the measured range, as the JnS_* config values
+ * - pwmOffset: how far the measured mid pulse sits from the nominal mid pulse,
+ *   pwmMultiplier: measured max pulse over the offset nominal max (as the
+ *   calibration tool defines them)
+ * - dcMultiplier/dcOffset: least squares line from the linear map's angle to
+ *   the measured angle over the range (the calibration tool's error function)
+ * - calibration: direction dependent curve tables
+ */
+struct ServoFit{
+    std::string source;   // File it came from
+    int channel;          // -1 for a single servo file
+    size_t rows;
+    std::string error;    // Why the fit failed, empty if it did not
+
+    float minPulse;
+    float maxPulse;
+    float maxAngle;
+    float hysteresis;
+    float pwmOffset;
+    float pwmMultiplier;
+    float dcOffset;
+    float dcMultiplier;
+    ServoCalibration calibration;
+};
+
+ServoFit fitSweep(const std::vector<SweepSample>& samples, const FitterParams& params); // Throws if the sweep is unusable
+
+/* Fits sweep files in parallel
+ * Files are handed out to worker threads one at a time from a shared counter,
+ * so one large file does not hold up the rest. Each file is mapped, parsed and
+ * fitted by one worker, results come back in input order (by file, then by
+ * channel in the order they appear). A file that cannot be read gives one
+ * result with its error and does not stop the others.
+ */
+std::vector<ServoFit> fitSweepFiles(const std::vector<std::string>& paths, const FitterParams& params, unsigned threads);
+
+// Machine readable calibration file: one [servo] section of key=value lines per fit, curve tables as pulse:angle lists
+void writeCalibrationFile(const std::string& path, const std::vector<ServoFit>& fits);
+std::vector<ServoFit> readCalibrationFile(const std::string& path);
+CalibrationCurve parseCurveTable(const std::string& value); // One "pulse:angle,pulse:angle,..." curve value, throws if malformed
+
+#endif
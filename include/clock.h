@@ -0,0 +1,60 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <chrono>
+#include <atomic>
+#include <cstdint>  // For int64_t
+
+/* Time source for motion and simulation
+ * Code that times motion reads now() and waits with sleepUntil() instead of
+ * going to std::chrono / std::this_thread, so the same code runs on the steady
+ * clock or on virtual time. Time points are steady_clock time points either way.
+ */
+class Clock
+{
+public:
+    typedef std::chrono::steady_clock::time_point TimePoint;
+
+    virtual ~Clock() {}
+
+    virtual TimePoint now() = 0;
+    virtual void sleepUntil(TimePoint time) = 0;
+    virtual bool isVirtual() = 0; // True if time only moves when told to (nothing runs in the background)
+
+    void sleepFor(std::chrono::nanoseconds duration);
+
+    static Clock* steady(); // Shared steady clock
+};
+
+// std::chrono::steady_clock, sleeps really block
+class SteadyClock : public Clock
+{
+public:
+    TimePoint now() override;
+    void sleepUntil(TimePoint time) override;
+    bool isVirtual() override { return false; }
+};
+
+/* Virtual time
+ * Starts at the steady clock's epoch and only moves forward: sleepUntil()
+ * jumps straight to the wake time, advance() moves it explicitly. Nothing
+ * blocks, so a run takes as long as its computation and every run of the same
+ * program sees the same times.
+ */
+class VirtualClock : public Clock
+{
+private:
+    std::atomic<int64_t> time; // Nanoseconds since the epoch
+
+public:
+    VirtualClock();
+
+    TimePoint now() override;
+    void sleepUntil(TimePoint time) override; // Never moves time backwards
+    bool isVirtual() override { return true; }
+
+    void advance(std::chrono::nanoseconds duration);
+    std::chrono::nanoseconds elapsed(); // Time since the epoch
+};
+
+#endif
@@ -5,20 +5,62 @@
 // ~~~ Robotic Arm Config ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
 // Robotic Arm Physical Parameters
+#define NUM_JOINTS 6 // Number of joints/servos on the arm
 #define D_6 55.0 // Length of link 6
 #define D_1 9.5 // Offset along Z1
 #define A_2 39.0 // Length of link 2
 #define A_3 150.0 // Length of link 3
 
+// Cartesian Motion Params
+#define CARTESIAN_STEP_SIZE 2.0 // mm per interpolation step
+#define CARTESIAN_ANGLE_STEP 2.0 // degrees of end effector rotation per interpolation step
+
+// Inverse Kinematics Params
+#define IK_MAX_ITERATIONS 50 // Iteration cap for the numerical solver
+#define IK_TIME_BUDGET_US 500 // Hard time cap for the numerical solver (microseconds)
+#define IK_DAMPING 1.0 // Damped least squares damping factor (mm)
+#define IK_ORIENTATION_WEIGHT 100.0 // mm of position error equivalent to 1 radian of orientation error
+#define IK_POSITION_TOLERANCE 0.1 // mm
+#define IK_ORIENTATION_TOLERANCE 0.002 // radians (~0.1 degrees)
+
+// Data Files (relative paths in this file resolve against ARM_DATA_DIR, "" for the executable's own directory, not the working directory)
+#ifndef ARM_DATA_DIR
+#define ARM_DATA_DIR ""
+#endif
+
+// Arm Config File (servo parameters and pulse tables, compiled from arm_config.txt)
+#define ARM_CONFIG_FILE "arm_config.bin" // Loaded at startup (from ARM_DATA_DIR) instead of the servo parameters below when present
+
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // ~~~ Device Parameters ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
 // I2C Params
 #define I2C_DIRECTORY "/dev/i2c-1"
+#define I2C_MUX_ADDRESS 0x70 // TCA9548A mux (AS5600 encoders sit behind it, one per channel)
+#define I2C_SCHEDULER_MAX_WAIT_US 20000 // Longest a queued transaction waits behind higher classes (0 runs transactions on the calling threads)
+#define I2C_RETRY_ATTEMPTS 3 // Tries per transaction before it fails (1 for no retries)
+#define I2C_RETRY_BACKOFF_US 100 // Wait before the first retry, doubles on each one (microseconds)
+#define I2C_RETRY_MAX_BACKOFF_US 1000 // Longest wait between retries (microseconds)
+#define I2C_RECOVER_AFTER 2 // Failed attempts in a row before the bus is recovered (0 never)
+#define I2C_STATS_DUMP_PERIOD_MS 0 // Prints the per-device bus statistics this often (0 for never, needs I2C_STATS)
 
 // PCA9865 Parms
 #define PCA9685_SLAVE_ADDR 0x40  // Slave address
 #define PCA9685_FREQ 50    // hz
+#define PCA9685_HIGH_RATE 0 // 1 runs the frames at PCA9685_HIGH_RATE_FREQ instead, the control tick follows them (digital servos only)
+#define PCA9685_HIGH_RATE_FREQ 333 // hz, digital servos take 200 - 333 (check the resolution report before raising it)
+#define PCA9685_FRAME_MARGIN_US 100 // A servo's longest pulse must end this long before the next frame starts (microseconds)
+#define PCA9685_BOARDS {PCA9685_SLAVE_ADDR} // Board addresses in board order, the joints' JnS_BOARD index into it
+#define PCA9685_ALL_CALL_ADDR 0x6F // Address every board also takes writes on (0 for none, must be free: the default 0x70 is the mux)
+#define PCA9685_BURST_OUTPUTS 1 // A tick's servo outputs go out together, one burst per board (0 writes each on its own)
+
+// AS5600 Params
+#define ENCODER_SAMPLE_PERIOD_US 1000 // Background sampler period (microseconds)
+#define ENCODER_BUFFER_SIZE 1024 // Samples kept per encoder (power of two)
+#define ENCODER_MEASUREMENT_NOISE 0.06 // Reading noise standard deviation (degrees)
+#define ENCODER_PROCESS_NOISE 1.0e6 // Estimator jerk noise density, higher tracks faster but noisier
+#define ENCODER_OUTLIER_GATE 6.0 // Readings further than this many standard deviations from the estimate are rejected
+#define ENCODER_MAX_REJECTIONS 5 // Consecutive rejections before the estimator re-locks onto the readings
 
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // ~~~ Servo Parameters ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -26,48 +68,96 @@
 // Global Servo Params
 #define SERVO_UPDATE_RESOLUTION 5 // updates/degree (servo smoothness)
 #define SERVO_SPEED 90 // deg/sec
+#define SERVO_PULSE_TABLE_SIZE 1024 // Angle -> pulse lookup table entries per servo
+#define MOTION_TICK_PERIOD_US 2000 // Motion engine control loop period (microseconds)
+
+// Calibration Params (ServoCalibrator, pulses in microseconds)
+#define CALIBRATION_SEARCH_LOW 300 // Lowest pulse the endpoint search may command
+#define CALIBRATION_SEARCH_HIGH 3000 // Highest pulse the endpoint search may command
+#define CALIBRATION_GALLOP_STEP 40 // First step out towards each end (doubles every step)
+#define CALIBRATION_ENDPOINT_RESOLUTION 2 // Endpoints are narrowed down to this
+#define CALIBRATION_BACKLASH_MARGIN 40 // Endpoint probes are approached from this far inside
+#define CALIBRATION_SATURATION_TOLERANCE 0.5 // Readings this close to the end stop count as at it (degrees)
+#define CALIBRATION_CLIP 10 // Trimmed from each measured end before sampling
+#define CALIBRATION_MIN_STEP 5 // Sampling step where the response bends
+#define CALIBRATION_MAX_STEP 80 // Sampling step where the response is straight
+#define CALIBRATION_CURVATURE_TOLERANCE 1.0 // Departure from a straight line that halves the sampling step (degrees)
+#define CALIBRATION_POLL_PERIOD_US 2000 // Encoder read period while waiting to settle (microseconds)
+#define CALIBRATION_MIN_DWELL_US 22000 // Shortest wait after a command, one PWM frame plus margin (microseconds)
+#define CALIBRATION_SETTLE_TIMEOUT_US 500000 // Take the reading anyway after this long (microseconds)
+#define CALIBRATION_SETTLE_WINDOW 6 // Readings compared to decide the servo is still
+#define CALIBRATION_SETTLE_TOLERANCE 0.5 // Encoder steps the window may still be drifting by
+#define CALIBRATION_FILE "arm_calibration.csv" // Combined sweep written by the arm calibration
+
+// Closed Loop Joint Control (used when a joint has encoder feedback)
+#define JOINT_CONTROL_PERIOD_US 2000 // Outer loop period (microseconds)
+#define JOINT_KP 0.6 // Trim degrees per degree of error
+#define JOINT_KI 8.0 // Trim degrees per degree-second of error
+#define JOINT_KV 0.04 // Trim degrees per deg/s of commanded velocity (servo lag feedforward)
+#define JOINT_MAX_TRIM 15.0 // Largest correction (degrees)
+#define JOINT_SETTLE_TOLERANCE 0.3 // At target within this error (degrees)
+#define JOINT_SETTLE_TIME_MS 50 // Error must stay within tolerance this long
+#define JOINT_SETTLE_TIMEOUT_MS 500 // Moves complete this long after the ramp even if not settled
 
 // Joint 1 Servo Params
+#define J1S_BOARD 0 // Index into PCA9685_BOARDS
 #define J1S_CHANNEL 0
 #define J1S_MIN_PULSE 540 // microseconds
 #define J1S_MAX_PULSE 2665 // microseconds
 #define J1S_MAX_ANGLE 262.793 // degrees
 #define J1S_DEF_ANGLE 130 // degrees
+#define J1S_CALIBRATION "samples/sample_S1.csv" // Calibration sweep (empty for the linear map)
+#define J1S_ENCODER_CHANNEL 0 // Mux channel of the AS5600 on the joint (-1 for none)
 
 // Joint 2 Servo Params
+#define J2S_BOARD 0 // Index into PCA9685_BOARDS
 #define J2S_CHANNEL 1
 #define J2S_MIN_PULSE 535 // microseconds
 #define J2S_MAX_PULSE 2655 // microseconds
 #define J2S_MAX_ANGLE 263.848 // degrees
 #define J2S_DEF_ANGLE 131 // degrees
+#define J2S_CALIBRATION "samples/sample_S2.csv" // Calibration sweep (empty for the linear map)
+#define J2S_ENCODER_CHANNEL 1 // Mux channel of the AS5600 on the joint (-1 for none)
 
 // Joint 3 Servo Params
+#define J3S_BOARD 0 // Index into PCA9685_BOARDS
 #define J3S_CHANNEL 4
 #define J3S_MIN_PULSE 400 // microseconds
 #define J3S_MAX_PULSE 2795 // microseconds
 #define J3S_MAX_ANGLE 296.367 // degrees
 #define J3S_DEF_ANGLE 136 // degrees
+#define J3S_CALIBRATION "samples/sample_S3.csv" // Calibration sweep (empty for the linear map)
+#define J3S_ENCODER_CHANNEL 2 // Mux channel of the AS5600 on the joint (-1 for none)
 
 // Joint 4 Servo Params
+#define J4S_BOARD 0 // Index into PCA9685_BOARDS
 #define J4S_CHANNEL 5
 #define J4S_MIN_PULSE 400 // microseconds
 #define J4S_MAX_PULSE 2790 // microseconds
 #define J4S_MAX_ANGLE 295.4 // degrees
 #define J4S_DEF_ANGLE 140 // degrees
+#define J4S_CALIBRATION "samples/sample_S4.csv" // Calibration sweep (empty for the linear map)
+#define J4S_ENCODER_CHANNEL 3 // Mux channel of the AS5600 on the joint (-1 for none)
 
 // Joint 5 Servo Params
+#define J5S_BOARD 0 // Index into PCA9685_BOARDS
 #define J5S_CHANNEL 6
 #define J5S_MIN_PULSE 395 // microseconds
 #define J5S_MAX_PULSE 2780 // microseconds
 #define J5S_MAX_ANGLE 296.719 // degrees
 #define J5S_DEF_ANGLE 134 // degrees
+#define J5S_CALIBRATION "samples/sample_S5.csv" // Calibration sweep (empty for the linear map)
+#define J5S_ENCODER_CHANNEL 4 // Mux channel of the AS5600 on the joint (-1 for none)
 
 // Joint 6 Servo Params
+#define J6S_BOARD 0 // Index into PCA9685_BOARDS
 #define J6S_CHANNEL 8
 #define J6S_MIN_PULSE 1000 // microseconds
 #define J6S_MAX_PULSE 2000 // microseconds
 #define J6S_MAX_ANGLE 79.8926 // degrees
 #define J6S_DEF_ANGLE 40 // degrees
+#define J6S_CALIBRATION "" // Calibration sweep (empty for the linear map)
+#define J6S_ENCODER_CHANNEL -1 // Mux channel of the AS5600 on the joint (-1 for none)
 
 
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
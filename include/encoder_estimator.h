@@ -0,0 +1,68 @@
+#ifndef ENCODER_ESTIMATOR_H
+#define ENCODER_ESTIMATOR_H
+
+#include "encoder_sampler.h"
+
+#include <cstdint> // For uint64_t
+
+// Estimator tuning (angles in degrees, times in seconds)
+struct EstimatorParams{
+    double measurementNoise; // Standard deviation of a single reading (degrees)
+    double processNoise;     // Jerk noise spectral density, higher tracks faster but noisier (deg^2/s^5)
+    double outlierGate;      // Readings further than this many standard deviations from the prediction are rejected
+    int maxRejections;       // Consecutive rejections before the estimator re-locks onto the readings
+};
+
+// Estimated encoder state
+struct EncoderState{
+    uint64_t timestamp;  // steady_clock time of the state (nanoseconds)
+    double angle;        // Multi-turn angle (degrees)
+    double velocity;     // deg/s
+    double acceleration; // deg/s^2
+    bool valid;          // False until the first sample
+};
+
+/* Multi-turn encoder state estimator
+ * A constant acceleration Kalman filter over timestamped AS5600 samples.
+ * Readings are unwrapped across the 4096 step boundary against the predicted
+ * angle (not the previous reading), so a single bad reading cannot add or lose
+ * a turn. Readings outside the innovation gate are rejected as outliers, after
+ * maxRejections in a row the filter re-locks onto the readings so a genuine
+ * jump (re-zero, slipped magnet) is followed. Allocation-free.
+ */
+class EncoderEstimator
+{
+private:
+    EstimatorParams params;
+
+    double x[3];    // Angle, velocity, acceleration
+    double P[3][3]; // State covariance
+    uint64_t lastTimestamp;
+    bool initialized;
+
+    int consecutiveRejections;
+    uint64_t updateCount;
+    uint64_t rejectedCount;
+
+    void initialize(double angle, uint64_t timestamp);
+    void predictState(double dt, double state[3]) const;
+    void predictCovariance(double dt);
+
+public:
+    EncoderEstimator(const EstimatorParams& params);
+
+    bool update(const EncoderSample& sample); // False if the sample was rejected as an outlier
+    void reset();                             // Forgets all state, the next sample re-initializes
+
+    // State
+    EncoderState getState() const;
+    EncoderState predict(uint64_t timestamp) const; // State extrapolated to a later time
+    bool isSettled(double velocityTolerance) const; // True once the estimated speed is within tolerance (deg/s)
+    long getTurns() const;                          // Whole turns from the first sample's turn
+
+    // Stats
+    uint64_t getUpdateCount() const;
+    uint64_t getRejectedCount() const;
+};
+
+#endif
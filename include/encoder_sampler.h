@@ -0,0 +1,146 @@
+#ifndef ENCODER_SAMPLER_H
+#define ENCODER_SAMPLER_H
+
+#include "as5600.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <cstddef> // For size_t
+#include <cstdint> // For uint16_t, uint64_t
+
+// One timestamped encoder reading
+struct EncoderSample{
+    uint64_t timestamp; // steady_clock time of the read (nanoseconds)
+    uint16_t step;      // Encoder step (0 - 4095)
+
+    float angle() const; // Step converted to degrees
+};
+
+/* Lock-free single-writer ring buffer of encoder samples
+ * The writer never waits on readers. Each slot carries the sequence number of
+ * the sample it holds, readers check it before and after copying and retry or
+ * drop samples the writer overwrote mid-copy, so a reader never sees a torn
+ * sample. Readers never block each other or the writer.
+ */
+class EncoderRing
+{
+private:
+    struct Slot{
+        std::atomic<uint64_t> sequence; // Sample number + 1 once written, 0 while being written
+        std::atomic<uint64_t> timestamp;
+        std::atomic<uint16_t> step;
+    };
+
+    Slot* slots;
+    size_t capacity;             // Power of two
+    size_t mask;
+    std::atomic<uint64_t> count; // Samples published so far
+
+    bool readSlot(uint64_t sample, EncoderSample& out) const; // False if the sample was overwritten
+
+public:
+    EncoderRing(size_t capacity); // Capacity is rounded up to a power of two
+    ~EncoderRing();
+
+    EncoderRing(const EncoderRing&) = delete;
+    EncoderRing& operator=(const EncoderRing&) = delete;
+
+    // Writer (one thread only)
+    void push(const EncoderSample& sample);
+
+    // Readers (any thread)
+    bool latest(EncoderSample& out) const;                        // False if nothing has been published
+    size_t snapshot(EncoderSample* out, size_t maxSamples) const; // Most recent samples, oldest first, returns the count
+    uint64_t getCount() const;
+    size_t getCapacity() const;
+};
+
+/* Reads an AS5600 at a fixed rate on its own thread
+ * Each read is timestamped with the monotonic clock and published to an
+ * EncoderRing, so consumers get the encoder state without touching the bus.
+ * Failed reads are counted and skipped, missed periods are counted as overruns
+ * and the schedule resyncs instead of bursting to catch up.
+ */
+class EncoderSampler
+{
+private:
+    AS5600* encoder;
+    std::chrono::nanoseconds period;
+    EncoderRing ring;
+
+    std::thread worker;
+    std::atomic<bool> running;
+    std::atomic<uint64_t> errorCount;
+    std::atomic<uint64_t> overrunCount;
+
+    void samplingThread();
+
+public:
+    EncoderSampler(AS5600* encoder, std::chrono::microseconds period, size_t capacity);
+    ~EncoderSampler(); // Stops the sampling thread
+
+    void start();
+    void stop();
+    bool isRunning() const;
+
+    // Sample access (never touches the bus)
+    bool latest(EncoderSample& out) const;                        // False if nothing has been sampled
+    size_t snapshot(EncoderSample* out, size_t maxSamples) const; // Most recent samples, oldest first, returns the count
+
+    // Stats
+    uint64_t getSampleCount() const;
+    uint64_t getErrorCount() const;
+    uint64_t getOverrunCount() const;
+    std::chrono::microseconds getPeriod() const;
+};
+
+/* Reads several AS5600s (one per mux channel) at a fixed rate on one thread
+ * Every sweep reads each encoder once. Reads are ordered by mux channel and
+ * alternate direction each sweep, so a sweep starts on the channel the last
+ * one ended on: N channels cost N - 1 channel switches per sweep instead of N
+ * (or one per transaction without the I2C channel cache). Each encoder has its
+ * own EncoderRing.
+ */
+class MultiEncoderSampler
+{
+private:
+    std::vector<AS5600*> encoders;
+    std::vector<EncoderRing*> rings;  // One per encoder
+    std::vector<size_t> order;        // Encoder indices sorted by mux channel
+    bool reverse;                     // Direction of the next sweep
+    std::chrono::nanoseconds period;
+
+    std::thread worker;
+    std::atomic<bool> running;
+    std::atomic<uint64_t> sweepCount;
+    std::atomic<uint64_t> errorCount;
+    std::atomic<uint64_t> overrunCount;
+
+    void samplingThread();
+
+public:
+    MultiEncoderSampler(const std::vector<AS5600*>& encoders, std::chrono::microseconds period, size_t capacity);
+    ~MultiEncoderSampler(); // Stops the sampling thread
+
+    MultiEncoderSampler(const MultiEncoderSampler&) = delete;
+    MultiEncoderSampler& operator=(const MultiEncoderSampler&) = delete;
+
+    void start();
+    void stop();
+    bool isRunning() const;
+    void sweep(); // Reads every encoder once (called by the sampling thread, or directly when not running)
+
+    // Sample access by encoder index (never touches the bus)
+    size_t size() const;
+    bool latest(size_t encoder, EncoderSample& out) const;
+    size_t snapshot(size_t encoder, EncoderSample* out, size_t maxSamples) const;
+
+    // Stats
+    uint64_t getSweepCount() const;
+    uint64_t getErrorCount() const;
+    uint64_t getOverrunCount() const;
+};
+
+#endif
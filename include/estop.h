@@ -0,0 +1,44 @@
+#ifndef ESTOP_H
+#define ESTOP_H
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+class PCA9685;
+
+/* Process-wide emergency stop
+ * Once latched, every motion path refuses to move, the I2C layer refuses all
+ * writes except the emergency cut, and every registered PCA9685 has its
+ * outputs switched off with a single ALL_LED_OFF_H write. The latch stays set
+ * until reset() is called.
+ */
+class EmergencyStop
+{
+private:
+    static std::atomic<bool> latched;
+    static int wakePipe[2];                // Signal handlers wake the watcher thread through this pipe
+    static std::mutex boardsMutex;
+    static std::vector<PCA9685*> boards;   // Boards whose outputs get cut
+
+    static void startWatcher();    // Starts the thread that cuts outputs after trigger()
+    static void watcherThread();
+    static void cutOutputs();      // One ALL_LED_OFF_H write per board
+    static void signalHandler(int signum);
+
+public:
+    // Triggering
+    static void trigger() noexcept; // Async-signal-safe, latches and wakes the watcher thread to cut outputs
+    static void stop();             // Latches and cuts outputs from the calling thread
+    static void installSignalHandler(int signum); // Makes signum trigger the emergency stop
+
+    // State
+    static bool isLatched() noexcept;
+    static void reset(); // Clears the latch, outputs stay off until re-enabled
+
+    // Boards
+    static void registerBoard(PCA9685* board);
+    static void unregisterBoard(PCA9685* board);
+};
+
+#endif
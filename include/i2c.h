@@ -1,31 +1,345 @@
 #ifndef i2c_H
 #define i2c_H
 
+#include "i2c_bus.h"
+#include "i2c_stats.h"
+
 #include <string>
 #include <vector>
+#include <mutex>
+#include <chrono>
+#include <future>
+#include <functional>
+#include <atomic>
+#include <array>
+#include <cstddef>  // For size_t
+#include <cstdint>  // For uint8_t
+
+// Mux channels
+#define I2C_DIRECT 0xFF     // Channel of devices directly on the bus (not behind the mux)
+#define I2C_MUX_CHANNELS 8  // TCA9548A downstream channels
+#define I2C_CHANNEL_SLOTS (I2C_MUX_CHANNELS + 1) // Mux channels, then the bus itself
+#define I2C_ADDRESSES 128   // 7-bit addresses
+
+// Priority classes of bus transactions, highest first
+enum class I2CPriority{
+    Emergency,  // Emergency stop cut (the only writes let through while latched)
+    Output,     // Servo/PWM output writes
+    Feedback,   // Encoder and register reads
+    Diagnostic  // Pings, registration, anything that can wait
+};
+#define I2C_PRIORITIES 4
+
+enum class I2COp{
+    Write,
+    Read,
+    WriteRead, // Register pointer write then read, with nothing else in between
+    Ping
+};
+
+// Outcome of a transaction
+enum class I2CStatus{
+    Ok,
+    Nack,          // Not acknowledged (device missing, busy or a glitch on the bus)
+    Short,         // Acknowledged but fewer bytes transferred than asked for
+    Refused,       // Write refused, emergency stop latched
+    MuxError,      // Mux channel could not be selected
+    NotRegistered, // Slave was never registered
+    Failed         // Could not be run at all (no bus, out of memory, transport threw)
+};
+
+const char* i2cStatusName(I2CStatus status) noexcept; // Short name, for logs
+
+/* Retries of failed transactions
+ * A transaction that was not acknowledged, came up short or could not select
+ * its mux channel is repeated up to maxAttempts times in all, waiting backoff
+ * before the first retry and doubling it up to maxBackoff. After recoverAfter
+ * failed attempts in a row the bus recovery runs before the next one. Pings
+ * are never retried (they probe for devices that may not be there).
+ */
+struct I2CRetryPolicy{
+    int maxAttempts;                       // 1 for no retries
+    std::chrono::microseconds backoff;
+    std::chrono::microseconds maxBackoff;
+    int recoverAfter;                      // 0 never recovers
+};
+
+// One bus transaction
+struct I2CRequest{
+    I2COp op;
+    I2CPriority priority;
+    uint8_t channel;            // Mux channel, I2C_DIRECT for the bus itself
+    uint8_t address;
+    std::vector<uint8_t> data;  // Bytes written (register pointer first)
+    int readBytes;              // Bytes read (Read, WriteRead)
+};
+
+struct I2CResult{
+    I2CStatus status;
+    bool ok;                   // Transferred in full
+    bool refused;              // Write refused by the emergency stop latch
+    std::vector<uint8_t> data; // Bytes read
+    std::string error;         // Why it failed, empty on success
+};
+
+class I2CScheduler;
+class I2CBatch;
+class I2C;
+
+/* View of a caller-owned byte buffer (std::span is C++20, the tree builds as C++17)
+ * Made from a pointer and a length, a C array, a std::array or a std::vector.
+ * It never owns or allocates, the buffer has to outlive the call it is passed to.
+ */
+template <typename T>
+class BasicByteSpan
+{
+private:
+    T* bytes;
+    int length;
+
+public:
+    BasicByteSpan(T* bytes, int length) : bytes(bytes), length(length){}
+    template <size_t N>
+    BasicByteSpan(T (&array)[N]) : bytes(array), length(static_cast<int>(N)){}
+    template <size_t N>
+    BasicByteSpan(std::array<uint8_t, N>& array) : bytes(array.data()), length(static_cast<int>(N)){}
+    template <size_t N>
+    BasicByteSpan(const std::array<uint8_t, N>& array) : bytes(array.data()), length(static_cast<int>(N)){}
+    BasicByteSpan(std::vector<uint8_t>& vector) : bytes(vector.data()), length(static_cast<int>(vector.size())){}
+    BasicByteSpan(const std::vector<uint8_t>& vector) : bytes(vector.data()), length(static_cast<int>(vector.size())){}
+
+    T* data() const { return bytes; }
+    int size() const { return length; }
+};
+
+typedef BasicByteSpan<uint8_t> ByteSpan;            // Bytes to read into
+typedef BasicByteSpan<const uint8_t> ConstByteSpan; // Bytes to write
+
+/* Bound device on an I2C bus
+ * Returned by I2C::bind once the device has answered, it carries its validated
+ * (channel, address) so its transactions skip the registry check. Where the
+ * bus supports it the device also has a dedicated handle (its own i2c-dev file
+ * descriptor), so the bus is never readdressed for it. Copies are cheap and
+ * stay valid as long as the I2C object. A default constructed device is
+ * unbound and every transaction on it fails with NotRegistered.
+ */
+class I2CDevice
+{
+private:
+    I2C* i2c;
+    uint8_t channel;
+    uint8_t address;
+
+    friend class I2C;
+    I2CDevice(I2C* i2c, uint8_t channel, uint8_t address);
+
+public:
+    I2CDevice(); // Unbound
+
+    bool isBound() const;
+    uint8_t getChannel() const;
+    uint8_t getAddress() const;
+    I2C* getBus() const;
+
+    // Non-throwing transactions, as I2C::try*
+    I2CStatus tryRead(uint8_t* buffer, int numBytes) noexcept;
+    I2CStatus tryWrite(const uint8_t* buffer, int numBytes) noexcept;
+    I2CStatus tryWriteRead(const uint8_t* out, int outBytes, uint8_t* in, int inBytes) noexcept;
+    I2CStatus tryRead(ByteSpan buffer) noexcept;
+    I2CStatus tryWrite(ConstByteSpan buffer) noexcept;
+    I2CStatus tryWriteRead(ConstByteSpan out, ByteSpan in) noexcept;
+
+    // Throwing (std::runtime_error naming the device), into caller-owned buffers
+    void read(ByteSpan buffer);
+    bool write(ConstByteSpan buffer); // Refused (false) while the emergency stop is latched
+    void writeRead(ConstByteSpan out, ByteSpan in);
+
+    // Fixed-size reads, the bytes come back by value
+    template <size_t N>
+    std::array<uint8_t, N> read(){
+        std::array<uint8_t, N> buffer;
+        read(ByteSpan(buffer));
+        return buffer;
+    }
+
+    template <size_t N>
+    std::array<uint8_t, N> readRegisters(uint8_t reg){ // Register pointer write, then N bytes from there
+        std::array<uint8_t, N> buffer;
+        writeRead(ConstByteSpan(&reg, 1), ByteSpan(buffer));
+        return buffer;
+    }
+};
 
 class I2C
 {
+    friend class I2CScheduler; // Executes queued requests on its bus thread
+    friend class I2CDevice; // Runs its transactions without the registry check
+
 private:
-    std::string busPath; // I2C bus path
-    int i2cBus; // I2C file descriptor
-    uint8_t activeSlave; // Currently active slave
-    std::vector<uint8_t> slaves; // Database of all slaves registered on I2C bus
-    
-    bool setSlave(uint8_t slave); // Configures slave for reading/writing
-    bool isActive(uint8_t slave); // Returns true if slave is active
-    bool validateSlave(uint8_t slave); // Checks if slave has been registered
+    I2CBus* bus; // Transport, nullptr for subclasses that override it
+    bool ownsBus; // Bus was opened by this object
+    std::atomic<uint64_t> present[I2C_CHANNEL_SLOTS][2]; // Registered slaves, one 128-bit bitmap per channel slot
+    int deviceHandles[I2C_CHANNEL_SLOTS][I2C_ADDRESSES]; // Dedicated bus handle per registered slave, -1 for none (bus lock held)
+    std::mutex busMutex; // One transaction at a time, so nothing can land after the emergency stop cut
+    I2CScheduler* scheduler; // Bus owner thread, nullptr when callers use the bus directly
+    I2CRetryPolicy retryPolicy; // Retries of failed transactions (bus lock held)
+    std::function<bool()> recoveryHook; // Replaces the bus recovery when set
+    uint64_t recoveries; // Bus recoveries run so far
+    I2CBatch* inFlight; // Batch submitted to the bus and not completed yet (bus lock held)
+#if I2C_STATS
+    I2CStats stats; // Per-device counters and latencies (bus lock held)
+#endif
+
+    // Mux
+    int muxAddress; // TCA9548A address, -1 without a mux
+    uint8_t activeChannel; // Currently selected mux channel, I2C_DIRECT if none
+    uint64_t channelSwitches; // Number of channel select writes
+
+    void clearRegistry(); // No slaves, no handles
+    static int slotOf(uint8_t channel); // Channel slot of a mux channel or I2C_DIRECT, -1 if it does not exist
+    bool validateSlave(uint8_t channel, uint8_t slave); // Checks if slave has been registered (one bit test)
+    bool addSlave(uint8_t channel, uint8_t addr); // Pings, then marks present and opens its dedicated handle
+    void markPresent(int slot, uint8_t addr); // Sets the slave's registry bit and opens its dedicated handle
+    int deviceHandle(uint8_t channel, uint8_t addr); // Dedicated bus handle, -1 for none (bus lock held)
+    int busRead(int handle, uint8_t addr, uint8_t* buffer, int numBytes); // Through the dedicated handle, or the transport
+    int busWrite(int handle, uint8_t addr, const uint8_t* buffer, int numBytes);
+    bool selectChannel(uint8_t channel); // Routes the mux to a channel if it is not already (bus lock held)
+    bool writeMux(uint8_t control); // Writes the mux control register (bus lock held)
+
+    I2CResult execute(const I2CRequest& request); // Runs a request on the bus now
+    I2CStatus perform(I2COp op, I2CPriority priority, uint8_t channel, uint8_t addr, const uint8_t* out, int outBytes
+                    , uint8_t* in, int inBytes) noexcept; // Through the scheduler when running, otherwise now
+    I2CStatus run(I2COp op, I2CPriority priority, uint8_t channel, uint8_t addr, const uint8_t* out, int outBytes
+                , uint8_t* in, int inBytes) noexcept; // On the bus now, with retries
+    I2CStatus attempt(I2COp op, uint8_t channel, uint8_t addr, const uint8_t* out, int outBytes
+                    , uint8_t* in, int inBytes); // One try on the bus (bus lock held)
+    bool recover(); // Recovery hook, or the bus's own recovery (bus lock held)
+    void settleBatch(); // Completes the batch in flight, if any, before the bus is used again (bus lock held)
+
+protected:
+    I2C(); // For subclasses that override the transport
+
+    // Transport, the bus unless overridden (returns the number of bytes transferred, or -1)
+    virtual int transferRead(uint8_t addr, uint8_t* buffer, int numBytes);
+    virtual int transferWrite(uint8_t addr, const uint8_t* buffer, int numBytes);
 
 public:
-    I2C(const std::string& busPath); // Constructor
-    ~I2C(); // Destructor
-	
-    bool registerSlave(uint8_t addr); // Registers slave into database
+    I2C(const std::string& busPath); // Opens an i2c-dev bus (/dev/i2c-*)
+    I2C(I2CBus* bus); // Runs on a bus owned by the caller (e.g. SimBus)
+    virtual ~I2C(); // Destructor
+
+    // Mux
+    bool attachMux(uint8_t muxAddr); // Adds a TCA9548A mux, returns false if it does not respond
+    uint8_t getActiveChannel(); // Currently selected mux channel, I2C_DIRECT if none
+    uint64_t getChannelSwitches(); // Number of channel select writes so far
+
+    /* Non-throwing transactions
+     * The hot path: nothing throws, and nothing allocates unless the scheduler
+     * queues the request. Failed transactions are retried per the retry policy.
+     */
+    I2CStatus tryRead(uint8_t channel, uint8_t addr, uint8_t* buffer, int numBytes) noexcept;
+    I2CStatus tryWrite(uint8_t channel, uint8_t addr, const uint8_t* buffer, int numBytes) noexcept;
+    I2CStatus tryWriteRead(uint8_t channel, uint8_t addr, const uint8_t* out, int outBytes, uint8_t* in, int inBytes) noexcept;
+
+    void setRetryPolicy(const I2CRetryPolicy& policy); // Default: one attempt, no retries
+    I2CRetryPolicy getRetryPolicy();
+    void setRecoveryHook(std::function<bool()> hook); // Runs instead of the bus's own recovery, returns true if the bus was recovered
+    uint64_t getRecoveries();
+
+    // Registration
+    I2CDevice bind(uint8_t channel, uint8_t addr); // Registers the slave if it answers, unbound if it does not
+    I2CDevice bind(uint8_t addr); // Slave directly on the bus
+    I2CDevice bindBroadcast(uint8_t addr); // Write-only address several slaves on the bus answer (not pinged)
+
+    // Throwing wrappers (std::runtime_error naming the device), slaves directly on the bus
+    bool registerSlave(uint8_t addr); // Registers slave into database, false if it does not answer or already is registered
     bool pingSlave(uint8_t addr); // Pings slave at given address, returns true if we get a response
-    
+
     std::vector<uint8_t> read(uint8_t addr, int numBytes);
-    bool write(uint8_t addr, uint8_t* buffer, int numBytes);
-    
+    bool write(uint8_t addr, uint8_t* buffer, int numBytes); // Refused (false) while the emergency stop is latched
+    bool writeEmergency(uint8_t addr, uint8_t* buffer, int numBytes); // Bypasses the emergency stop latch, aborts the batch in flight
+    std::vector<uint8_t> writeRead(uint8_t addr, const uint8_t* out, int outBytes, int numBytes); // Pointer write then read, as one request
+
+    // Slaves behind the mux, addressed as (channel, address), I2C_DIRECT for the bus itself
+    bool registerSlave(uint8_t channel, uint8_t addr);
+    bool pingSlave(uint8_t channel, uint8_t addr);
+
+    std::vector<uint8_t> read(uint8_t channel, uint8_t addr, int numBytes);
+    bool write(uint8_t channel, uint8_t addr, uint8_t* buffer, int numBytes); // Refused (false) while the emergency stop is latched
+    std::vector<uint8_t> writeRead(uint8_t channel, uint8_t addr, const uint8_t* out, int outBytes, int numBytes);
+
+    /* Caller-owned buffers
+     * The overloads above allocate a vector per read, these fill the caller's
+     * buffer (a C array, std::array or vector) and allocate nothing once the
+     * device has been seen (without the scheduler, which queues a copy).
+     */
+    void read(uint8_t addr, ByteSpan buffer);
+    void read(uint8_t channel, uint8_t addr, ByteSpan buffer);
+    bool write(uint8_t addr, ConstByteSpan buffer); // Refused (false) while the emergency stop is latched
+    bool write(uint8_t channel, uint8_t addr, ConstByteSpan buffer);
+    void writeRead(uint8_t addr, ConstByteSpan out, ByteSpan in);
+    void writeRead(uint8_t channel, uint8_t addr, ConstByteSpan out, ByteSpan in);
+
+    template <size_t N>
+    std::array<uint8_t, N> read(uint8_t channel, uint8_t addr){
+        std::array<uint8_t, N> buffer;
+        read(channel, addr, ByteSpan(buffer));
+        return buffer;
+    }
+
+    template <size_t N>
+    std::array<uint8_t, N> readRegisters(uint8_t channel, uint8_t addr, uint8_t reg){ // Register pointer write, then N bytes from there
+        std::array<uint8_t, N> buffer;
+        writeRead(channel, addr, ConstByteSpan(&reg, 1), ByteSpan(buffer));
+        return buffer;
+    }
+
+    /* Bus owner thread
+     * Once started, every call above from any thread is queued and run by one
+     * thread in priority order. The blocking calls queue at their default class
+     * (writeEmergency: Emergency, write: Output, read/writeRead: Feedback,
+     * ping/register: Diagnostic) unless the calling thread holds an
+     * I2CPriorityScope. submit() queues without waiting.
+     */
+    void startScheduler(std::chrono::microseconds maxWait); // Lower classes waiting longer than maxWait are served next
+    void stopScheduler(); // Runs what is queued, then calls go to the bus directly again
+    I2CScheduler* getScheduler(); // nullptr when not running
+
+    std::future<I2CResult> submit(const I2CRequest& request);
+    void submit(const I2CRequest& request, std::function<void(const I2CResult&)> done); // done runs on the bus thread
+
+    /* Batches (see I2CBatch)
+     * submitBatch starts a frame of transactions and returns, Failed if the bus
+     * could not take it. Writes are Refused while the emergency stop is latched
+     * and batched transactions are not retried, the caller sees each status.
+     * With the scheduler running the transactions are queued one by one and
+     * have completed when it returns.
+     */
+    I2CStatus submitBatch(I2CBatch& batch) noexcept;
+    void waitBatch(I2CBatch& batch); // Blocks until the batch has completed
+    bool pollBatch(I2CBatch& batch); // True once the batch has completed, never waits for the bus
+
+    // Bus statistics, empty when built with I2C_STATS=0
+    std::vector<I2CDeviceStats> getStats(); // Every device addressed so far, in (channel, address) order
+    void resetStats();
+
+};
+
+/* Sets the priority class of the blocking I2C calls made by this thread
+ * Scopes nest, the previous class is restored when the scope ends. Emergency
+ * stays reserved for writeEmergency, a scope of Emergency keeps the defaults.
+ */
+class I2CPriorityScope
+{
+private:
+    int previous;
+
+public:
+    I2CPriorityScope(I2CPriority priority);
+    ~I2CPriorityScope();
+
+    I2CPriorityScope(const I2CPriorityScope&) = delete;
+    I2CPriorityScope& operator=(const I2CPriorityScope&) = delete;
 };
 
 #endif
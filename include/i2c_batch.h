@@ -0,0 +1,71 @@
+#ifndef I2C_BATCH_H
+#define I2C_BATCH_H
+
+#include "i2c.h"
+#include "i2c_bus.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>  // For uint8_t
+
+#define I2C_BATCH_OPS 32  // Transactions per batch
+#define I2C_BATCH_BYTES 65 // Bytes written per transaction, copied into the batch (a whole PCA9685 burst: pointer + 16 channels x 4)
+
+/* A frame of bus transactions, submitted at once
+ * Writes, reads and register reads of bound devices are queued here, then
+ * I2C::submitBatch hands the whole frame to the bus in one go (one io_uring
+ * submission on i2c-dev) and returns. The transactions complete in the order
+ * they were queued, mux channel selects are put in between where needed. The
+ * caller keeps computing and collects the results with I2C::waitBatch or
+ * I2C::pollBatch; any other transaction on the bus completes the batch first.
+ * Everything lives in the batch, nothing allocates. Read buffers belong to
+ * the caller and must stay put until the batch has completed.
+ */
+class I2CBatch
+{
+private:
+    struct Entry{
+        I2COp op;
+        I2CDevice device;
+        uint8_t out[I2C_BATCH_BYTES];
+        int outBytes;
+        uint8_t* in;
+        int inBytes;
+        I2CStatus status;  // Set once the batch has completed
+        uint8_t muxControl; // Channel select written before it, when one is
+        int muxOp;   // Bus op of the channel select, -1 for none
+        int firstOp; // First bus op of the transaction itself, -1 if it never went out
+    };
+
+    Entry entries[I2C_BATCH_OPS];
+    int count;
+    I2CBusOp busOps[3 * I2C_BATCH_OPS]; // Channel select, write and read per transaction at most
+    int busCount;
+    std::atomic<I2C*> owner; // Bus the batch is in flight on, nullptr once completed
+    std::chrono::steady_clock::time_point submitted;
+
+    friend class I2C;
+    bool add(I2COp op, const I2CDevice& device, ConstByteSpan out, ByteSpan in);
+
+public:
+    I2CBatch();
+    ~I2CBatch(); // Waits for the batch if it is still in flight
+
+    I2CBatch(const I2CBatch&) = delete;
+    I2CBatch& operator=(const I2CBatch&) = delete;
+
+    // Queueing, false if the batch is full or in flight, the device is unbound or the write is over I2C_BATCH_BYTES
+    bool write(const I2CDevice& device, ConstByteSpan bytes);
+    bool writeRead(const I2CDevice& device, ConstByteSpan out, ByteSpan in); // Register pointer write then read
+    bool read(const I2CDevice& device, ByteSpan in);
+    void clear(); // Empties the batch for the next frame, waits for it first if it is in flight
+
+    // Results, once the batch has completed
+    int size() const;
+    bool isPending() const; // Submitted and not completed yet
+    I2CStatus status(int index) const; // Failed for an index that was never queued
+    bool ok() const; // Every transaction went through
+    I2CStatus rerun(int index) noexcept; // Runs a completed transaction again on its own, with the bus's retries, and keeps its new status
+};
+
+#endif
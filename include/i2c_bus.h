@@ -0,0 +1,109 @@
+#ifndef I2C_BUS_H
+#define I2C_BUS_H
+
+#include <atomic>
+#include <string>
+#include <cstdint>  // For uint8_t
+
+class IoUringQueue;
+
+#define I2C_OP_SKIPPED -2 // Result of an op that never ran
+
+// One transfer of a batch
+struct I2CBusOp{
+    int handle;      // Dedicated handle of the device, -1 to go by address
+    uint8_t addr;
+    bool isRead;
+    uint8_t* buffer; // Read into, or written from
+    int numBytes;
+    int result;      // Bytes transferred, -1 or I2C_OP_SKIPPED, set once the op has completed
+    bool linked = false; // The next op is skipped unless this one transfers every byte (a channel select and its transaction)
+};
+
+/* Raw I2C transport
+ * Moves bytes to and from a 7-bit address and nothing more. I2C layers slave
+ * registration, the mux and the emergency stop on top, so the same drivers run
+ * on the real bus (DevI2CBus) or the simulated one (SimBus). Both calls return
+ * the number of bytes transferred, or -1 when the address is not acknowledged.
+ */
+class I2CBus
+{
+protected:
+    std::atomic<bool> aborting{false}; // abortOps() was called for the batch running
+
+    bool runOps(I2CBusOp* ops, int count); // Runs a batch now, stops once aborted
+
+public:
+    virtual ~I2CBus() {}
+
+    virtual int read(uint8_t addr, uint8_t* buffer, int numBytes) = 0;
+    virtual int write(uint8_t addr, const uint8_t* buffer, int numBytes) = 0;
+
+    // Brings a failing bus back to a known state, false if it cannot (the default)
+    virtual bool recover() { return false; }
+
+    /* Dedicated handles
+     * A bus that can address a device once and keep it addressed (i2c-dev, one
+     * file descriptor per device) returns a handle for it, transfers through
+     * the handle never readdress the bus. -1 means the bus has none and the
+     * device goes through read/write.
+     */
+    virtual int openDevice(uint8_t addr) { return -1; }
+    virtual void closeDevice(int handle) {}
+    virtual int readDevice(int handle, uint8_t* buffer, int numBytes) { return -1; }
+    virtual int writeDevice(int handle, const uint8_t* buffer, int numBytes) { return -1; }
+
+    /* Batches
+     * submitOps starts a batch of transfers that complete in order, one batch
+     * at a time. An asynchronous bus returns once they are queued and fills in
+     * the results as they complete, the default runs them before returning.
+     * An op that fails skips the rest of its linked run, the next run goes out
+     * regardless. abortOps cuts the batch short from any thread: the op on the
+     * wire completes, the ops after it are skipped. The ops have to stay put
+     * until waitOps returns or pollOps returns true.
+     */
+    virtual bool submitOps(I2CBusOp* ops, int count); // False if the batch could not be started
+    virtual void waitOps() {}                         // Blocks until the batch has completed
+    virtual bool pollOps() { return true; }           // True once the batch has completed, never blocks
+    virtual bool isAsync() { return false; }          // Batches run in the background
+    virtual void abortOps();                          // Skips what the batch in flight has not started yet
+};
+
+// Linux i2c-dev bus (/dev/i2c-*)
+class DevI2CBus : public I2CBus
+{
+private:
+    std::string busPath; // I2C bus path
+    int i2cBus; // I2C file descriptor
+    uint8_t activeSlave; // Currently active slave
+    IoUringQueue* uring; // Batch queue, nullptr when io_uring is off or unavailable
+    bool uringBatch; // The batch in flight went through io_uring
+
+    bool setSlave(uint8_t slave); // Configures slave for reading/writing, false if the ioctl fails
+
+public:
+    DevI2CBus(const std::string& busPath, bool async = true); // Throws if the bus cannot be opened, async: batches through io_uring when the kernel has it
+    ~DevI2CBus();
+
+    DevI2CBus(const DevI2CBus&) = delete;
+    DevI2CBus& operator=(const DevI2CBus&) = delete;
+
+    int read(uint8_t addr, uint8_t* buffer, int numBytes) override;
+    int write(uint8_t addr, const uint8_t* buffer, int numBytes) override;
+    bool recover() override; // Reopens the bus (the adapter resets it), the slave is set again on the next transfer
+
+    // One file descriptor per device, set to its address once
+    int openDevice(uint8_t addr) override;
+    void closeDevice(int handle) override;
+    int readDevice(int handle, uint8_t* buffer, int numBytes) override;
+    int writeDevice(int handle, const uint8_t* buffer, int numBytes) override;
+
+    // Batches go through io_uring when every op has a dedicated handle, otherwise they block
+    bool submitOps(I2CBusOp* ops, int count) override;
+    void waitOps() override;
+    bool pollOps() override;
+    bool isAsync() override;
+    void abortOps() override; // Cancels the io_uring chain, or stops the blocking loop
+};
+
+#endif
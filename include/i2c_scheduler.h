@@ -0,0 +1,79 @@
+#ifndef I2C_SCHEDULER_H
+#define I2C_SCHEDULER_H
+
+#include "i2c.h"
+
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+#include <cstdint>  // For uint64_t
+
+// Queue to completion latency of one priority class
+struct I2CClassStats{
+    uint64_t completed;  // Requests completed (coalesced ones included)
+    uint64_t coalesced;  // Writes folded into a newer write to the same register
+    uint64_t promoted;   // Served ahead of a higher class after waiting maxWait
+    std::chrono::nanoseconds meanLatency;
+    std::chrono::nanoseconds maxLatency;
+};
+
+/* Bus owner thread of an I2C object
+ * Requests queue per priority class and run highest class first, in order
+ * within a class. Apart from the emergency class, a request that has waited
+ * longer than maxWait goes next whatever its class, so every class has a
+ * bounded wait (once several classes are overdue, the oldest goes first). A write is coalesced with the writes queued right behind it in
+ * its class to the same device and register: the newest data is written once
+ * and every request involved completes with that result. A retry backing off
+ * on the bus thread still lets emergency requests through.
+ */
+class I2CScheduler
+{
+private:
+    struct Pending{
+        I2CRequest request;
+        std::function<void(const I2CResult&)> done;
+        std::chrono::steady_clock::time_point queued;
+    };
+
+    struct Totals{
+        uint64_t completed;
+        uint64_t coalesced;
+        uint64_t promoted;
+        std::chrono::nanoseconds latency; // Sum over completed requests
+        std::chrono::nanoseconds maxLatency;
+    };
+
+    I2C* i2c;
+    std::chrono::microseconds maxWait;
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping;
+    std::deque<Pending> queues[I2C_PRIORITIES];
+    Totals totals[I2C_PRIORITIES];
+
+    void busThread();
+    void serve(std::unique_lock<std::mutex>& lock, int served, std::vector<Pending>& group); // Runs the front of a queue, coalesced (lock held, released meanwhile)
+    int nextClass(std::chrono::steady_clock::time_point now); // Queue to serve next, -1 if all are empty (lock held)
+    bool coalesces(const I2CRequest& first, const I2CRequest& next); // next overwrites exactly what first writes
+
+public:
+    I2CScheduler(I2C* i2c, std::chrono::microseconds maxWait);
+    ~I2CScheduler(); // Runs what is still queued, then stops
+
+    I2CScheduler(const I2CScheduler&) = delete;
+    I2CScheduler& operator=(const I2CScheduler&) = delete;
+
+    void submit(const I2CRequest& request, std::function<void(const I2CResult&)> done); // done runs on the bus thread
+    bool onBusThread();
+    void backOff(std::chrono::microseconds duration); // Retry backoff on the bus thread, emergency requests still run
+
+    I2CClassStats getStats(I2CPriority priority);
+    void resetStats();
+};
+
+#endif
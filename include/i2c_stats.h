@@ -0,0 +1,127 @@
+#ifndef I2C_STATS_H
+#define I2C_STATS_H
+
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <ostream>
+#include <condition_variable>
+#include <cstdint>  // For uint8_t, uint64_t
+
+// Per-device bus instrumentation, build with -DI2C_STATS=0 to compile it out
+#ifndef I2C_STATS
+#define I2C_STATS 1
+#endif
+
+/* HDR-style latency histogram (nanoseconds)
+ * Values below 16 ns get a bucket each, above that every power of two is split
+ * into 16 linear sub-buckets, so any value is known to within 1/16 (6.25%)
+ * from 1 ns to about 18 minutes in a fixed 608 bucket array. Recording is an
+ * index computation and an increment, nothing allocates.
+ */
+class LatencyHistogram
+{
+public:
+    static const int SUB_BUCKETS = 16;
+    static const int SUB_BITS = 4;
+    static const int MAX_EXPONENT = 40; // Values from 2^41 ns are counted in the last bucket
+    static const int BUCKETS = (MAX_EXPONENT - SUB_BITS + 2) * SUB_BUCKETS;
+
+private:
+    uint64_t counts[BUCKETS];
+    uint64_t count;
+    uint64_t total; // Sum of the recorded values
+    uint64_t minimum;
+    uint64_t maximum;
+
+    static int bucketOf(uint64_t value);
+    static uint64_t bucketLow(int bucket);  // Smallest value of a bucket
+    static uint64_t bucketHigh(int bucket); // Largest value of a bucket
+
+public:
+    LatencyHistogram();
+
+    void record(std::chrono::nanoseconds latency);
+    void reset();
+
+    uint64_t getCount() const;
+    std::chrono::nanoseconds getMin() const;
+    std::chrono::nanoseconds getMax() const;
+    std::chrono::nanoseconds getMean() const;
+    std::chrono::nanoseconds getPercentile(double percentile) const; // 0 - 100, upper edge of the bucket it falls in (within 6.25%)
+};
+
+// Counters of one device, as (channel, address)
+struct I2CDeviceStats{
+    uint8_t channel;        // Mux channel, I2C_DIRECT for the bus itself
+    uint8_t address;
+    uint64_t transactions;  // Bus transactions addressed to the device (a register read is one)
+    uint64_t bytesWritten;
+    uint64_t bytesRead;
+    uint64_t errors;        // Transactions that were not acknowledged or transferred short
+    uint64_t retries;       // Transactions repeated after an error
+    uint64_t slaveSwitches; // Transactions that had to readdress the bus first (an I2C_SLAVE ioctl on i2c-dev)
+    LatencyHistogram readLatency;  // Reads, register reads and pings, on the wire
+    LatencyHistogram writeLatency; // Writes (mux channel selects included, on the mux)
+};
+
+/* Counters and latency histograms of every device seen on one bus
+ * Devices are looked up by (channel, address) in a flat table, created the
+ * first time they are addressed. Not synchronized, I2C records under its bus
+ * lock and snapshots under the same lock.
+ */
+class I2CStats
+{
+private:
+    static const int CHANNEL_SLOTS = 9; // Mux channels 0 - 7, then the bus itself
+    static const int ADDRESSES = 128;   // 7-bit addresses
+
+    I2CDeviceStats* devices[CHANNEL_SLOTS * ADDRESSES];
+    int lastAddress; // Address the bus was last pointed at, -1 before the first transaction
+
+    I2CDeviceStats* device(uint8_t channel, uint8_t address); // Created on first use
+
+public:
+    I2CStats();
+    ~I2CStats();
+
+    I2CStats(const I2CStats&) = delete;
+    I2CStats& operator=(const I2CStats&) = delete;
+
+    void record(uint8_t channel, uint8_t address, bool isRead, int bytesWritten, int bytesRead, bool ok, bool dedicated
+              , std::chrono::nanoseconds latency); // dedicated: through the device's own handle, the bus is not readdressed
+    void recordRetry(uint8_t channel, uint8_t address);
+    void forgetAddress(); // The bus was reset, the next transaction readdresses it
+
+    std::vector<I2CDeviceStats> snapshot() const; // Devices in (channel, address) order
+    void reset();
+
+    static void print(const std::vector<I2CDeviceStats>& devices, std::ostream& out); // One line per device
+};
+
+class I2C;
+
+// Prints the bus statistics of an I2C object every period, on its own thread
+class I2CStatsDump
+{
+private:
+    I2C* i2c;
+    std::chrono::milliseconds period;
+    std::ostream& out;
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping;
+
+    void run();
+
+public:
+    I2CStatsDump(I2C* i2c, std::chrono::milliseconds period, std::ostream& out);
+    ~I2CStatsDump(); // Stops without a last dump
+
+    I2CStatsDump(const I2CStatsDump&) = delete;
+    I2CStatsDump& operator=(const I2CStatsDump&) = delete;
+};
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef IO_URING_QUEUE_H
+#define IO_URING_QUEUE_H
+
+#include "i2c_bus.h"
+
+#include <atomic>
+#include <mutex>
+#include <cstddef>  // For size_t
+
+/* Batched reads and writes through io_uring, on raw syscalls (no liburing)
+ * A batch of I2CBusOps (op.handle is the file descriptor) goes to the kernel
+ * in one io_uring_enter, as one IOSQE_IO_LINK chain. i2c-dev transfers block,
+ * so the kernel runs the chain on its own worker and the caller carries on
+ * until wait() or poll(). A failure cancels the rest of the chain: the rest of
+ * its linked run stays skipped and the runs after it are sent again as a new
+ * chain by the next wait() or poll(). cancel() stops the chain from any thread
+ * with IORING_OP_ASYNC_CANCEL. One batch at a time. Without io_uring (old
+ * kernel, seccomp, disabled by sysctl) isOpen() is false and the caller runs
+ * the ops itself.
+ */
+class IoUringQueue
+{
+private:
+    int ring; // io_uring file descriptor, -1 if unavailable
+    unsigned entries;
+
+    // Shared rings, mapped from the kernel
+    void* sqMap;
+    size_t sqMapSize;
+    void* cqMap;
+    size_t cqMapSize;
+    void* sqes; // Submission entries
+    size_t sqesSize;
+    unsigned* sqTail;
+    unsigned* sqMask;
+    unsigned* sqArray;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned* cqMask;
+    void* cqes; // Completion entries
+
+    std::mutex sqMutex; // Submission ring, and ops/count for cancel()
+    I2CBusOp* ops;      // Batch in flight
+    int count;
+    int chainStart;     // First op of the chain in the kernel
+    int pending;        // Ops of the chain not completed yet
+    std::atomic<int> nextOp;      // First op not completed, the one cancel() targets
+    std::atomic<bool> cancelling; // cancel() was called for this batch
+
+    bool queueChain(int first); // Sends ops first..count as one chain
+    void queueCancel(int op);   // Sends an IORING_OP_ASYNC_CANCEL for one op (sqMutex held)
+    void reap();     // Takes every completion already posted, never blocks
+    bool progress(); // Reaps, sends the runs after a failure, true once the batch has completed
+
+public:
+    static const unsigned DEFAULT_ENTRIES = 128;
+
+    IoUringQueue(unsigned entries);
+    ~IoUringQueue(); // Does not wait, wait() first if a batch is in flight
+
+    IoUringQueue(const IoUringQueue&) = delete;
+    IoUringQueue& operator=(const IoUringQueue&) = delete;
+
+    bool isOpen() const;
+    int capacity() const; // Most ops in one batch
+
+    bool submit(I2CBusOp* ops, int count); // False if a batch is in flight, it is too big or the kernel refused it
+    void wait(); // Blocks until the batch has completed
+    bool poll(); // True once the batch has completed
+    void cancel(); // Skips every op not yet started, from any thread, the one running may still complete
+};
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef JOINT_CONTROLLER_H
+#define JOINT_CONTROLLER_H
+
+#include <cstdint> // For uint64_t
+
+// Controller tuning (angles in degrees, times in seconds)
+struct ControllerParams{
+    float kp;               // Proportional gain (trim degrees per degree of error)
+    float ki;               // Integral gain (trim degrees per degree-second of error)
+    float kv;               // Velocity feedforward (trim degrees per deg/s of commanded velocity)
+    float maxTrim;          // Largest correction added to the commanded angle (degrees)
+    float period;           // Loop period, updates closer together are skipped (seconds)
+    float settleTolerance;  // Error counted as at target (degrees)
+    float settleTime;       // Time the error must stay within tolerance to be settled (seconds)
+    float settleTimeout;    // Give up waiting to settle this long after the trajectory ends (seconds)
+};
+
+/* Outer position loop for one joint
+ * The servo's own loop tracks the pulse it is given, this loop trims that pulse
+ * from encoder feedback: command = reference + kv * referenceVelocity + PI(error).
+ * The trim is clamped to maxTrim and the integrator stops integrating in the
+ * direction that is saturated (conditional integration anti-windup), so a
+ * blocked joint does not wind up a large correction. The integral is kept
+ * between motions so steady loads (gravity, calibration error) stay corrected.
+ */
+class JointController
+{
+private:
+    ControllerParams params;
+
+    float integral;      // Integral term (degrees of trim)
+    float trim;          // Last correction (degrees)
+    float error;         // Last error, reference - measured (degrees)
+    float sinceUpdate;   // Time since the last loop update (seconds)
+    float withinTime;    // Time the error has been within tolerance (seconds)
+    float sinceTrajectoryEnd; // Time since the reference stopped moving (seconds)
+    bool settled;
+    uint64_t updateCount;
+
+public:
+    JointController(const ControllerParams& params);
+
+    /* Runs the loop, returns the angle to command (reference plus trim)
+     * dt is the time since the previous call, updates inside the loop period
+     * return the previous trim without running the loop.
+     */
+    float update(float reference, float referenceVelocity, float measured, float dt);
+    void beginMotion(); // Restarts settle detection (keeps the integral)
+    void reset();       // Clears all state including the integral
+
+    // State
+    bool isSettled() const;     // Error within tolerance for settleTime
+    bool isTimedOut() const;    // Not settled settleTimeout after the trajectory ended
+    float getError() const;     // reference - measured (degrees)
+    float getTrim() const;      // Correction applied to the reference (degrees)
+    uint64_t getUpdateCount() const;
+    float getPeriod() const;    // Loop period (seconds)
+};
+
+#endif
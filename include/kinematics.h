@@ -0,0 +1,85 @@
+#ifndef KINEMATICS_H
+#define KINEMATICS_H
+
+#include "quaternion.h"
+#include "config.h"
+#include "clock.h"
+
+#include <chrono>
+
+// Position/Orientation Structures
+struct Position{
+    float x, y, z;
+};
+struct Orientation{
+    float pitch, yaw, roll;
+};
+
+// Inverse kinematics solver selection
+enum class IKMode{
+    ClosedForm, // Decoupled analytic solution only
+    Numerical,  // Damped least squares only
+    Auto        // Closed form, falls back to damped least squares when it fails
+};
+
+// Outcome of an inverse kinematics solve
+enum class IKStatus{
+    Converged,      // Within IK_POSITION_TOLERANCE and IK_ORIENTATION_TOLERANCE
+    IterationLimit, // Hit IK_MAX_ITERATIONS, theta holds the best iterate
+    TimeLimit,      // Hit the time budget, theta holds the best iterate
+    Failed          // Closed form has no answer within the joint limits
+};
+
+struct IKResult{
+    IKStatus status;
+    bool numerical;         // True if the damped least squares solver produced the answer
+    int iterations;         // Damped least squares iterations (0 for closed form)
+    float positionError;    // mm
+    float orientationError; // radians
+};
+
+/* Forward and inverse kinematics of the arm (all joint angles in radians)
+ * Joints 1-3 place the wrist center, joints 4-6 set the absolute tool
+ * orientation as Z-Y-Z angles. The numerical solver is warm-started from the
+ * last solution handed out by this object, so consecutive ticks converge in a
+ * few iterations.
+ */
+class Kinematics
+{
+private:
+    // Joint limits (radians)
+    float lowerLimit[NUM_JOINTS];
+    float upperLimit[NUM_JOINTS];
+
+    // Numerical solver limits
+    int maxIterations;
+    std::chrono::microseconds timeBudget;
+    Clock* clock; // Budget is measured on it (a virtual clock does not move during a solve)
+
+    // Warm start
+    float lastSolution[NUM_JOINTS];
+
+    // Helper Methods
+    void clampToLimits(float theta[NUM_JOINTS]);
+    void poseError(const Position& position, const Quaternion& orientation, const float theta[NUM_JOINTS], float error[6]);
+    void jacobian(const float theta[NUM_JOINTS], float J[6][NUM_JOINTS]);
+    IKResult measure(const Position& position, const Quaternion& orientation, const float theta[NUM_JOINTS]);
+
+public:
+    // Constructor
+    Kinematics(const float lower[NUM_JOINTS], const float upper[NUM_JOINTS], Clock* clock = Clock::steady());
+
+    // Forward Kinematics
+    void forward(const float theta[NUM_JOINTS], Position& position, Quaternion& orientation);
+
+    // Inverse Kinematics
+    IKResult solve(IKMode mode, const Position& position, const Quaternion& orientation, float theta[NUM_JOINTS]);
+    bool solveClosedForm(const Position& position, const Quaternion& orientation, float theta[NUM_JOINTS]); // False if unreachable
+    IKResult solveNumerical(const Position& position, const Quaternion& orientation, float theta[NUM_JOINTS]);
+
+    // Configuration
+    void setWarmStart(const float theta[NUM_JOINTS]);
+    void setLimits(int maxIterations, std::chrono::microseconds timeBudget);
+};
+
+#endif
@@ -0,0 +1,143 @@
+#ifndef MOTION_H
+#define MOTION_H
+
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+#include "clock.h"
+
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#endif
+
+class Servo;
+class JointController;
+enum class I2CStatus;
+
+// State of a motion
+enum class MotionStatus{
+    Running,   // Still moving
+    Completed, // Reached the target
+    Cancelled, // Cancelled, superseded by a newer move, failed, or the engine shut down
+    Stopped    // Emergency stop
+};
+
+/* Runs an engine's ticks on the waiting thread until done() holds or timeout
+ * has passed on the engine's clock (engines on virtual time have no thread)
+ */
+typedef std::function<void(const std::function<bool()>& done, std::chrono::nanoseconds timeout)> MotionDriver;
+
+// Shared completion state behind a MotionHandle
+class MotionState
+{
+private:
+    std::mutex mutex;
+    std::condition_variable finished;
+    MotionStatus status;
+    std::vector<std::function<void()>> callbacks; // Run once on completion
+    std::function<void()> cancelHook;             // Asks the owner to stop the motion
+    MotionDriver driver;                          // Moves the motion along while waiting, empty when a thread does
+
+public:
+    MotionState();
+
+    void complete(MotionStatus result);              // Completes the motion, later calls are ignored
+    bool addCallback(std::function<void()> callback); // False if already complete (callback is not stored)
+    void setCancelHook(std::function<void()> hook);  // Ignored once complete
+    void setDriver(MotionDriver driver);             // Ignored once complete
+    MotionDriver getDriver();
+    void cancel();
+
+    MotionStatus getStatus();
+    void wait();
+    bool waitFor(std::chrono::milliseconds timeout);
+};
+
+/* Lightweight completion handle for a motion
+ * Copies share the same motion. Dropping a handle does not stop the motion,
+ * the motion engine keeps driving it until it completes or is cancelled.
+ * With C++20 coroutines a handle can be co_await'ed, the coroutine resumes
+ * on the motion engine thread.
+ */
+class MotionHandle
+{
+private:
+    std::shared_ptr<MotionState> state;
+
+public:
+    MotionHandle(); // Already completed handle
+    explicit MotionHandle(std::shared_ptr<MotionState> state);
+
+    void wait();                                    // Blocks until the motion is no longer running
+    bool waitFor(std::chrono::milliseconds timeout); // True if the motion finished within the timeout
+    bool isDone();
+    MotionStatus status();
+    void cancel();                                  // Stops the motion where it is
+
+    bool onComplete(std::function<void()> callback); // False if already complete (callback is not run)
+
+    static MotionHandle whenAll(const std::vector<MotionHandle>& handles); // Completes when every handle has
+
+#if defined(__cpp_impl_coroutine)
+    bool await_ready(){ return isDone(); }
+    bool await_suspend(std::coroutine_handle<> waiting){ return onComplete([waiting]{ waiting.resume(); }); }
+    MotionStatus await_resume(){ return status(); }
+#endif
+};
+
+/* Drives every servo motion from a single control thread
+ * Each tick steps the servos with a motion in progress (no more often than
+ * their own rotation step period) and completes their handles when they
+ * reach the target. The thread sleeps while nothing is moving.
+ * On a virtual clock there is no thread: ticks run on whichever thread waits
+ * on a handle (or calls step/runFor), and each tick jumps the clock to the next
+ * one, so a motion program runs as fast as it computes and replays exactly.
+ * With an output flush the servos only stage their pulses while they step, and
+ * the flush writes the whole tick's outputs at once (one burst per board).
+ */
+class MotionEngine
+{
+private:
+    std::thread worker;
+    std::mutex mutex;                  // Guards the active list and all servo motion state
+    std::condition_variable wake;
+    bool stopping;
+    std::chrono::microseconds tickPeriod;
+    Clock* clock;
+    Clock::TimePoint nextTick;
+    std::vector<Servo*> active;        // Servos with a motion in progress
+    std::function<I2CStatus()> flush;  // Writes the outputs staged during a tick, empty when servos write their own
+
+    void controlThread();
+    void tick(std::unique_lock<std::mutex>& lock); // Steps the active servos once at the current time
+    void runUntil(const std::function<bool()>& done, std::chrono::nanoseconds timeout); // Ticks on the caller's thread
+    void cancel(Servo* servo, const std::shared_ptr<MotionState>& motion); // Stops a motion if it is still the current one
+
+public:
+    MotionEngine(); // Ticks every MOTION_TICK_PERIOD_US
+    MotionEngine(std::chrono::microseconds tickPeriod, Clock* clock = Clock::steady());
+    ~MotionEngine();
+
+    static MotionEngine* defaultEngine(); // Shared engine for servos built without one
+
+    MotionHandle move(Servo* servo, float angle); // Starts (or retargets) a servo motion
+    void release(Servo* servo);                    // Cancels and forgets a servo's motion
+    void setFeedback(Servo* servo, JointController* controller, std::function<bool(float&)> feedback); // Swaps a servo's closed loop between steps
+    void setOutputFlush(std::function<I2CStatus()> flush); // Servos stage their outputs and this writes them after each tick (empty to stop)
+    bool isStaging();                              // An output flush is set
+    void setTickPeriod(std::chrono::microseconds tickPeriod); // Takes effect from the next tick (the PWM frame period in high-rate mode)
+
+    // Virtual clock only
+    bool step();                                 // Runs the next tick (the clock jumps to it), false if nothing is moving
+    void runFor(std::chrono::nanoseconds duration); // Runs the ticks due within duration, the clock ends duration later
+
+    std::chrono::microseconds getTickPeriod();
+    Clock* getClock();
+};
+
+#endif
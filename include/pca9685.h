@@ -7,6 +7,9 @@
 // Register Definitions
 #define MODE1_REG 0x00
 #define MODE2_REG 0x01
+#define SUBADR1_REG 0x02    // Sub-addresses 1 - 3 follow in order
+#define ALLCALLADR_REG 0x05
+#define LED0_ON_L_REG 0x06  // Each channel has ON_L, ON_H, OFF_L, OFF_H from here
 
 #define ALL_LED_ON_L 0xFA
 #define ALL_LED_ON_H 0xFB
@@ -14,21 +17,40 @@
 #define ALL_LED_OFF_H 0xFD
 #define PRESCALE_REG 0xFE
 
+// MODE1 Bits
+#define MODE1_RESTART 0x80
+#define MODE1_AI 0x20      // Register pointer auto-increments over multi-byte transfers
+#define MODE1_SLEEP 0x10
+#define MODE1_SUB1 0x08    // Sub-address 1 - 3 enables, SUB2 and SUB3 are the next bits down
+#define MODE1_ALLCALL 0x01
+
+class I2CBatch;
+
 class PCA9685
 {
 private:
 	// Private Variables
     I2C* i2c; 		// Pointer to I2C object
     uint8_t address; 	// I2C slave address
+    I2CDevice device; 	// Bound handle register I/O goes through
+    uint8_t prescaler; // Oscillator prescaler the board runs at
     float stepSize; // Time duration of one step (based on prescaler)
+
+    // Burst staging
+    uint8_t onBytes[32];    // ON_L, ON_H per channel as last written (bursts rewrite them unchanged)
+    uint16_t staged;        // Channels with an off time waiting for the next flush, one bit each
+    uint16_t stagedOff[16]; // Their off times
     
     // Helper methods
     void writeReg(uint8_t reg, uint8_t value); 						// Writes a value to a register
+    I2CStatus tryWriteReg(uint8_t reg, uint8_t value) noexcept;      // Writes a value to a register without throwing
     uint8_t readReg(uint8_t reg); 									// Reads a value from a register
     void modifyReg(uint8_t reg, uint8_t mask, uint8_t value); 		// Modifies specific bits in a register without overwriting the entire register.
     void setPrescaler(uint8_t value); 								// Sets Prescaler Value
     uint8_t getRegister(uint8_t channel, uint8_t on, uint8_t high); // Calculates the register for a channel
-    float calculateStepSize(uint8_t prescaler);                     // Calculates step size given prescaler
+    void track(uint8_t reg, uint8_t value);                         // Keeps the ON register copy in step with a write
+    bool nextRun(int& first, int& last);                            // Next run of neighbouring staged channels from first on
+    int burst(int first, int last, uint8_t* buffer);                // Fills the auto-increment write of a run, returns its length
     
     // Input validation (Throws error if invalid)
     void validatePrescaler(uint8_t value); 	// 3 - 255
@@ -41,12 +63,20 @@ public:
     ~PCA9685();
     
     // Global Controls
-    void setPWMFrequency(int freq); // Sets Prescaler given frequency in Hz
+    void setPWMFrequency(int freq); // Sets Prescaler given frequency in Hz (a sleeping board stays asleep)
     void allOn(); 	// Switches all channel on
     void allOff(); 	// Switches all channels off
+    bool emergencyOff(); // Switches all channels off with a single write, bypassing the emergency stop latch
     
     void sleep(); 	// Puts the PCA9685 into sleep mode
     void wake(); 	// Takes the PCA9685 out of sleep mode
+    uint8_t getMode();  // MODE1 as the board has it
+
+    // Addressing
+    void setAllCallAddress(uint8_t addr); // Answers writes to addr as well as its own (every board can share it)
+    void disableAllCall();                // Stops answering the all-call address
+    void setSubAddress(uint8_t index, uint8_t addr); // Answers writes to addr as sub-address index (1 - 3)
+    void disableSubAddress(uint8_t index);
 	
 	// Channel Controls
 	void switchOn(uint8_t channel); 	// Turns channel on
@@ -56,6 +86,29 @@ public:
     void setDuty(uint8_t channel, float duty); 							// Sets PWM based on desired duty cycle
     void setOffTime(uint8_t channel, uint16_t offTime);					// Sets ONLY the offTime
     void setOnTime(uint8_t channel, uint16_t onTime);					// Sets ONLY the onTime
+    I2CStatus trySetOffTime(uint8_t channel, uint16_t offTime) noexcept; // Sets ONLY the offTime without throwing (the servo output path)
+    bool queueOffTime(I2CBatch& batch, uint8_t channel, uint16_t offTime); // Queues the offTime writes into a batch the caller submits, false if full
+
+    /* Bursts
+     * Off times staged here go out on the next flush, each run of neighbouring
+     * staged channels as one auto-increment write of their ON/OFF registers
+     * (the ON times as they were last written), instead of two writes each.
+     */
+    bool stageOffTime(uint8_t channel, uint16_t offTime) noexcept; // No bus access, false for a channel above 15
+    bool hasStaged();
+    I2CStatus flush() noexcept;       // Writes the staged runs and clears them, the first failure is returned (not retried here)
+    bool queueFlush(I2CBatch& batch); // Queues the staged runs into a batch the caller submits, false (nothing queued) if they do not fit
+
+    // Getters
+    float getStepSize(); // Length of one PWM tick in microseconds
+    uint8_t getAddress(); // I2C slave address
+    uint8_t getPrescaler();
+    float getFrequency();   // PWM frame rate in Hz, as the prescaler gives it (not exactly the one asked for)
+    float getFramePeriod(); // Length of one PWM frame (4096 ticks) in microseconds
+
+    // Timing at a prescaler, without a board
+    static uint8_t prescalerFor(float freq);     // Prescaler setPWMFrequency picks (throws outside 3 - 255)
+    static float stepSizeFor(uint8_t prescaler); // Tick length in microseconds
     
 };
 
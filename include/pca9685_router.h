@@ -0,0 +1,66 @@
+#ifndef PCA9685_ROUTER_H
+#define PCA9685_ROUTER_H
+
+#include "i2c.h"
+#include "i2c_batch.h"
+#include "pca9685.h"
+
+#include <vector>
+#include <cstdint>  // For uint8_t, uint16_t
+
+/* Routes logical joints to (board, channel) over several PCA9685s
+ * Boards are added by address and owned here, each joint maps to one channel
+ * of one board. Off times staged during a control tick (by the servos, or with
+ * stage()) go out on flush() as one batch: a burst per run of neighbouring
+ * channels on each board, so a tick costs about one transaction per board
+ * however many joints moved. With an all-call address every board takes
+ * sleep, wake and all-off in the same write, so their outputs stop and start
+ * together.
+ */
+class PCA9685Router
+{
+private:
+    struct Route{
+        int board;       // -1 for a joint that was never routed
+        uint8_t channel;
+    };
+
+    I2C* i2c;
+    std::vector<PCA9685*> boards;
+    std::vector<Route> routes; // Indexed by joint
+    I2CDevice allCall;         // Unbound until enableAllCall
+    I2CBatch batch;            // A tick's bursts
+
+    I2CStatus send(); // Submits the queued bursts and waits, failed ones are rerun on their own
+    void writeAll(uint8_t reg, uint8_t value); // One write through the all-call address (throws)
+    bool sameMode(uint8_t& mode); // MODE1 (without SLEEP/RESTART) when every board has the same one
+
+public:
+    PCA9685Router(I2C* i2c);
+    ~PCA9685Router(); // Deletes the boards, each switches its outputs off and sleeps
+
+    PCA9685Router(const PCA9685Router&) = delete;
+    PCA9685Router& operator=(const PCA9685Router&) = delete;
+
+    // Boards and routes (std::runtime_error on a repeated address, unknown board or channel in use)
+    int addBoard(uint8_t addr, uint8_t prescaler = 0x79); // Returns the board's index
+    void route(int joint, int board, uint8_t channel);
+    int getNumBoards();
+    PCA9685* getBoard(int board);
+    PCA9685* boardOf(int joint);   // Throws for a joint that was never routed
+    uint8_t channelOf(int joint);
+    void setPWMFrequency(int freq); // Every board's frame rate (a sleeping board stays asleep)
+
+    // Control tick
+    bool stage(int joint, uint16_t offTime) noexcept; // False for a joint that was never routed
+    I2CStatus flush() noexcept; // Writes every board's staged off times, the first failure is returned
+
+    // All-call (every board answers the address as well as its own)
+    void enableAllCall(uint8_t addr);
+    bool hasAllCall();
+    void sleepAll(); // One write when every board has the same MODE1, otherwise board by board
+    void wakeAll();
+    void allOff();   // Full OFF on every channel of every board
+};
+
+#endif
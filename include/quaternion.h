@@ -0,0 +1,52 @@
+#ifndef QUATERNION_H
+#define QUATERNION_H
+
+/* Unit quaternion used to represent end effector orientation
+ * The arm's Euler convention is Z-Y-Z about the tool frame:
+ * R = Rz(yaw) * Ry(pitch) * Rz(roll), all angles in radians.
+ */
+class Quaternion
+{
+public:
+    float w, x, y, z;
+
+    // Constructors
+    Quaternion(); // Identity rotation
+    Quaternion(float w, float x, float y, float z);
+
+    // Conversions (radians)
+    static Quaternion fromAxisAngle(float ax, float ay, float az, float angle); // Axis must be normalized
+    static Quaternion fromEuler(float yaw, float pitch, float roll);           // Z-Y-Z convention
+    void toEuler(float& yaw, float& pitch, float& roll) const;                  // Z-Y-Z convention
+    void toRotationMatrix(float R[3][3]) const;                                 // Columns are the tool x, y, z axes
+
+    // Operations
+    Quaternion operator*(const Quaternion& other) const; // Hamilton product
+    Quaternion conjugate() const;                        // Inverse for unit quaternions
+    Quaternion normalized() const;
+    float dot(const Quaternion& other) const;
+
+    // Interpolation
+    static Quaternion slerp(const Quaternion& from, const Quaternion& to, float t); // t = 0.0 - 1.0
+};
+
+/* Steps a SLERP between two orientations in equal increments
+ * The constant step rotation is computed once, so each step is a single
+ * quaternion product instead of re-evaluating trig per step.
+ */
+class SlerpPath
+{
+private:
+    Quaternion current;
+    Quaternion delta;  // Rotation applied every step
+    Quaternion target;
+    int stepsLeft;
+
+public:
+    SlerpPath(const Quaternion& from, const Quaternion& to, int steps);
+
+    Quaternion next(); // Returns the next orientation along the path (the last step lands exactly on the target)
+    bool done() const;
+};
+
+#endif
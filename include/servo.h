@@ -2,11 +2,14 @@
 #define SERVO_H
 
 #include "pca9685.h"
+#include "motion.h"
+#include "joint_controller.h"
+#include "calibration.h"
 #include <cstdint>  // For uint8_t
-#include <atomic>
-#include <thread>
 #include <chrono>
+#include <memory>
 #include <mutex>
+#include <functional>
 
 // Parameters
 struct ServoParams{
@@ -24,10 +27,34 @@ struct ServoParams{
     // Rotation Characteristics
     float rotationSpeed;
     float updateResolution; // updates/degree (Affects smoothness)
+
+    // Motion engine driving this servo (nullptr uses MotionEngine::defaultEngine())
+    MotionEngine* engine;
+
+    // Measured pulse -> angle curves per direction (nullptr uses the linear minPulse/maxPulse/maxAngle map)
+    const ServoCalibration* calibration;
+
+    // Pulse tables built ahead of time (arm config file), used instead of building them when the step size matches
+    const PrebuiltTables* tables;
+};
+
+// Output resolution of a servo at one PWM frame rate (see Servo::resolutionAt)
+struct ServoResolution{
+    float frequency;    // Frame rate in Hz, as the prescaler gives it
+    uint8_t prescaler;
+    float stepSize;     // Tick length in microseconds
+    float framePeriod;  // Microseconds
+    float longestPulse; // Widest pulse the servo's tables command (microseconds)
+    int ticks;          // Ticks between its shortest and longest pulse
+    float degreesPerTick;      // Mean over the range
+    float worstDegreesPerTick; // Where the curve is steepest (the coarsest step)
+    bool fits;          // Longest pulse ends PCA9685_FRAME_MARGIN_US before the frame does
 };
 
 class Servo
 {
+    friend class MotionEngine; // Steps the servo and owns its motion state
+
 private:
 	// Private Variables
     PCA9685* pca; 		// Pointer to PCA object
@@ -44,25 +71,38 @@ private:
     
     // Preprocessed variables
     float angleToPwmSlope; // Preprocessed slop for calculating pulse width
+    PulseTable risingTable;  // Angle -> PCA9685 off time approaching from below
+    PulseTable fallingTable; // Angle -> PCA9685 off time approaching from above (same as rising without calibration)
+    float tableStepSize;     // PCA9685 tick length the tables are in (microseconds)
     
     // Real-Time Characteristics
     float targetAngle;
     float currentAngle;
+    float lastCommand; // Last angle written to the PCA (including trim)
+    bool rising; // Direction of travel of the last command, picks the pulse table
     float rotationSpeed; // Degrees / Second
     float updateResolution; // Updates/Degree
     
-    // Velocity Control
-    bool running;
+    // Velocity Control (guarded by the motion engine)
+    MotionEngine* engine;
+    std::shared_ptr<MotionState> motion; // Motion in progress, null when idle
     bool clockwise; // True if moving clockwise
-    std::chrono::time_point<std::chrono::steady_clock> startTime;
+    Clock::TimePoint startTime;    // On the engine's clock
+    Clock::TimePoint nextStepTime;
+    bool stepped;          // Stepped in the current tick
+    I2CStatus stepStatus;  // Status of that step, including the tick's output flush
 
-    void velocityControlThread();
+    // Closed Loop (optional, guarded by the motion engine)
+    JointController* controller; // Trims the commanded angle from feedback, nullptr for open loop
+    std::function<bool(float&)> feedback; // Measured servo angle in degrees, false if unavailable
 
     // Helper Methods
-    void step(); // Takes a step towards the target position
+    I2CStatus step(); // Takes a step towards the target position, returns the status of the output write
+    bool motionDone(); // Reached the target, and settled (or timed out) when closed loop
+    std::chrono::microseconds stepPeriod(); // Time between steps
 
     // Servo Control (Private)
-    void setPosition(float angle);	// In degrees
+    I2CStatus setPosition(float angle, bool stage = false) noexcept;	// In degrees, Refused while the emergency stop is latched (staged for the board's next flush when stage)
 
 public:
 	// Constructor / Destructor
@@ -70,7 +110,7 @@ public:
     ~Servo();
 
     // Servo Control (Public)
-    std::thread moveToPosition(float angle); // In degrees
+    MotionHandle moveToPosition(float angle); // In degrees
     void setSpeed(float speed);		// In radians/second
     
     // Validation
@@ -79,6 +119,15 @@ public:
     // Enable/Disable
     void disable(); // Disables servo motor
     void enable(); // Enables servo motor
+    void refresh(); // Rewrites the current position (restores the output after an emergency stop)
+
+    // PWM Frame Rate
+    void retime(); // Converts the pulse tables to the PCA9685's step size after its frequency changed, rewrites the position (call while not moving)
+    ServoResolution resolutionAt(uint8_t prescaler); // Angular resolution the servo's pulse range gets at a prescaler
+
+    // Closed Loop
+    void setFeedback(JointController* controller, std::function<bool(float&)> feedback); // Closes the loop, nullptr opens it (takes effect from the next step)
+    bool atTarget(); // True once the measured angle has settled on the target (always true open loop when not moving)
 
 };
 
@@ -0,0 +1,202 @@
+#ifndef SERVO_CALIBRATOR_H
+#define SERVO_CALIBRATOR_H
+
+#include "pca9685.h"
+#include "as5600.h"
+#include "calibration.h"
+
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <vector>
+#include <string>
+#include <cstdint> // For uint8_t
+
+// Calibration tuning (pulses in microseconds, angles in degrees)
+struct CalibratorParams{
+    float startPulse;           // Pulse inside the range to start from
+    float searchLow;            // Lowest pulse the endpoint search may command
+    float searchHigh;           // Highest pulse the endpoint search may command
+    float gallopStep;           // First endpoint bracketing step, doubles every probe
+    float endpointResolution;   // Endpoint binary search stops when the bracket is this narrow
+    float backlashMargin;       // Endpoint probes are approached from this far inside the bracket
+    float saturationTolerance;  // Readings within this of the end stop count as at the end stop
+    float clip;                 // Trimmed from each measured end before sampling
+    float minStep;              // Smallest sampling step
+    float maxStep;              // Largest sampling step
+    float curvatureTolerance;   // Departure from the extrapolated line that halves the sampling step
+    std::chrono::microseconds pollPeriod;    // Encoder read period while settling
+    std::chrono::microseconds minDwell;      // Wait at least this after a command (one PWM frame)
+    std::chrono::microseconds settleTimeout; // Take the reading anyway after this long
+    int settleWindow;           // Readings compared for settling (even, older half against newer half)
+    float settleTolerance;      // Difference of the half means that counts as still (encoder steps)
+};
+
+/* Measures one servo's pulse range and pulse -> angle sweep from its encoder
+ * Replaces fixed dwell stepping with:
+ * - Settle detection: after each command the encoder is polled and the servo
+ *   moves on as soon as the older and newer halves of the last settleWindow
+ *   readings agree (at least minDwell after the command, since the servo only
+ *   sees a new pulse on its next PWM frame).
+ * - Endpoint search: galloping steps out from startPulse to the search limit
+ *   bracket each end stop, then a search narrows it to endpointResolution,
+ *   aiming along the secant through the last two probes that moved and
+ *   bisecting otherwise. Every probe is reached moving outwards (backing off
+ *   backlashMargin after a probe at the end stop) so backlash does not shift
+ *   the result.
+ * - Adaptive sampling: the down and up sweeps double their step while the
+ *   curve stays on the line through the last two readings, and halve it where
+ *   it bends.
+ * The output is the same down/up sweep servo_calibration.cpp writes, so it fits
+ * with ServoCalibration::fromSweep().
+ *
+ * poll() does at most one command or encoder read and never blocks, so several
+ * calibrators can share one thread and bus, run() drives a single one.
+ */
+class ServoCalibrator
+{
+private:
+    enum class Phase{
+        Start,      // Settling at startPulse
+        Gallop,     // Stepping out towards the search limit
+        Search,     // Binary search on the end stop
+        SweepStart, // Settling at the top of the sampling range
+        SweepDown,
+        SweepUp,
+        Done
+    };
+
+    struct Reading{
+        float pulse;
+        float angle; // Degrees, unwrapped
+    };
+
+    // Hardware
+    PCA9685* pca;
+    uint8_t channel;
+    AS5600* encoder;
+    CalibratorParams params;
+
+    // Command and settle state
+    Phase phase;
+    bool started;
+    float commandPulse;
+    std::chrono::steady_clock::time_point commandTime;
+    std::chrono::steady_clock::time_point nextTime;
+    std::deque<float> window;   // Latest readings since the command (unwrapped steps)
+    long lastRawStep;
+    long turns;
+
+    // Endpoint search (low end first, then high)
+    int direction;              // -1 searching the low end, +1 the high end
+    float gallop;               // Current gallop step
+    std::vector<Reading> probes;
+    Reading inside;             // Probe known to move the servo
+    Reading previousInside;     // The one before it, for the secant towards the end stop
+    float outside;              // Pulse known to be at the end stop
+    float endStopAngle;
+    float probePulse;
+    bool approaching;           // Moving inside the bracket before the next probe
+    bool fromInside;            // Last probe moved the servo, so the next one can be commanded directly
+    bool overshot;              // Last search probe was at the end stop, so the next one bisects
+
+    // Sweep
+    float sampleMin;
+    float sampleMax;
+    float step;
+    std::vector<Reading> pass;  // Readings of the current sweep direction
+    std::vector<SweepSample> samples;
+
+    // Results
+    float minPulse;
+    float maxPulse;
+    float maxAngle;
+    uint64_t commandCount;
+    uint64_t readCount;
+    uint64_t timeoutCount;
+    std::chrono::steady_clock::time_point startTime;
+    std::chrono::steady_clock::time_point endTime;
+
+    // Helper Methods
+    void command(float pulse);          // Sets the pulse and restarts settle detection
+    float toTick(float pulse);          // Nearest pulse the PCA9685 can produce
+    void onSettled(float angle, uint16_t step); // Advances the calibration with a settled reading
+    void startEndpoint(int direction);  // Begins galloping out towards one end
+    void nextProbe();                   // Next binary search probe, or finishes the end
+    void nextSample(float angle, uint16_t step); // Records a sweep reading and steps on
+
+public:
+    ServoCalibrator(PCA9685* pca, uint8_t channel, AS5600* encoder, const CalibratorParams& params);
+
+    bool poll();  // Does the next due command or read, true once finished
+    void run();   // Polls until finished (blocking)
+
+    bool isDone() const;
+    std::chrono::steady_clock::time_point nextPollTime() const; // When poll() next has work to do
+
+    // Results (valid once done)
+    const std::vector<SweepSample>& getSamples() const; // Down then up sweep, in the order taken
+    ServoCalibration getCalibration() const;            // Direction dependent fit of the sweep
+    float getMinPulse() const;  // Lowest pulse that moves the servo (before clipping)
+    float getMaxPulse() const;  // Highest pulse that moves the servo (before clipping)
+    float getMaxAngle() const;  // Angle between the clipped ends
+
+    // Statistics
+    uint64_t getCommandCount() const;
+    uint64_t getReadCount() const;
+    uint64_t getTimeoutCount() const;  // Readings taken without settling
+    std::chrono::milliseconds getElapsed() const;
+};
+
+// One servo to calibrate: its PCA9685 channel, the encoder on its horn and its tuning
+struct CalibrationTarget{
+    uint8_t channel;
+    AS5600* encoder;
+    CalibratorParams params;
+};
+
+/* Calibrates several servos on one PCA9685 at once, on one thread
+ * A calibrating servo spends nearly all of its time waiting for its horn to
+ * settle, so the calibrators are interleaved on a single schedule: poll()
+ * serves whichever is due first and run() sleeps only while none is, so one
+ * servo's commands and encoder reads fill another's settle time. The bus is
+ * only ever used from the calling thread. A servo that fails (start pulse at
+ * an end stop, range too narrow, bus error) is dropped with its error and the
+ * others carry on.
+ */
+class MultiServoCalibrator
+{
+private:
+    std::vector<CalibrationTarget> targets;
+    std::vector<std::unique_ptr<ServoCalibrator>> calibrators; // One per target, the ones built so far go if a later one throws
+    std::vector<std::string> errors;           // Why each target failed, empty if it did not
+    bool started;
+    std::chrono::steady_clock::time_point startTime;
+    std::chrono::steady_clock::time_point endTime;
+
+public:
+    MultiServoCalibrator(PCA9685* pca, const std::vector<CalibrationTarget>& targets); // Throws on a repeated channel or encoder
+
+    MultiServoCalibrator(const MultiServoCalibrator&) = delete;
+    MultiServoCalibrator& operator=(const MultiServoCalibrator&) = delete;
+
+    bool poll();  // Polls the calibrator that is due first, true once every servo is done or failed
+    void run();   // Polls until finished (blocking)
+
+    bool isDone() const;
+    std::chrono::steady_clock::time_point nextPollTime() const; // When poll() next has work to do
+
+    // Results by target index
+    size_t size() const;
+    uint8_t getChannel(size_t target) const;
+    bool succeeded(size_t target) const;
+    const std::string& getError(size_t target) const;
+    const ServoCalibrator& getCalibrator(size_t target) const;
+
+    // Combined "Channel,Pulse Width (us),Absolute Step (0-4096)" sweep of every servo that succeeded
+    void writeCsv(const std::string& path) const;
+
+    std::chrono::milliseconds getElapsed() const;
+};
+
+#endif
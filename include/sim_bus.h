@@ -0,0 +1,255 @@
+#ifndef SIM_BUS_H
+#define SIM_BUS_H
+
+#include "i2c.h"
+#include "i2c_bus.h"
+#include "calibration.h"
+#include "clock.h"
+
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <random>
+#include <vector>
+#include <functional>
+#include <cstdint>  // For uint8_t, uint16_t, uint64_t
+
+// Bus clock rates (Hz)
+#define I2C_STANDARD_MODE 100000
+#define I2C_FAST_MODE 400000
+
+/* Device on a simulated bus
+ * Sees the bytes of each transaction addressed to it, as a real slave would
+ * (the first written byte is usually a register pointer). Returns the number of
+ * bytes transferred, or -1 to not acknowledge.
+ */
+class SimDevice
+{
+public:
+    virtual ~SimDevice() {}
+
+    virtual int read(uint8_t* buffer, int numBytes) = 0;
+    virtual int write(const uint8_t* buffer, int numBytes) = 0;
+    virtual bool answers(uint8_t addr){ return false; } // Shared address it takes writes on besides its own (all-call)
+};
+
+struct SimBusParams{
+    uint32_t clockHz;  // Bus clock (I2C_STANDARD_MODE, I2C_FAST_MODE)
+    bool realTime;     // Block each transaction for its time on the wire, as i2c-dev does
+    Clock* clock = nullptr; // Clock the transactions take their time on, nullptr for the steady clock
+    bool deviceHandles = false; // Hand out a dedicated handle per device, as i2c-dev does
+    bool asyncBatches = false; // Run batches on a bus thread, as io_uring does
+};
+
+/* In-process I2C bus
+ * Hosts simulated devices at their addresses, directly on the bus or behind a
+ * TCA9548A mux (control register at the mux address, one enable bit per
+ * channel). Devices behind the mux only answer while their channel is enabled,
+ * and two enabled devices at one address collide (not acknowledged). Every
+ * transaction costs start + address + data bytes (9 clocks each) + stop at the
+ * bus clock; the total is kept, and with realTime the caller sleeps for it on
+ * the bus's clock (a virtual clock just moves forward). Faults can be
+ * injected: dropped transactions, random drops (noise) and a jammed bus that
+ * only recover() clears. Writes to an address no device has go to every
+ * device that answers it (all-call, sub-addresses), reads from it are not
+ * acknowledged. With deviceHandles a device's handle is its address.
+ * With asyncBatches submitted batches run in order on a thread of the bus's.
+ */
+class SimBus : public I2CBus
+{
+private:
+    struct Slot{
+        SimDevice* device;
+        uint8_t address;
+        uint8_t channel; // Mux channel, I2C_DIRECT on the bus itself
+    };
+
+    std::mutex mutex;
+    SimBusParams params;
+    Clock* clock;
+    std::vector<Slot> slots;
+    int muxAddress;     // -1 without a mux
+    uint8_t muxControl; // Enabled mux channels, one bit each
+
+    // Injected faults
+    int pendingNacks; // Transactions still to be dropped
+    bool jammed;      // Nothing is acknowledged until recover()
+    double nackRate;  // Chance of dropping any transaction (noise)
+    std::mt19937 noise;
+
+    // Statistics
+    uint64_t transactions;
+    uint64_t nacks;
+    std::chrono::nanoseconds busTime; // Modeled time on the wire
+
+    // Batches (asyncBatches)
+    std::thread batchThread; // Started with the first batch
+    std::mutex batchMutex;
+    std::condition_variable batchChanged;
+    I2CBusOp* batchOps; // Batch in flight, nullptr when none
+    int batchCount;
+    bool stopping;
+
+
+    void runBatches(); // Bus thread
+    SimDevice* route(uint8_t addr); // Device answering an address, nullptr if none or a collision
+    int broadcast(uint8_t addr, const uint8_t* buffer, int numBytes); // Write to every device answering a shared address, -1 if none does
+    bool faulted(); // Drops the transaction if a fault is injected (bus lock held)
+    void occupy(int bytes); // Models the time a transaction with this many bytes after the address takes
+
+public:
+    SimBus(const SimBusParams& params = {I2C_FAST_MODE, true});
+    ~SimBus(); // Finishes the batch in flight
+
+    SimBus(const SimBus&) = delete;
+    SimBus& operator=(const SimBus&) = delete;
+
+    void addDevice(SimDevice* device, uint8_t address, uint8_t channel = I2C_DIRECT); // Not owned, channel I2C_DIRECT for the bus itself
+    void addMux(uint8_t address); // TCA9548A, all channels start disabled
+    void setClock(uint32_t clockHz);
+
+    int read(uint8_t addr, uint8_t* buffer, int numBytes) override;
+    int write(uint8_t addr, const uint8_t* buffer, int numBytes) override;
+    bool recover() override; // Clears a jam
+    int openDevice(uint8_t addr) override; // The address, -1 without deviceHandles
+    int readDevice(int handle, uint8_t* buffer, int numBytes) override;
+    int writeDevice(int handle, const uint8_t* buffer, int numBytes) override;
+    bool submitOps(I2CBusOp* ops, int count) override; // Returns at once with asyncBatches
+    void waitOps() override;
+    bool pollOps() override;
+    bool isAsync() override;
+
+    // Faults, whatever the address (mux included)
+    void injectNacks(int count); // The next count transactions are not acknowledged
+    void jam(); // No transaction is acknowledged until the bus is recovered
+    void setNackRate(double rate, unsigned seed = 1); // Drops each transaction with this chance, as a noisy bus would
+
+    uint64_t getTransactions();
+    uint64_t getNacks();
+    std::chrono::nanoseconds getBusTime();
+    std::chrono::nanoseconds transactionTime(int bytes); // Modeled time of one transaction at the current clock
+};
+
+/* Register model of a PCA9685
+ * 256 byte register file with the power-on defaults (MODE1 0x11: asleep,
+ * ALLCALL; PRESCALE 0x1E; all-call 0x70, sub-addresses 0x71, 0x72, 0x74).
+ * MODE1 AI auto-increments the register pointer over multi-byte transfers.
+ * PRESCALE only takes writes while asleep. ALL_LED writes go to every channel
+ * and read back as 0. The all-call and enabled sub-addresses are answered as
+ * shared addresses. Each channel's output is decoded from its ON/OFF registers
+ * including the full ON/OFF bits (bit 4 of the high bytes). Watchers run
+ * before every write, so models driven by the outputs can catch up first.
+ */
+class SimPCA9685 : public SimDevice
+{
+private:
+    std::mutex mutex;
+    uint8_t registers[256];
+    uint8_t pointer; // Register the next byte reads or writes
+
+    // Called before each write lands (outside the register lock)
+    std::mutex watchMutex;
+    std::vector<std::pair<int, std::function<void()>>> watchers;
+    int nextWatcher;
+
+    void store(uint8_t reg, uint8_t value); // Register write with the device's side effects
+
+public:
+    SimPCA9685();
+
+    int watch(std::function<void()> beforeWrite); // Returns the id unwatch() takes
+    void unwatch(int id);
+
+    int read(uint8_t* buffer, int numBytes) override;
+    int write(const uint8_t* buffer, int numBytes) override;
+    bool answers(uint8_t addr) override; // All-call or an enabled sub-address
+
+    uint8_t getRegister(uint8_t reg);
+    bool isSleeping();
+    float getPeriod();              // PWM frame length at the current prescaler (us)
+    float getPulseWidth(uint8_t channel); // High time of a channel's output (us), 0 when off or asleep
+};
+
+/* Register model of an AS5600
+ * The magnet angle comes from a callback (degrees). RAW ANGLE is that angle in
+ * 4096 steps (plus optional reading noise), ANGLE is RAW ANGLE relative to
+ * ZPOS. Reading the high byte of RAW ANGLE, ANGLE or MAGNITUDE samples the
+ * value and the low byte returns the rest of that sample, as the driver reads
+ * the pair in two transactions. STATUS reports the magnet as detected.
+ */
+class SimAS5600 : public SimDevice
+{
+private:
+    std::mutex mutex;
+    std::function<double()> magnetAngle;
+    uint8_t registers[256];
+    uint8_t pointer;
+    uint16_t sample; // Latched by reading a high byte
+    double noise;    // Reading noise standard deviation (steps)
+    std::mt19937 rng;
+
+    uint16_t rawStep(); // Current reading of the magnet
+
+public:
+    SimAS5600(std::function<double()> magnetAngle, double noise = 0.0, unsigned seed = 1);
+
+    int read(uint8_t* buffer, int numBytes) override;
+    int write(const uint8_t* buffer, int numBytes) override;
+
+    uint8_t getRegister(uint8_t reg);
+};
+
+// Simulated servo characteristics
+struct SimServoParams{
+    float minPulse;      // Pulse reaching angle 0 (us), without a calibration
+    float maxPulse;      // Pulse reaching maxAngle (us), without a calibration
+    float maxAngle;      // degrees
+    float maxSpeed;      // deg/s
+    float timeConstant;  // First order lag (s)
+    const ServoCalibration* calibration; // Rising/falling curves with backlash between them, nullptr for the linear map
+    float deadBand = 0.0f; // Pulses reaching closer than this to the current target are ignored (degrees)
+};
+
+/* Servo driven by a simulated PCA9685 channel
+ * The servo picks up the channel's pulse once per PWM frame and drives towards
+ * the angle it maps to (with a calibration, only out of the backlash band
+ * between the rising and falling curves) through a first order lag and a
+ * speed limit. Pulses that map within the dead band of the current target are
+ * ignored. A channel that is off or asleep leaves the horn where it is.
+ * State advances in small steps up to the time it is looked at or the PCA9685
+ * is written (so every pulse is seen for the frames it was on), on the clock it
+ * was given (the same virtual clock as the motion engine for replays).
+ */
+class SimServo
+{
+private:
+    std::mutex mutex;
+    SimPCA9685* pca;
+    uint8_t channel;
+    SimServoParams params;
+    Clock* clock;
+    Clock::TimePoint start;
+    double simTime; // Seconds since start the state is valid for
+    double pulse;   // Pulse picked up at the last frame (us), 0 when off
+    double target;  // Angle being driven to
+    double angle;
+
+    int watcher;    // Catches up before each write to the PCA9685
+
+    double pulseToAngle(double pulse); // Angle a pulse drives to from the current target
+
+    void advance(); // Steps the dynamics up to now
+
+public:
+    SimServo(SimPCA9685* pca, uint8_t channel, const SimServoParams& params, float startAngle, Clock* clock = Clock::steady());
+    ~SimServo();
+
+    SimServo(const SimServo&) = delete;
+    SimServo& operator=(const SimServo&) = delete;
+
+    double getAngle(); // Horn angle (degrees)
+    double getPulse(); // Pulse the servo last picked up (us)
+};
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef SPLINE_H
+#define SPLINE_H
+
+#include "config.h"
+
+#include <array>
+#include <vector>
+#include <cstddef> // For size_t
+
+// Number of polynomial coefficients stored per joint per segment (quintic = 6)
+#define SPLINE_COEFFS 6
+
+// Joint-space waypoint (one angle per joint, degrees)
+typedef std::array<float, NUM_JOINTS> JointVector;
+
+enum class SplineType{
+    Cubic,  // C2 through the waypoints, zero velocity at both ends
+    Quintic // C2 through the waypoints, zero velocity and acceleration at both ends
+};
+
+/* Joint-space spline through N waypoints
+ * Coefficients for every segment are stored in one contiguous array laid out as
+ * [segment][power][joint], so a tick evaluates all joints with a single Horner
+ * pass over SPLINE_COEFFS rows. Cubic segments are padded with zeros so both
+ * spline types share the same branch-free kernel.
+ */
+class JointSpline
+{
+private:
+    SplineType type;
+    std::vector<float> knots;  // Waypoint times in seconds (segments + 1)
+    std::vector<float> coeffs; // Segment coefficients, local time u = t - knots[segment]
+    size_t cursor;             // Last segment evaluated, ticks normally move forward in time
+
+    // Fitting
+    void solveKnotVelocities(const std::vector<JointVector>& waypoints, std::vector<JointVector>& velocities);
+    void fitCubic(const std::vector<JointVector>& waypoints, const std::vector<JointVector>& velocities);
+    void fitQuintic(const std::vector<JointVector>& waypoints, const std::vector<JointVector>& velocities);
+
+    // Evaluation
+    size_t findSegment(float t);    // Moves the cursor to the segment containing t
+    float* segment(size_t index);   // Returns a pointer to the coefficients of a segment
+
+public:
+    // Constructor
+    JointSpline(SplineType type = SplineType::Cubic);
+
+    // Fitting (times must be strictly increasing, one per waypoint)
+    void fit(const std::vector<float>& times, const std::vector<JointVector>& waypoints);
+
+    // Evaluation
+    void evaluate(float t, float* positions);       // Fills NUM_JOINTS positions at time t
+    void evaluateVelocity(float t, float* velocities); // Fills NUM_JOINTS velocities at time t
+
+    // Accessors
+    float startTime() const;
+    float endTime() const;
+    size_t numSegments() const;
+    SplineType getType() const;
+};
+
+#endif
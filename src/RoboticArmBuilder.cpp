@@ -2,13 +2,16 @@
 // ~~ Libraries ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
 #include "RoboticArmBuilder.h"
+#include "estop.h"
 #include "config.h"
 
-#include <vector>
 #include <cmath>
+#include <algorithm> // For std::min, std::max
 #include <iostream>
-#include <unistd.h> // For sleep()
-#include <thread>
+#include <iomanip>  // For std::setw, std::setprecision
+#include <unistd.h> // For access(), readlink()
+#include <climits>  // For PATH_MAX
+#include <vector>
 #include <stdexcept>   // For std::runtime_error
 
 
@@ -19,52 +22,233 @@ const float RoboticArmBuilder::RAD_TO_DEG = 180.0 / M_PI;
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // ~~ Constructor ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
-// Constructor: Creates and initializes object
-RoboticArmBuilder::RoboticArmBuilder(){
+/* Loads a servo's calibration sweep, logging the file it came from
+ * Returns nullptr (linear pulse map) when no file is configured or it cannot be loaded.
+ */
+static const ServoCalibration* loadCalibration(int joint, const char* path, ServoCalibration& calibration){
+
+    if(path[0] == '\0'){
+        std::cout << "J" << joint + 1 << "S: no calibration sweep, using the linear pulse map" << std::endl;
+        return nullptr;
+    }
+    try{
+        std::string resolved = RoboticArmBuilder::dataPath(path);
+        calibration = ServoCalibration::fromSweepCsv(resolved);
+        std::cout << "J" << joint + 1 << "S: calibration sweep " << resolved << std::endl;
+        return &calibration;
+    }
+    catch(const std::runtime_error& e){
+        std::cerr << "Warning: " << e.what() << ", using the linear pulse map" << std::endl;
+        return nullptr;
+    }
+}
+
+// Relative data paths resolve against ARM_DATA_DIR, or the directory of the executable when it is ""
+std::string RoboticArmBuilder::dataPath(const std::string& path){
+
+    if(path.empty() || path[0] == '/'){
+        return path;
+    }
+    std::string base = ARM_DATA_DIR;
+    if(base.empty()){
+        char executable[PATH_MAX];
+        ssize_t length = readlink("/proc/self/exe", executable, sizeof(executable) - 1);
+        if(length <= 0){
+            return path; // No /proc, the working directory it is
+        }
+        base.assign(executable, length);
+        base.erase(base.find_last_of('/'));
+    }
+    return base + "/" + path;
+}
+
+// Constructor: Builds the arm from ARM_CONFIG_FILE (in ARM_DATA_DIR), or from config.h when there is none
+RoboticArmBuilder::RoboticArmBuilder() : RoboticArmBuilder(nullptr, Clock::steady()){}
+
+// Constructor: Builds the arm from a binary arm config
+RoboticArmBuilder::RoboticArmBuilder(const std::string& configPath) : clock(Clock::steady()){
+    std::cout << "Arm config: " << configPath << std::endl;
+    ArmConfig config(configPath);
+    build(&config, nullptr);
+}
+
+/* Constructor: Builds the arm on a given bus and clock
+ * With a simulated bus and a virtual clock every move runs on the caller's
+ * thread in virtual time, so a motion program replays exactly and as fast as
+ * it computes. A null bus opens I2C_DIRECTORY.
+ */
+RoboticArmBuilder::RoboticArmBuilder(I2CBus* bus, Clock* clock) : clock(clock){
+
+    std::string configPath = dataPath(ARM_CONFIG_FILE);
+    if(access(configPath.c_str(), F_OK) == 0){
+        std::cout << "Arm config: " << configPath << std::endl;
+        ArmConfig config(configPath);
+        build(&config, bus);
+    }
+    else{
+        std::cout << "No " << configPath << ", using the config.h servo parameters" << std::endl;
+        build(nullptr, bus);
+    }
+}
+
+/* Creates and initializes the devices and servos
+ * With an arm config everything comes precomputed from the file (limits,
+ * offsets, pulse tables in the PCA9685's ticks). Without one the servos are
+ * built from the config.h defines and their calibration sweeps.
+ */
+void RoboticArmBuilder::build(const ArmConfig* config, I2CBus* bus){
+
+    if(config && config->getNumJoints() != NUM_JOINTS){
+        throw std::runtime_error("Arm config has " + std::to_string(config->getNumJoints()) + " joints, the arm has "
+                               + std::to_string(NUM_JOINTS));
+    }
 
     // Initializes targetPosition and targetOrientation
     initStartVector();
 
+    // Motion Engine Construction
+    engine = new MotionEngine(std::chrono::microseconds(MOTION_TICK_PERIOD_US), clock);
+
     // I2C Construction
-    i2c = new I2C(I2C_DIRECTORY);
+    if(bus){
+        i2c = new I2C(bus);
+    }
+    else{
+        i2c = new I2C(I2C_DIRECTORY);
+    }
 
-    // PCA9685 Construction
-    pca = new PCA9685(i2c, PCA9685_SLAVE_ADDR);
+    // A NACK on a noisy bus is retried rather than failing the move
+    i2c->setRetryPolicy({I2C_RETRY_ATTEMPTS, std::chrono::microseconds(I2C_RETRY_BACKOFF_US)
+                       , std::chrono::microseconds(I2C_RETRY_MAX_BACKOFF_US), I2C_RECOVER_AFTER});
 
-    // Constructing Servo Parameters
-    ServoParams j1sParams = {pca, J1S_CHANNEL, J1S_MIN_PULSE, J1S_MAX_PULSE
-							 , J1S_MAX_ANGLE, J1S_DEF_ANGLE, SERVO_SPEED, SERVO_UPDATE_RESOLUTION};
-    ServoParams j2sParams = {pca, J2S_CHANNEL, J2S_MIN_PULSE, J2S_MAX_PULSE
-							 , J2S_MAX_ANGLE, J2S_DEF_ANGLE, SERVO_SPEED, SERVO_UPDATE_RESOLUTION};
-    ServoParams j3sParams = {pca, J3S_CHANNEL, J3S_MIN_PULSE, J3S_MAX_PULSE
-							 , J3S_MAX_ANGLE, J3S_DEF_ANGLE, SERVO_SPEED, SERVO_UPDATE_RESOLUTION};
-    ServoParams j4sParams = {pca, J4S_CHANNEL, J4S_MIN_PULSE, J4S_MAX_PULSE
-							 , J4S_MAX_ANGLE, J4S_DEF_ANGLE, SERVO_SPEED, SERVO_UPDATE_RESOLUTION};
-    ServoParams j5sParams = {pca, J5S_CHANNEL, J5S_MIN_PULSE, J5S_MAX_PULSE
-							 , J5S_MAX_ANGLE, J5S_DEF_ANGLE, SERVO_SPEED, SERVO_UPDATE_RESOLUTION};
-    ServoParams j6sParams = {pca, J6S_CHANNEL, J6S_MIN_PULSE, J6S_MAX_PULSE
-							 , J6S_MAX_ANGLE, J6S_DEF_ANGLE, SERVO_SPEED, SERVO_UPDATE_RESOLUTION};
+    // One thread owns the bus, servo writes go ahead of encoder reads
+    if(I2C_SCHEDULER_MAX_WAIT_US > 0){
+        i2c->startScheduler(std::chrono::microseconds(I2C_SCHEDULER_MAX_WAIT_US));
+    }
+
+    // Periodic per-device bus statistics
+    statsDump = nullptr;
+    if(I2C_STATS && I2C_STATS_DUMP_PERIOD_MS > 0){
+        statsDump = new I2CStatsDump(i2c, std::chrono::milliseconds(I2C_STATS_DUMP_PERIOD_MS), std::cout);
+    }
+
+    // PCA9685 Construction, every board at the prescaler the config's tables were built for (the servos convert them in high-rate mode)
+    uint8_t prescaler = config ? config->getHeader().prescaler : PCA9685::prescalerFor(PCA9685_FREQ);
+    if(PCA9685_HIGH_RATE){
+        prescaler = PCA9685::prescalerFor(PCA9685_HIGH_RATE_FREQ);
+    }
+    boards = new PCA9685Router(i2c);
+    const uint8_t boardAddresses[] = PCA9685_BOARDS;
+    for(uint8_t address : boardAddresses){
+        boards->addBoard(address, prescaler);
+    }
+    engine->setTickPeriod(controlTick());
+    if(PCA9685_ALL_CALL_ADDR > 0){
+        boards->enableAllCall(PCA9685_ALL_CALL_ADDR);
+    }
+
+    // Joints start open loop
+    for (int i = 0; i < NUM_JOINTS; i++){
+        controllers[i] = nullptr;
+    }
+
+    float lower[NUM_JOINTS];
+    float upper[NUM_JOINTS];
+
+    if(config){
+
+        // Servos straight from the config, the tables are copied so nothing is rebuilt (the config has no boards, every joint is on the first)
+        const ArmConfigHeader& header = config->getHeader();
+        for (int i = 0; i < NUM_JOINTS; i++){
+            const JointConfig& joint = config->getJoint(i);
+            PrebuiltTables tables = config->getTables(i);
+            boards->route(i, 0, joint.channel);
+            ServoParams params = {boards->boardOf(i), joint.channel, joint.minPulse, joint.maxPulse, joint.maxAngle, joint.defaultAngle
+                                , header.servoSpeed, header.updateResolution, engine, nullptr, &tables};
+            servos[i] = new Servo(params);
+            jointOffset[i] = joint.jointOffset;
+            lower[i] = joint.lowerLimit;
+            upper[i] = joint.upperLimit;
+        }
+    }
+    else{
+
+        // Calibration curves (only needed while the servos build their pulse tables)
+        const char* calibrationFiles[NUM_JOINTS] = {J1S_CALIBRATION, J2S_CALIBRATION, J3S_CALIBRATION
+                                                  , J4S_CALIBRATION, J5S_CALIBRATION, J6S_CALIBRATION};
+        ServoCalibration calibrations[NUM_JOINTS];
+        const ServoCalibration* calibration[NUM_JOINTS];
+        for (int i = 0; i < NUM_JOINTS; i++){
+            calibration[i] = loadCalibration(i, calibrationFiles[i], calibrations[i]);
+        }
+
+        // Joint -> (board, channel) routes
+        const int jointBoards[NUM_JOINTS] = {J1S_BOARD, J2S_BOARD, J3S_BOARD, J4S_BOARD, J5S_BOARD, J6S_BOARD};
+        const uint8_t jointChannels[NUM_JOINTS] = {J1S_CHANNEL, J2S_CHANNEL, J3S_CHANNEL, J4S_CHANNEL, J5S_CHANNEL, J6S_CHANNEL};
+        for (int i = 0; i < NUM_JOINTS; i++){
+            boards->route(i, jointBoards[i], jointChannels[i]);
+        }
+
+        // Constructing Servo Parameters
+        ServoParams j1sParams = {boards->boardOf(0), J1S_CHANNEL, J1S_MIN_PULSE, J1S_MAX_PULSE
+                                 , J1S_MAX_ANGLE, J1S_DEF_ANGLE, SERVO_SPEED, SERVO_UPDATE_RESOLUTION, engine, calibration[0]};
+        ServoParams j2sParams = {boards->boardOf(1), J2S_CHANNEL, J2S_MIN_PULSE, J2S_MAX_PULSE
+                                 , J2S_MAX_ANGLE, J2S_DEF_ANGLE, SERVO_SPEED, SERVO_UPDATE_RESOLUTION, engine, calibration[1]};
+        ServoParams j3sParams = {boards->boardOf(2), J3S_CHANNEL, J3S_MIN_PULSE, J3S_MAX_PULSE
+                                 , J3S_MAX_ANGLE, J3S_DEF_ANGLE, SERVO_SPEED, SERVO_UPDATE_RESOLUTION, engine, calibration[2]};
+        ServoParams j4sParams = {boards->boardOf(3), J4S_CHANNEL, J4S_MIN_PULSE, J4S_MAX_PULSE
+                                 , J4S_MAX_ANGLE, J4S_DEF_ANGLE, SERVO_SPEED, SERVO_UPDATE_RESOLUTION, engine, calibration[3]};
+        ServoParams j5sParams = {boards->boardOf(4), J5S_CHANNEL, J5S_MIN_PULSE, J5S_MAX_PULSE
+                                 , J5S_MAX_ANGLE, J5S_DEF_ANGLE, SERVO_SPEED, SERVO_UPDATE_RESOLUTION, engine, calibration[4]};
+        ServoParams j6sParams = {boards->boardOf(5), J6S_CHANNEL, J6S_MIN_PULSE, J6S_MAX_PULSE
+                                 , J6S_MAX_ANGLE, J6S_DEF_ANGLE, SERVO_SPEED, SERVO_UPDATE_RESOLUTION, engine, calibration[5]};
+
+        // Create Servo objects
+        servos[0] = new Servo(j1sParams);
+        servos[1] = new Servo(j2sParams);
+        servos[2] = new Servo(j3sParams);
+        servos[3] = new Servo(j4sParams);
+        servos[4] = new Servo(j5sParams);
+        servos[5] = new Servo(j6sParams);
+
+        // Joint limits are the servo ranges shifted by each joint's offset
+        const float offsets[NUM_JOINTS] = {J1S_DEF_ANGLE, 90.0 + J2S_DEF_ANGLE, J3S_DEF_ANGLE
+                                         , J4S_DEF_ANGLE, J5S_DEF_ANGLE, J6S_DEF_ANGLE};
+        const float maxAngles[NUM_JOINTS] = {J1S_MAX_ANGLE, J2S_MAX_ANGLE, J3S_MAX_ANGLE
+                                           , J4S_MAX_ANGLE, J5S_MAX_ANGLE, J6S_MAX_ANGLE};
+        for (int i = 0; i < NUM_JOINTS; i++){
+            jointOffset[i] = offsets[i];
+            lower[i] = degToRad(-jointOffset[i]);
+            upper[i] = degToRad(maxAngles[i] - jointOffset[i]);
+        }
+    }
 
-    // Create Servo objects
-    servos[0] = new Servo(j1sParams);
-    servos[1] = new Servo(j2sParams);
-    servos[2] = new Servo(j3sParams);
-    servos[3] = new Servo(j4sParams);
-    servos[4] = new Servo(j5sParams);
-    servos[5] = new Servo(j6sParams);
+    // Servo outputs of a tick go out as one burst per board
+    if(PCA9685_BURST_OUTPUTS){
+        engine->setOutputFlush([this]{ return boards->flush(); });
+    }
 
+    // Kinematics Construction
+    kinematics = new Kinematics(lower, upper, clock);
+    ikMode = IKMode::Auto;
+    lastIKResult = {IKStatus::Converged, false, 0, 0.0f, 0.0f};
 
 }
 
 // Deconstructor: Cleans up objects, sets arm to default position
 RoboticArmBuilder::~RoboticArmBuilder(){
-    sleep(1);
+    clock->sleepFor(std::chrono::seconds(1));
     for (int i = 0; i < 6; i++){
         delete servos[i];
+        delete controllers[i];
     }
-    delete pca;
+    delete kinematics;
+    engine->setOutputFlush(nullptr);
+    delete boards;
+    delete statsDump;
     delete i2c;
-    sleep(1);
+    delete engine;
+    clock->sleepFor(std::chrono::seconds(1));
 
 }
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -78,6 +262,19 @@ bool RoboticArmBuilder::validateAngle(uint8_t motor, float angle){
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // ~~ Helper Methods ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
+/* Motion engine tick for the boards' frame rate
+ * Frames faster than PCA9685_FREQ take a new setpoint each, so the tick is one
+ * frame (a faster one writes setpoints no frame picks up). At the analog rate
+ * it stays MOTION_TICK_PERIOD_US, a 20 ms tick would make the ramps coarse.
+ */
+std::chrono::microseconds RoboticArmBuilder::controlTick(){
+    PCA9685* board = boards->getBoard(0);
+    if(board->getPrescaler() >= PCA9685::prescalerFor(PCA9685_FREQ)){
+        return std::chrono::microseconds(MOTION_TICK_PERIOD_US);
+    }
+    return std::chrono::microseconds(static_cast<long>(std::ceil(board->getFramePeriod())));
+}
+
 // Converts radians to degrees
 float RoboticArmBuilder::radToDeg(float rad){
     return rad * RAD_TO_DEG;
@@ -88,98 +285,52 @@ float RoboticArmBuilder::degToRad(float deg){
     return deg * DEG_TO_RAD;
 }
 
-// Calculates and updates joint angles based on target position/orientation variables
-void RoboticArmBuilder::updateJoints(){
+// Converts pitch/yaw/roll (degrees) to a unit quaternion
+Quaternion RoboticArmBuilder::toQuaternion(const Orientation& orientation){
+    return Quaternion::fromEuler(degToRad(orientation.yaw), degToRad(orientation.pitch), degToRad(orientation.roll));
+}
 
-    // ~~ Calculate RDesired ~~
-    // Precompute cosines and sines
-    float cYaw = cos(degToRad(targetOrientation.yaw));
-    float sYaw = sin(degToRad(targetOrientation.yaw));
-    float cPitch = cos(degToRad(targetOrientation.pitch));
-    float sPitch = sin(degToRad(targetOrientation.pitch));
-    //float cRoll = cos(degToRad(targetOrientation.roll));
-    //float sRoll = sin(degToRad(targetOrientation.roll));
-
-    // Z-axis of the end effector
-    std::vector<float> zEffector = {
-        cYaw * sPitch,
-        sYaw * sPitch,
-        cPitch
-    };
-
-    // X-axis of the end effector
-    std::vector<float> xEffector = {
-        cYaw * cPitch,
-        sYaw * cPitch,
-        -sPitch
-    };
-
-    // Y-axis of the end effector
-    std::vector<float> yEffector = {
-        zEffector[1] * xEffector[2] - zEffector[2] * xEffector[1],
-        zEffector[2] * xEffector[0] - zEffector[0] * xEffector[2],
-        zEffector[0] * xEffector[1] - zEffector[1] * xEffector[0]
-    };
-
-    // Assemble RDesired matrix using vectors
-    std::vector<std::vector<float>> RDesired(3, std::vector<float>(3));
-    RDesired[0] = xEffector;
-    RDesired[1] = yEffector;
-    RDesired[2] = zEffector;
-
-    // ~~ Calculate wrist center ~~
-
-    float wcX = targetPosition.x - D_6 * RDesired[0][2];
-    float wcY = targetPosition.y - D_6 * RDesired[1][2];
-    float wcZ = targetPosition.z - D_6 * RDesired[2][2] - D_1;
-
-    // ~~ Calculate Theta 1, 2, and 3 ~~
-
-    // Theta_1
-    float theta1 = atan2(wcY, wcX);
-
-    // r is the projection onto the XY plane
-    float r = sqrt(wcX * wcX + wcY * wcY);
-
-    // Distance from joint 2 to wrist center
-    float s = sqrt(r * r + wcZ * wcZ);
-
-    // Using the law of cosines for theta3
-    float cosTheta3 = (s * s - A_2 * A_2 - A_3 * A_3) / (2 * A_2 * A_3);
-    float theta3 = atan2(sqrt(1 - cosTheta3 * cosTheta3), cosTheta3); // elbow up
-
-    // Theta2
-    float alpha = atan2(wcZ, r); // angle to wrist center
-    float beta = atan2(A_3 * sin(theta3), A_2 + A_3 * cos(theta3));
-    float theta2 = alpha - beta;
-
-    // ~~ Calculate Theta 4, 5, and 6 ~~
-    
-    float theta4 = atan2(RDesired[1][2], RDesired[0][2]);
-    float theta5 = atan2(sqrt(RDesired[0][2]*RDesired[0][2] + RDesired[1][2]*RDesired[1][2]), RDesired[2][2]);
-    float theta6 = atan2(RDesired[1][1], RDesired[1][0]);
+// Solves the inverse kinematics with the selected solver, fills theta with joint angles in radians
+void RoboticArmBuilder::solveJoints(const Position& position, const Quaternion& orientation, float theta[NUM_JOINTS]){
 
-    std::cout << "Theta 1: " << radToDeg(theta1) << std::endl;
-    std::cout << "Theta 2: " << radToDeg(theta2) << std::endl;
-    std::cout << "Theta 3: " << radToDeg(theta3) << std::endl;
-    std::cout << "Theta 4: " << radToDeg(theta4) << std::endl;
-    std::cout << "Theta 5: " << radToDeg(theta5) << std::endl;
-    std::cout << "Theta 6: " << radToDeg(theta6) << std::endl;
-    //std::cout << "Wrist Center Position: (" << wcX << ", " << wcY << ", " << wcZ << ")" << std::endl;
+    lastIKResult = kinematics->solve(ikMode, position, orientation, theta);
 
-    std::thread t1 = servos[0]->moveToPosition(radToDeg(theta1) + J1S_DEF_ANGLE);
-    std::thread t2 = servos[1]->moveToPosition(radToDeg(theta2) + 90.0 + J2S_DEF_ANGLE);
-    std::thread t3 = servos[2]->moveToPosition(radToDeg(theta3) + J3S_DEF_ANGLE);
-    std::thread t4 = servos[3]->moveToPosition(radToDeg(theta4) + J4S_DEF_ANGLE);
-    std::thread t5 = servos[4]->moveToPosition(radToDeg(theta5) + J5S_DEF_ANGLE);
-    servos[5]->moveToPosition(radToDeg(theta6) + J6S_DEF_ANGLE).join();
+    // Unreachable with the closed form only, nothing sensible to move to
+    if(lastIKResult.status == IKStatus::Failed){
+        throw std::runtime_error("Target pose is not reachable");
+    }
+    // Best effort from the numerical solver, still within the joint limits
+    if(lastIKResult.status != IKStatus::Converged){
+        std::cout << "IK did not converge, position error: " << lastIKResult.positionError
+                  << "mm, orientation error: " << radToDeg(lastIKResult.orientationError) << " degrees" << std::endl;
+    }
+}
 
-    if(t1.joinable()){t1.join();} else{t1.detach();}
-    if(t2.joinable()){t2.join();} else{t2.detach();}
-    if(t3.joinable()){t3.join();} else{t3.detach();}
-    if(t4.joinable()){t4.join();} else{t4.detach();}
-    if(t5.joinable()){t5.join();} else{t5.detach();}
+// Moves all servos to the joint angles (radians) and waits for them
+void RoboticArmBuilder::moveJoints(const float theta[NUM_JOINTS]){
 
+    std::vector<MotionHandle> moves;
+    for (int i = 0; i < NUM_JOINTS; i++){
+        moves.push_back(servos[i]->moveToPosition(radToDeg(theta[i]) + jointOffset[i]));
+    }
+
+    MotionHandle::whenAll(moves).wait();
+}
+
+// Calculates and updates joint angles based on target position/orientation variables
+void RoboticArmBuilder::updateJoints(){
+
+    float theta[NUM_JOINTS];
+    solveJoints(targetPosition, targetOrientation, theta);
+
+    std::cout << "Theta 1: " << radToDeg(theta[0]) << std::endl;
+    std::cout << "Theta 2: " << radToDeg(theta[1]) << std::endl;
+    std::cout << "Theta 3: " << radToDeg(theta[2]) << std::endl;
+    std::cout << "Theta 4: " << radToDeg(theta[3]) << std::endl;
+    std::cout << "Theta 5: " << radToDeg(theta[4]) << std::endl;
+    std::cout << "Theta 6: " << radToDeg(theta[5]) << std::endl;
+
+    moveJoints(theta);
 }
 
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -190,41 +341,185 @@ void RoboticArmBuilder::updateJoints(){
 void RoboticArmBuilder::initStartVector(){
 
     targetPosition = {0.0, 0.0, 0.0}; // {x, y, z}
-    targetOrientation = {0.0, 0.0, 0.0}; // {pitch, yaw, roll}
+    targetOrientation = Quaternion(); // Identity, tool z axis pointing up
 }
 
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // ~~ Arm Control ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
-// Sets the angle of a given motor
-void RoboticArmBuilder::setAngle(uint8_t motor, float angle, bool wait){
+// Sets the angle of a given motor, the handle tracks the move when not waiting
+MotionHandle RoboticArmBuilder::setAngle(uint8_t motor, float angle, bool wait){
     
     // Throws error if angle is not in servo's range
     if(!validateAngle(motor, angle)){
         throw std::runtime_error("Angle is not within servo's range");
     }
     
+    MotionHandle move = servos[motor]->moveToPosition(angle);
+
     // Waits until the motors stops moving before moving on
     if(wait){
-        servos[motor]->moveToPosition(angle).join();
-    }
-    // Moves on without waiting for the servo to stop
-    else{
-        servos[motor]->moveToPosition(angle).detach();
+        move.wait();
     }
+    // Otherwise the motion engine keeps moving the servo in the background
+    return move;
 }
 
 // Sets the orientation of the last 3 joints in terms of pitch, yaw, and roll
 void RoboticArmBuilder::setEE(Position position, Orientation orientation){
     
+    // Convert to a quaternion at the API boundary
+    setEE(position, toQuaternion(orientation));
+}
+
+// Sets the end effector position and orientation from a quaternion
+void RoboticArmBuilder::setEE(Position position, Quaternion orientation){
+
     // Set global variables
     targetPosition = position;
-    targetOrientation = orientation;
+    targetOrientation = orientation.normalized();
 
     // Update Joints
     updateJoints();
 }
 
+/* Moves the end effector along a straight line to the given pose
+ * Position is interpolated linearly and orientation with SLERP; the per-step
+ * rotation is precomputed so each step only costs a quaternion product.
+ */
+void RoboticArmBuilder::moveLinear(Position position, Orientation orientation){
+
+    Position start = targetPosition;
+    Quaternion goal = toQuaternion(orientation);
+
+    // Number of steps needed to respect both the translation and rotation resolution
+    float dx = position.x - start.x;
+    float dy = position.y - start.y;
+    float dz = position.z - start.z;
+    float distance = sqrt(dx * dx + dy * dy + dz * dz);
+    float rotation = radToDeg(2.0f * acos(std::min(1.0f, std::fabs(targetOrientation.dot(goal)))));
+    int steps = std::max(1, static_cast<int>(ceil(std::max(distance / CARTESIAN_STEP_SIZE, rotation / CARTESIAN_ANGLE_STEP))));
+
+    SlerpPath path(targetOrientation, goal, steps);
+    float theta[NUM_JOINTS];
+
+    for(int i = 1; i <= steps; i++){
+        float t = static_cast<float>(i) / steps;
+        targetPosition = {start.x + dx * t, start.y + dy * t, start.z + dz * t};
+        targetOrientation = path.next();
+
+        solveJoints(targetPosition, targetOrientation, theta);
+        moveJoints(theta);
+    }
+}
+
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Closed Loop Control ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Closes the loop around a motor, feedback returns the measured servo angle in degrees
+void RoboticArmBuilder::enableClosedLoop(uint8_t motor, std::function<bool(float&)> feedback){
+
+    if(motor >= NUM_JOINTS){
+        throw std::runtime_error("Motor does not exist");
+    }
+    if(!controllers[motor]){
+        ControllerParams params = {JOINT_KP, JOINT_KI, JOINT_KV, JOINT_MAX_TRIM, JOINT_CONTROL_PERIOD_US / 1e6f
+                                 , JOINT_SETTLE_TOLERANCE, JOINT_SETTLE_TIME_MS / 1e3f, JOINT_SETTLE_TIMEOUT_MS / 1e3f};
+        controllers[motor] = new JointController(params);
+    }
+    servos[motor]->setFeedback(controllers[motor], std::move(feedback));
+}
+
+// Returns a motor to open loop control, the engine has dropped the controller before it is deleted
+void RoboticArmBuilder::disableClosedLoop(uint8_t motor){
+
+    if(motor >= NUM_JOINTS){
+        throw std::runtime_error("Motor does not exist");
+    }
+    servos[motor]->setFeedback(nullptr, nullptr);
+    delete controllers[motor];
+    controllers[motor] = nullptr;
+}
+
+// True once the motor has settled on its target
+bool RoboticArmBuilder::atTarget(uint8_t motor){
+    return servos[motor]->atTarget();
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Emergency Stop ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Latches the emergency stop and cuts all outputs
+void RoboticArmBuilder::emergencyStop(){
+    EmergencyStop::stop();
+}
+
+// Clears the latch and re-enables the servos where they stopped
+void RoboticArmBuilder::resetEmergencyStop(){
+    EmergencyStop::reset();
+
+    // The cut cleared every channel's OFF_H register, rewrite the pulses where the servos stopped
+    for (int i = 0; i < NUM_JOINTS; i++){
+        servos[i]->refresh();
+    }
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ PWM Frame Rate ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+/* Runs every board at a frame rate (call while not moving)
+ * The outputs stop while the boards change rate and the servos rewrite their
+ * pulses in the new ticks, then start together, so no frame goes out with an
+ * off time meant for the old rate.
+ */
+void RoboticArmBuilder::setPWMFrequency(int freq){
+
+    // Nothing changes unless every servo's longest pulse fits the frame
+    uint8_t prescaler = PCA9685::prescalerFor(freq);
+    for (int i = 0; i < NUM_JOINTS; i++){
+        ServoResolution resolution = servos[i]->resolutionAt(prescaler);
+        if(!resolution.fits){
+            throw std::runtime_error("Joint " + std::to_string(i + 1) + " pulses up to " + std::to_string(resolution.longestPulse)
+                                   + " us do not fit a " + std::to_string(resolution.framePeriod) + " us frame");
+        }
+    }
+
+    boards->sleepAll();
+    boards->setPWMFrequency(freq);
+    for (int i = 0; i < NUM_JOINTS; i++){
+        servos[i]->retime();
+    }
+    boards->wakeAll();
+    engine->setTickPeriod(controlTick());
+}
+
+// Angular resolution of every servo at each frame rate, and whether its pulses fit the frame
+void RoboticArmBuilder::reportResolution(std::ostream& out, const std::vector<int>& frequencies){
+
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << std::fixed;
+
+    for(int frequency : frequencies){
+        uint8_t prescaler = PCA9685::prescalerFor(frequency);
+        ServoResolution first = servos[0]->resolutionAt(prescaler);
+        out << std::setprecision(1) << frequency << " Hz: prescaler " << static_cast<int>(prescaler) << ", " << first.frequency
+            << " Hz frames of " << std::setprecision(0) << first.framePeriod << " us, " << std::setprecision(2) << first.stepSize
+            << " us ticks" << std::endl;
+        out << "  Joint   Ticks   Deg/tick   Worst deg/tick   Longest pulse (us)   Fits" << std::endl;
+        for (int i = 0; i < NUM_JOINTS; i++){
+            ServoResolution resolution = servos[i]->resolutionAt(prescaler);
+            out << "  " << std::setw(5) << i + 1 << std::setw(8) << resolution.ticks << std::setprecision(3)
+                << std::setw(11) << resolution.degreesPerTick << std::setw(17) << resolution.worstDegreesPerTick
+                << std::setprecision(0) << std::setw(21) << resolution.longestPulse
+                << std::setw(7) << (resolution.fits ? "yes" : "NO") << std::endl;
+        }
+    }
+
+    out.flags(flags);
+    out.precision(precision);
+}
 
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // ~~ Set Arm Characterists ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -234,4 +529,14 @@ void RoboticArmBuilder::setEndSpeed(float speed){
     this->endSpeed = speed;
 }
 
+// Selects the inverse kinematics solver
+void RoboticArmBuilder::setIKMode(IKMode mode){
+    ikMode = mode;
+}
+
+// Returns the convergence status of the most recent solve
+IKResult RoboticArmBuilder::getLastIKResult(){
+    return lastIKResult;
+}
+
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
\ No newline at end of file
@@ -0,0 +1,287 @@
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Libraries ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+#include "arm_config.h"
+#include "pca9685.h"
+
+#include <map>
+#include <cmath>     // For M_PI
+#include <cstddef>   // For offsetof
+#include <cstring>   // For std::memcpy, std::memcmp
+#include <cstdlib>   // For std::strtod
+#include <fstream>
+#include <stdexcept> // For std::runtime_error
+
+static const float DEG_TO_RAD = M_PI / 180.0;
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Checksum ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// CRC-32 (IEEE, as zlib), table driven
+uint32_t crc32(const uint8_t* data, size_t size){
+
+    static const std::vector<uint32_t> table = [](){
+        std::vector<uint32_t> entries(256);
+        for(uint32_t i = 0; i < 256; i++){
+            uint32_t crc = i;
+            for(int bit = 0; bit < 8; bit++){
+                crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+            }
+            entries[i] = crc;
+        }
+        return entries;
+    }();
+
+    uint32_t crc = 0xFFFFFFFFu;
+    for(size_t i = 0; i < size; i++){
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+// Bytes covered by the checksum start after the checksum field
+static const size_t CHECKSUM_START = offsetof(ArmConfigHeader, checksum) + sizeof(uint32_t);
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ ArmConfig ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Maps the file and checks it once, everything after reads it in place
+ArmConfig::ArmConfig(const std::string& path) : file(path), header(nullptr), joints(nullptr){
+
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(file.begin());
+    size_t size = file.getSize();
+
+    if(size < sizeof(ArmConfigHeader)){
+        throw std::runtime_error("Arm config is too short: " + path);
+    }
+    header = reinterpret_cast<const ArmConfigHeader*>(data);
+    if(std::memcmp(header->magic, ARM_CONFIG_MAGIC, 4) != 0){
+        throw std::runtime_error("Not an arm config file: " + path);
+    }
+    if(header->version != ARM_CONFIG_VERSION){
+        throw std::runtime_error("Arm config " + path + " is version " + std::to_string(header->version)
+                               + ", expected " + std::to_string(ARM_CONFIG_VERSION));
+    }
+    if(header->size != size){
+        throw std::runtime_error("Arm config is truncated: " + path);
+    }
+    if(crc32(data + CHECKSUM_START, size - CHECKSUM_START) != header->checksum){
+        throw std::runtime_error("Arm config checksum mismatch: " + path);
+    }
+
+    // Layout checks, so later reads never leave the mapping
+    if(header->tableSize < 2 || header->stepSize <= 0.0f
+    || sizeof(ArmConfigHeader) + static_cast<size_t>(header->numJoints) * sizeof(JointConfig) > size){
+        throw std::runtime_error("Arm config has an invalid layout: " + path);
+    }
+    joints = reinterpret_cast<const JointConfig*>(data + sizeof(ArmConfigHeader));
+    size_t tableBytes = static_cast<size_t>(header->tableSize) * sizeof(float);
+    for(uint32_t i = 0; i < header->numJoints; i++){
+        for(uint32_t offset : {joints[i].risingOffset, joints[i].fallingOffset}){
+            if(offset % alignof(float) != 0 || offset < sizeof(ArmConfigHeader) || offset + tableBytes > size){
+                throw std::runtime_error("Arm config has an invalid layout: " + path);
+            }
+        }
+        if(joints[i].maxAngle <= 0.0f){
+            throw std::runtime_error("Arm config has an invalid joint: " + path);
+        }
+    }
+}
+
+const float* ArmConfig::tableAt(uint32_t offset) const{
+    return reinterpret_cast<const float*>(file.begin() + offset);
+}
+
+const ArmConfigHeader& ArmConfig::getHeader() const{
+    return *header;
+}
+
+uint32_t ArmConfig::getNumJoints() const{
+    return header->numJoints;
+}
+
+const JointConfig& ArmConfig::getJoint(uint32_t joint) const{
+    if(joint >= header->numJoints){
+        throw std::runtime_error("Joint does not exist in the arm config");
+    }
+    return joints[joint];
+}
+
+// A joint's pulse tables, pointing into the mapping
+PrebuiltTables ArmConfig::getTables(uint32_t joint) const{
+    const JointConfig& config = getJoint(joint);
+    return {tableAt(config.risingOffset), tableAt(config.fallingOffset)
+          , static_cast<int>(header->tableSize), header->stepSize};
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Compiler ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Keys of one text section, with the line they came from
+struct TextSection{
+    int line;
+    std::map<std::string, std::pair<std::string, int>> values;
+};
+
+// Numeric value of a required key
+static double number(const TextSection& section, const char* key, const std::string& name){
+    auto found = section.values.find(key);
+    if(found == section.values.end()){
+        throw std::runtime_error(name + " (line " + std::to_string(section.line) + ") is missing " + key);
+    }
+    const std::string& value = found->second.first;
+    char* end;
+    double result = std::strtod(value.c_str(), &end);
+    if(value.empty() || *end != '\0'){
+        throw std::runtime_error("Invalid number for " + std::string(key) + " on line " + std::to_string(found->second.second));
+    }
+    return result;
+}
+
+// Numeric value of an optional key
+static double number(const TextSection& section, const char* key, const std::string& name, double fallback){
+    return section.values.count(key) ? number(section, key, name) : fallback;
+}
+
+// Direction dependent curves of a joint, empty for the linear map (a relative sweep path is relative to textDir)
+static ServoCalibration jointCalibration(const TextSection& section, const std::string& textDir){
+    auto sweep = section.values.find("sweep");
+    if(sweep != section.values.end() && !sweep->second.first.empty()){
+        const std::string& path = sweep->second.first;
+        return ServoCalibration::fromSweepCsv(path[0] == '/' ? path : textDir + path);
+    }
+    auto rising = section.values.find("rising");
+    auto falling = section.values.find("falling");
+    if(rising != section.values.end() && falling != section.values.end()){
+        return ServoCalibration(parseCurveTable(rising->second.first), parseCurveTable(falling->second.first));
+    }
+    return ServoCalibration();
+}
+
+// Parses the text config, fits the curves and lays out the binary file
+std::vector<uint8_t> compileArmConfig(const std::string& textPath){
+
+    std::ifstream file(textPath);
+    if(!file.is_open()){
+        throw std::runtime_error("Failed to open arm config: " + textPath);
+    }
+    std::string textDir = textPath.substr(0, textPath.find_last_of('/') + 1); // "" or ending in '/'
+
+    // The [arm] section and each [joint] section in order
+    TextSection arm = {0, {}};
+    std::vector<TextSection> jointSections;
+    TextSection* current = nullptr;
+    std::string line;
+    for(int lineNumber = 1; std::getline(file, line); lineNumber++){
+        if(!line.empty() && line.back() == '\r'){
+            line.pop_back();
+        }
+        if(line.empty() || line[0] == '#'){
+            continue;
+        }
+        if(line == "[arm]"){
+            arm.line = lineNumber;
+            current = &arm;
+            continue;
+        }
+        if(line == "[joint]"){
+            jointSections.push_back({lineNumber, {}});
+            current = &jointSections.back();
+            continue;
+        }
+        size_t equals = line.find('=');
+        if(equals == std::string::npos || !current){
+            throw std::runtime_error("Malformed arm config line " + std::to_string(lineNumber) + ": " + line);
+        }
+        current->values[line.substr(0, equals)] = {line.substr(equals + 1), lineNumber};
+    }
+    if(arm.line == 0){
+        throw std::runtime_error("Arm config has no [arm] section: " + textPath);
+    }
+
+    // Arm, prescaler and step size as PCA9685::setPWMFrequency() picks them
+    ArmConfigHeader header = {};
+    std::memcpy(header.magic, ARM_CONFIG_MAGIC, 4);
+    header.version = ARM_CONFIG_VERSION;
+    header.numJoints = jointSections.size();
+    header.tableSize = static_cast<uint32_t>(number(arm, "table_size", "[arm]"));
+    double frequency = number(arm, "pwm_frequency", "[arm]");
+    if(header.tableSize < 2 || frequency <= 0.0){
+        throw std::runtime_error("Invalid table_size or pwm_frequency in [arm] (line " + std::to_string(arm.line) + ")");
+    }
+    header.prescaler = PCA9685::prescalerFor(frequency);
+    header.stepSize = PCA9685::stepSizeFor(header.prescaler);
+    header.servoSpeed = number(arm, "servo_speed", "[arm]");
+    header.updateResolution = number(arm, "update_resolution", "[arm]");
+    if(jointSections.empty()){
+        throw std::runtime_error("Arm config has no joints: " + textPath);
+    }
+
+    size_t tableBytes = header.tableSize * sizeof(float);
+    size_t tablesStart = sizeof(ArmConfigHeader) + header.numJoints * sizeof(JointConfig);
+    header.size = tablesStart + 2 * header.numJoints * tableBytes;
+
+    std::vector<uint8_t> blob(header.size, 0);
+    for(size_t i = 0; i < jointSections.size(); i++){
+        const TextSection& section = jointSections[i];
+        std::string name = "[joint] " + std::to_string(i + 1);
+
+        JointConfig joint = {};
+        joint.channel = static_cast<uint8_t>(number(section, "channel", name));
+        joint.encoderChannel = static_cast<int8_t>(number(section, "encoder_channel", name, -1));
+        joint.minPulse = static_cast<uint16_t>(number(section, "min_pulse", name));
+        joint.maxPulse = static_cast<uint16_t>(number(section, "max_pulse", name));
+        joint.maxAngle = number(section, "max_angle", name);
+        joint.defaultAngle = number(section, "default_angle", name);
+        joint.jointOffset = number(section, "joint_offset", name, joint.defaultAngle);
+        if(joint.maxAngle <= 0.0f || joint.maxPulse <= joint.minPulse){
+            throw std::runtime_error(name + " (line " + std::to_string(section.line) + ") has an empty range");
+        }
+        joint.angleToPwmSlope = (joint.maxPulse - joint.minPulse) / joint.maxAngle;
+        joint.lowerLimit = -joint.jointOffset * DEG_TO_RAD;
+        joint.upperLimit = (joint.maxAngle - joint.jointOffset) * DEG_TO_RAD;
+
+        // Tables built exactly as the Servo constructor would
+        ServoCalibration calibration = jointCalibration(section, textDir);
+        PulseTable rising, falling;
+        if(!calibration.empty()){
+            const CalibrationCurve* up = &calibration.getRising();
+            const CalibrationCurve* down = &calibration.getFalling();
+            rising.build([up](float angle){ return up->pulseAt(angle); }, joint.maxAngle, header.stepSize, header.tableSize);
+            falling.build([down](float angle){ return down->pulseAt(angle); }, joint.maxAngle, header.stepSize, header.tableSize);
+            joint.calibrated = 1;
+            joint.hysteresis = calibration.getHysteresis();
+        }
+        else{
+            float slope = joint.angleToPwmSlope;
+            float minPulse = joint.minPulse;
+            auto linear = [slope, minPulse](float angle){ return slope * angle + minPulse; };
+            rising.build(linear, joint.maxAngle, header.stepSize, header.tableSize);
+            falling.build(linear, joint.maxAngle, header.stepSize, header.tableSize);
+        }
+
+        joint.risingOffset = tablesStart + 2 * i * tableBytes;
+        joint.fallingOffset = joint.risingOffset + tableBytes;
+        std::memcpy(blob.data() + joint.risingOffset, rising.getTicks(), tableBytes);
+        std::memcpy(blob.data() + joint.fallingOffset, falling.getTicks(), tableBytes);
+        std::memcpy(blob.data() + sizeof(ArmConfigHeader) + i * sizeof(JointConfig), &joint, sizeof(JointConfig));
+    }
+
+    std::memcpy(blob.data(), &header, sizeof(ArmConfigHeader));
+    uint32_t checksum = crc32(blob.data() + CHECKSUM_START, blob.size() - CHECKSUM_START);
+    std::memcpy(blob.data() + offsetof(ArmConfigHeader, checksum), &checksum, sizeof(uint32_t));
+    return blob;
+}
+
+void writeArmConfig(const std::string& path, const std::vector<uint8_t>& blob){
+    std::ofstream file(path, std::ios::binary);
+    if(!file.is_open()){
+        throw std::runtime_error("Failed to open arm config for writing: " + path);
+    }
+    file.write(reinterpret_cast<const char*>(blob.data()), blob.size());
+    if(!file){
+        throw std::runtime_error("Failed to write arm config: " + path);
+    }
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
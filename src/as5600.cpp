@@ -3,6 +3,7 @@
 
 #include "as5600.h"
 #include "i2c.h"
+#include "i2c_batch.h"
 
 #include <string>
 #include <stdexcept> // For std::runtime_error
@@ -12,10 +13,11 @@
 // ~~ Constructor/Destructor ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
 // Constructor: Creates and initializes object
-AS5600::AS5600(I2C *i2cPtr, uint16_t config) : i2c(i2cPtr), address(AS5600_ADDRESS){
+AS5600::AS5600(I2C *i2cPtr, uint16_t config, uint8_t muxChannel) : i2c(i2cPtr), address(AS5600_ADDRESS), channel(muxChannel){
 
-    // Attempts to register PCA9685 into i2c object, returns error if it fails
-    if(!i2c->registerSlave(address)){
+    // Attempts to bind AS5600 to the i2c object, returns error if it fails
+    device = i2c->bind(channel, address);
+    if(!device.isBound()){
         throw std::runtime_error("Failed to add AS5600 to i2c");
     }
 
@@ -36,7 +38,7 @@ void AS5600::initConfig(uint16_t config){
 
     // Write config to AS5600
     uint8_t buffer[3] = {REG_CONF_MSB, msb, lsb};
-    if(!i2c -> write(address, buffer, 3)){
+    if(!device.write(buffer)){
         throw std::runtime_error("Failed to write config to AS5600");
     }
 
@@ -51,22 +53,19 @@ void AS5600::writeReg(uint8_t reg, uint8_t value){
     uint8_t buffer[2] = {reg, value};
     
     // Sends two bytes to PCA containing register and value to update, throws error if failure
-    if(!i2c -> write(address, buffer, 2)){
+    if(!device.write(buffer)){
         throw std::runtime_error("Failed to write value to register");
     }
 }
 
-// Reads a value from a register
+// Reads a value from a register, the pointer write and the read go out as one request
 uint8_t AS5600::readReg(uint8_t reg){
-    
-    // Sends one bytes to PCA containing register to set for reading, throws error if failure
-    if(!i2c -> write(address, &reg, 1)){
-        throw std::runtime_error("Failed to setup register for reading");
-    }
-    
-    std::vector<uint8_t> buffer = i2c -> read(address, 1);
-    return buffer[0];
-    
+    return device.readRegisters<1>(reg)[0];
+}
+
+// Reads a value from a register without throwing
+I2CStatus AS5600::tryReadReg(uint8_t reg, uint8_t& value) noexcept{
+    return device.tryWriteRead(ConstByteSpan(&reg, 1), ByteSpan(&value, 1));
 }
 
 // Modifies specific bits in a register without overwriting the entire register.
@@ -159,6 +158,31 @@ uint16_t AS5600::getStep(){
     return (angleMSB << 8) | angleLSB;
 }
 
+// Reads the rotational step of the encoder (0 - 4095) without throwing
+I2CStatus AS5600::tryGetStep(uint16_t& step) noexcept{
+
+    uint8_t angleMSB;
+    uint8_t angleLSB;
+    I2CStatus status = tryReadReg(REG_ANGLE_MSB, angleMSB);
+    if(status == I2CStatus::Ok){
+        status = tryReadReg(REG_ANGLE_LSB, angleLSB);
+    }
+    if(status == I2CStatus::Ok){
+        step = (angleMSB << 8) | angleLSB;
+    }
+    return status;
+}
+
+// Queues both ANGLE bytes as one register read (the pointer auto-increments), read into angle when the batch completes
+bool AS5600::queueStep(I2CBatch& batch, uint8_t (&angle)[2]){
+    uint8_t reg = REG_ANGLE_MSB;
+    return batch.writeRead(device, ConstByteSpan(&reg, 1), angle);
+}
+
+uint16_t AS5600::stepOf(const uint8_t (&angle)[2]){
+    return ((angle[0] & 0x0F) << 8) | angle[1];
+}
+
 // Returns the rotational step of the encoder (0 - 4095)
 uint16_t AS5600::getRawStep(){
 
@@ -175,4 +199,12 @@ float AS5600::getAngle(){
     // Converts steps into an angle
     return (static_cast<float>(getStep()) * 45.0f) / 512.0f; // 360 degrees / 4096 steps = 45/512
 
-}
\ No newline at end of file
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Getters ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Returns the I2C mux channel
+uint8_t AS5600::getChannel(){
+    return channel;
+}
@@ -0,0 +1,426 @@
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Libraries ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+#include "calibration.h"
+
+#include <map>
+#include <cmath>     // For std::floor, std::lround
+#include <cstdlib>   // For std::strtol
+#include <fstream>
+#include <algorithm> // For std::upper_bound, std::lower_bound, std::min_element, std::copy
+#include <stdexcept> // For std::runtime_error
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Sweep Files ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Reads a "Pulse Width (us),Absolute Step (0-4096)" sweep CSV
+std::vector<SweepSample> readSweepCsv(const std::string& path){
+
+    std::ifstream file(path);
+    if(!file.is_open()){
+        throw std::runtime_error("Failed to open calibration file: " + path);
+    }
+
+    std::vector<SweepSample> samples;
+    std::string line;
+    std::getline(file, line); // Header
+    while(std::getline(file, line)){
+        size_t comma = line.find(',');
+        if(comma == std::string::npos){
+            continue;
+        }
+        long pulse = std::strtol(line.c_str(), nullptr, 10);
+        long step = std::strtol(line.c_str() + comma + 1, nullptr, 10);
+        samples.push_back({static_cast<float>(pulse), static_cast<uint16_t>(step)});
+    }
+    return samples;
+}
+
+// Reads one channel's rows of a "Channel,Pulse Width (us),Absolute Step (0-4096)" combined sweep CSV
+std::vector<SweepSample> readSweepCsv(const std::string& path, uint8_t channel){
+
+    std::ifstream file(path);
+    if(!file.is_open()){
+        throw std::runtime_error("Failed to open calibration file: " + path);
+    }
+
+    std::vector<SweepSample> samples;
+    std::string line;
+    std::getline(file, line); // Header
+    while(std::getline(file, line)){
+        size_t first = line.find(',');
+        size_t second = line.find(',', first == std::string::npos ? first : first + 1);
+        if(second == std::string::npos || std::strtol(line.c_str(), nullptr, 10) != channel){
+            continue;
+        }
+        long pulse = std::strtol(line.c_str() + first + 1, nullptr, 10);
+        long step = std::strtol(line.c_str() + second + 1, nullptr, 10);
+        samples.push_back({static_cast<float>(pulse), static_cast<uint16_t>(step)});
+    }
+    if(samples.empty()){
+        throw std::runtime_error("No sweep for channel " + std::to_string(channel) + " in " + path);
+    }
+    return samples;
+}
+
+// Writes a sweep in the format readSweepCsv() reads
+void writeSweepCsv(const std::string& path, const std::vector<SweepSample>& samples){
+
+    std::ofstream file(path);
+    if(!file.is_open()){
+        throw std::runtime_error("Failed to open calibration file for writing: " + path);
+    }
+
+    file << "Pulse Width (us),Absolute Step (0-4096)\n";
+    for(const SweepSample& sample : samples){
+        file << std::lround(sample.pulse) << "," << sample.step << "\n";
+    }
+}
+
+/* Converts sweep samples to fitting points
+ * Steps are unwrapped across the 4096 boundary, and angle 0 is the mean reading
+ * at the lowest pulse (shared by both directions so their offset is kept). Each
+ * sample is tagged rising if the pulse went up to reach it, the first takes the
+ * direction of the second.
+ */
+static void tagSweep(const std::vector<SweepSample>& samples, std::vector<float>& pulses, std::vector<float>& angles, std::vector<bool>& rising){
+
+    if(samples.size() < 2){
+        throw std::runtime_error("Calibration sweep has too few samples");
+    }
+
+    long turns = 0;
+    long previousStep = -1;
+    for(const SweepSample& sample : samples){
+
+        // Unwrap
+        long step = sample.step;
+        if(previousStep >= 0 && step - previousStep > 2048){
+            turns--;
+        }
+        else if(previousStep >= 0 && previousStep - step > 2048){
+            turns++;
+        }
+        previousStep = step;
+
+        // Direction of travel (a repeated pulse keeps the previous direction)
+        bool up = pulses.empty() || sample.pulse > pulses.back() || (sample.pulse == pulses.back() && rising.back());
+        if(pulses.size() == 1){
+            rising[0] = up;
+        }
+
+        pulses.push_back(sample.pulse);
+        angles.push_back((step + turns * 4096) * 360.0f / 4096.0f);
+        rising.push_back(up);
+    }
+
+    // Angle 0 at the lowest pulse
+    float lowest = *std::min_element(pulses.begin(), pulses.end());
+    double sum = 0.0;
+    int count = 0;
+    for(size_t i = 0; i < pulses.size(); i++){
+        if(pulses[i] == lowest){
+            sum += angles[i];
+            count++;
+        }
+    }
+    float zero = static_cast<float>(sum / count);
+    for(float& angle : angles){
+        angle -= zero;
+    }
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ CalibrationCurve ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+CalibrationCurve::CalibrationCurve(){}
+
+/* Fits a monotone curve through raw (pulse, angle) points
+ * Points at the same pulse are averaged, then pool adjacent violators makes the
+ * angles non-decreasing (the least squares monotone fit).
+ */
+CalibrationCurve::CalibrationCurve(const std::vector<float>& rawPulses, const std::vector<float>& rawAngles){
+
+    if(rawPulses.size() != rawAngles.size() || rawPulses.size() < 2){
+        throw std::runtime_error("Calibration curve needs at least two matching points");
+    }
+
+    // Average readings per pulse (sorted by pulse)
+    std::map<float, std::pair<double, int>> binned;
+    for(size_t i = 0; i < rawPulses.size(); i++){
+        auto& bin = binned[rawPulses[i]];
+        bin.first += rawAngles[i];
+        bin.second++;
+    }
+    if(binned.size() < 2){
+        throw std::runtime_error("Calibration curve needs at least two distinct pulses");
+    }
+
+    // Pool adjacent violators, each block holds (sum, weight, number of pulses)
+    struct Block{
+        double sum;
+        double weight;
+        int count;
+    };
+    std::vector<Block> blocks;
+    for(const auto& bin : binned){
+        blocks.push_back({bin.second.first, static_cast<double>(bin.second.second), 1});
+        while(blocks.size() > 1){
+            Block& last = blocks[blocks.size() - 1];
+            Block& previous = blocks[blocks.size() - 2];
+            if(previous.sum / previous.weight <= last.sum / last.weight){
+                break;
+            }
+            previous.sum += last.sum;
+            previous.weight += last.weight;
+            previous.count += last.count;
+            blocks.pop_back();
+        }
+    }
+
+    // Knots at every measured pulse
+    auto bin = binned.begin();
+    for(const Block& block : blocks){
+        float value = static_cast<float>(block.sum / block.weight);
+        for(int i = 0; i < block.count; i++, ++bin){
+            pulses.push_back(bin->first);
+            angles.push_back(value);
+        }
+    }
+
+}
+
+
+// Fits a sweep, keeping only the readings taken in one direction unless Both
+CalibrationCurve CalibrationCurve::fromSweep(const std::vector<SweepSample>& samples, SweepDirection direction){
+
+    std::vector<float> pulses, angles;
+    std::vector<bool> rising;
+    tagSweep(samples, pulses, angles, rising);
+
+    if(direction == SweepDirection::Both){
+        return CalibrationCurve(pulses, angles);
+    }
+
+    std::vector<float> keptPulses, keptAngles;
+    for(size_t i = 0; i < pulses.size(); i++){
+        if(rising[i] == (direction == SweepDirection::Rising)){
+            keptPulses.push_back(pulses[i]);
+            keptAngles.push_back(angles[i]);
+        }
+    }
+    return CalibrationCurve(keptPulses, keptAngles);
+}
+
+// Loads and fits a sweep CSV
+CalibrationCurve CalibrationCurve::fromSweepCsv(const std::string& path, SweepDirection direction){
+    return fromSweep(readSweepCsv(path), direction);
+}
+
+// Angle a pulse reaches (clamped to the measured range)
+float CalibrationCurve::angleAt(float pulse) const{
+
+    if(pulse <= pulses.front()){
+        return angles.front();
+    }
+    if(pulse >= pulses.back()){
+        return angles.back();
+    }
+
+    size_t upper = std::upper_bound(pulses.begin(), pulses.end(), pulse) - pulses.begin();
+    size_t lower = upper - 1;
+    float t = (pulse - pulses[lower]) / (pulses[upper] - pulses[lower]);
+    return angles[lower] + t * (angles[upper] - angles[lower]);
+}
+
+// Smallest pulse that reaches an angle (clamped to the measured range), dead bands map to their start
+float CalibrationCurve::pulseAt(float angle) const{
+
+    if(angle <= angles.front()){
+        return pulses.front();
+    }
+    if(angle >= angles.back()){
+        return pulses[std::lower_bound(angles.begin(), angles.end(), angles.back()) - angles.begin()];
+    }
+
+    size_t upper = std::lower_bound(angles.begin(), angles.end(), angle) - angles.begin();
+    size_t lower = upper - 1;
+    float t = (angle - angles[lower]) / (angles[upper] - angles[lower]);
+    return pulses[lower] + t * (pulses[upper] - pulses[lower]);
+}
+
+bool CalibrationCurve::empty() const{
+    return pulses.empty();
+}
+
+float CalibrationCurve::getMinPulse() const{
+    return pulses.front();
+}
+
+float CalibrationCurve::getMaxPulse() const{
+    return pulses.back();
+}
+
+float CalibrationCurve::getMaxAngle() const{
+    return angles.back();
+}
+
+size_t CalibrationCurve::size() const{
+    return pulses.size();
+}
+
+const std::vector<float>& CalibrationCurve::getPulses() const{
+    return pulses;
+}
+
+const std::vector<float>& CalibrationCurve::getAngles() const{
+    return angles;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ ServoCalibration ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+ServoCalibration::ServoCalibration(){}
+
+// Same curve in both directions (no hysteresis)
+ServoCalibration::ServoCalibration(const CalibrationCurve& curve) : rising(curve), falling(curve){}
+
+ServoCalibration::ServoCalibration(const CalibrationCurve& rising, const CalibrationCurve& falling) : rising(rising), falling(falling){}
+
+/* Fits one curve per direction of travel from a bidirectional sweep
+ * Falls back to a single curve for both directions if the sweep only went one way.
+ */
+ServoCalibration ServoCalibration::fromSweep(const std::vector<SweepSample>& samples){
+
+    try{
+        return ServoCalibration(CalibrationCurve::fromSweep(samples, SweepDirection::Rising)
+                              , CalibrationCurve::fromSweep(samples, SweepDirection::Falling));
+    }
+    catch(const std::runtime_error&){
+        return ServoCalibration(CalibrationCurve::fromSweep(samples)); // Still throws if the sweep is unusable
+    }
+}
+
+// Loads and fits a sweep CSV
+ServoCalibration ServoCalibration::fromSweepCsv(const std::string& path){
+    return fromSweep(readSweepCsv(path));
+}
+
+const CalibrationCurve& ServoCalibration::getRising() const{
+    return rising;
+}
+
+const CalibrationCurve& ServoCalibration::getFalling() const{
+    return falling;
+}
+
+// Mean falling - rising angle over the pulses both curves cover (degrees)
+float ServoCalibration::getHysteresis() const{
+
+    if(rising.empty() || falling.empty()){
+        return 0.0f;
+    }
+    float low = std::max(rising.getMinPulse(), falling.getMinPulse());
+    float high = std::min(rising.getMaxPulse(), falling.getMaxPulse());
+    if(high <= low){
+        return 0.0f;
+    }
+
+    double sum = 0.0;
+    int count = 0;
+    for(float pulse = low; pulse <= high; pulse += 1.0f){
+        sum += falling.angleAt(pulse) - rising.angleAt(pulse);
+        count++;
+    }
+    return static_cast<float>(sum / count);
+}
+
+bool ServoCalibration::empty() const{
+    return rising.empty() || falling.empty();
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ PulseTable ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+PulseTable::PulseTable() : ticks(nullptr), size(0), maxAngle(0.0f), entryScale(0.0f){}
+
+PulseTable::~PulseTable(){
+    delete[] ticks;
+}
+
+// Samples an angle -> pulse map into evenly spaced entries over 0 - maxAngle
+void PulseTable::build(const std::function<float(float)>& pulseOf, float maxAngle, float stepSize, int size){
+
+    if(size < 2 || maxAngle <= 0.0f || stepSize <= 0.0f){
+        throw std::runtime_error("Invalid pulse table parameters");
+    }
+
+    delete[] ticks;
+    ticks = new float[size];
+    this->size = size;
+    this->maxAngle = maxAngle;
+    entryScale = (size - 1) / maxAngle;
+
+    for(int i = 0; i < size; i++){
+        ticks[i] = pulseOf(i / entryScale) / stepSize;
+    }
+}
+
+// Copies evenly spaced entries over 0 - maxAngle that were built ahead of time
+void PulseTable::assign(const float* ticks, int size, float maxAngle){
+
+    if(size < 2 || maxAngle <= 0.0f){
+        throw std::runtime_error("Invalid pulse table parameters");
+    }
+
+    delete[] this->ticks;
+    this->ticks = new float[size];
+    std::copy(ticks, ticks + size, this->ticks);
+    this->size = size;
+    this->maxAngle = maxAngle;
+    entryScale = (size - 1) / maxAngle;
+}
+
+/* Converts the entries to the ticks of another step size
+ * Entries are fractional ticks, so the pulses they stand for carry over
+ * without rebuilding from the curve they were sampled from.
+ */
+void PulseTable::rescale(float fromStepSize, float toStepSize){
+
+    if(fromStepSize <= 0.0f || toStepSize <= 0.0f){
+        throw std::runtime_error("Invalid pulse table parameters");
+    }
+    float factor = fromStepSize / toStepSize;
+    for(int i = 0; i < size; i++){
+        ticks[i] *= factor;
+    }
+}
+
+// Off time for an angle (clamped to 0 - maxAngle)
+uint16_t PulseTable::ticksAt(float angle) const{
+
+    if(!(angle > 0.0f)){
+        return static_cast<uint16_t>(ticks[0] + 0.5f);
+    }
+    float position = angle * entryScale;
+    int index = static_cast<int>(position);
+    if(index >= size - 1){
+        return static_cast<uint16_t>(ticks[size - 1] + 0.5f);
+    }
+    float t = position - index;
+    return static_cast<uint16_t>(ticks[index] + t * (ticks[index + 1] - ticks[index]) + 0.5f);
+}
+
+bool PulseTable::empty() const{
+    return ticks == nullptr;
+}
+
+const float* PulseTable::getTicks() const{
+    return ticks;
+}
+
+int PulseTable::getSize() const{
+    return size;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -0,0 +1,448 @@
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Libraries ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+#include "calibration_fitter.h"
+
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <iomanip>   // For std::setprecision
+#include <algorithm> // For std::min, std::max
+#include <cstdlib>   // For std::strtof, std::strtol
+#include <stdexcept> // For std::runtime_error
+#include <fcntl.h>    // For open
+#include <unistd.h>   // For close
+#include <sys/mman.h> // For mmap
+#include <sys/stat.h> // For fstat
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ MappedFile ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+MappedFile::MappedFile(const std::string& path) : fd(-1), data(nullptr), size(0){
+
+    fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0){
+        throw std::runtime_error("Failed to open file: " + path);
+    }
+    struct stat info;
+    if(::fstat(fd, &info) < 0){
+        ::close(fd);
+        throw std::runtime_error("Failed to stat file: " + path);
+    }
+    size = static_cast<size_t>(info.st_size);
+    if(size == 0){
+        return; // Nothing to map
+    }
+
+    void* mapped = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(mapped == MAP_FAILED){
+        ::close(fd);
+        throw std::runtime_error("Failed to map file: " + path);
+    }
+    ::madvise(mapped, size, MADV_SEQUENTIAL);
+    data = static_cast<const char*>(mapped);
+}
+
+MappedFile::~MappedFile(){
+    if(data){
+        ::munmap(const_cast<char*>(data), size);
+    }
+    if(fd >= 0){
+        ::close(fd);
+    }
+}
+
+const char* MappedFile::begin() const{
+    return data;
+}
+
+const char* MappedFile::end() const{
+    return data + size;
+}
+
+size_t MappedFile::getSize() const{
+    return size;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Parsing ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+/* Parses one decimal field ("-12", "551.44") and moves past it
+ * Returns false if there are no digits before the next separator.
+ */
+static bool parseField(const char*& at, const char* end, float& value){
+
+    while(at < end && *at == ' '){
+        at++;
+    }
+    bool negative = at < end && *at == '-';
+    if(negative){
+        at++;
+    }
+
+    bool digits = false;
+    long whole = 0;
+    while(at < end && *at >= '0' && *at <= '9'){
+        whole = whole * 10 + (*at++ - '0');
+        digits = true;
+    }
+    float fraction = 0.0f;
+    if(at < end && *at == '.'){
+        at++;
+        float scale = 0.1f;
+        while(at < end && *at >= '0' && *at <= '9'){
+            fraction += (*at++ - '0') * scale;
+            scale *= 0.1f;
+            digits = true;
+        }
+    }
+    while(at < end && (*at == ' ' || *at == '\r')){
+        at++;
+    }
+
+    value = static_cast<float>(whole) + fraction;
+    if(negative){
+        value = -value;
+    }
+    return digits;
+}
+
+// Parses sweep CSV bytes without copying them, returns the number of rows read
+size_t parseSweepCsv(const char* begin, const char* end, std::vector<ChannelSweep>& sweeps){
+
+    const char* at = begin;
+
+    // Header (if any) gives the column count
+    const char* lineEnd = at;
+    while(lineEnd < end && *lineEnd != '\n'){
+        lineEnd++;
+    }
+    int columns = 1;
+    for(const char* c = at; c < lineEnd; c++){
+        columns += *c == ',';
+    }
+    if(columns != 2 && columns != 3){
+        throw std::runtime_error("Sweep files have 2 or 3 columns, found " + std::to_string(columns));
+    }
+    const char* first = at;
+    while(first < lineEnd && *first == ' '){
+        first++;
+    }
+    if(first < lineEnd && *first != '-' && (*first < '0' || *first > '9')){
+        at = lineEnd < end ? lineEnd + 1 : end;
+    }
+
+    size_t rows = 0;
+    size_t line = 1;
+    size_t current = sweeps.size(); // Sweep rows are going to, none yet
+    while(at < end){
+        line++;
+
+        // Blank line
+        if(*at == '\n' || *at == '\r'){
+            while(at < end && *at != '\n'){
+                at++;
+            }
+            if(at < end){
+                at++;
+            }
+            continue;
+        }
+
+        float channel = -1.0f;
+        float pulse = 0.0f;
+        float step = 0.0f;
+        bool ok = true;
+        if(columns == 3){
+            ok = parseField(at, end, channel) && at < end && *at++ == ',';
+        }
+        ok = ok && parseField(at, end, pulse) && at < end && *at++ == ',';
+        ok = ok && parseField(at, end, step) && (at == end || *at == '\n');
+        if(!ok || step < 0.0f || step > 4095.0f){
+            throw std::runtime_error("Malformed sweep row on line " + std::to_string(line));
+        }
+        if(at < end){
+            at++; // Past the newline
+        }
+
+        // Rows of a channel usually come together, so the last sweep is checked first
+        int id = static_cast<int>(channel);
+        if(current >= sweeps.size() || sweeps[current].channel != id){
+            current = 0;
+            while(current < sweeps.size() && sweeps[current].channel != id){
+                current++;
+            }
+            if(current == sweeps.size()){
+                sweeps.push_back({id, {}});
+            }
+        }
+        sweeps[current].samples.push_back({pulse, static_cast<uint16_t>(step)});
+        rows++;
+    }
+    return rows;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Fitting ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Fits one servo's sweep
+ServoFit fitSweep(const std::vector<SweepSample>& samples, const FitterParams& params){
+
+    ServoFit fit;
+    fit.channel = -1;
+    fit.rows = samples.size();
+    fit.calibration = ServoCalibration::fromSweep(samples);
+
+    CalibrationCurve curve = CalibrationCurve::fromSweep(samples);
+    fit.minPulse = curve.getMinPulse();
+    fit.maxPulse = curve.getMaxPulse();
+    fit.maxAngle = curve.getMaxAngle();
+    fit.hysteresis = fit.calibration.getHysteresis();
+    if(fit.maxPulse <= fit.minPulse || fit.maxAngle <= 0.0f){
+        throw std::runtime_error("Calibration sweep does not move the servo");
+    }
+
+    // Pulse range against the nominal one
+    float nominalMid = (params.nominalMinPulse + params.nominalMaxPulse) / 2.0f;
+    fit.pwmOffset = (fit.minPulse + fit.maxPulse) / 2.0f - nominalMid;
+    fit.pwmMultiplier = fit.maxPulse / (params.nominalMaxPulse + fit.pwmOffset);
+
+    // Measured angle against the linear map's angle over the knots
+    const std::vector<float>& pulses = curve.getPulses();
+    const std::vector<float>& angles = curve.getAngles();
+    double scale = fit.maxAngle / (fit.maxPulse - fit.minPulse);
+    double sumX = 0.0, sumY = 0.0, sumXX = 0.0, sumXY = 0.0;
+    for(size_t i = 0; i < pulses.size(); i++){
+        double x = (pulses[i] - fit.minPulse) * scale;
+        sumX += x;
+        sumY += angles[i];
+        sumXX += x * x;
+        sumXY += x * angles[i];
+    }
+    double n = static_cast<double>(pulses.size());
+    double denominator = n * sumXX - sumX * sumX;
+    fit.dcMultiplier = denominator != 0.0 ? static_cast<float>((n * sumXY - sumX * sumY) / denominator) : 1.0f;
+    fit.dcOffset = static_cast<float>((sumY - fit.dcMultiplier * sumX) / n);
+    return fit;
+}
+
+// Maps, parses and fits one file
+static std::vector<ServoFit> fitFile(const std::string& path, const FitterParams& params){
+
+    std::vector<ServoFit> fits;
+    std::vector<ChannelSweep> sweeps;
+    try{
+        MappedFile file(path);
+        parseSweepCsv(file.begin(), file.end(), sweeps);
+        if(sweeps.empty()){
+            throw std::runtime_error("Sweep file has no rows");
+        }
+    }
+    catch(const std::exception& e){
+        ServoFit failed = ServoFit();
+        failed.source = path;
+        failed.channel = -1;
+        failed.error = e.what();
+        fits.push_back(failed);
+        return fits;
+    }
+
+    for(const ChannelSweep& sweep : sweeps){
+        ServoFit fit = ServoFit();
+        try{
+            fit = fitSweep(sweep.samples, params);
+        }
+        catch(const std::exception& e){
+            fit.rows = sweep.samples.size();
+            fit.error = e.what();
+        }
+        fit.source = path;
+        fit.channel = sweep.channel;
+        fits.push_back(fit);
+    }
+    return fits;
+}
+
+// Fits sweep files in parallel, results in input order
+std::vector<ServoFit> fitSweepFiles(const std::vector<std::string>& paths, const FitterParams& params, unsigned threads){
+
+    if(threads == 0){
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = std::min<unsigned>(threads, std::max<size_t>(paths.size(), 1));
+
+    std::vector<std::vector<ServoFit>> perFile(paths.size());
+    std::atomic<size_t> next(0);
+    auto worker = [&](){
+        for(size_t i = next++; i < paths.size(); i = next++){
+            perFile[i] = fitFile(paths[i], params);
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for(unsigned i = 1; i < threads; i++){
+        workers.emplace_back(worker);
+    }
+    worker(); // The calling thread works too
+    for(std::thread& thread : workers){
+        thread.join();
+    }
+
+    std::vector<ServoFit> fits;
+    for(std::vector<ServoFit>& file : perFile){
+        fits.insert(fits.end(), file.begin(), file.end());
+    }
+    return fits;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Calibration Files ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Writes a curve table as "pulse:angle,pulse:angle,..."
+static void writeCurve(std::ofstream& file, const char* key, const CalibrationCurve& curve){
+    file << key << "=";
+    const std::vector<float>& pulses = curve.getPulses();
+    const std::vector<float>& angles = curve.getAngles();
+    for(size_t i = 0; i < pulses.size(); i++){
+        file << (i ? "," : "") << pulses[i] << ":" << angles[i];
+    }
+    file << "\n";
+}
+
+// Reads a curve table written by writeCurve()
+CalibrationCurve parseCurveTable(const std::string& value){
+    std::vector<float> pulses, angles;
+    const char* at = value.c_str();
+    while(*at){
+        char* next;
+        pulses.push_back(std::strtof(at, &next));
+        if(*next != ':'){
+            throw std::runtime_error("Malformed curve table in calibration file");
+        }
+        angles.push_back(std::strtof(next + 1, &next));
+        at = *next == ',' ? next + 1 : next;
+        if(*next && *next != ','){
+            throw std::runtime_error("Malformed curve table in calibration file");
+        }
+    }
+    return CalibrationCurve(pulses, angles);
+}
+
+// One [servo] section of key=value lines per fit
+void writeCalibrationFile(const std::string& path, const std::vector<ServoFit>& fits){
+
+    std::ofstream file(path);
+    if(!file.is_open()){
+        throw std::runtime_error("Failed to open calibration file for writing: " + path);
+    }
+
+    file << "# Servo calibration fits (pulses in us, angles in degrees)\n";
+    file << std::setprecision(9);
+    for(const ServoFit& fit : fits){
+        file << "\n[servo]\n";
+        file << "source=" << fit.source << "\n";
+        file << "channel=" << fit.channel << "\n";
+        file << "rows=" << fit.rows << "\n";
+        if(!fit.error.empty()){
+            file << "error=" << fit.error << "\n";
+            continue;
+        }
+        file << "min_pulse=" << fit.minPulse << "\n";
+        file << "max_pulse=" << fit.maxPulse << "\n";
+        file << "max_angle=" << fit.maxAngle << "\n";
+        file << "hysteresis=" << fit.hysteresis << "\n";
+        file << "pwm_offset=" << fit.pwmOffset << "\n";
+        file << "pwm_multiplier=" << fit.pwmMultiplier << "\n";
+        file << "dc_offset=" << fit.dcOffset << "\n";
+        file << "dc_multiplier=" << fit.dcMultiplier << "\n";
+        writeCurve(file, "rising", fit.calibration.getRising());
+        writeCurve(file, "falling", fit.calibration.getFalling());
+    }
+}
+
+// Reads a file written by writeCalibrationFile()
+std::vector<ServoFit> readCalibrationFile(const std::string& path){
+
+    std::ifstream file(path);
+    if(!file.is_open()){
+        throw std::runtime_error("Failed to open calibration file: " + path);
+    }
+
+    std::vector<ServoFit> fits;
+    CalibrationCurve rising, falling;
+    auto finish = [&](){
+        if(!fits.empty() && fits.back().error.empty()){
+            fits.back().calibration = ServoCalibration(rising, falling);
+        }
+        rising = CalibrationCurve();
+        falling = CalibrationCurve();
+    };
+
+    std::string line;
+    while(std::getline(file, line)){
+        if(line.empty() || line[0] == '#'){
+            continue;
+        }
+        if(line == "[servo]"){
+            finish();
+            ServoFit fit = ServoFit();
+            fit.channel = -1;
+            fits.push_back(fit);
+            continue;
+        }
+        size_t equals = line.find('=');
+        if(equals == std::string::npos || fits.empty()){
+            throw std::runtime_error("Malformed calibration file line: " + line);
+        }
+        std::string key = line.substr(0, equals);
+        std::string value = line.substr(equals + 1);
+        ServoFit& fit = fits.back();
+        if(key == "source"){
+            fit.source = value;
+        }
+        else if(key == "channel"){
+            fit.channel = std::strtol(value.c_str(), nullptr, 10);
+        }
+        else if(key == "rows"){
+            fit.rows = std::strtoul(value.c_str(), nullptr, 10);
+        }
+        else if(key == "error"){
+            fit.error = value;
+        }
+        else if(key == "min_pulse"){
+            fit.minPulse = std::strtof(value.c_str(), nullptr);
+        }
+        else if(key == "max_pulse"){
+            fit.maxPulse = std::strtof(value.c_str(), nullptr);
+        }
+        else if(key == "max_angle"){
+            fit.maxAngle = std::strtof(value.c_str(), nullptr);
+        }
+        else if(key == "hysteresis"){
+            fit.hysteresis = std::strtof(value.c_str(), nullptr);
+        }
+        else if(key == "pwm_offset"){
+            fit.pwmOffset = std::strtof(value.c_str(), nullptr);
+        }
+        else if(key == "pwm_multiplier"){
+            fit.pwmMultiplier = std::strtof(value.c_str(), nullptr);
+        }
+        else if(key == "dc_offset"){
+            fit.dcOffset = std::strtof(value.c_str(), nullptr);
+        }
+        else if(key == "dc_multiplier"){
+            fit.dcMultiplier = std::strtof(value.c_str(), nullptr);
+        }
+        else if(key == "rising"){
+            rising = parseCurveTable(value);
+        }
+        else if(key == "falling"){
+            falling = parseCurveTable(value);
+        }
+        // Unknown keys are skipped so newer files still load
+    }
+    finish();
+    return fits;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
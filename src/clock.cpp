@@ -0,0 +1,58 @@
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Libraries ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+#include "clock.h"
+
+#include <thread>  // For std::this_thread::sleep_until
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Clock ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+void Clock::sleepFor(std::chrono::nanoseconds duration){
+    sleepUntil(now() + duration);
+}
+
+// Shared steady clock
+Clock* Clock::steady(){
+    static SteadyClock clock;
+    return &clock;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ SteadyClock ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+Clock::TimePoint SteadyClock::now(){
+    return std::chrono::steady_clock::now();
+}
+
+void SteadyClock::sleepUntil(TimePoint time){
+    std::this_thread::sleep_until(time);
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ VirtualClock ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+VirtualClock::VirtualClock() : time(0){}
+
+Clock::TimePoint VirtualClock::now(){
+    return TimePoint(std::chrono::nanoseconds(time.load()));
+}
+
+// Jumps to the wake time, a time already passed leaves the clock where it is
+void VirtualClock::sleepUntil(TimePoint wake){
+    int64_t target = std::chrono::duration_cast<std::chrono::nanoseconds>(wake.time_since_epoch()).count();
+    int64_t current = time.load();
+    while(current < target && !time.compare_exchange_weak(current, target)){}
+}
+
+void VirtualClock::advance(std::chrono::nanoseconds duration){
+    if(duration.count() > 0){
+        time += duration.count();
+    }
+}
+
+std::chrono::nanoseconds VirtualClock::elapsed(){
+    return std::chrono::nanoseconds(time.load());
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -0,0 +1,239 @@
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Libraries ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+#include "encoder_estimator.h"
+
+#include <cmath>     // For std::round, std::floor, std::fabs
+#include <stdexcept> // For std::runtime_error
+
+// Initial uncertainty of the unobserved states
+const double INITIAL_VELOCITY_STDDEV = 1000.0;       // deg/s
+const double INITIAL_ACCELERATION_STDDEV = 100000.0; // deg/s^2
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Constructor ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+EncoderEstimator::EncoderEstimator(const EstimatorParams& params) : params(params){
+
+    if(params.measurementNoise <= 0.0 || params.processNoise <= 0.0 || params.outlierGate <= 0.0){
+        throw std::runtime_error("Encoder estimator noise and gate parameters must be positive");
+    }
+    reset();
+}
+
+// Forgets all state, the next sample re-initializes
+void EncoderEstimator::reset(){
+    for(int i = 0; i < 3; i++){
+        x[i] = 0.0;
+        for(int j = 0; j < 3; j++){
+            P[i][j] = 0.0;
+        }
+    }
+    lastTimestamp = 0;
+    initialized = false;
+    consecutiveRejections = 0;
+    updateCount = 0;
+    rejectedCount = 0;
+}
+
+// Starts tracking at a measured angle, at rest but with a wide velocity/acceleration prior
+void EncoderEstimator::initialize(double angle, uint64_t timestamp){
+    x[0] = angle;
+    x[1] = 0.0;
+    x[2] = 0.0;
+    for(int i = 0; i < 3; i++){
+        for(int j = 0; j < 3; j++){
+            P[i][j] = 0.0;
+        }
+    }
+    P[0][0] = params.measurementNoise * params.measurementNoise;
+    P[1][1] = INITIAL_VELOCITY_STDDEV * INITIAL_VELOCITY_STDDEV;
+    P[2][2] = INITIAL_ACCELERATION_STDDEV * INITIAL_ACCELERATION_STDDEV;
+
+    lastTimestamp = timestamp;
+    initialized = true;
+    consecutiveRejections = 0;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Prediction ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// state = F * x
+void EncoderEstimator::predictState(double dt, double state[3]) const{
+    state[0] = x[0] + x[1] * dt + 0.5 * x[2] * dt * dt;
+    state[1] = x[1] + x[2] * dt;
+    state[2] = x[2];
+}
+
+// P = F * P * F^T + Q
+void EncoderEstimator::predictCovariance(double dt){
+
+    const double F[3][3] = {
+        {1.0, dt, 0.5 * dt * dt},
+        {0.0, 1.0, dt},
+        {0.0, 0.0, 1.0}
+    };
+
+    // FP = F * P
+    double FP[3][3];
+    for(int i = 0; i < 3; i++){
+        for(int j = 0; j < 3; j++){
+            FP[i][j] = F[i][0] * P[0][j] + F[i][1] * P[1][j] + F[i][2] * P[2][j];
+        }
+    }
+
+    // Discrete white jerk noise
+    double dt2 = dt * dt;
+    double dt3 = dt2 * dt;
+    double q = params.processNoise;
+    const double Q[3][3] = {
+        {q * dt3 * dt2 / 20.0, q * dt2 * dt2 / 8.0, q * dt3 / 6.0},
+        {q * dt2 * dt2 / 8.0,  q * dt3 / 3.0,       q * dt2 / 2.0},
+        {q * dt3 / 6.0,        q * dt2 / 2.0,       q * dt}
+    };
+
+    for(int i = 0; i < 3; i++){
+        for(int j = 0; j < 3; j++){
+            P[i][j] = FP[i][0] * F[j][0] + FP[i][1] * F[j][1] + FP[i][2] * F[j][2] + Q[i][j];
+        }
+    }
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Update ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Feeds one sample into the filter, false if it was rejected as an outlier
+bool EncoderEstimator::update(const EncoderSample& sample){
+
+    double reading = sample.angle(); // 0 - 360
+
+    if(!initialized){
+        initialize(reading, sample.timestamp);
+        updateCount++;
+        return true;
+    }
+
+    // Samples out of order are ignored rather than run backwards
+    if(sample.timestamp < lastTimestamp){
+        rejectedCount++;
+        return false;
+    }
+    double dt = (sample.timestamp - lastTimestamp) * 1e-9;
+
+    double predicted[3];
+    predictState(dt, predicted);
+
+    // Unwrap to the turn nearest the prediction
+    double measured = reading + 360.0 * std::round((predicted[0] - reading) / 360.0);
+
+    // Innovation gate (only the angle is measured)
+    double PPred[3][3];
+    for(int i = 0; i < 3; i++){
+        for(int j = 0; j < 3; j++){
+            PPred[i][j] = P[i][j];
+        }
+    }
+    predictCovariance(dt);
+
+    double innovation = measured - predicted[0];
+    double S = P[0][0] + params.measurementNoise * params.measurementNoise;
+
+    if(innovation * innovation > params.outlierGate * params.outlierGate * S){
+        // Too many in a row: the readings moved, not the noise, so re-lock onto them
+        if(++consecutiveRejections > params.maxRejections){
+            initialize(reading + 360.0 * std::round((x[0] - reading) / 360.0), sample.timestamp);
+            updateCount++;
+            return true;
+        }
+        rejectedCount++;
+
+        // Keep the old state, the rejected reading never happened
+        for(int i = 0; i < 3; i++){
+            for(int j = 0; j < 3; j++){
+                P[i][j] = PPred[i][j];
+            }
+        }
+        return false;
+    }
+    consecutiveRejections = 0;
+
+    // K = P * H^T / S, with H = [1 0 0]
+    double K[3] = {P[0][0] / S, P[1][0] / S, P[2][0] / S};
+
+    for(int i = 0; i < 3; i++){
+        x[i] = predicted[i] + K[i] * innovation;
+    }
+
+    // P = (I - K * H) * P, then kept symmetric
+    double row0[3] = {P[0][0], P[0][1], P[0][2]};
+    for(int i = 0; i < 3; i++){
+        for(int j = 0; j < 3; j++){
+            P[i][j] -= K[i] * row0[j];
+        }
+    }
+    for(int i = 0; i < 3; i++){
+        for(int j = i + 1; j < 3; j++){
+            double average = 0.5 * (P[i][j] + P[j][i]);
+            P[i][j] = average;
+            P[j][i] = average;
+        }
+    }
+
+    lastTimestamp = sample.timestamp;
+    updateCount++;
+    return true;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ State ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+EncoderState EncoderEstimator::getState() const{
+    EncoderState state;
+    state.timestamp = lastTimestamp;
+    state.angle = x[0];
+    state.velocity = x[1];
+    state.acceleration = x[2];
+    state.valid = initialized;
+    return state;
+}
+
+// State extrapolated to a later time (the current state if timestamp is not later)
+EncoderState EncoderEstimator::predict(uint64_t timestamp) const{
+    if(!initialized || timestamp <= lastTimestamp){
+        return getState();
+    }
+
+    double predicted[3];
+    predictState((timestamp - lastTimestamp) * 1e-9, predicted);
+
+    EncoderState state;
+    state.timestamp = timestamp;
+    state.angle = predicted[0];
+    state.velocity = predicted[1];
+    state.acceleration = predicted[2];
+    state.valid = true;
+    return state;
+}
+
+// True once the estimated speed is within tolerance (deg/s)
+bool EncoderEstimator::isSettled(double velocityTolerance) const{
+    return initialized && std::fabs(x[1]) <= velocityTolerance;
+}
+
+// Whole turns from the first sample's turn
+long EncoderEstimator::getTurns() const{
+    return static_cast<long>(std::floor(x[0] / 360.0));
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Stats ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+uint64_t EncoderEstimator::getUpdateCount() const{
+    return updateCount;
+}
+
+uint64_t EncoderEstimator::getRejectedCount() const{
+    return rejectedCount;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
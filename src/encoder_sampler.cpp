@@ -0,0 +1,335 @@
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Libraries ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+#include "encoder_sampler.h"
+
+#include <algorithm> // For std::stable_sort
+#include <stdexcept> // For std::runtime_error
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ EncoderSample ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Step converted to degrees
+float EncoderSample::angle() const{
+    return (static_cast<float>(step) * 45.0f) / 512.0f; // 360 degrees / 4096 steps = 45/512
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ EncoderRing ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Constructor: Capacity is rounded up to a power of two
+EncoderRing::EncoderRing(size_t capacity) : slots(nullptr), capacity(1), count(0){
+
+    if(capacity < 2){
+        throw std::runtime_error("Encoder ring capacity must be at least 2");
+    }
+    while(this->capacity < capacity){
+        this->capacity <<= 1;
+    }
+    mask = this->capacity - 1;
+
+    slots = new Slot[this->capacity];
+    for(size_t i = 0; i < this->capacity; i++){
+        slots[i].sequence.store(0, std::memory_order_relaxed);
+        slots[i].timestamp.store(0, std::memory_order_relaxed);
+        slots[i].step.store(0, std::memory_order_relaxed);
+    }
+}
+
+EncoderRing::~EncoderRing(){
+    delete[] slots;
+}
+
+// Publishes a sample, overwriting the oldest once full (one writer thread only)
+void EncoderRing::push(const EncoderSample& sample){
+
+    uint64_t number = count.load(std::memory_order_relaxed);
+    Slot& slot = slots[number & mask];
+
+    // Mark the slot as being written before touching the data
+    slot.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot.timestamp.store(sample.timestamp, std::memory_order_relaxed);
+    slot.step.store(sample.step, std::memory_order_relaxed);
+
+    slot.sequence.store(number + 1, std::memory_order_release);
+    count.store(number + 1, std::memory_order_release);
+}
+
+// Copies a sample out of its slot, false if the writer overwrote it
+bool EncoderRing::readSlot(uint64_t sample, EncoderSample& out) const{
+
+    const Slot& slot = slots[sample & mask];
+
+    if(slot.sequence.load(std::memory_order_acquire) != sample + 1){
+        return false;
+    }
+    out.timestamp = slot.timestamp.load(std::memory_order_relaxed);
+    out.step = slot.step.load(std::memory_order_relaxed);
+
+    // The data is only valid if the slot was not rewritten while we copied it
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot.sequence.load(std::memory_order_relaxed) == sample + 1;
+}
+
+// Most recent sample, false if nothing has been published
+bool EncoderRing::latest(EncoderSample& out) const{
+
+    // A full ring lap during the copy is the only way to fail, retry with the new latest
+    while(true){
+        uint64_t published = count.load(std::memory_order_acquire);
+        if(published == 0){
+            return false;
+        }
+        if(readSlot(published - 1, out)){
+            return true;
+        }
+    }
+}
+
+// Copies up to maxSamples of the most recent samples, oldest first, returns the count
+size_t EncoderRing::snapshot(EncoderSample* out, size_t maxSamples) const{
+
+    uint64_t published = count.load(std::memory_order_acquire);
+
+    // The slot after the newest may be mid-write, so at most capacity - 1 samples are stable
+    uint64_t available = published < capacity - 1 ? published : capacity - 1;
+    uint64_t wanted = maxSamples < available ? maxSamples : available;
+
+    size_t copied = 0;
+    for(uint64_t sample = published - wanted; sample < published; sample++){
+        // The writer overwrites oldest first, so a lost sample invalidates everything older
+        if(!readSlot(sample, out[copied])){
+            copied = 0;
+            continue;
+        }
+        copied++;
+    }
+    return copied;
+}
+
+uint64_t EncoderRing::getCount() const{
+    return count.load(std::memory_order_acquire);
+}
+
+size_t EncoderRing::getCapacity() const{
+    return capacity;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ EncoderSampler ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Constructor: Does not start sampling until start() is called
+EncoderSampler::EncoderSampler(AS5600* encoder, std::chrono::microseconds period, size_t capacity)
+    : encoder(encoder), period(period), ring(capacity), running(false), errorCount(0), overrunCount(0){
+
+    if(period.count() <= 0){
+        throw std::runtime_error("Encoder sample period must be positive");
+    }
+}
+
+// Destructor: Stops the sampling thread
+EncoderSampler::~EncoderSampler(){
+    stop();
+}
+
+void EncoderSampler::start(){
+    if(running.exchange(true)){
+        return;
+    }
+    worker = std::thread(&EncoderSampler::samplingThread, this);
+}
+
+void EncoderSampler::stop(){
+    running = false;
+    if(worker.joinable()){
+        worker.join();
+    }
+}
+
+bool EncoderSampler::isRunning() const{
+    return running.load();
+}
+
+// Thread that reads the encoder once per period
+void EncoderSampler::samplingThread(){
+
+    auto nextSample = std::chrono::steady_clock::now();
+
+    while(running.load(std::memory_order_relaxed)){
+
+        uint16_t step;
+        if(encoder->tryGetStep(step) == I2CStatus::Ok){
+            auto now = std::chrono::steady_clock::now();
+
+            EncoderSample sample;
+            sample.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+            sample.step = step;
+            ring.push(sample);
+        }
+        else{
+            errorCount.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // Fixed rate, resyncing (not bursting) after a missed period
+        nextSample += period;
+        auto now = std::chrono::steady_clock::now();
+        if(nextSample < now){
+            overrunCount.fetch_add(1, std::memory_order_relaxed);
+            nextSample = now;
+        }
+        std::this_thread::sleep_until(nextSample);
+    }
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Sample Access ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+bool EncoderSampler::latest(EncoderSample& out) const{
+    return ring.latest(out);
+}
+
+size_t EncoderSampler::snapshot(EncoderSample* out, size_t maxSamples) const{
+    return ring.snapshot(out, maxSamples);
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Stats ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+uint64_t EncoderSampler::getSampleCount() const{
+    return ring.getCount();
+}
+
+uint64_t EncoderSampler::getErrorCount() const{
+    return errorCount.load(std::memory_order_relaxed);
+}
+
+uint64_t EncoderSampler::getOverrunCount() const{
+    return overrunCount.load(std::memory_order_relaxed);
+}
+
+std::chrono::microseconds EncoderSampler::getPeriod() const{
+    return std::chrono::duration_cast<std::chrono::microseconds>(period);
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ MultiEncoderSampler ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Constructor: Does not start sampling until start() is called
+MultiEncoderSampler::MultiEncoderSampler(const std::vector<AS5600*>& encoders, std::chrono::microseconds period, size_t capacity)
+    : encoders(encoders), reverse(false), period(period), running(false), sweepCount(0), errorCount(0), overrunCount(0){
+
+    if(encoders.empty()){
+        throw std::runtime_error("Multi encoder sampler needs at least one encoder");
+    }
+    if(period.count() <= 0){
+        throw std::runtime_error("Encoder sample period must be positive");
+    }
+
+    for(size_t i = 0; i < encoders.size(); i++){
+        rings.push_back(new EncoderRing(capacity));
+        order.push_back(i);
+    }
+
+    // Group reads by channel so each channel is selected once per sweep
+    std::stable_sort(order.begin(), order.end(), [&encoders](size_t a, size_t b){
+        return encoders[a]->getChannel() < encoders[b]->getChannel();
+    });
+}
+
+// Destructor: Stops the sampling thread
+MultiEncoderSampler::~MultiEncoderSampler(){
+    stop();
+    for(EncoderRing* ring : rings){
+        delete ring;
+    }
+}
+
+void MultiEncoderSampler::start(){
+    if(running.exchange(true)){
+        return;
+    }
+    worker = std::thread(&MultiEncoderSampler::samplingThread, this);
+}
+
+void MultiEncoderSampler::stop(){
+    running = false;
+    if(worker.joinable()){
+        worker.join();
+    }
+}
+
+bool MultiEncoderSampler::isRunning() const{
+    return running.load();
+}
+
+// Reads every encoder once, in channel order, alternating direction each sweep
+void MultiEncoderSampler::sweep(){
+
+    for(size_t i = 0; i < order.size(); i++){
+        size_t index = reverse ? order[order.size() - 1 - i] : order[i];
+
+        uint16_t step;
+        if(encoders[index]->tryGetStep(step) == I2CStatus::Ok){
+            auto now = std::chrono::steady_clock::now();
+
+            EncoderSample sample;
+            sample.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+            sample.step = step;
+            rings[index]->push(sample);
+        }
+        else{
+            errorCount.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    reverse = !reverse;
+    sweepCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Thread that sweeps the encoders once per period
+void MultiEncoderSampler::samplingThread(){
+
+    auto nextSweep = std::chrono::steady_clock::now();
+
+    while(running.load(std::memory_order_relaxed)){
+
+        sweep();
+
+        // Fixed rate, resyncing (not bursting) after a missed period
+        nextSweep += period;
+        auto now = std::chrono::steady_clock::now();
+        if(nextSweep < now){
+            overrunCount.fetch_add(1, std::memory_order_relaxed);
+            nextSweep = now;
+        }
+        std::this_thread::sleep_until(nextSweep);
+    }
+}
+
+size_t MultiEncoderSampler::size() const{
+    return encoders.size();
+}
+
+bool MultiEncoderSampler::latest(size_t encoder, EncoderSample& out) const{
+    return rings.at(encoder)->latest(out);
+}
+
+size_t MultiEncoderSampler::snapshot(size_t encoder, EncoderSample* out, size_t maxSamples) const{
+    return rings.at(encoder)->snapshot(out, maxSamples);
+}
+
+uint64_t MultiEncoderSampler::getSweepCount() const{
+    return sweepCount.load(std::memory_order_relaxed);
+}
+
+uint64_t MultiEncoderSampler::getErrorCount() const{
+    return errorCount.load(std::memory_order_relaxed);
+}
+
+uint64_t MultiEncoderSampler::getOverrunCount() const{
+    return overrunCount.load(std::memory_order_relaxed);
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
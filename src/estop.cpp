@@ -0,0 +1,118 @@
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Libraries ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+#include "estop.h"
+#include "pca9685.h"
+
+#include <thread>
+#include <algorithm>  // For std::remove
+#include <stdexcept>  // For std::runtime_error
+#include <fcntl.h>    // For O_NONBLOCK, O_CLOEXEC
+#include <unistd.h>   // For pipe2, read, write
+#include <signal.h>   // For sigaction
+
+// Static members
+std::atomic<bool> EmergencyStop::latched(false);
+int EmergencyStop::wakePipe[2] = {-1, -1};
+std::mutex EmergencyStop::boardsMutex;
+std::vector<PCA9685*> EmergencyStop::boards;
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Watcher Thread ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Starts the thread that cuts outputs after trigger() (once per process)
+void EmergencyStop::startWatcher(){
+    static std::once_flag started;
+    std::call_once(started, []{
+        // Non-blocking write end so a signal handler can never block on a full pipe
+        if(pipe2(wakePipe, O_CLOEXEC) < 0){
+            throw std::runtime_error("Failed to create emergency stop pipe");
+        }
+        fcntl(wakePipe[1], F_SETFL, O_NONBLOCK);
+
+        // Lives for the rest of the process
+        std::thread(&EmergencyStop::watcherThread).detach();
+    });
+}
+
+// Waits for trigger() and cuts the outputs
+void EmergencyStop::watcherThread(){
+    char buffer[16];
+    while(true){
+        if(::read(wakePipe[0], buffer, sizeof(buffer)) > 0 && latched.load()){
+            cutOutputs();
+        }
+    }
+}
+
+// Switches every registered board off with a single write each
+void EmergencyStop::cutOutputs(){
+    std::lock_guard<std::mutex> lock(boardsMutex);
+    for(PCA9685* board : boards){
+        board->emergencyOff();
+    }
+}
+
+void EmergencyStop::signalHandler(int signum){
+    trigger();
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Triggering ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Async-signal-safe: only an atomic store and a pipe write
+void EmergencyStop::trigger() noexcept{
+    latched.store(true);
+    if(wakePipe[1] >= 0){
+        char byte = 1;
+        ssize_t result = ::write(wakePipe[1], &byte, 1);
+        (void)result; // Pipe already full means the watcher is already awake
+    }
+}
+
+// Latches and cuts outputs from the calling thread
+void EmergencyStop::stop(){
+    latched.store(true);
+    cutOutputs();
+}
+
+// Makes signum trigger the emergency stop
+void EmergencyStop::installSignalHandler(int signum){
+    startWatcher();
+
+    struct sigaction action = {};
+    action.sa_handler = &EmergencyStop::signalHandler;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    if(sigaction(signum, &action, nullptr) < 0){
+        throw std::runtime_error("Failed to install emergency stop signal handler");
+    }
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ State ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+bool EmergencyStop::isLatched() noexcept{
+    return latched.load();
+}
+
+// Clears the latch, outputs stay off until re-enabled
+void EmergencyStop::reset(){
+    latched.store(false);
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Boards ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+void EmergencyStop::registerBoard(PCA9685* board){
+    startWatcher();
+    std::lock_guard<std::mutex> lock(boardsMutex);
+    boards.push_back(board);
+}
+
+void EmergencyStop::unregisterBoard(PCA9685* board){
+    std::lock_guard<std::mutex> lock(boardsMutex);
+    boards.erase(std::remove(boards.begin(), boards.end(), board), boards.end());
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -1,115 +1,956 @@
 #include "i2c.h"
-#include <fcntl.h>          // For open() function
-#include <unistd.h>    // For close, read, write
-#include <sys/ioctl.h>      // For ioctl() function
-#include <linux/i2c-dev.h>  // For I2C_SLAVE and other I2C constants
+#include "i2c_scheduler.h"
+#include "i2c_batch.h"
+#include "estop.h"
 #include <stdexcept>        // For exceptions like std::runtime_error
 #include <vector>
 #include <string>
+#include <cstdio>           // For snprintf
+#include <algorithm>        // For std::max, std::min, std::copy
+#include <thread>           // For std::this_thread::sleep_for
 
-// Constructor
-I2C::I2C(const std::string& busPath): busPath(busPath), i2cBus(-1), activeSlave(0x00){
-	
-	// Open the I2C bus 
-	i2cBus = open(busPath.c_str(), O_RDWR);
-	if (i2cBus < 0){
-		throw std::runtime_error("Failed to open I2C bus");
+// Priority class set by the calling thread's I2CPriorityScope, -1 for the defaults
+static thread_local int threadPriority = -1;
+
+// Class a blocking call queues at, Emergency is only for writeEmergency
+static I2CPriority priorityFor(I2CPriority defaultClass){
+	if(threadPriority < 0 || threadPriority == static_cast<int>(I2CPriority::Emergency)){
+		return defaultClass;
+	}
+	return static_cast<I2CPriority>(threadPriority);
+}
+
+// Device named in error messages
+static std::string deviceName(uint8_t channel, uint8_t addr){
+	char name[32];
+	if(channel == I2C_DIRECT){
+		snprintf(name, sizeof(name), "0x%02x", addr);
+	}
+	else{
+		snprintf(name, sizeof(name), "0x%02x on mux channel %d", addr, channel);
+	}
+	return name;
+}
+
+// Default retry policy: one attempt
+static const I2CRetryPolicy NO_RETRIES = {1, std::chrono::microseconds(0), std::chrono::microseconds(0), 0};
+
+// Short name of a status, for logs
+const char* i2cStatusName(I2CStatus status) noexcept{
+	switch(status){
+		case I2CStatus::Ok: return "ok";
+		case I2CStatus::Nack: return "not acknowledged";
+		case I2CStatus::Short: return "short transfer";
+		case I2CStatus::Refused: return "refused, emergency stop latched";
+		case I2CStatus::MuxError: return "mux channel select failed";
+		case I2CStatus::NotRegistered: return "slave not registered";
+		case I2CStatus::Failed: return "failed";
 	}
+	return "unknown";
+}
+
+// Error message of a failed transaction, naming the device
+static std::string describe(I2CStatus status, I2COp op, uint8_t channel, uint8_t addr){
+	switch(status){
+		case I2CStatus::Refused:
+			return "Write refused, emergency stop latched";
+		case I2CStatus::NotRegistered:
+			return "Slave is not registered to I2C: " + deviceName(channel, addr);
+		case I2CStatus::MuxError:
+			return "Failed to select I2C mux channel " + std::to_string(channel);
+		default:
+			break;
+	}
+	const char* action = op == I2COp::Write ? "write to" : op == I2COp::WriteRead ? "read a register from" : "read from";
+	return std::string("Failed to ") + action + " I2C device " + deviceName(channel, addr) + " (" + i2cStatusName(status) + ")";
+}
+
+// Constructor: opens an i2c-dev bus
+I2C::I2C(const std::string& busPath): bus(new DevI2CBus(busPath)), ownsBus(true), scheduler(nullptr), retryPolicy(NO_RETRIES), recoveries(0), inFlight(nullptr)
+                                    , muxAddress(-1), activeChannel(I2C_DIRECT), channelSwitches(0){
+	clearRegistry();
+}
+
+// Constructor: runs on a bus owned by the caller
+I2C::I2C(I2CBus* bus): bus(bus), ownsBus(false), scheduler(nullptr), retryPolicy(NO_RETRIES), recoveries(0), inFlight(nullptr)
+                     , muxAddress(-1), activeChannel(I2C_DIRECT), channelSwitches(0){
+	clearRegistry();
+}
+
+// Constructor for subclasses that override the transport
+I2C::I2C(): bus(nullptr), ownsBus(false), scheduler(nullptr), retryPolicy(NO_RETRIES), recoveries(0), inFlight(nullptr)
+          , muxAddress(-1), activeChannel(I2C_DIRECT), channelSwitches(0){
+	clearRegistry();
 }
 
 // Destructor
 I2C::~I2C(){
-	if(i2cBus >= 0){
-		close(i2cBus);
+	stopScheduler();
+	{
+		std::lock_guard<std::mutex> lock(busMutex);
+		settleBatch();
+	}
+	if(bus){
+		for(int slot = 0; slot < I2C_CHANNEL_SLOTS; slot++){
+			for(int addr = 0; addr < I2C_ADDRESSES; addr++){
+				bus->closeDevice(deviceHandles[slot][addr]);
+			}
+		}
+	}
+	if(ownsBus){
+		delete bus;
 	}
 }
 
-// Configures slave for reading/writing
-bool I2C::setSlave(uint8_t slave){
-	
-	// Returns if the slave is already active
-	if(isActive(slave)){
-		return true;
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Registry ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+void I2C::clearRegistry(){
+	for(int slot = 0; slot < I2C_CHANNEL_SLOTS; slot++){
+		present[slot][0].store(0, std::memory_order_relaxed);
+		present[slot][1].store(0, std::memory_order_relaxed);
+		for(int addr = 0; addr < I2C_ADDRESSES; addr++){
+			deviceHandles[slot][addr] = -1;
+		}
+	}
+}
+
+// Mux channels take slots 0 - 7, the bus itself the last one
+int I2C::slotOf(uint8_t channel){
+	if(channel == I2C_DIRECT){
+		return I2C_CHANNEL_SLOTS - 1;
 	}
-	// Sets slave
-	if(ioctl(i2cBus, I2C_SLAVE, slave) < 0) {
-		throw std::runtime_error("Failed to set I2C slave address to " + std::to_string(slave));
+	return channel < I2C_MUX_CHANNELS ? channel : -1;
+}
+
+// Checks if slave has been registered, one bit of the channel's bitmap
+bool I2C::validateSlave(uint8_t channel, uint8_t slave){
+	int slot = slotOf(channel);
+	if(slot < 0 || slave >= I2C_ADDRESSES){
 		return false;
 	}
-	activeSlave = slave;
-	return true;
+	return (present[slot][slave >> 6].load(std::memory_order_acquire) >> (slave & 63)) & 1;
 }
 
-// Returns true if slave is active
-bool I2C::isActive(uint8_t slave){
-	if(slave == activeSlave){
-		return true;
-	}else{
+// Pings the slave, then marks it present and opens its dedicated handle
+bool I2C::addSlave(uint8_t channel, uint8_t addr){
+
+	int slot = slotOf(channel);
+	if(slot < 0 || addr >= I2C_ADDRESSES || !pingSlave(channel, addr)){
 		return false;
 	}
+
+	markPresent(slot, addr);
+	return true;
 }
 
-// Checks if slave has been registered
-bool I2C::validateSlave(uint8_t slave){
-	for(int i = 0; i < slaves.size(); i++){
-		if(slaves[i] == slave){
-			return true;
-		}
+// Marks the slave present and opens its dedicated handle
+void I2C::markPresent(int slot, uint8_t addr){
+	std::lock_guard<std::mutex> lock(busMutex);
+	if(bus && deviceHandles[slot][addr] < 0){
+		deviceHandles[slot][addr] = bus->openDevice(addr);
+	}
+	present[slot][addr >> 6].fetch_or(uint64_t(1) << (addr & 63), std::memory_order_release);
+}
+
+// Dedicated bus handle of a slave, -1 if it has none (bus lock held)
+int I2C::deviceHandle(uint8_t channel, uint8_t addr){
+	int slot = slotOf(channel);
+	if(slot < 0 || addr >= I2C_ADDRESSES){
+		return -1;
+	}
+	return deviceHandles[slot][addr];
+}
+
+// Registers the slave if it answers, the handle is unbound if it does not
+I2CDevice I2C::bind(uint8_t channel, uint8_t addr){
+	if(validateSlave(channel, addr) || addSlave(channel, addr)){
+		return I2CDevice(this, channel, addr);
+	}
+	return I2CDevice();
+}
+
+I2CDevice I2C::bind(uint8_t addr){
+	return bind(I2C_DIRECT, addr);
+}
+
+/* Registers a write-only address several slaves answer at once (PCA9685 all-call, sub-addresses)
+ * There is no ping, a read from it would have every slave driving the bus.
+ */
+I2CDevice I2C::bindBroadcast(uint8_t addr){
+	if(addr >= I2C_ADDRESSES){
+		return I2CDevice();
 	}
-	return false;
+	markPresent(slotOf(I2C_DIRECT), addr);
+	return I2CDevice(this, I2C_DIRECT, addr);
 }
 
 // Registers slave into database
 bool I2C::registerSlave(uint8_t addr){
-	if(!validateSlave(addr) && pingSlave(addr)){
-		slaves.push_back(addr);
-		return true;
-	}
-	return false;
+	return registerSlave(I2C_DIRECT, addr);
+}
+
+// Registers slave behind the mux into database
+bool I2C::registerSlave(uint8_t channel, uint8_t addr){
+	return !validateSlave(channel, addr) && addSlave(channel, addr);
 }
 
 // Pings slave at given address by reading from a known register
 bool I2C::pingSlave(uint8_t addr){
-    setSlave(addr);
-    
-    uint8_t dummyByte = 0x00;
-    if (::read(i2cBus, &dummyByte, 1) != 1) {
-        return false;  // If read fails, the slave is not responding
-    }
-    return true;  // Return true if the slave responds
+	return pingSlave(I2C_DIRECT, addr);
+}
+
+// Pings slave behind the mux by reading from a known register
+bool I2C::pingSlave(uint8_t channel, uint8_t addr){
+	uint8_t data = 0x00;
+	return perform(I2COp::Ping, priorityFor(I2CPriority::Diagnostic), channel, addr, nullptr, 0, &data, 1) == I2CStatus::Ok;
+}
+
+// Reads through the bus
+int I2C::transferRead(uint8_t addr, uint8_t* buffer, int numBytes){
+    return bus ? bus->read(addr, buffer, numBytes) : -1;
+}
+
+// Writes through the bus
+int I2C::transferWrite(uint8_t addr, const uint8_t* buffer, int numBytes){
+    return bus ? bus->write(addr, buffer, numBytes) : -1;
+}
+
+// Reads through a device's dedicated handle, or the transport
+int I2C::busRead(int handle, uint8_t addr, uint8_t* buffer, int numBytes){
+	return handle >= 0 ? bus->readDevice(handle, buffer, numBytes) : transferRead(addr, buffer, numBytes);
+}
+
+// Writes through a device's dedicated handle, or the transport
+int I2C::busWrite(int handle, uint8_t addr, const uint8_t* buffer, int numBytes){
+	return handle >= 0 ? bus->writeDevice(handle, buffer, numBytes) : transferWrite(addr, buffer, numBytes);
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Transactions ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// One try on the bus: selects the channel, then transfers (bus lock held)
+I2CStatus I2C::attempt(I2COp op, uint8_t channel, uint8_t addr, const uint8_t* out, int outBytes, uint8_t* in, int inBytes){
+
+	settleBatch();
+	if(!selectChannel(channel)){
+		return I2CStatus::MuxError;
+	}
+
+#if I2C_STATS
+	auto started = std::chrono::steady_clock::now();
+#endif
+
+	I2CStatus status = I2CStatus::Ok;
+	int handle = deviceHandle(channel, addr);
+	int written = 0;
+	int received = 0;
+	if(op == I2COp::Write || op == I2COp::WriteRead){
+		written = busWrite(handle, addr, out, outBytes);
+		if(written != outBytes){
+			status = written < 0 ? I2CStatus::Nack : I2CStatus::Short;
+		}
+	}
+	if(status == I2CStatus::Ok && op != I2COp::Write){
+		received = busRead(handle, addr, in, inBytes);
+		if(received != inBytes){
+			status = received < 0 ? I2CStatus::Nack : I2CStatus::Short;
+		}
+	}
+
+#if I2C_STATS
+	stats.record(channel, addr, op != I2COp::Write, std::max(written, 0), std::max(received, 0), status == I2CStatus::Ok
+	           , handle >= 0, std::chrono::steady_clock::now() - started);
+#endif
+	return status;
+}
+
+/* Runs a transaction on the bus now, retrying per the retry policy
+ * The latch is checked under the bus lock on every attempt, so no write can
+ * follow the emergency stop cut, and an Emergency write aborts the batch in
+ * flight before settling it. The lock is released while backing off, and
+ * Emergency requests never back off.
+ */
+I2CStatus I2C::run(I2COp op, I2CPriority priority, uint8_t channel, uint8_t addr, const uint8_t* out, int outBytes
+                 , uint8_t* in, int inBytes) noexcept{
+
+	std::chrono::microseconds backoff(0);
+	int failures = 0;
+
+	for(int tries = 1; ; tries++){
+
+		I2CStatus status;
+		I2CRetryPolicy policy;
+		{
+			std::lock_guard<std::mutex> lock(busMutex);
+			policy = retryPolicy;
+
+			if(op == I2COp::Write && priority != I2CPriority::Emergency && EmergencyStop::isLatched()){
+				return I2CStatus::Refused;
+			}
+			if(priority == I2CPriority::Emergency && inFlight && bus){
+				bus->abortOps(); // The cut does not wait for the rest of a batch
+			}
+			try{
+				status = attempt(op, channel, addr, out, outBytes, in, inBytes);
+			}
+			catch(...){
+				return I2CStatus::Failed; // Transport threw, nothing to retry
+			}
+			if(status == I2CStatus::Ok || op == I2COp::Ping || tries >= policy.maxAttempts){
+				return status;
+			}
+
+			// Retrying, recovering the bus first after too many failures in a row
+#if I2C_STATS
+			stats.recordRetry(channel, addr);
+#endif
+			failures++;
+			if(policy.recoverAfter > 0 && failures % policy.recoverAfter == 0){
+				recover();
+			}
+		}
+
+		// The cut retries at once, and a retry backing off on the bus thread leaves it to the emergency queue
+		backoff = tries == 1 ? policy.backoff : std::min(backoff * 2, policy.maxBackoff);
+		if(backoff.count() > 0 && priority != I2CPriority::Emergency){
+			if(scheduler && scheduler->onBusThread()){
+				scheduler->backOff(backoff);
+			}
+			else{
+				std::this_thread::sleep_for(backoff);
+			}
+		}
+	}
+}
+
+// Recovery hook, or the bus's own recovery, then the mux and slave address are unknown (bus lock held)
+bool I2C::recover(){
+
+	bool recovered = false;
+	try{
+		if(recoveryHook){
+			recovered = recoveryHook();
+		}
+		else if(bus){
+			recovered = bus->recover();
+		}
+	}
+	catch(...){
+		recovered = false;
+	}
+
+	activeChannel = I2C_DIRECT; // Reselected by the next transaction
+#if I2C_STATS
+	stats.forgetAddress();
+#endif
+	recoveries++;
+	return recovered;
+}
+
+// Runs a transaction through the scheduler when it is running (inline on its own thread), otherwise now
+I2CStatus I2C::perform(I2COp op, I2CPriority priority, uint8_t channel, uint8_t addr, const uint8_t* out, int outBytes
+                     , uint8_t* in, int inBytes) noexcept{
+
+	if(scheduler && !scheduler->onBusThread()){
+		try{
+			I2CResult result = submit({op, priority, channel, addr, std::vector<uint8_t>(out, out + outBytes), inBytes}).get();
+			if(result.status == I2CStatus::Ok && inBytes > 0){
+				std::copy(result.data.begin(), result.data.end(), in);
+			}
+			return result.status;
+		}
+		catch(...){
+			return I2CStatus::Failed; // Could not be queued
+		}
+	}
+	return run(op, priority, channel, addr, out, outBytes, in, inBytes);
+}
+
+// Runs a queued request on the bus now
+I2CResult I2C::execute(const I2CRequest& request){
+
+	I2CResult result = {I2CStatus::Ok, false, false, std::vector<uint8_t>(request.op == I2COp::Write ? 0 : request.readBytes), ""};
+	result.status = run(request.op, request.priority, request.channel, request.address, request.data.data()
+	                  , static_cast<int>(request.data.size()), result.data.data(), static_cast<int>(result.data.size()));
+	result.ok = result.status == I2CStatus::Ok;
+	result.refused = result.status == I2CStatus::Refused;
+	if(!result.ok){
+		result.error = describe(result.status, request.op, request.channel, request.address);
+	}
+	return result;
+}
+
+// Reads from a slave without throwing
+I2CStatus I2C::tryRead(uint8_t channel, uint8_t addr, uint8_t* buffer, int numBytes) noexcept{
+	if(!validateSlave(channel, addr)){
+		return I2CStatus::NotRegistered;
+	}
+	return perform(I2COp::Read, priorityFor(I2CPriority::Feedback), channel, addr, nullptr, 0, buffer, numBytes);
+}
+
+// Writes to a slave without throwing, Refused while the emergency stop is latched
+I2CStatus I2C::tryWrite(uint8_t channel, uint8_t addr, const uint8_t* buffer, int numBytes) noexcept{
+	if(!validateSlave(channel, addr)){
+		return I2CStatus::NotRegistered;
+	}
+	return perform(I2COp::Write, priorityFor(I2CPriority::Output), channel, addr, buffer, numBytes, nullptr, 0);
+}
+
+// Writes a register pointer then reads, as one transaction, without throwing
+I2CStatus I2C::tryWriteRead(uint8_t channel, uint8_t addr, const uint8_t* out, int outBytes, uint8_t* in, int inBytes) noexcept{
+	if(!validateSlave(channel, addr)){
+		return I2CStatus::NotRegistered;
+	}
+	return perform(I2COp::WriteRead, priorityFor(I2CPriority::Feedback), channel, addr, out, outBytes, in, inBytes);
 }
 
 // Reads information from slave
 std::vector<uint8_t> I2C::read(uint8_t addr, int numBytes) {
-	
-	// Ensures the slave has been registered
-	if(!validateSlave(addr)){
-		throw std::runtime_error("Slave is not registered to I2C: " + std::to_string(addr));
+	return read(I2C_DIRECT, addr, numBytes);
+}
+
+// Reads information from slave behind the mux
+std::vector<uint8_t> I2C::read(uint8_t channel, uint8_t addr, int numBytes) {
+	std::vector<uint8_t> buffer(numBytes);
+	I2CStatus status = tryRead(channel, addr, buffer.data(), numBytes);
+	if(status != I2CStatus::Ok){
+		throw std::runtime_error(describe(status, I2COp::Read, channel, addr));
 	}
-    setSlave(addr); // Sets the slave as active
-    
-    std::vector<uint8_t> buffer(numBytes); // Sets the buffer to hold the number of bytes
+	return buffer;
+}
 
-    // Perform the read operation
-    if (::read(i2cBus, buffer.data(), numBytes) != numBytes) {
-        throw std::runtime_error("Failed to read from I2C device");
-    }
+// Writes a register pointer then reads, as one request (nothing can change the pointer in between)
+std::vector<uint8_t> I2C::writeRead(uint8_t addr, const uint8_t* out, int outBytes, int numBytes){
+	return writeRead(I2C_DIRECT, addr, out, outBytes, numBytes);
+}
 
-    return buffer; // Return the buffer after successful read
+// Writes a register pointer then reads from a slave behind the mux, as one request
+std::vector<uint8_t> I2C::writeRead(uint8_t channel, uint8_t addr, const uint8_t* out, int outBytes, int numBytes){
+	std::vector<uint8_t> buffer(numBytes);
+	I2CStatus status = tryWriteRead(channel, addr, out, outBytes, buffer.data(), numBytes);
+	if(status != I2CStatus::Ok){
+		throw std::runtime_error(describe(status, I2COp::WriteRead, channel, addr));
+	}
+	return buffer;
 }
 
 // Writes information to slave
 bool I2C::write(uint8_t addr, uint8_t* buffer, int numBytes){
-	
-	// Ensures the slave has been registered
-	if(!validateSlave(addr)){
-		throw std::runtime_error("Slave is not registered to I2C: " + std::to_string(addr));
-	}
-	setSlave(addr); // Sets the slave as active
-	
-	if(::write(i2cBus, buffer, numBytes) != numBytes){
-		throw std::runtime_error("Failed to write to I2C device");
+	return write(I2C_DIRECT, addr, buffer, numBytes);
+}
+
+// Writes information to slave behind the mux
+bool I2C::write(uint8_t channel, uint8_t addr, uint8_t* buffer, int numBytes){
+	I2CStatus status = tryWrite(channel, addr, buffer, numBytes);
+	if(status == I2CStatus::Refused){
+		return false;
+	}
+	if(status != I2CStatus::Ok){
+		throw std::runtime_error(describe(status, I2COp::Write, channel, addr));
+	}
+	return true;
+}
+
+// Reads into a caller-owned buffer
+void I2C::read(uint8_t addr, ByteSpan buffer){
+	read(I2C_DIRECT, addr, buffer);
+}
+
+// Reads into a caller-owned buffer from a slave behind the mux
+void I2C::read(uint8_t channel, uint8_t addr, ByteSpan buffer){
+	I2CStatus status = tryRead(channel, addr, buffer.data(), buffer.size());
+	if(status != I2CStatus::Ok){
+		throw std::runtime_error(describe(status, I2COp::Read, channel, addr));
+	}
+}
+
+// Writes a caller-owned buffer
+bool I2C::write(uint8_t addr, ConstByteSpan buffer){
+	return write(I2C_DIRECT, addr, buffer);
+}
+
+// Writes a caller-owned buffer to a slave behind the mux
+bool I2C::write(uint8_t channel, uint8_t addr, ConstByteSpan buffer){
+	I2CStatus status = tryWrite(channel, addr, buffer.data(), buffer.size());
+	if(status == I2CStatus::Refused){
 		return false;
 	}
+	if(status != I2CStatus::Ok){
+		throw std::runtime_error(describe(status, I2COp::Write, channel, addr));
+	}
 	return true;
 }
+
+// Writes a register pointer then reads into a caller-owned buffer, as one request
+void I2C::writeRead(uint8_t addr, ConstByteSpan out, ByteSpan in){
+	writeRead(I2C_DIRECT, addr, out, in);
+}
+
+// Writes a register pointer then reads into a caller-owned buffer from a slave behind the mux
+void I2C::writeRead(uint8_t channel, uint8_t addr, ConstByteSpan out, ByteSpan in){
+	I2CStatus status = tryWriteRead(channel, addr, out.data(), out.size(), in.data(), in.size());
+	if(status != I2CStatus::Ok){
+		throw std::runtime_error(describe(status, I2COp::WriteRead, channel, addr));
+	}
+}
+
+/* Writes information to slave regardless of the emergency stop latch (used to cut outputs)
+ * The batch in flight is aborted first, without the bus lock, as a blocking
+ * batch holds it until its last op.
+ */
+bool I2C::writeEmergency(uint8_t addr, uint8_t* buffer, int numBytes){
+	if(bus){
+		bus->abortOps();
+	}
+	return perform(I2COp::Write, I2CPriority::Emergency, I2C_DIRECT, addr, buffer, numBytes, nullptr, 0) == I2CStatus::Ok;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Retries ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+void I2C::setRetryPolicy(const I2CRetryPolicy& policy){
+	std::lock_guard<std::mutex> lock(busMutex);
+	retryPolicy = policy;
+	retryPolicy.maxAttempts = std::max(1, policy.maxAttempts);
+}
+
+I2CRetryPolicy I2C::getRetryPolicy(){
+	std::lock_guard<std::mutex> lock(busMutex);
+	return retryPolicy;
+}
+
+// Runs instead of the bus's own recovery (on the thread running the transaction, bus lock held)
+void I2C::setRecoveryHook(std::function<bool()> hook){
+	std::lock_guard<std::mutex> lock(busMutex);
+	recoveryHook = std::move(hook);
+}
+
+uint64_t I2C::getRecoveries(){
+	std::lock_guard<std::mutex> lock(busMutex);
+	return recoveries;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Scheduler ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Starts the bus owner thread (call before other threads use the bus)
+void I2C::startScheduler(std::chrono::microseconds maxWait){
+	if(!scheduler){
+		scheduler = new I2CScheduler(this, maxWait);
+	}
+}
+
+// Runs what is queued and stops the bus owner thread (call once other threads are done with the bus)
+void I2C::stopScheduler(){
+	delete scheduler;
+	scheduler = nullptr;
+}
+
+I2CScheduler* I2C::getScheduler(){
+	return scheduler;
+}
+
+// Queues a request, the future holds its result (runs now without a scheduler)
+std::future<I2CResult> I2C::submit(const I2CRequest& request){
+	auto promise = std::make_shared<std::promise<I2CResult>>();
+	std::future<I2CResult> result = promise->get_future();
+	submit(request, [promise](const I2CResult& done){ promise->set_value(done); });
+	return result;
+}
+
+// Queues a request, done gets its result on the bus thread (runs now without a scheduler)
+void I2C::submit(const I2CRequest& request, std::function<void(const I2CResult&)> done){
+	if(scheduler){
+		scheduler->submit(request, std::move(done));
+	}
+	else{
+		done(execute(request));
+	}
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Batches ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+/* Turns a batch into bus ops and starts them
+ * Channel selects go in front of the transactions that need them, linked so a
+ * failed select keeps its transaction off the wrong channel (as a failed write
+ * keeps the read of a register read back). The active channel is tracked as if
+ * they had already run. Writes are refused here while
+ * latched, an emergency cut after this aborts the rest of the batch and lands
+ * once the op on the wire has completed.
+ */
+I2CStatus I2C::submitBatch(I2CBatch& batch) noexcept{
+
+	if(batch.owner.load()){
+		return I2CStatus::Failed; // Already in flight
+	}
+
+	// The scheduler orders every transaction, so they go through it one by one
+	if(scheduler && !scheduler->onBusThread()){
+		for(int i = 0; i < batch.count; i++){
+			I2CBatch::Entry& entry = batch.entries[i];
+			if(entry.device.i2c != this){
+				entry.status = I2CStatus::NotRegistered;
+				continue;
+			}
+			I2CPriority priority = priorityFor(entry.op == I2COp::Write ? I2CPriority::Output : I2CPriority::Feedback);
+			entry.status = perform(entry.op, priority, entry.device.channel, entry.device.address, entry.out, entry.outBytes
+			                     , entry.in, entry.inBytes);
+		}
+		return I2CStatus::Ok;
+	}
+
+	std::lock_guard<std::mutex> lock(busMutex);
+	settleBatch();
+
+	bool latched = EmergencyStop::isLatched();
+	batch.busCount = 0;
+	for(int i = 0; i < batch.count; i++){
+		I2CBatch::Entry& entry = batch.entries[i];
+		uint8_t channel = entry.device.channel;
+		uint8_t addr = entry.device.address;
+		entry.muxOp = -1;
+		entry.firstOp = -1;
+		if(entry.device.i2c != this){
+			entry.status = I2CStatus::NotRegistered;
+			continue;
+		}
+		if(entry.op == I2COp::Write && latched){
+			entry.status = I2CStatus::Refused;
+			continue;
+		}
+
+		if(channel != I2C_DIRECT && channel != activeChannel){
+			if(muxAddress < 0 || channel >= I2C_MUX_CHANNELS){
+				entry.status = I2CStatus::MuxError;
+				continue;
+			}
+			entry.muxControl = 1 << channel;
+			entry.muxOp = batch.busCount;
+			batch.busOps[batch.busCount++] = {deviceHandle(I2C_DIRECT, muxAddress), static_cast<uint8_t>(muxAddress), false, &entry.muxControl, 1, -1
+			                                , true};
+			activeChannel = channel;
+			channelSwitches++;
+		}
+
+		int handle = deviceHandle(channel, addr);
+		entry.firstOp = batch.busCount;
+		if(entry.op != I2COp::Read){
+			batch.busOps[batch.busCount++] = {handle, addr, false, entry.out, entry.outBytes, -1, entry.op == I2COp::WriteRead};
+		}
+		if(entry.op != I2COp::Write){
+			batch.busOps[batch.busCount++] = {handle, addr, true, entry.in, entry.inBytes, -1};
+		}
+	}
+
+	batch.submitted = std::chrono::steady_clock::now();
+	bool started = false;
+	try{
+		if(bus){
+			started = bus->submitOps(batch.busOps, batch.busCount);
+		}
+		else{
+			bool skipping = false;
+			for(int i = 0; i < batch.busCount; i++){
+				I2CBusOp& op = batch.busOps[i];
+				if(skipping){
+					op.result = I2C_OP_SKIPPED;
+				}
+				else{
+					op.result = op.isRead ? transferRead(op.addr, op.buffer, op.numBytes) : transferWrite(op.addr, op.buffer, op.numBytes);
+				}
+				skipping = op.linked && (skipping || op.result != op.numBytes);
+			}
+			started = true;
+		}
+	}
+	catch(...){
+		started = false;
+	}
+
+	if(!started){
+		for(int i = 0; i < batch.count; i++){
+			if(batch.entries[i].firstOp >= 0){
+				batch.entries[i].status = I2CStatus::Failed;
+			}
+		}
+		activeChannel = I2C_DIRECT; // Unknown, reselect next time
+		return I2CStatus::Failed;
+	}
+	batch.owner.store(this);
+	inFlight = &batch;
+	return I2CStatus::Ok;
+}
+
+/* Completes the batch in flight and sets its statuses (bus lock held)
+ * A failed channel select fails its transaction with MuxError. Transactions
+ * an emergency cut aborted are Refused. The latency recorded is from
+ * submission to completion, the bus ran the batch meanwhile.
+ */
+void I2C::settleBatch(){
+
+	I2CBatch* batch = inFlight;
+	if(!batch){
+		return;
+	}
+	if(bus){
+		bus->waitOps();
+	}
+#if I2C_STATS
+	std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - batch->submitted;
+#endif
+
+	for(int i = 0; i < batch->count; i++){
+		I2CBatch::Entry& entry = batch->entries[i];
+		if(entry.firstOp < 0){
+			continue;
+		}
+		uint8_t channel = entry.device.channel;
+		uint8_t addr = entry.device.address;
+
+		if(entry.muxOp >= 0){
+			const I2CBusOp& select = batch->busOps[entry.muxOp];
+#if I2C_STATS
+			stats.record(I2C_DIRECT, select.addr, false, std::max(select.result, 0), 0, select.result == 1, select.handle >= 0, elapsed);
+#endif
+			if(select.result != 1){
+				entry.status = select.result == I2C_OP_SKIPPED ? I2CStatus::Refused : I2CStatus::MuxError;
+				activeChannel = I2C_DIRECT; // Unknown, reselect next time
+				continue;
+			}
+		}
+
+		I2CStatus status = I2CStatus::Ok;
+		int next = entry.firstOp;
+		int written = 0;
+		int received = 0;
+		bool dedicated = batch->busOps[next].handle >= 0;
+		if(entry.op != I2COp::Read){
+			written = batch->busOps[next++].result;
+			if(written != entry.outBytes){
+				status = written == I2C_OP_SKIPPED ? I2CStatus::Refused : written < 0 ? I2CStatus::Nack : I2CStatus::Short;
+			}
+		}
+		if(entry.op != I2COp::Write){
+			received = batch->busOps[next].result;
+			if(status == I2CStatus::Ok && received != entry.inBytes){
+				status = received == I2C_OP_SKIPPED ? I2CStatus::Refused : received < 0 ? I2CStatus::Nack : I2CStatus::Short;
+			}
+		}
+		if(status == I2CStatus::Refused){
+			activeChannel = I2C_DIRECT; // Selects after the abort never ran
+		}
+		entry.status = status;
+#if I2C_STATS
+		stats.record(channel, addr, entry.op != I2COp::Write, std::max(written, 0), std::max(received, 0), status == I2CStatus::Ok
+		           , dedicated, elapsed);
+#else
+		(void)channel;
+		(void)addr;
+		(void)dedicated;
+#endif
+	}
+
+	inFlight = nullptr;
+	batch->owner.store(nullptr);
+}
+
+void I2C::waitBatch(I2CBatch& batch){
+	std::lock_guard<std::mutex> lock(busMutex);
+	if(inFlight == &batch){
+		settleBatch();
+	}
+}
+
+bool I2C::pollBatch(I2CBatch& batch){
+	std::lock_guard<std::mutex> lock(busMutex);
+	if(inFlight != &batch){
+		return true;
+	}
+	if(bus && !bus->pollOps()){
+		return false;
+	}
+	settleBatch();
+	return true;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Mux ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Adds a TCA9548A mux, all channels start deselected
+bool I2C::attachMux(uint8_t muxAddr){
+	std::lock_guard<std::mutex> lock(busMutex);
+	settleBatch();
+
+	muxAddress = muxAddr;
+	activeChannel = I2C_DIRECT;
+	if(bus && deviceHandles[I2C_CHANNEL_SLOTS - 1][muxAddr & (I2C_ADDRESSES - 1)] < 0){
+		deviceHandles[I2C_CHANNEL_SLOTS - 1][muxAddr & (I2C_ADDRESSES - 1)] = bus->openDevice(muxAddr);
+	}
+	if(!writeMux(0x00)){
+		muxAddress = -1;
+		return false;
+	}
+	return true;
+}
+
+// Routes the mux to a channel, skipped if it is already selected (bus lock held)
+bool I2C::selectChannel(uint8_t channel){
+
+	// Devices on the bus itself are visible whatever channel is selected
+	if(channel == I2C_DIRECT || channel == activeChannel){
+		return true;
+	}
+	if(muxAddress < 0 || channel >= I2C_MUX_CHANNELS){
+		return false;
+	}
+
+	if(!writeMux(1 << channel)){
+		activeChannel = I2C_DIRECT; // Unknown, reselect next time
+		return false;
+	}
+	activeChannel = channel;
+	channelSwitches++;
+	return true;
+}
+
+// Writes the mux control register, one bit per channel (bus lock held)
+bool I2C::writeMux(uint8_t control){
+
+#if I2C_STATS
+	auto started = std::chrono::steady_clock::now();
+#endif
+	int handle = deviceHandle(I2C_DIRECT, muxAddress);
+	int written = busWrite(handle, muxAddress, &control, 1);
+#if I2C_STATS
+	stats.record(I2C_DIRECT, muxAddress, false, std::max(written, 0), 0, written == 1, handle >= 0, std::chrono::steady_clock::now() - started);
+#endif
+	return written == 1;
+}
+
+// Currently selected mux channel, I2C_DIRECT if none
+uint8_t I2C::getActiveChannel(){
+	std::lock_guard<std::mutex> lock(busMutex);
+	return activeChannel;
+}
+
+// Number of channel select writes so far
+uint64_t I2C::getChannelSwitches(){
+	std::lock_guard<std::mutex> lock(busMutex);
+	return channelSwitches;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Statistics ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Every device addressed so far, empty when compiled out
+std::vector<I2CDeviceStats> I2C::getStats(){
+#if I2C_STATS
+	std::lock_guard<std::mutex> lock(busMutex);
+	return stats.snapshot();
+#else
+	return {};
+#endif
+}
+
+void I2C::resetStats(){
+#if I2C_STATS
+	std::lock_guard<std::mutex> lock(busMutex);
+	stats.reset();
+#endif
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ I2CPriorityScope ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+I2CPriorityScope::I2CPriorityScope(I2CPriority priority) : previous(threadPriority){
+	threadPriority = static_cast<int>(priority);
+}
+
+I2CPriorityScope::~I2CPriorityScope(){
+	threadPriority = previous;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ I2CDevice ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+I2CDevice::I2CDevice() : i2c(nullptr), channel(I2C_DIRECT), address(0x00){}
+
+I2CDevice::I2CDevice(I2C* i2c, uint8_t channel, uint8_t address) : i2c(i2c), channel(channel), address(address){}
+
+bool I2CDevice::isBound() const{
+	return i2c != nullptr;
+}
+
+uint8_t I2CDevice::getChannel() const{
+	return channel;
+}
+
+uint8_t I2CDevice::getAddress() const{
+	return address;
+}
+
+I2C* I2CDevice::getBus() const{
+	return i2c;
+}
+
+// Validated when bound, straight to the transaction
+I2CStatus I2CDevice::tryRead(uint8_t* buffer, int numBytes) noexcept{
+	if(!i2c){
+		return I2CStatus::NotRegistered;
+	}
+	return i2c->perform(I2COp::Read, priorityFor(I2CPriority::Feedback), channel, address, nullptr, 0, buffer, numBytes);
+}
+
+I2CStatus I2CDevice::tryWrite(const uint8_t* buffer, int numBytes) noexcept{
+	if(!i2c){
+		return I2CStatus::NotRegistered;
+	}
+	return i2c->perform(I2COp::Write, priorityFor(I2CPriority::Output), channel, address, buffer, numBytes, nullptr, 0);
+}
+
+I2CStatus I2CDevice::tryWriteRead(const uint8_t* out, int outBytes, uint8_t* in, int inBytes) noexcept{
+	if(!i2c){
+		return I2CStatus::NotRegistered;
+	}
+	return i2c->perform(I2COp::WriteRead, priorityFor(I2CPriority::Feedback), channel, address, out, outBytes, in, inBytes);
+}
+
+I2CStatus I2CDevice::tryRead(ByteSpan buffer) noexcept{
+	return tryRead(buffer.data(), buffer.size());
+}
+
+I2CStatus I2CDevice::tryWrite(ConstByteSpan buffer) noexcept{
+	return tryWrite(buffer.data(), buffer.size());
+}
+
+I2CStatus I2CDevice::tryWriteRead(ConstByteSpan out, ByteSpan in) noexcept{
+	return tryWriteRead(out.data(), out.size(), in.data(), in.size());
+}
+
+// Throwing transactions, as the I2C wrappers
+void I2CDevice::read(ByteSpan buffer){
+	I2CStatus status = tryRead(buffer);
+	if(status != I2CStatus::Ok){
+		throw std::runtime_error(describe(status, I2COp::Read, channel, address));
+	}
+}
+
+bool I2CDevice::write(ConstByteSpan buffer){
+	I2CStatus status = tryWrite(buffer);
+	if(status == I2CStatus::Refused){
+		return false;
+	}
+	if(status != I2CStatus::Ok){
+		throw std::runtime_error(describe(status, I2COp::Write, channel, address));
+	}
+	return true;
+}
+
+void I2CDevice::writeRead(ConstByteSpan out, ByteSpan in){
+	I2CStatus status = tryWriteRead(out, in);
+	if(status != I2CStatus::Ok){
+		throw std::runtime_error(describe(status, I2COp::WriteRead, channel, address));
+	}
+}
@@ -0,0 +1,113 @@
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Libraries ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+#include "i2c_batch.h"
+#include "i2c.h"
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Constructor/Destructor ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+I2CBatch::I2CBatch() : count(0), busCount(0), owner(nullptr){}
+
+// The bus would complete into the batch after it is gone
+I2CBatch::~I2CBatch(){
+    I2C* i2c = owner.load();
+    if(i2c){
+        i2c->waitBatch(*this);
+    }
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Queueing ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Copies the written bytes in, the read buffer stays the caller's
+bool I2CBatch::add(I2COp op, const I2CDevice& device, ConstByteSpan out, ByteSpan in){
+
+    if(owner.load() || count >= I2C_BATCH_OPS || !device.isBound() || out.size() > I2C_BATCH_BYTES){
+        return false;
+    }
+
+    Entry& entry = entries[count];
+    entry.op = op;
+    entry.device = device;
+    for(int i = 0; i < out.size(); i++){
+        entry.out[i] = out.data()[i];
+    }
+    entry.outBytes = out.size();
+    entry.in = in.data();
+    entry.inBytes = in.size();
+    entry.status = I2CStatus::Failed;
+    entry.muxControl = 0x00;
+    entry.muxOp = -1;
+    entry.firstOp = -1;
+    count++;
+    return true;
+}
+
+bool I2CBatch::write(const I2CDevice& device, ConstByteSpan bytes){
+    return add(I2COp::Write, device, bytes, ByteSpan(nullptr, 0));
+}
+
+bool I2CBatch::writeRead(const I2CDevice& device, ConstByteSpan out, ByteSpan in){
+    return add(I2COp::WriteRead, device, out, in);
+}
+
+bool I2CBatch::read(const I2CDevice& device, ByteSpan in){
+    return add(I2COp::Read, device, ConstByteSpan(nullptr, 0), in);
+}
+
+void I2CBatch::clear(){
+    I2C* i2c = owner.load();
+    if(i2c){
+        i2c->waitBatch(*this);
+    }
+    count = 0;
+    busCount = 0;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Results ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+int I2CBatch::size() const{
+    return count;
+}
+
+bool I2CBatch::isPending() const{
+    return owner.load() != nullptr;
+}
+
+I2CStatus I2CBatch::status(int index) const{
+    if(index < 0 || index >= count){
+        return I2CStatus::Failed;
+    }
+    return entries[index].status;
+}
+
+bool I2CBatch::ok() const{
+    for(int i = 0; i < count; i++){
+        if(entries[i].status != I2CStatus::Ok){
+            return false;
+        }
+    }
+    return true;
+}
+
+// Batched transactions are not retried, this runs one through the normal path that is
+I2CStatus I2CBatch::rerun(int index) noexcept{
+    if(index < 0 || index >= count || owner.load()){
+        return I2CStatus::Failed;
+    }
+    Entry& entry = entries[index];
+    if(entry.op == I2COp::Write){
+        entry.status = entry.device.tryWrite(entry.out, entry.outBytes);
+    }
+    else if(entry.op == I2COp::WriteRead){
+        entry.status = entry.device.tryWriteRead(entry.out, entry.outBytes, entry.in, entry.inBytes);
+    }
+    else{
+        entry.status = entry.device.tryRead(entry.in, entry.inBytes);
+    }
+    return entry.status;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -0,0 +1,173 @@
+#include "i2c_bus.h"
+#include "io_uring_queue.h"
+#include <fcntl.h>          // For open() function
+#include <unistd.h>    // For close, read, write
+#include <sys/ioctl.h>      // For ioctl() function
+#include <linux/i2c-dev.h>  // For I2C_SLAVE and other I2C constants
+#include <stdexcept>        // For exceptions like std::runtime_error
+#include <string>
+
+// Runs a batch now
+bool I2CBus::submitOps(I2CBusOp* ops, int count){
+	aborting.store(false);
+	return runOps(ops, count);
+}
+
+// Runs the ops in order, skipping the rest of a linked run after a failure and everything once aborted
+bool I2CBus::runOps(I2CBusOp* ops, int count){
+	bool skipping = false;
+	for(int i = 0; i < count; i++){
+		I2CBusOp& op = ops[i];
+		if(skipping || aborting.load()){
+			op.result = I2C_OP_SKIPPED;
+		}
+		else if(op.handle >= 0){
+			op.result = op.isRead ? readDevice(op.handle, op.buffer, op.numBytes) : writeDevice(op.handle, op.buffer, op.numBytes);
+		}
+		else{
+			op.result = op.isRead ? read(op.addr, op.buffer, op.numBytes) : write(op.addr, op.buffer, op.numBytes);
+		}
+		skipping = op.linked && (skipping || op.result != op.numBytes);
+	}
+	return true;
+}
+
+// Checked before every op, so the op on the wire still completes
+void I2CBus::abortOps(){
+	aborting.store(true);
+}
+
+// Constructor
+DevI2CBus::DevI2CBus(const std::string& busPath, bool async): busPath(busPath), i2cBus(-1), activeSlave(0x00), uring(nullptr)
+                                                            , uringBatch(false){
+
+	// Open the I2C bus
+	i2cBus = open(busPath.c_str(), O_RDWR);
+	if (i2cBus < 0){
+		throw std::runtime_error("Failed to open I2C bus");
+	}
+
+	// Batch queue, left off if the kernel has no io_uring (or it is disabled)
+	if(async){
+		uring = new IoUringQueue(IoUringQueue::DEFAULT_ENTRIES);
+		if(!uring->isOpen()){
+			delete uring;
+			uring = nullptr;
+		}
+	}
+}
+
+// Destructor
+DevI2CBus::~DevI2CBus(){
+	if(uring){
+		uring->wait();
+		delete uring;
+	}
+	if(i2cBus >= 0){
+		close(i2cBus);
+	}
+}
+
+// Configures slave for reading/writing, skipped if it is already active
+bool DevI2CBus::setSlave(uint8_t slave){
+
+	if(slave == activeSlave){
+		return true;
+	}
+	if(i2cBus < 0 || ioctl(i2cBus, I2C_SLAVE, slave) < 0) {
+		return false;
+	}
+	activeSlave = slave;
+	return true;
+}
+
+// Reopens the bus, the next transfer sets its slave again
+bool DevI2CBus::recover(){
+	if(i2cBus >= 0){
+		close(i2cBus);
+	}
+	i2cBus = open(busPath.c_str(), O_RDWR);
+	activeSlave = 0x00;
+	return i2cBus >= 0;
+}
+
+// Opens a file descriptor of its own for a device, addressed once
+int DevI2CBus::openDevice(uint8_t addr){
+	int handle = open(busPath.c_str(), O_RDWR);
+	if(handle < 0){
+		return -1;
+	}
+	if(ioctl(handle, I2C_SLAVE, addr) < 0){
+		close(handle);
+		return -1;
+	}
+	return handle;
+}
+
+void DevI2CBus::closeDevice(int handle){
+	if(handle >= 0){
+		close(handle);
+	}
+}
+
+// Reads through a device's own file descriptor, no ioctl
+int DevI2CBus::readDevice(int handle, uint8_t* buffer, int numBytes){
+	return ::read(handle, buffer, numBytes);
+}
+
+// Writes through a device's own file descriptor, no ioctl
+int DevI2CBus::writeDevice(int handle, const uint8_t* buffer, int numBytes){
+	return ::write(handle, buffer, numBytes);
+}
+
+// Reads from the i2c-dev file descriptor
+int DevI2CBus::read(uint8_t addr, uint8_t* buffer, int numBytes){
+    if(!setSlave(addr)){ // Sets the slave as active
+        return -1;
+    }
+    return ::read(i2cBus, buffer, numBytes);
+}
+
+// Writes to the i2c-dev file descriptor
+int DevI2CBus::write(uint8_t addr, const uint8_t* buffer, int numBytes){
+    if(!setSlave(addr)){ // Sets the slave as active
+        return -1;
+    }
+    return ::write(i2cBus, buffer, numBytes);
+}
+
+// One io_uring submission for the whole batch, run in order
+bool DevI2CBus::submitOps(I2CBusOp* ops, int count){
+
+	bool queued = uring && count <= uring->capacity();
+	for(int i = 0; queued && i < count; i++){
+		queued = ops[i].handle >= 0; // Transfers by address need the ioctl first
+	}
+	uringBatch = queued && uring->submit(ops, count);
+	if(uringBatch){
+		return true;
+	}
+	return I2CBus::submitOps(ops, count);
+}
+
+void DevI2CBus::waitOps(){
+	if(uringBatch){
+		uring->wait();
+		uringBatch = false;
+	}
+}
+
+bool DevI2CBus::pollOps(){
+	return !uringBatch || uring->poll();
+}
+
+bool DevI2CBus::isAsync(){
+	return uring != nullptr;
+}
+
+void DevI2CBus::abortOps(){
+	if(uring){
+		uring->cancel();
+	}
+	I2CBus::abortOps();
+}
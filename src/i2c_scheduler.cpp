@@ -0,0 +1,178 @@
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Libraries ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+#include "i2c_scheduler.h"
+
+#include <algorithm>  // For std::max
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Constructor/Destructor ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Constructor: Starts the bus thread
+I2CScheduler::I2CScheduler(I2C* i2c, std::chrono::microseconds maxWait) : i2c(i2c), maxWait(maxWait), stopping(false){
+    resetStats();
+    worker = std::thread(&I2CScheduler::busThread, this);
+}
+
+// Destructor: Runs what is still queued, then stops the bus thread
+I2CScheduler::~I2CScheduler(){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    worker.join();
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Bus Thread ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Thread that owns the bus, one request (or coalesced group) at a time
+void I2CScheduler::busThread(){
+
+    std::unique_lock<std::mutex> lock(mutex);
+    std::vector<Pending> group;
+
+    while(true){
+        int served = nextClass(std::chrono::steady_clock::now());
+        if(served < 0){
+            if(stopping){
+                return;
+            }
+            wake.wait(lock);
+            continue;
+        }
+        serve(lock, served, group);
+    }
+}
+
+// Runs the request at the front of a queue, and the writes queued right behind it that coalesce with it (lock held)
+void I2CScheduler::serve(std::unique_lock<std::mutex>& lock, int served, std::vector<Pending>& group){
+
+    std::deque<Pending>& queue = queues[served];
+    group.clear();
+    group.push_back(std::move(queue.front()));
+    queue.pop_front();
+    I2CRequest request = group.front().request;
+    while(!queue.empty() && coalesces(request, queue.front().request)){
+        request.data = queue.front().request.data;
+        group.push_back(std::move(queue.front()));
+        queue.pop_front();
+    }
+
+    // The bus runs without the queue lock, so callers keep queueing
+    lock.unlock();
+    I2CResult result = i2c->execute(request);
+    auto completed = std::chrono::steady_clock::now();
+    lock.lock();
+
+    // Counted before completing, so a caller that saw its result also sees it in the statistics
+    Totals& total = totals[served];
+    total.coalesced += group.size() - 1;
+    for(Pending& pending : group){
+        std::chrono::nanoseconds latency = completed - pending.queued;
+        total.completed++;
+        total.latency += latency;
+        total.maxLatency = std::max(total.maxLatency, latency);
+    }
+
+    lock.unlock();
+    for(Pending& pending : group){
+        pending.done(result);
+    }
+    lock.lock();
+}
+
+/* Waits out a retry's backoff on the bus thread (bus lock not held)
+ * Emergency requests queued meanwhile run at once instead of waiting for the
+ * retry, the other classes wait.
+ */
+void I2CScheduler::backOff(std::chrono::microseconds duration){
+
+    auto until = std::chrono::steady_clock::now() + duration;
+    int emergency = static_cast<int>(I2CPriority::Emergency);
+    std::unique_lock<std::mutex> lock(mutex);
+    std::vector<Pending> group; // The bus thread's own group is still running the retry
+    while(wake.wait_until(lock, until, [this, emergency](){ return !queues[emergency].empty(); })){
+        serve(lock, emergency, group);
+    }
+}
+
+/* Queue to serve next, -1 if every queue is empty (lock held)
+ * The emergency class always goes first. Otherwise the oldest request that has
+ * waited past maxWait goes, then the highest class with anything queued.
+ */
+int I2CScheduler::nextClass(std::chrono::steady_clock::time_point now){
+
+    int emergency = static_cast<int>(I2CPriority::Emergency);
+    if(!queues[emergency].empty()){
+        return emergency;
+    }
+
+    int highest = -1;
+    int overdue = -1;
+    for(int i = emergency + 1; i < I2C_PRIORITIES; i++){
+        if(queues[i].empty()){
+            continue;
+        }
+        if(highest < 0){
+            highest = i;
+        }
+        if(now - queues[i].front().queued > maxWait
+        && (overdue < 0 || queues[i].front().queued < queues[overdue].front().queued)){
+            overdue = i;
+        }
+    }
+
+    if(overdue >= 0 && overdue != highest){
+        totals[overdue].promoted++;
+        return overdue;
+    }
+    return highest;
+}
+
+// next writes the same bytes of the same register of the same device, so only its data needs to reach the bus
+bool I2CScheduler::coalesces(const I2CRequest& first, const I2CRequest& next){
+    return first.op == I2COp::Write && next.op == I2COp::Write
+        && first.channel == next.channel && first.address == next.address
+        && first.data.size() == next.data.size() && !first.data.empty() && first.data[0] == next.data[0];
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Requests ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Queues a request at its priority class
+void I2CScheduler::submit(const I2CRequest& request, std::function<void(const I2CResult&)> done){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queues[static_cast<int>(request.priority)].push_back({request, std::move(done), std::chrono::steady_clock::now()});
+    }
+    wake.notify_one();
+}
+
+// True on the bus thread (completion callbacks), where requests run inline instead of queueing behind themselves
+bool I2CScheduler::onBusThread(){
+    return std::this_thread::get_id() == worker.get_id();
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Statistics ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+I2CClassStats I2CScheduler::getStats(I2CPriority priority){
+    std::lock_guard<std::mutex> lock(mutex);
+    const Totals& total = totals[static_cast<int>(priority)];
+    std::chrono::nanoseconds mean(0);
+    if(total.completed > 0){
+        mean = total.latency / total.completed;
+    }
+    return {total.completed, total.coalesced, total.promoted, mean, total.maxLatency};
+}
+
+void I2CScheduler::resetStats(){
+    std::lock_guard<std::mutex> lock(mutex);
+    for(Totals& total : totals){
+        total = {0, 0, 0, std::chrono::nanoseconds(0), std::chrono::nanoseconds(0)};
+    }
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -0,0 +1,254 @@
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Libraries ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+#include "i2c_stats.h"
+#include "i2c.h"
+
+#include <iomanip>   // For std::setw
+#include <algorithm> // For std::min, std::max
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ LatencyHistogram ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+LatencyHistogram::LatencyHistogram(){
+    reset();
+}
+
+// Bucket of a value: exact below 16, otherwise the power of two and the 16th of it the value falls in
+int LatencyHistogram::bucketOf(uint64_t value){
+    if(value < SUB_BUCKETS){
+        return static_cast<int>(value);
+    }
+    int exponent = 63 - __builtin_clzll(value);
+    if(exponent > MAX_EXPONENT){
+        return BUCKETS - 1;
+    }
+    int sub = static_cast<int>((value >> (exponent - SUB_BITS)) & (SUB_BUCKETS - 1));
+    return (exponent - SUB_BITS + 1) * SUB_BUCKETS + sub;
+}
+
+uint64_t LatencyHistogram::bucketLow(int bucket){
+    if(bucket < SUB_BUCKETS){
+        return bucket;
+    }
+    int exponent = bucket / SUB_BUCKETS + SUB_BITS - 1;
+    uint64_t sub = bucket % SUB_BUCKETS;
+    return (SUB_BUCKETS + sub) << (exponent - SUB_BITS);
+}
+
+uint64_t LatencyHistogram::bucketHigh(int bucket){
+    if(bucket < SUB_BUCKETS){
+        return bucket;
+    }
+    int exponent = bucket / SUB_BUCKETS + SUB_BITS - 1;
+    return bucketLow(bucket) + (uint64_t(1) << (exponent - SUB_BITS)) - 1;
+}
+
+void LatencyHistogram::record(std::chrono::nanoseconds latency){
+    uint64_t value = latency.count() > 0 ? latency.count() : 0;
+    counts[bucketOf(value)]++;
+    count++;
+    total += value;
+    minimum = std::min(minimum, value);
+    maximum = std::max(maximum, value);
+}
+
+void LatencyHistogram::reset(){
+    for(int i = 0; i < BUCKETS; i++){
+        counts[i] = 0;
+    }
+    count = 0;
+    total = 0;
+    minimum = UINT64_MAX;
+    maximum = 0;
+}
+
+uint64_t LatencyHistogram::getCount() const{
+    return count;
+}
+
+std::chrono::nanoseconds LatencyHistogram::getMin() const{
+    return std::chrono::nanoseconds(count > 0 ? minimum : 0);
+}
+
+std::chrono::nanoseconds LatencyHistogram::getMax() const{
+    return std::chrono::nanoseconds(maximum);
+}
+
+std::chrono::nanoseconds LatencyHistogram::getMean() const{
+    return std::chrono::nanoseconds(count > 0 ? total / count : 0);
+}
+
+// Upper edge of the bucket holding the percentile, capped at the largest value recorded
+std::chrono::nanoseconds LatencyHistogram::getPercentile(double percentile) const{
+
+    if(count == 0){
+        return std::chrono::nanoseconds(0);
+    }
+
+    // Rank of the value the percentile lands on (1 based)
+    uint64_t rank = static_cast<uint64_t>(percentile / 100.0 * count + 0.999999);
+    rank = std::max<uint64_t>(1, std::min(rank, count));
+
+    uint64_t seen = 0;
+    for(int i = 0; i < BUCKETS; i++){
+        seen += counts[i];
+        if(seen >= rank){
+            return std::chrono::nanoseconds(std::min(bucketHigh(i), maximum));
+        }
+    }
+    return std::chrono::nanoseconds(maximum);
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ I2CStats ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+I2CStats::I2CStats() : lastAddress(-1){
+    for(int i = 0; i < CHANNEL_SLOTS * ADDRESSES; i++){
+        devices[i] = nullptr;
+    }
+}
+
+I2CStats::~I2CStats(){
+    for(int i = 0; i < CHANNEL_SLOTS * ADDRESSES; i++){
+        delete devices[i];
+    }
+}
+
+// Counters of a device, created the first time it is addressed
+I2CDeviceStats* I2CStats::device(uint8_t channel, uint8_t address){
+
+    int slot = channel < I2C_MUX_CHANNELS ? channel : CHANNEL_SLOTS - 1;
+    I2CDeviceStats*& stats = devices[slot * ADDRESSES + (address & (ADDRESSES - 1))];
+    if(!stats){
+        stats = new I2CDeviceStats();
+        stats->channel = slot < I2C_MUX_CHANNELS ? channel : I2C_DIRECT;
+        stats->address = address;
+        stats->transactions = 0;
+        stats->bytesWritten = 0;
+        stats->bytesRead = 0;
+        stats->errors = 0;
+        stats->retries = 0;
+        stats->slaveSwitches = 0;
+    }
+    return stats;
+}
+
+/* One transaction
+ * Through the shared handle the bus is readdressed whenever it goes to another
+ * address than the last one, a device's dedicated handle never readdresses it.
+ */
+void I2CStats::record(uint8_t channel, uint8_t address, bool isRead, int bytesWritten, int bytesRead, bool ok, bool dedicated
+                    , std::chrono::nanoseconds latency){
+
+    I2CDeviceStats* stats = device(channel, address);
+    stats->transactions++;
+    stats->bytesWritten += bytesWritten;
+    stats->bytesRead += bytesRead;
+    if(!ok){
+        stats->errors++;
+    }
+    if(!dedicated && lastAddress != address){
+        stats->slaveSwitches++;
+        lastAddress = address;
+    }
+    if(isRead){
+        stats->readLatency.record(latency);
+    }
+    else{
+        stats->writeLatency.record(latency);
+    }
+}
+
+void I2CStats::recordRetry(uint8_t channel, uint8_t address){
+    device(channel, address)->retries++;
+}
+
+void I2CStats::forgetAddress(){
+    lastAddress = -1;
+}
+
+// Copies of every device seen so far
+std::vector<I2CDeviceStats> I2CStats::snapshot() const{
+    std::vector<I2CDeviceStats> copies;
+    for(int i = 0; i < CHANNEL_SLOTS * ADDRESSES; i++){
+        if(devices[i]){
+            copies.push_back(*devices[i]);
+        }
+    }
+    return copies;
+}
+
+// Forgets every device (the bus address is kept, it has not changed)
+void I2CStats::reset(){
+    for(int i = 0; i < CHANNEL_SLOTS * ADDRESSES; i++){
+        delete devices[i];
+        devices[i] = nullptr;
+    }
+}
+
+// One line per device, latencies in microseconds
+void I2CStats::print(const std::vector<I2CDeviceStats>& devices, std::ostream& out){
+
+    auto us = [](std::chrono::nanoseconds latency){ return latency.count() / 1000.0; };
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+
+    out << "  ch addr   transactions    written       read  errors retries switches | read p50/p99/max us | write p50/p99/max us" << std::endl;
+    out << std::fixed << std::setprecision(1);
+    for(const I2CDeviceStats& device : devices){
+        out << "  " << std::setw(2);
+        if(device.channel == I2C_DIRECT){
+            out << "-";
+        }
+        else{
+            out << static_cast<int>(device.channel);
+        }
+        out << " 0x" << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(device.address) << std::dec << std::setfill(' ')
+            << " " << std::setw(14) << device.transactions << " " << std::setw(10) << device.bytesWritten
+            << " " << std::setw(10) << device.bytesRead << " " << std::setw(7) << device.errors
+            << " " << std::setw(7) << device.retries << " " << std::setw(8) << device.slaveSwitches << " |";
+
+        const LatencyHistogram* histograms[] = {&device.readLatency, &device.writeLatency};
+        for(const LatencyHistogram* histogram : histograms){
+            if(histogram->getCount() == 0){
+                out << std::setw(22) << "-" << " |";
+                continue;
+            }
+            out << " " << std::setw(6) << us(histogram->getPercentile(50)) << "/" << std::setw(6) << us(histogram->getPercentile(99))
+                << "/" << std::setw(7) << us(histogram->getMax()) << " |";
+        }
+        out << std::endl;
+    }
+
+    out.flags(flags);
+    out.precision(precision);
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ I2CStatsDump ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+I2CStatsDump::I2CStatsDump(I2C* i2c, std::chrono::milliseconds period, std::ostream& out)
+    : i2c(i2c), period(period), out(out), stopping(false){
+    worker = std::thread(&I2CStatsDump::run, this);
+}
+
+I2CStatsDump::~I2CStatsDump(){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    worker.join();
+}
+
+// Dumps every period until stopped
+void I2CStatsDump::run(){
+    std::unique_lock<std::mutex> lock(mutex);
+    while(!wake.wait_for(lock, period, [this](){ return stopping; })){
+        out << "I2C bus statistics:" << std::endl;
+        I2CStats::print(i2c->getStats(), out);
+    }
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -0,0 +1,282 @@
+#include "io_uring_queue.h"
+
+#include <linux/io_uring.h> // For the ring layout and opcodes
+#include <sys/mman.h>       // For mmap, munmap
+#include <sys/syscall.h>    // For __NR_io_uring_setup, __NR_io_uring_enter
+#include <unistd.h>         // For syscall, close
+#include <cerrno>
+#include <cstring>          // For memset
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Syscalls ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+static int uringSetup(unsigned entries, io_uring_params* params){
+	return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int uringEnter(int ring, unsigned submit, unsigned minComplete, unsigned flags){
+	return static_cast<int>(syscall(__NR_io_uring_enter, ring, submit, minComplete, flags, nullptr, 0));
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Constructor/Destructor ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Sets up a ring and maps it, left closed if anything fails
+IoUringQueue::IoUringQueue(unsigned entries) : ring(-1), entries(0), sqMap(MAP_FAILED), sqMapSize(0), cqMap(MAP_FAILED), cqMapSize(0)
+                                             , sqes(MAP_FAILED), sqesSize(0), sqTail(nullptr), sqMask(nullptr), sqArray(nullptr)
+                                             , cqHead(nullptr), cqTail(nullptr), cqMask(nullptr), cqes(nullptr), ops(nullptr), count(0)
+                                             , chainStart(0), pending(0), nextOp(0), cancelling(false){
+
+	io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	ring = uringSetup(entries, &params);
+	if(ring < 0){
+		ring = -1;
+		return;
+	}
+
+	// Reads and writes at the file position (5.6), one mapping for both rings (5.4)
+	if(!(params.features & IORING_FEAT_RW_CUR_POS) || !(params.features & IORING_FEAT_SINGLE_MMAP)){
+		close(ring);
+		ring = -1;
+		return;
+	}
+
+	sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	if(cqMapSize > sqMapSize){
+		sqMapSize = cqMapSize;
+	}
+	sqMap = mmap(nullptr, sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+	sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+	sqes = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES);
+	if(sqMap == MAP_FAILED || sqes == MAP_FAILED){
+		if(sqMap != MAP_FAILED){
+			munmap(sqMap, sqMapSize);
+			sqMap = MAP_FAILED;
+		}
+		if(sqes != MAP_FAILED){
+			munmap(sqes, sqesSize);
+			sqes = MAP_FAILED;
+		}
+		close(ring);
+		ring = -1;
+		return;
+	}
+
+	char* sq = static_cast<char*>(sqMap);
+	sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+	sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+	sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+	cqHead = reinterpret_cast<unsigned*>(sq + params.cq_off.head);
+	cqTail = reinterpret_cast<unsigned*>(sq + params.cq_off.tail);
+	cqMask = reinterpret_cast<unsigned*>(sq + params.cq_off.ring_mask);
+	cqes = sq + params.cq_off.cqes;
+	this->entries = params.sq_entries;
+}
+
+IoUringQueue::~IoUringQueue(){
+	if(sqes != MAP_FAILED){
+		munmap(sqes, sqesSize);
+	}
+	if(sqMap != MAP_FAILED){
+		munmap(sqMap, sqMapSize);
+	}
+	if(ring >= 0){
+		close(ring);
+	}
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Batches ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+bool IoUringQueue::isOpen() const{
+	return ring >= 0;
+}
+
+int IoUringQueue::capacity() const{
+	return static_cast<int>(entries);
+}
+
+// user_data of the cancel entries, their completions are not ops
+static const uint64_t CANCEL_TAG = ~static_cast<uint64_t>(0);
+
+// Starts a batch, its first chain goes out now
+bool IoUringQueue::submit(I2CBusOp* ops, int count){
+
+	if(ring < 0 || this->ops || count <= 0 || count > capacity()){
+		return false;
+	}
+	cancelling.store(false);
+	nextOp.store(0);
+	{
+		std::lock_guard<std::mutex> lock(sqMutex);
+		this->ops = ops;
+		this->count = count;
+	}
+	if(!queueChain(0)){
+		std::lock_guard<std::mutex> lock(sqMutex);
+		this->ops = nullptr;
+		return false;
+	}
+	return true;
+}
+
+/* Queues ops first..count as one link chain and submits it in one syscall
+ * The chain keeps them in order. A soft link failure cancels everything after
+ * it, so progress() sends the runs after a failed one again. The ring is empty
+ * between chains, so the ops fit if the batch does.
+ */
+bool IoUringQueue::queueChain(int first){
+
+	std::lock_guard<std::mutex> lock(sqMutex);
+	if(ring < 0){
+		return false;
+	}
+	int length = count - first;
+	io_uring_sqe* entry = static_cast<io_uring_sqe*>(sqes);
+	unsigned tail = *sqTail;
+	for(int i = 0; i < length; i++){
+		I2CBusOp& op = ops[first + i];
+		unsigned index = (tail + i) & *sqMask;
+		io_uring_sqe& sqe = entry[index];
+		memset(&sqe, 0, sizeof(sqe));
+		sqe.opcode = op.isRead ? IORING_OP_READ : IORING_OP_WRITE;
+		sqe.fd = op.handle;
+		sqe.addr = reinterpret_cast<uint64_t>(op.buffer);
+		sqe.len = static_cast<uint32_t>(op.numBytes);
+		sqe.off = static_cast<uint64_t>(-1); // At the file position, i2c-dev has none
+		sqe.flags = i + 1 < length ? IOSQE_IO_LINK : 0;
+		sqe.user_data = static_cast<uint64_t>(first + i);
+		sqArray[index] = index;
+		op.result = -1;
+	}
+	__atomic_store_n(sqTail, tail + length, __ATOMIC_RELEASE);
+
+	chainStart = first;
+	nextOp.store(first);
+	pending = length;
+
+	// Entered until the kernel has taken the whole chain
+	int submitted = 0;
+	while(submitted < length){
+		int taken = uringEnter(ring, length - submitted, 0, 0);
+		if(taken < 0){
+			if(errno == EINTR || errno == EAGAIN || errno == EBUSY){
+				continue;
+			}
+			break;
+		}
+		submitted += taken;
+	}
+	if(submitted == 0){
+		// Nothing went out, the entries stay queued and the next enter would send them, so the ring is unusable
+		close(ring);
+		ring = -1;
+		pending = 0;
+		return false;
+	}
+	pending = submitted; // A refused tail of the chain never completes, its results stay -1
+	return true;
+}
+
+// Cancels one op by its user_data, the completion of the cancel itself is dropped (sqMutex held)
+void IoUringQueue::queueCancel(int op){
+	if(ring < 0){
+		return;
+	}
+	unsigned tail = *sqTail;
+	unsigned index = tail & *sqMask;
+	io_uring_sqe& sqe = static_cast<io_uring_sqe*>(sqes)[index];
+	memset(&sqe, 0, sizeof(sqe));
+	sqe.opcode = IORING_OP_ASYNC_CANCEL;
+	sqe.fd = -1;
+	sqe.addr = static_cast<uint64_t>(op); // user_data of the op to cancel
+	sqe.user_data = CANCEL_TAG;
+	sqArray[index] = index;
+	__atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+	while(uringEnter(ring, 1, 0, 0) < 0 && (errno == EINTR || errno == EAGAIN || errno == EBUSY)){}
+}
+
+/* Cancels the op running, which cancels the rest of the chain after it
+ * An op can complete before the cancel reaches it (a blocking transfer already
+ * on the wire finishes), then reap() cancels the next one.
+ */
+void IoUringQueue::cancel(){
+	cancelling.store(true);
+	std::lock_guard<std::mutex> lock(sqMutex);
+	if(ops){
+		queueCancel(nextOp.load());
+	}
+}
+
+// Takes the completions posted so far
+void IoUringQueue::reap(){
+	io_uring_cqe* entry = static_cast<io_uring_cqe*>(cqes);
+	unsigned head = *cqHead;
+	unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+	bool chase = false;
+	while(head != tail){
+		const io_uring_cqe& cqe = entry[head & *cqMask];
+		if(cqe.user_data < static_cast<uint64_t>(count) && ops){
+			ops[cqe.user_data].result = cqe.res == -ECANCELED ? I2C_OP_SKIPPED : cqe.res < 0 ? -1 : cqe.res;
+			nextOp.store(static_cast<int>(cqe.user_data) + 1);
+			chase = cqe.res != -ECANCELED;
+			pending--;
+		}
+		head++;
+	}
+	__atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+
+	// An op finished before the cancel got to it, the chain went on to the next one
+	if(chase && pending > 0 && cancelling.load()){
+		std::lock_guard<std::mutex> lock(sqMutex);
+		queueCancel(nextOp.load());
+	}
+}
+
+/* Reaps, then sends the runs after a failed op as a new chain
+ * The failed op's own linked run stays skipped. Nothing is sent again once
+ * the batch is cancelled.
+ */
+bool IoUringQueue::progress(){
+
+	reap();
+	if(pending > 0){
+		return false;
+	}
+
+	int next = count;
+	if(!cancelling.load()){
+		for(int i = chainStart; i < count; i++){
+			if(ops[i].result != ops[i].numBytes){
+				next = i;
+				while(next < count && ops[next].linked){
+					next++;
+				}
+				next++;
+				break;
+			}
+		}
+	}
+	if(next < count && queueChain(next)){
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(sqMutex);
+	ops = nullptr;
+	pending = 0;
+	return true;
+}
+
+void IoUringQueue::wait(){
+	while(ops && !progress()){
+		if(pending > 0 && uringEnter(ring, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR){
+			break;
+		}
+	}
+}
+
+bool IoUringQueue::poll(){
+	return !ops || progress();
+}
@@ -0,0 +1,113 @@
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Libraries ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+#include "joint_controller.h"
+
+#include <cmath>     // For std::fabs
+#include <algorithm> // For std::clamp
+#include <stdexcept> // For std::runtime_error
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Constructor ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+JointController::JointController(const ControllerParams& params) : params(params){
+
+    if(params.maxTrim < 0.0f || params.period < 0.0f || params.settleTolerance <= 0.0f){
+        throw std::runtime_error("Invalid joint controller parameters");
+    }
+    reset();
+}
+
+// Clears all state including the integral
+void JointController::reset(){
+    integral = 0.0f;
+    trim = 0.0f;
+    error = 0.0f;
+    sinceUpdate = params.period; // First call always runs the loop
+    updateCount = 0;
+    beginMotion();
+}
+
+// Restarts settle detection, the integral is kept so steady loads stay corrected
+void JointController::beginMotion(){
+    withinTime = 0.0f;
+    sinceTrajectoryEnd = 0.0f;
+    settled = false;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Loop ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Runs the loop, returns the angle to command (reference plus trim)
+float JointController::update(float reference, float referenceVelocity, float measured, float dt){
+
+    // Settle detection runs every call
+    error = reference - measured;
+    if(referenceVelocity == 0.0f){
+        sinceTrajectoryEnd += dt;
+    }
+    else{
+        sinceTrajectoryEnd = 0.0f;
+    }
+    if(std::fabs(error) <= params.settleTolerance){
+        withinTime += dt;
+        settled = withinTime >= params.settleTime;
+    }
+    else{
+        withinTime = 0.0f;
+        settled = false;
+    }
+
+    // The loop itself runs at its own rate
+    sinceUpdate += dt;
+    if(sinceUpdate < params.period){
+        return reference + trim;
+    }
+    float loopDt = sinceUpdate;
+    sinceUpdate = 0.0f;
+    updateCount++;
+
+    float feedforward = params.kv * referenceVelocity;
+    float proportional = params.kp * error;
+    float candidate = integral + params.ki * error * loopDt;
+    float unclamped = feedforward + proportional + candidate;
+
+    // Conditional integration: only integrate if it does not push further into saturation
+    if(!(unclamped > params.maxTrim && error > 0.0f) && !(unclamped < -params.maxTrim && error < 0.0f)){
+        integral = std::clamp(candidate, -params.maxTrim, params.maxTrim);
+    }
+
+    trim = std::clamp(feedforward + proportional + integral, -params.maxTrim, params.maxTrim);
+    return reference + trim;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ State ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Error within tolerance for settleTime
+bool JointController::isSettled() const{
+    return settled;
+}
+
+// Not settled settleTimeout after the trajectory ended
+bool JointController::isTimedOut() const{
+    return !settled && sinceTrajectoryEnd >= params.settleTimeout;
+}
+
+float JointController::getError() const{
+    return error;
+}
+
+float JointController::getTrim() const{
+    return trim;
+}
+
+uint64_t JointController::getUpdateCount() const{
+    return updateCount;
+}
+
+float JointController::getPeriod() const{
+    return params.period;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
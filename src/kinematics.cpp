@@ -0,0 +1,353 @@
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Libraries ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+#include "kinematics.h"
+
+#include <cmath>
+#include <algorithm>  // For std::clamp
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Constructor ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Constructor: Stores joint limits (radians), warm start begins at the middle of each range
+Kinematics::Kinematics(const float lower[NUM_JOINTS], const float upper[NUM_JOINTS], Clock* clock)
+        : maxIterations(IK_MAX_ITERATIONS), timeBudget(IK_TIME_BUDGET_US), clock(clock){
+
+    for(int i = 0; i < NUM_JOINTS; i++){
+        lowerLimit[i] = lower[i];
+        upperLimit[i] = upper[i];
+        lastSolution[i] = (lower[i] + upper[i]) / 2.0f;
+    }
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Helper Methods ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Clamps each joint into its limits
+void Kinematics::clampToLimits(float theta[NUM_JOINTS]){
+    for(int i = 0; i < NUM_JOINTS; i++){
+        theta[i] = std::clamp(theta[i], lowerLimit[i], upperLimit[i]);
+    }
+}
+
+/* Pose error of theta relative to the target
+ * error[0-2] is the position error (mm), error[3-5] is the rotation vector
+ * taking the current orientation to the target, scaled by IK_ORIENTATION_WEIGHT.
+ */
+void Kinematics::poseError(const Position& position, const Quaternion& orientation, const float theta[NUM_JOINTS], float error[6]){
+
+    Position current;
+    Quaternion currentOrientation;
+    forward(theta, current, currentOrientation);
+
+    error[0] = position.x - current.x;
+    error[1] = position.y - current.y;
+    error[2] = position.z - current.z;
+
+    // Rotation still needed, in the world frame
+    Quaternion q = orientation * currentOrientation.conjugate();
+    if(q.w < 0.0f){
+        q = Quaternion(-q.w, -q.x, -q.y, -q.z);
+    }
+    float sinHalf = sqrt(q.x * q.x + q.y * q.y + q.z * q.z);
+    float scale = (sinHalf > 1e-7f) ? 2.0f * atan2(sinHalf, q.w) / sinHalf : 2.0f;
+
+    error[3] = IK_ORIENTATION_WEIGHT * scale * q.x;
+    error[4] = IK_ORIENTATION_WEIGHT * scale * q.y;
+    error[5] = IK_ORIENTATION_WEIGHT * scale * q.z;
+}
+
+/* Analytic Jacobian of [position; weighted angular velocity] w.r.t. theta
+ * The wrist orientation is absolute, so joints 1-3 only move the position
+ * and joints 4-6 rotate about z, the rotated y axis and the tool z axis.
+ */
+void Kinematics::jacobian(const float theta[NUM_JOINTS], float J[6][NUM_JOINTS]){
+
+    float c1 = cos(theta[0]), s1 = sin(theta[0]);
+    float c2 = cos(theta[1]), s2 = sin(theta[1]);
+    float c23 = cos(theta[1] + theta[2]), s23 = sin(theta[1] + theta[2]);
+    float c4 = cos(theta[3]), s4 = sin(theta[3]);
+    float c5 = cos(theta[4]), s5 = sin(theta[4]);
+
+    float reach = A_2 * c2 + A_3 * c23;     // Wrist center distance in the XY plane
+    float dReach2 = -A_2 * s2 - A_3 * s23;  // d(reach)/d(theta2)
+    float dReach3 = -A_3 * s23;             // d(reach)/d(theta3)
+
+    // Position rows
+    J[0][0] = -s1 * reach;  J[1][0] = c1 * reach;  J[2][0] = 0.0f;
+    J[0][1] = c1 * dReach2; J[1][1] = s1 * dReach2; J[2][1] = A_2 * c2 + A_3 * c23;
+    J[0][2] = c1 * dReach3; J[1][2] = s1 * dReach3; J[2][2] = A_3 * c23;
+    J[0][3] = -D_6 * s4 * s5; J[1][3] = D_6 * c4 * s5; J[2][3] = 0.0f;
+    J[0][4] = D_6 * c4 * c5;  J[1][4] = D_6 * s4 * c5; J[2][4] = -D_6 * s5;
+    J[0][5] = 0.0f;           J[1][5] = 0.0f;          J[2][5] = 0.0f;
+
+    // Orientation rows
+    for(int i = 0; i < 3; i++){
+        J[3][i] = 0.0f; J[4][i] = 0.0f; J[5][i] = 0.0f;
+    }
+    J[3][3] = 0.0f;                          J[4][3] = 0.0f;                          J[5][3] = IK_ORIENTATION_WEIGHT;
+    J[3][4] = -IK_ORIENTATION_WEIGHT * s4;   J[4][4] = IK_ORIENTATION_WEIGHT * c4;    J[5][4] = 0.0f;
+    J[3][5] = IK_ORIENTATION_WEIGHT * c4 * s5; J[4][5] = IK_ORIENTATION_WEIGHT * s4 * s5; J[5][5] = IK_ORIENTATION_WEIGHT * c5;
+}
+
+// Evaluates how well theta reaches the target
+IKResult Kinematics::measure(const Position& position, const Quaternion& orientation, const float theta[NUM_JOINTS]){
+
+    float error[6];
+    poseError(position, orientation, theta, error);
+
+    IKResult result;
+    result.numerical = false;
+    result.iterations = 0;
+    result.positionError = sqrt(error[0] * error[0] + error[1] * error[1] + error[2] * error[2]);
+    result.orientationError = sqrt(error[3] * error[3] + error[4] * error[4] + error[5] * error[5]) / IK_ORIENTATION_WEIGHT;
+    result.status = (result.positionError <= IK_POSITION_TOLERANCE && result.orientationError <= IK_ORIENTATION_TOLERANCE)
+                    ? IKStatus::Converged : IKStatus::Failed;
+    return result;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Forward Kinematics ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Computes the end effector pose for the joint angles
+void Kinematics::forward(const float theta[NUM_JOINTS], Position& position, Quaternion& orientation){
+
+    // Wrist center
+    float reach = A_2 * cos(theta[1]) + A_3 * cos(theta[1] + theta[2]);
+    float height = A_2 * sin(theta[1]) + A_3 * sin(theta[1] + theta[2]);
+
+    // Tool z axis from the wrist angles
+    float s5 = sin(theta[4]);
+    float zAxis[3] = {std::cos(theta[3]) * s5, std::sin(theta[3]) * s5, std::cos(theta[4])};
+
+    position.x = cos(theta[0]) * reach + D_6 * zAxis[0];
+    position.y = sin(theta[0]) * reach + D_6 * zAxis[1];
+    position.z = height + D_1 + D_6 * zAxis[2];
+
+    orientation = Quaternion::fromEuler(theta[3], theta[4], theta[5]);
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Inverse Kinematics ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Solves with the selected solver, successful solutions become the next warm start
+IKResult Kinematics::solve(IKMode mode, const Position& position, const Quaternion& orientation, float theta[NUM_JOINTS]){
+
+    IKResult result;
+
+    if(mode == IKMode::Numerical){
+        result = solveNumerical(position, orientation, theta);
+    }
+    else if(solveClosedForm(position, orientation, theta)){
+        // Verify the decoupled answer actually reaches the pose
+        result = measure(position, orientation, theta);
+    }
+    else{
+        result = {IKStatus::Failed, false, 0, NAN, NAN};
+    }
+
+    // Fall back to the numerical solver when the closed form has no valid answer
+    if(mode == IKMode::Auto && result.status != IKStatus::Converged){
+        result = solveNumerical(position, orientation, theta);
+    }
+
+    if(result.status == IKStatus::Converged || result.numerical){
+        setWarmStart(theta);
+    }
+    return result;
+}
+
+/* Closed-form (decoupled) inverse kinematics
+ * Returns false when the wrist center is out of reach or a joint would leave its limits,
+ * in which case theta is left in an unspecified state.
+ */
+bool Kinematics::solveClosedForm(const Position& position, const Quaternion& orientation, float theta[NUM_JOINTS]){
+
+    // ~~ Calculate RDesired ~~
+    // Columns are the x, y and z axes of the end effector, no trig required
+    float RDesired[3][3];
+    orientation.toRotationMatrix(RDesired);
+
+    // ~~ Calculate wrist center ~~
+    // Back off from the end effector along its z axis
+
+    float wcX = position.x - D_6 * RDesired[0][2];
+    float wcY = position.y - D_6 * RDesired[1][2];
+    float wcZ = position.z - D_6 * RDesired[2][2] - D_1;
+
+    // ~~ Calculate Theta 1, 2, and 3 ~~
+
+    // Theta_1
+    theta[0] = atan2(wcY, wcX);
+
+    // r is the projection onto the XY plane
+    float r = sqrt(wcX * wcX + wcY * wcY);
+
+    // Distance from joint 2 to wrist center
+    float s = sqrt(r * r + wcZ * wcZ);
+
+    // Using the law of cosines for theta3, out of reach when |cos| > 1
+    float cosTheta3 = (s * s - A_2 * A_2 - A_3 * A_3) / (2 * A_2 * A_3);
+    if(!(std::fabs(cosTheta3) <= 1.0f)){
+        return false;
+    }
+    theta[2] = atan2(sqrt(1 - cosTheta3 * cosTheta3), cosTheta3); // elbow up
+
+    // Theta2
+    float alpha = atan2(wcZ, r); // angle to wrist center
+    float beta = atan2(A_3 * sin(theta[2]), A_2 + A_3 * cos(theta[2]));
+    theta[1] = alpha - beta;
+
+    // ~~ Calculate Theta 4, 5, and 6 ~~
+    // Z-Y-Z decomposition of RDesired, theta6 carries the roll about the tool axis
+
+    float sinTheta5 = sqrt(RDesired[0][2] * RDesired[0][2] + RDesired[1][2] * RDesired[1][2]);
+    theta[4] = atan2(sinTheta5, RDesired[2][2]);
+
+    if(sinTheta5 > 1e-6f){
+        theta[3] = atan2(RDesired[1][2], RDesired[0][2]);
+        theta[5] = atan2(RDesired[2][1], -RDesired[2][0]);
+    }
+    else{
+        // Wrist singularity: joints 4 and 6 share an axis, put all of the rotation on joint 4
+        theta[3] = atan2(RDesired[1][0], RDesired[0][0]);
+        theta[5] = 0.0f;
+    }
+
+    // Reject answers the servos cannot reach
+    for(int i = 0; i < NUM_JOINTS; i++){
+        if(!(theta[i] >= lowerLimit[i] && theta[i] <= upperLimit[i])){
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Damped least squares inverse kinematics
+ * dTheta = J^T (J J^T + lambda^2 I)^-1 e, warm-started from the last solution and
+ * bounded by both an iteration cap and a time budget on the clock. theta always holds the
+ * best iterate found, clamped to the joint limits.
+ */
+IKResult Kinematics::solveNumerical(const Position& position, const Quaternion& orientation, float theta[NUM_JOINTS]){
+
+    auto deadline = clock->now() + timeBudget;
+
+    float current[NUM_JOINTS];
+    float best[NUM_JOINTS];
+    for(int i = 0; i < NUM_JOINTS; i++){
+        current[i] = lastSolution[i];
+        best[i] = lastSolution[i];
+    }
+
+    IKResult result = {IKStatus::IterationLimit, true, 0, INFINITY, INFINITY};
+    float bestCost = INFINITY;
+    float error[6];
+    float J[6][NUM_JOINTS];
+
+    for(int iteration = 0; ; iteration++){
+
+        // Track the best iterate
+        poseError(position, orientation, current, error);
+        float positionError = sqrt(error[0] * error[0] + error[1] * error[1] + error[2] * error[2]);
+        float orientationError = sqrt(error[3] * error[3] + error[4] * error[4] + error[5] * error[5]) / IK_ORIENTATION_WEIGHT;
+        float cost = positionError + IK_ORIENTATION_WEIGHT * orientationError;
+
+        if(cost < bestCost){
+            bestCost = cost;
+            result.positionError = positionError;
+            result.orientationError = orientationError;
+            for(int i = 0; i < NUM_JOINTS; i++){
+                best[i] = current[i];
+            }
+        }
+
+        // Exit conditions
+        if(positionError <= IK_POSITION_TOLERANCE && orientationError <= IK_ORIENTATION_TOLERANCE){
+            result.status = IKStatus::Converged;
+            break;
+        }
+        if(iteration >= maxIterations){
+            result.status = IKStatus::IterationLimit;
+            break;
+        }
+        if(clock->now() >= deadline){
+            result.status = IKStatus::TimeLimit;
+            break;
+        }
+
+        // A = J J^T + lambda^2 I
+        jacobian(current, J);
+        double A[6][6];
+        for(int r = 0; r < 6; r++){
+            for(int c = 0; c <= r; c++){
+                double sum = (r == c) ? IK_DAMPING * IK_DAMPING : 0.0;
+                for(int k = 0; k < NUM_JOINTS; k++){
+                    sum += static_cast<double>(J[r][k]) * J[c][k];
+                }
+                A[r][c] = sum;
+                A[c][r] = sum;
+            }
+        }
+
+        // Solve A y = e with a Cholesky factorization (A is symmetric positive definite)
+        double L[6][6] = {};
+        for(int r = 0; r < 6; r++){
+            for(int c = 0; c <= r; c++){
+                double sum = A[r][c];
+                for(int k = 0; k < c; k++){
+                    sum -= L[r][k] * L[c][k];
+                }
+                L[r][c] = (r == c) ? sqrt(sum) : sum / L[c][c];
+            }
+        }
+        double y[6];
+        for(int r = 0; r < 6; r++){
+            double sum = error[r];
+            for(int k = 0; k < r; k++){
+                sum -= L[r][k] * y[k];
+            }
+            y[r] = sum / L[r][r];
+        }
+        for(int r = 5; r >= 0; r--){
+            double sum = y[r];
+            for(int k = r + 1; k < 6; k++){
+                sum -= L[k][r] * y[k];
+            }
+            y[r] = sum / L[r][r];
+        }
+
+        // dTheta = J^T y
+        for(int i = 0; i < NUM_JOINTS; i++){
+            double step = 0.0;
+            for(int r = 0; r < 6; r++){
+                step += J[r][i] * y[r];
+            }
+            current[i] += static_cast<float>(step);
+        }
+        clampToLimits(current);
+        result.iterations = iteration + 1;
+    }
+
+    for(int i = 0; i < NUM_JOINTS; i++){
+        theta[i] = best[i];
+    }
+    return result;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Configuration ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Sets the starting point of the next numerical solve
+void Kinematics::setWarmStart(const float theta[NUM_JOINTS]){
+    for(int i = 0; i < NUM_JOINTS; i++){
+        lastSolution[i] = theta[i];
+    }
+}
+
+// Sets the iteration cap and wall clock budget of the numerical solver
+void Kinematics::setLimits(int maxIterations, std::chrono::microseconds timeBudget){
+    this->maxIterations = maxIterations;
+    this->timeBudget = timeBudget;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
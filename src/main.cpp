@@ -5,18 +5,17 @@ int main()
 {
     RoboticArmBuilder robot;
 
+    Orientation orientation = {0, 270, 0}; // {pitch, yaw, roll}
 
-    robot.setOrientation(0, 270, 0);
-
-    robot.setEndPosition(100, -50, 200);
+    robot.setEE({100, -50, 200}, orientation);
 
     sleep(5);
 
-    robot.setEndPosition(100, 0, 200);
+    robot.moveLinear({100, 0, 200}, orientation);
 
     sleep(5);
 
-    robot.setEndPosition(100, 50, 200);
+    robot.moveLinear({100, 50, 200}, orientation);
 
 
     return 0;
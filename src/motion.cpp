@@ -0,0 +1,522 @@
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Libraries ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+#include "motion.h"
+#include "servo.h"
+#include "estop.h"
+#include "config.h"
+
+#include <atomic>
+#include <iostream>
+#include <algorithm>  // For std::find
+#include <stdexcept>  // For std::runtime_error
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ MotionState ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+MotionState::MotionState() : status(MotionStatus::Running){}
+
+// Completes the motion and runs the callbacks, later calls are ignored
+void MotionState::complete(MotionStatus result){
+
+    std::vector<std::function<void()>> toRun;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(status != MotionStatus::Running){
+            return;
+        }
+        status = result;
+        toRun.swap(callbacks);
+        cancelHook = nullptr;
+        driver = nullptr;
+    }
+    finished.notify_all();
+
+    // Callbacks run without the lock, they may start new motions
+    for(auto& callback : toRun){
+        callback();
+    }
+}
+
+// Stores a callback to run on completion, false if already complete
+bool MotionState::addCallback(std::function<void()> callback){
+    std::lock_guard<std::mutex> lock(mutex);
+    if(status != MotionStatus::Running){
+        return false;
+    }
+    callbacks.push_back(std::move(callback));
+    return true;
+}
+
+// Hooks and drivers are only stored while running, complete() has already dropped them
+void MotionState::setCancelHook(std::function<void()> hook){
+    std::lock_guard<std::mutex> lock(mutex);
+    if(status == MotionStatus::Running){
+        cancelHook = std::move(hook);
+    }
+}
+
+void MotionState::setDriver(MotionDriver driver){
+    std::lock_guard<std::mutex> lock(mutex);
+    if(status == MotionStatus::Running){
+        this->driver = std::move(driver);
+    }
+}
+
+MotionDriver MotionState::getDriver(){
+    std::lock_guard<std::mutex> lock(mutex);
+    return driver;
+}
+
+// Asks the owner to stop the motion, completes it as cancelled either way
+void MotionState::cancel(){
+    std::function<void()> hook;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        hook = cancelHook;
+    }
+    if(hook){
+        hook();
+    }
+    complete(MotionStatus::Cancelled);
+}
+
+MotionStatus MotionState::getStatus(){
+    std::lock_guard<std::mutex> lock(mutex);
+    return status;
+}
+
+// Waits for completion, running the engine's ticks here when it has no thread
+void MotionState::wait(){
+    MotionDriver drive = getDriver();
+    if(drive){
+        drive([this]{ return getStatus() != MotionStatus::Running; }, std::chrono::nanoseconds::max());
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [this]{ return status != MotionStatus::Running; });
+}
+
+// Waits for completion up to the timeout, on the engine's clock when it has no thread
+bool MotionState::waitFor(std::chrono::milliseconds timeout){
+    MotionDriver drive = getDriver();
+    if(drive){
+        drive([this]{ return getStatus() != MotionStatus::Running; }, timeout);
+        return getStatus() != MotionStatus::Running;
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    return finished.wait_for(lock, timeout, [this]{ return status != MotionStatus::Running; });
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ MotionHandle ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Already completed handle
+MotionHandle::MotionHandle() : state(std::make_shared<MotionState>()){
+    state->complete(MotionStatus::Completed);
+}
+
+MotionHandle::MotionHandle(std::shared_ptr<MotionState> state) : state(std::move(state)){}
+
+void MotionHandle::wait(){
+    state->wait();
+}
+
+bool MotionHandle::waitFor(std::chrono::milliseconds timeout){
+    return state->waitFor(timeout);
+}
+
+bool MotionHandle::isDone(){
+    return state->getStatus() != MotionStatus::Running;
+}
+
+MotionStatus MotionHandle::status(){
+    return state->getStatus();
+}
+
+void MotionHandle::cancel(){
+    state->cancel();
+}
+
+bool MotionHandle::onComplete(std::function<void()> callback){
+    return state->addCallback(std::move(callback));
+}
+
+/* Completes when every handle has completed
+ * The result is Completed only if every motion completed, cancelling it cancels them all.
+ */
+MotionHandle MotionHandle::whenAll(const std::vector<MotionHandle>& handles){
+
+    auto combined = std::make_shared<MotionState>();
+    auto remaining = std::make_shared<std::atomic<int>>(static_cast<int>(handles.size()) + 1);
+    auto allCompleted = std::make_shared<std::atomic<bool>>(true);
+
+    // Called once per child plus once after registration, so an empty list completes immediately
+    auto childDone = [combined, remaining, allCompleted](MotionStatus result){
+        if(result != MotionStatus::Completed){
+            *allCompleted = false;
+        }
+        if(--(*remaining) == 0){
+            combined->complete(*allCompleted ? MotionStatus::Completed : MotionStatus::Cancelled);
+        }
+    };
+
+    std::vector<std::shared_ptr<MotionState>> children;
+    for(const MotionHandle& handle : handles){
+        std::shared_ptr<MotionState> child = handle.state;
+        children.push_back(child);
+
+        // Waiting on the combined handle runs the children's engine when it has no thread
+        MotionDriver drive = child->getDriver();
+        if(drive){
+            combined->setDriver(drive);
+        }
+        if(!child->addCallback([child, childDone]{ childDone(child->getStatus()); })){
+            childDone(child->getStatus());
+        }
+    }
+
+    combined->setCancelHook([children]{
+        for(auto& child : children){
+            child->cancel();
+        }
+    });
+    childDone(MotionStatus::Completed);
+
+    return MotionHandle(combined);
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ MotionEngine ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Constructor: Starts the control thread at the configured tick period
+MotionEngine::MotionEngine() : MotionEngine(std::chrono::microseconds(MOTION_TICK_PERIOD_US)){}
+
+// Constructor: Starts the control thread, none on a virtual clock (waiting on a handle runs the ticks)
+MotionEngine::MotionEngine(std::chrono::microseconds tickPeriod, Clock* clock)
+        : stopping(false), tickPeriod(tickPeriod), clock(clock), nextTick(clock->now()){
+    if(!clock->isVirtual()){
+        worker = std::thread(&MotionEngine::controlThread, this);
+    }
+}
+
+// Destructor: Stops the control thread and cancels anything still moving
+MotionEngine::~MotionEngine(){
+
+    std::vector<std::shared_ptr<MotionState>> pending;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        for(Servo* servo : active){
+            pending.push_back(servo->motion);
+            servo->motion.reset();
+        }
+        active.clear();
+    }
+    wake.notify_all();
+    if(worker.joinable()){
+        worker.join();
+    }
+
+    for(auto& motion : pending){
+        motion->complete(MotionStatus::Cancelled);
+    }
+}
+
+// Shared engine for servos built without one
+MotionEngine* MotionEngine::defaultEngine(){
+    static MotionEngine engine;
+    return &engine;
+}
+
+// Thread that steps every active servo once per tick
+void MotionEngine::controlThread(){
+
+    std::unique_lock<std::mutex> lock(mutex);
+    nextTick = clock->now();
+
+    while(!stopping){
+
+        // Sleep until there is something to move
+        if(active.empty()){
+            wake.wait(lock, [this]{ return stopping || !active.empty(); });
+            nextTick = clock->now();
+            continue;
+        }
+
+        tick(lock);
+
+        // Wait for the next tick, skipping ticks we have fallen behind on
+        nextTick += tickPeriod;
+        if(nextTick < clock->now()){
+            nextTick = clock->now();
+        }
+        wake.wait_until(lock, nextTick, [this]{ return stopping; });
+    }
+}
+
+/* Steps every active servo due at the current time and completes the finished motions (called with the lock held)
+ * With an output flush the steps only stage the pulses, the flush writes them
+ * before any motion is judged, and a failed flush fails every servo it carried.
+ */
+void MotionEngine::tick(std::unique_lock<std::mutex>& lock){
+
+    auto now = clock->now();
+    std::vector<std::pair<std::shared_ptr<MotionState>, MotionStatus>> finished;
+
+    // Step no more often than each servo's own rotation step period
+    bool stepped = false;
+    for(Servo* servo : active){
+        servo->stepped = false;
+        if(EmergencyStop::isLatched() || now < servo->nextStepTime){
+            continue;
+        }
+        // Bus failures come back as a status, only a throwing feedback callback can still raise
+        try{
+            std::lock_guard<std::mutex> pcaLock(Servo::pcaMutex);
+            servo->stepStatus = servo->step();
+        }
+        catch(const std::exception& e){
+            std::cerr << "Servo feedback failed: " << e.what() << std::endl;
+            servo->stepStatus = I2CStatus::Failed;
+        }
+        servo->stepped = true;
+        servo->nextStepTime = now + servo->stepPeriod();
+        stepped = true;
+    }
+
+    // The tick's outputs go out together
+    if(flush && stepped){
+        I2CStatus status;
+        {
+            std::lock_guard<std::mutex> pcaLock(Servo::pcaMutex);
+            status = flush();
+        }
+        if(status != I2CStatus::Ok){
+            for(Servo* servo : active){
+                if(servo->stepped && servo->stepStatus == I2CStatus::Ok){
+                    servo->stepStatus = status;
+                }
+            }
+        }
+    }
+
+    for(auto it = active.begin(); it != active.end();){
+        Servo* servo = *it;
+        MotionStatus result = MotionStatus::Running;
+
+        // Emergency stop: hold every servo where it is
+        if(EmergencyStop::isLatched() && !servo->stepped){
+            servo->targetAngle = servo->currentAngle;
+            result = MotionStatus::Stopped;
+        }
+        else if(servo->stepped){
+            I2CStatus status = servo->stepStatus;
+            if(status != I2CStatus::Ok){
+                // The bus refuses writes once the emergency stop latches mid-tick, anything else failed past its retries
+                servo->targetAngle = servo->currentAngle;
+                result = status == I2CStatus::Refused || EmergencyStop::isLatched() ? MotionStatus::Stopped : MotionStatus::Cancelled;
+                if(result == MotionStatus::Cancelled){
+                    std::cerr << "Servo motion failed: " << i2cStatusName(status) << std::endl;
+                }
+            }
+        }
+
+        // Checks to see if we've reached the target
+        if(result == MotionStatus::Running && servo->motionDone()){
+            result = MotionStatus::Completed;
+        }
+
+        if(result != MotionStatus::Running){
+            finished.emplace_back(servo->motion, result);
+            servo->motion.reset();
+            it = active.erase(it);
+        }
+        else{
+            ++it;
+        }
+    }
+
+    // Complete without the lock, callbacks may start new motions
+    if(!finished.empty()){
+        lock.unlock();
+        for(auto& motion : finished){
+            motion.first->complete(motion.second);
+        }
+        lock.lock();
+    }
+}
+
+// Starts (or retargets) a servo motion, a motion already in progress is completed as cancelled
+MotionHandle MotionEngine::move(Servo* servo, float angle){
+
+    auto motion = std::make_shared<MotionState>();
+    std::shared_ptr<MotionState> superseded;
+
+    // Nothing moves while the emergency stop is latched
+    if(EmergencyStop::isLatched()){
+        motion->complete(MotionStatus::Stopped);
+        return MotionHandle(motion);
+    }
+
+    // Installed before the motion is published, the control thread may complete it right away
+    motion->setCancelHook([this, servo, weak = std::weak_ptr<MotionState>(motion)]{
+        if(auto current = weak.lock()){
+            cancel(servo, current);
+        }
+    });
+    if(clock->isVirtual()){
+        motion->setDriver([this](const std::function<bool()>& done, std::chrono::nanoseconds timeout){
+            runUntil(done, timeout);
+        });
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        // Sets target
+        servo->targetAngle = angle;
+        servo->startTime = clock->now();
+        servo->nextStepTime = servo->startTime;
+        servo->clockwise = !(angle < servo->currentAngle);
+        if(servo->controller){
+            servo->controller->beginMotion();
+        }
+
+        superseded = servo->motion;
+        servo->motion = motion;
+        if(active.empty()){
+            nextTick = servo->startTime;
+        }
+        if(std::find(active.begin(), active.end(), servo) == active.end()){
+            active.push_back(servo);
+        }
+    }
+    wake.notify_all();
+
+    if(superseded){
+        superseded->complete(MotionStatus::Cancelled);
+    }
+
+    return MotionHandle(motion);
+}
+
+// Stops a motion where it is, if it is still the servo's current motion
+void MotionEngine::cancel(Servo* servo, const std::shared_ptr<MotionState>& motion){
+    std::lock_guard<std::mutex> lock(mutex);
+    if(servo->motion != motion){
+        return;
+    }
+    servo->targetAngle = servo->currentAngle;
+    servo->motion.reset();
+    active.erase(std::remove(active.begin(), active.end(), servo), active.end());
+}
+
+// Cancels and forgets a servo's motion (called when a servo is destroyed)
+void MotionEngine::release(Servo* servo){
+    std::shared_ptr<MotionState> motion;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        motion = servo->motion;
+        servo->motion.reset();
+        active.erase(std::remove(active.begin(), active.end(), servo), active.end());
+    }
+    if(motion){
+        motion->complete(MotionStatus::Cancelled);
+    }
+}
+
+/* Swaps a servo's controller and feedback between steps
+ * The control thread reads both while stepping, under the lock. Once this
+ * returns the old controller is no longer used and can be deleted.
+ */
+void MotionEngine::setFeedback(Servo* servo, JointController* controller, std::function<bool(float&)> feedback){
+    std::lock_guard<std::mutex> lock(mutex);
+    servo->controller = controller;
+    servo->feedback.swap(feedback);
+    if(controller){
+        controller->reset();
+    }
+}
+
+// Servos stage their outputs while stepping, the flush writes them after each tick
+void MotionEngine::setOutputFlush(std::function<I2CStatus()> flush){
+    std::lock_guard<std::mutex> lock(mutex);
+    this->flush = std::move(flush);
+}
+
+// Called by the servos while they step (lock held)
+bool MotionEngine::isStaging(){
+    return static_cast<bool>(flush);
+}
+
+// Takes effect from the next tick (one already scheduled keeps its time)
+void MotionEngine::setTickPeriod(std::chrono::microseconds tickPeriod){
+    std::lock_guard<std::mutex> lock(mutex);
+    this->tickPeriod = tickPeriod;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Virtual Time ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Jumps the clock to the next tick and runs it, false if nothing is moving
+bool MotionEngine::step(){
+
+    if(!clock->isVirtual()){
+        throw std::runtime_error("Only an engine on a virtual clock can be stepped");
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    if(active.empty()){
+        return false;
+    }
+    clock->sleepUntil(nextTick);
+    tick(lock);
+
+    // Time spent on the bus during the tick may already have passed the next one
+    nextTick += tickPeriod;
+    if(nextTick < clock->now()){
+        nextTick = clock->now();
+    }
+    return true;
+}
+
+/* Runs ticks until done() holds, nothing is moving, or the next tick is past the timeout
+ * A timeout leaves the clock at exactly the timeout, as a real wait would.
+ */
+void MotionEngine::runUntil(const std::function<bool()>& done, std::chrono::nanoseconds timeout){
+
+    Clock::TimePoint start = clock->now();
+    while(!done()){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(active.empty()){
+                return;
+            }
+            if(nextTick - start > timeout){
+                clock->sleepUntil(start + timeout);
+                return;
+            }
+        }
+        step();
+    }
+}
+
+// Runs the ticks due within duration, the clock ends exactly duration later even when nothing is moving
+void MotionEngine::runFor(std::chrono::nanoseconds duration){
+    Clock::TimePoint end = clock->now() + duration;
+    runUntil([]{ return false; }, duration);
+    clock->sleepUntil(end);
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Getters ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+std::chrono::microseconds MotionEngine::getTickPeriod(){
+    std::lock_guard<std::mutex> lock(mutex);
+    return tickPeriod;
+}
+
+Clock* MotionEngine::getClock(){
+    return clock;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
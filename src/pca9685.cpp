@@ -3,32 +3,56 @@
 
 #include "pca9685.h"
 #include "i2c.h"
+#include "i2c_batch.h"
+#include "estop.h"
 #include <stdexcept>   // For std::runtime_error
 #include <vector>
+#include <array>
 #include <cmath> // For round()
 #include <iostream>
+#include <string>
 
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // ~~ Constructor/Destructor ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
 // Constructor: Creates and initializes object
-PCA9685::PCA9685(I2C* i2cPtr, uint8_t addr, uint8_t prescaler) : i2c(i2cPtr), address(addr){
+PCA9685::PCA9685(I2C* i2cPtr, uint8_t addr, uint8_t prescaler) : i2c(i2cPtr), address(addr), staged(0){
     
-    // Attempts to register PCA9685 into i2c object, returns error if it fails
-    if(!i2c->registerSlave(address)){
+    // Attempts to bind PCA9685 to the i2c object, returns error if it fails
+    device = i2c->bind(address);
+    if(!device.isBound()){
         throw std::runtime_error("Failed to add PCA9685 to i2c");
     }
     
     // Preprocessing for PWM calculations
-    stepSize = calculateStepSize(prescaler);
+    this->prescaler = prescaler;
+    stepSize = stepSizeFor(prescaler);
 
-    // Set the prescaler to the default value and switch all channels off
+    // Set the prescaler to the default value, start the oscillator (asleep from power-on) and switch all channels off
     setPrescaler(prescaler);
+    wake();
     allOff();
+
+    // Auto-increment for bursts, then the ON registers as the board has them
+    modifyReg(MODE1_REG, MODE1_AI, MODE1_AI);
+    std::array<uint8_t, 64> leds = device.readRegisters<64>(LED0_ON_L_REG);
+    for(int channel = 0; channel < 16; channel++){
+        onBytes[2 * channel] = leds[4 * channel];
+        onBytes[2 * channel + 1] = leds[4 * channel + 1];
+    }
+
+    // Outputs get cut by the emergency stop
+    EmergencyStop::registerBoard(this);
 }
 
 // Destructor
 PCA9685::~PCA9685(){
+    EmergencyStop::unregisterBoard(this);
+
+    // Outputs were already cut, and the bus refuses writes while latched
+    if(EmergencyStop::isLatched()){
+        return;
+    }
     allOff();
     sleep();
 }
@@ -36,28 +60,71 @@ PCA9685::~PCA9685(){
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // ~~ Helper methods ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
-// Writes a value to a register
+// Writes a value to a register, throws error if failure
 void PCA9685::writeReg(uint8_t reg, uint8_t value){
-    // Creates buffer
+    I2CStatus status = tryWriteReg(reg, value);
+    if(status != I2CStatus::Ok){
+        throw std::runtime_error(std::string("Failed to write value to PCA9685 register: ") + i2cStatusName(status));
+    }
+}
+
+// Writes a value to a register without throwing
+I2CStatus PCA9685::tryWriteReg(uint8_t reg, uint8_t value) noexcept{
+    // Sends two bytes to PCA containing register and value to update
     uint8_t buffer[2] = {reg, value};
-    
-    // Sends two bytes to PCA containing register and value to update, throws error if failure
-    if(!i2c -> write(address, buffer, 2)){
-        throw std::runtime_error("Failed to write value to register");
+    I2CStatus status = device.tryWrite(buffer);
+    if(status == I2CStatus::Ok){
+        track(reg, value);
     }
+    return status;
 }
 
-// Reads a value from a register
-uint8_t PCA9685::readReg(uint8_t reg){
-    
-    // Sends one bytes to PCA containing register to set for reading, throws error if failure
-    if(!i2c -> write(address, &reg, 1)){
-        throw std::runtime_error("Failed to setup register for reading");
+// Keeps the copy of the ON registers in step with a register write, ALL_LED writes go to every channel
+void PCA9685::track(uint8_t reg, uint8_t value){
+    if(reg >= LED0_ON_L_REG && reg < LED0_ON_L_REG + 64 && (reg - LED0_ON_L_REG) % 4 < 2){
+        int offset = reg - LED0_ON_L_REG;
+        onBytes[2 * (offset / 4) + offset % 4] = value;
     }
-    
-    std::vector<uint8_t> buffer = i2c -> read(address, 1);
-    return buffer[0];
-    
+    else if(reg == ALL_LED_ON_L || reg == ALL_LED_ON_H){
+        for(int channel = 0; channel < 16; channel++){
+            onBytes[2 * channel + (reg - ALL_LED_ON_L)] = value;
+        }
+    }
+}
+
+// Finds the next run of neighbouring staged channels, starting at first
+bool PCA9685::nextRun(int& first, int& last){
+    while(first < 16 && !((staged >> first) & 1)){
+        first++;
+    }
+    if(first >= 16){
+        return false;
+    }
+    last = first;
+    while(last + 1 < 16 && ((staged >> (last + 1)) & 1)){
+        last++;
+    }
+    return true;
+}
+
+/* Fills the write of a run of staged channels: the pointer at the first one's
+ * LEDn_ON_L, then ON_L, ON_H, OFF_L, OFF_H of each (auto-increment walks them)
+ */
+int PCA9685::burst(int first, int last, uint8_t* buffer){
+    int length = 0;
+    buffer[length++] = LED0_ON_L_REG + 4 * first;
+    for(int channel = first; channel <= last; channel++){
+        buffer[length++] = onBytes[2 * channel];
+        buffer[length++] = onBytes[2 * channel + 1];
+        buffer[length++] = stagedOff[channel] & 0x00FF;
+        buffer[length++] = (stagedOff[channel] >> 8) & 0x0F;
+    }
+    return length;
+}
+
+// Reads a value from a register, the pointer write and the read go out as one request
+uint8_t PCA9685::readReg(uint8_t reg){
+    return device.readRegisters<1>(reg)[0];
 }
 
 // Modifies specific bits in a register without overwriting the entire register.
@@ -77,12 +144,20 @@ void PCA9685::setPrescaler(uint8_t value){
     
     validatePrescaler(value);
 
-    stepSize = calculateStepSize(value);
-    sleep();
+    prescaler = value;
+    stepSize = stepSizeFor(value);
+
+    // PRESCALE only takes writes while the oscillator sleeps, a board already asleep stays asleep
+    uint8_t mode = readReg(MODE1_REG);
+    if(!(mode & MODE1_SLEEP)){
+        writeReg(MODE1_REG, mode | MODE1_SLEEP);
+    }
     
     writeReg(PRESCALE_REG, value);
     
-    wake();
+    if(!(mode & MODE1_SLEEP)){
+        writeReg(MODE1_REG, mode);
+    }
 }
 
 /* Calculates the register for a channel
@@ -97,10 +172,6 @@ uint8_t PCA9685::getRegister(uint8_t channel, uint8_t on, uint8_t high){
     
 }
 
-float PCA9685::calculateStepSize(uint8_t prescaler){
-    return (static_cast<float>(prescaler) + 1.0f) / 25.0f;
-}
-
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // ~~ Input validation ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
@@ -133,7 +204,7 @@ void PCA9685::validateChannel(uint8_t channel){
 
 // Sets Prescaler given frequency in Hz
 void PCA9685::setPWMFrequency(int freq){
-    setPrescaler(uint8_t(round(25000000.0/(4096.0 * freq)) - 1));
+    setPrescaler(prescalerFor(freq));
 }
 
 // Switches ALL_LED_OFF - off (Effectively turning on ALL channels)
@@ -146,14 +217,58 @@ void PCA9685::allOff(){
     modifyReg(ALL_LED_OFF_H, 0x10, 0x10);
 }
 
+/* Sets the full OFF bit of ALL_LED_OFF_H directly (Effectively turning off ALL channels)
+ * One write with no read-modify-write, full OFF takes precedence over every ON setting.
+ */
+bool PCA9685::emergencyOff(){
+    uint8_t buffer[2] = {ALL_LED_OFF_H, 0x10};
+    return i2c -> writeEmergency(address, buffer, 2);
+}
+
 // Puts the PCA9685 into sleep mode
 void PCA9685::sleep(){
-    modifyReg(MODE1_REG, 0x10, 0x10);
+    modifyReg(MODE1_REG, MODE1_SLEEP, MODE1_SLEEP);
 }
 
 // Takes the PCA9685 out of sleep mode
 void PCA9685::wake(){
-    modifyReg(MODE1_REG, 0x10, 0x00);
+    modifyReg(MODE1_REG, MODE1_SLEEP, 0x00);
+}
+
+// MODE1 as the board has it
+uint8_t PCA9685::getMode(){
+    return readReg(MODE1_REG);
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Addressing ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Answers writes to the all-call address as well as its own, the register holds it shifted left one
+void PCA9685::setAllCallAddress(uint8_t addr){
+    writeReg(ALLCALLADR_REG, addr << 1);
+    modifyReg(MODE1_REG, MODE1_ALLCALL, MODE1_ALLCALL);
+}
+
+// Stops answering the all-call address
+void PCA9685::disableAllCall(){
+    modifyReg(MODE1_REG, MODE1_ALLCALL, 0x00);
+}
+
+// Answers writes to a sub-address (1 - 3)
+void PCA9685::setSubAddress(uint8_t index, uint8_t addr){
+    if(index < 1 || index > 3){
+        throw std::runtime_error("Failed to validate Sub-address");
+    }
+    writeReg(SUBADR1_REG + index - 1, addr << 1);
+    modifyReg(MODE1_REG, MODE1_SUB1 >> (index - 1), MODE1_SUB1 >> (index - 1));
+}
+
+// Stops answering a sub-address (1 - 3)
+void PCA9685::disableSubAddress(uint8_t index){
+    if(index < 1 || index > 3){
+        throw std::runtime_error("Failed to validate Sub-address");
+    }
+    modifyReg(MODE1_REG, MODE1_SUB1 >> (index - 1), 0x00);
 }
 
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -218,8 +333,26 @@ void PCA9685::setDuty(uint8_t channel, float duty){
 // Sets ONLY the offTime
 void PCA9685::setOffTime(uint8_t channel, uint16_t offTime){
     
-    // Get Register Addresses
-    uint8_t offLowReg = getRegister(channel, 0, 0);
+    validateChannel(channel);
+    
+    I2CStatus status = trySetOffTime(channel, offTime);
+    if(status != I2CStatus::Ok){
+        throw std::runtime_error(std::string("Failed to set PCA9685 off time: ") + i2cStatusName(status));
+    }
+}
+
+// Sets ONLY the offTime without throwing, Failed for a channel above 15
+I2CStatus PCA9685::trySetOffTime(uint8_t channel, uint16_t offTime) noexcept{
+    
+    if(channel > 15){
+        return I2CStatus::Failed;
+    }
+
+    // Written now, a staged value would overwrite it on the next flush
+    staged &= ~(1 << channel);
+    
+    // Get Register Addresses (LEDn_OFF_L)
+    uint8_t offLowReg = 0x08 + (channel * 4);
     uint8_t offHighReg = offLowReg + 1;
     
     // Seperate input into bytes
@@ -227,8 +360,24 @@ void PCA9685::setOffTime(uint8_t channel, uint16_t offTime){
     uint8_t offHighByte = (offTime >> 8) & 0x0F;
     
     // Write values to registers
-    writeReg(offLowReg,offLowByte);
-    writeReg(offHighReg,offHighByte);
+    I2CStatus status = tryWriteReg(offLowReg,offLowByte);
+    if(status != I2CStatus::Ok){
+        return status;
+    }
+    return tryWriteReg(offHighReg,offHighByte);
+}
+
+// Queues the same two register writes as trySetOffTime, they go out when the caller submits the batch
+bool PCA9685::queueOffTime(I2CBatch& batch, uint8_t channel, uint16_t offTime){
+
+    if(channel > 15 || batch.size() + 2 > I2C_BATCH_OPS){
+        return false;
+    }
+
+    uint8_t offLowReg = 0x08 + (channel * 4);
+    uint8_t low[2] = {offLowReg, static_cast<uint8_t>(offTime & 0x00FF)};
+    uint8_t high[2] = {static_cast<uint8_t>(offLowReg + 1), static_cast<uint8_t>((offTime >> 8) & 0x0F)};
+    return batch.write(device, low) && batch.write(device, high);
 }
 
 // Sets ONLY the onTime
@@ -247,3 +396,110 @@ void PCA9685::setOnTime(uint8_t channel, uint16_t onTime){
     writeReg(onHighReg,onHighByte);
 }
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Bursts ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Stages an off time for the next flush, a later one for the same channel replaces it
+bool PCA9685::stageOffTime(uint8_t channel, uint16_t offTime) noexcept{
+    if(channel > 15){
+        return false;
+    }
+    stagedOff[channel] = offTime;
+    staged |= 1 << channel;
+    return true;
+}
+
+bool PCA9685::hasStaged(){
+    return staged != 0;
+}
+
+// Writes each run of staged channels in one transaction
+I2CStatus PCA9685::flush() noexcept{
+
+    I2CStatus result = I2CStatus::Ok;
+    uint8_t buffer[1 + 4 * 16];
+    int first = 0;
+    int last = 0;
+    while(nextRun(first, last)){
+        int length = burst(first, last, buffer);
+        I2CStatus status = device.tryWrite(buffer, length);
+        if(status != I2CStatus::Ok && result == I2CStatus::Ok){
+            result = status;
+        }
+        first = last + 1;
+    }
+    staged = 0;
+    return result;
+}
+
+// Queues the same writes as flush, they go out when the caller submits the batch
+bool PCA9685::queueFlush(I2CBatch& batch){
+
+    int runs = 0;
+    int first = 0;
+    int last = 0;
+    while(nextRun(first, last)){
+        runs++;
+        first = last + 1;
+    }
+    if(batch.size() + runs > I2C_BATCH_OPS){
+        return false;
+    }
+
+    uint8_t buffer[1 + 4 * 16];
+    first = 0;
+    while(nextRun(first, last)){
+        batch.write(device, ConstByteSpan(buffer, burst(first, last, buffer)));
+        first = last + 1;
+    }
+    staged = 0;
+    return true;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Getters ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Length of one PWM tick in microseconds
+float PCA9685::getStepSize(){
+    return stepSize;
+}
+
+// I2C slave address
+uint8_t PCA9685::getAddress(){
+    return address;
+}
+
+uint8_t PCA9685::getPrescaler(){
+    return prescaler;
+}
+
+// PWM frame rate in Hz, as the prescaler gives it
+float PCA9685::getFrequency(){
+    return 1e6f / getFramePeriod();
+}
+
+// Length of one PWM frame in microseconds
+float PCA9685::getFramePeriod(){
+    return 4096.0f * stepSize;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Timing ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+/* Prescaler for a PWM frame rate (25 MHz oscillator, 4096 ticks a frame)
+ * The rate the board runs at is the nearest the prescaler allows, 333 Hz
+ * gives a prescaler of 17 and 339 Hz frames.
+ */
+uint8_t PCA9685::prescalerFor(float freq){
+    double prescaler = round(25000000.0 / (4096.0 * freq)) - 1;
+    if(!(prescaler > 2 && prescaler < 256)){
+        throw std::runtime_error("Failed to validate PWM frequency");
+    }
+    return static_cast<uint8_t>(prescaler);
+}
+
+// Tick length in microseconds at a prescaler
+float PCA9685::stepSizeFor(uint8_t prescaler){
+    return (static_cast<float>(prescaler) + 1.0f) / 25.0f;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -0,0 +1,229 @@
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Libraries ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+#include "pca9685_router.h"
+
+#include <stdexcept>   // For std::runtime_error
+#include <string>
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Constructor/Destructor ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+PCA9685Router::PCA9685Router(I2C* i2c) : i2c(i2c){}
+
+// Boards go in the reverse order they came
+PCA9685Router::~PCA9685Router(){
+    for(int i = static_cast<int>(boards.size()) - 1; i >= 0; i--){
+        delete boards[i];
+    }
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Helper methods ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+/* Submits the queued bursts and waits for them
+ * Batched writes are not retried, a burst that failed (other than refused by
+ * the emergency stop) is rerun on its own with the bus's retry policy.
+ */
+I2CStatus PCA9685Router::send(){
+
+    I2CStatus result = i2c->submitBatch(batch);
+    if(result == I2CStatus::Ok){
+        i2c->waitBatch(batch);
+        for(int i = 0; i < batch.size(); i++){
+            I2CStatus status = batch.status(i);
+            if(status != I2CStatus::Ok && status != I2CStatus::Refused){
+                status = batch.rerun(i);
+            }
+            if(status != I2CStatus::Ok && result == I2CStatus::Ok){
+                result = status;
+            }
+        }
+    }
+    batch.clear();
+    return result;
+}
+
+// One write every board takes at once
+void PCA9685Router::writeAll(uint8_t reg, uint8_t value){
+    uint8_t buffer[2] = {reg, value};
+    I2CStatus status = allCall.tryWrite(buffer);
+    if(status != I2CStatus::Ok){
+        throw std::runtime_error(std::string("Failed to write PCA9685 all-call: ") + i2cStatusName(status));
+    }
+}
+
+// MODE1 without SLEEP/RESTART, false if the boards differ (sub-addresses set on some of them)
+bool PCA9685Router::sameMode(uint8_t& mode){
+    for(size_t i = 0; i < boards.size(); i++){
+        uint8_t current = boards[i]->getMode() & ~(MODE1_SLEEP | MODE1_RESTART);
+        if(i > 0 && current != mode){
+            return false;
+        }
+        mode = current;
+    }
+    return true;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Boards and Routes ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Creates the board at an address, returns its index
+int PCA9685Router::addBoard(uint8_t addr, uint8_t prescaler){
+    for(PCA9685* board : boards){
+        if(board->getAddress() == addr){
+            throw std::runtime_error("PCA9685 already added at that address");
+        }
+    }
+    boards.push_back(new PCA9685(i2c, addr, prescaler));
+    return static_cast<int>(boards.size()) - 1;
+}
+
+// Maps a joint to a board's channel, a joint routed again moves
+void PCA9685Router::route(int joint, int board, uint8_t channel){
+
+    if(joint < 0){
+        throw std::runtime_error("Failed to validate Joint");
+    }
+    if(board < 0 || board >= static_cast<int>(boards.size())){
+        throw std::runtime_error("PCA9685 board " + std::to_string(board) + " does not exist");
+    }
+    if(channel > 15){
+        throw std::runtime_error("Failed to validate Channel");
+    }
+    for(size_t i = 0; i < routes.size(); i++){
+        if(static_cast<int>(i) != joint && routes[i].board == board && routes[i].channel == channel){
+            throw std::runtime_error("Channel " + std::to_string(channel) + " of PCA9685 board " + std::to_string(board)
+                                   + " is already routed to joint " + std::to_string(i));
+        }
+    }
+
+    if(joint >= static_cast<int>(routes.size())){
+        routes.resize(joint + 1, {-1, 0});
+    }
+    routes[joint] = {board, channel};
+}
+
+int PCA9685Router::getNumBoards(){
+    return static_cast<int>(boards.size());
+}
+
+PCA9685* PCA9685Router::getBoard(int board){
+    if(board < 0 || board >= static_cast<int>(boards.size())){
+        throw std::runtime_error("PCA9685 board " + std::to_string(board) + " does not exist");
+    }
+    return boards[board];
+}
+
+PCA9685* PCA9685Router::boardOf(int joint){
+    if(joint < 0 || joint >= static_cast<int>(routes.size()) || routes[joint].board < 0){
+        throw std::runtime_error("Joint " + std::to_string(joint) + " is not routed to a PCA9685");
+    }
+    return boards[routes[joint].board];
+}
+
+uint8_t PCA9685Router::channelOf(int joint){
+    boardOf(joint);
+    return routes[joint].channel;
+}
+
+// Every board's frame rate, sleeping boards stay asleep so sleepAll/wakeAll can bracket the change
+void PCA9685Router::setPWMFrequency(int freq){
+    for(PCA9685* board : boards){
+        board->setPWMFrequency(freq);
+    }
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Control Tick ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Stages a joint's off time on its board for the next flush
+bool PCA9685Router::stage(int joint, uint16_t offTime) noexcept{
+    if(joint < 0 || joint >= static_cast<int>(routes.size()) || routes[joint].board < 0){
+        return false;
+    }
+    return boards[routes[joint].board]->stageOffTime(routes[joint].channel, offTime);
+}
+
+/* Writes every board's staged off times in one batch
+ * A board's runs always fit an empty batch, a full batch is sent before the
+ * next board is queued.
+ */
+I2CStatus PCA9685Router::flush() noexcept{
+
+    I2CStatus result = I2CStatus::Ok;
+    for(PCA9685* board : boards){
+        if(!board->hasStaged()){
+            continue;
+        }
+        if(!board->queueFlush(batch)){
+            I2CStatus status = send();
+            if(status != I2CStatus::Ok && result == I2CStatus::Ok){
+                result = status;
+            }
+            board->queueFlush(batch);
+        }
+    }
+    if(batch.size() > 0){
+        I2CStatus status = send();
+        if(status != I2CStatus::Ok && result == I2CStatus::Ok){
+            result = status;
+        }
+    }
+    return result;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ All-call ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Every board answers the address, it must not be one a device on the bus has
+void PCA9685Router::enableAllCall(uint8_t addr){
+    for(PCA9685* board : boards){
+        board->setAllCallAddress(addr);
+    }
+    allCall = i2c->bindBroadcast(addr);
+    if(!allCall.isBound()){
+        throw std::runtime_error("Failed to bind PCA9685 all-call address");
+    }
+}
+
+bool PCA9685Router::hasAllCall(){
+    return allCall.isBound();
+}
+
+// Every oscillator stops with the same write
+void PCA9685Router::sleepAll(){
+    uint8_t mode = 0x00;
+    if(allCall.isBound() && sameMode(mode)){
+        writeAll(MODE1_REG, mode | MODE1_SLEEP);
+        return;
+    }
+    for(PCA9685* board : boards){
+        board->sleep();
+    }
+}
+
+// Every oscillator starts with the same write, so the PWM frames line up
+void PCA9685Router::wakeAll(){
+    uint8_t mode = 0x00;
+    if(allCall.isBound() && sameMode(mode)){
+        writeAll(MODE1_REG, mode);
+        return;
+    }
+    for(PCA9685* board : boards){
+        board->wake();
+    }
+}
+
+// Sets the full OFF bit of ALL_LED_OFF_H on every board
+void PCA9685Router::allOff(){
+    if(allCall.isBound()){
+        writeAll(ALL_LED_OFF_H, 0x10);
+        return;
+    }
+    for(PCA9685* board : boards){
+        board->allOff();
+    }
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -0,0 +1,187 @@
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Libraries ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+#include "quaternion.h"
+
+#include <cmath>
+#include <algorithm>  // For std::clamp
+#include <stdexcept>  // For std::runtime_error
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Constructors ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Identity rotation
+Quaternion::Quaternion() : w(1.0f), x(0.0f), y(0.0f), z(0.0f){}
+
+Quaternion::Quaternion(float w, float x, float y, float z) : w(w), x(x), y(y), z(z){}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Conversions ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Rotation of angle (radians) about a normalized axis
+Quaternion Quaternion::fromAxisAngle(float ax, float ay, float az, float angle){
+    float s = sin(angle / 2.0f);
+    return Quaternion(cos(angle / 2.0f), ax * s, ay * s, az * s);
+}
+
+// Builds Rz(yaw) * Ry(pitch) * Rz(roll)
+Quaternion Quaternion::fromEuler(float yaw, float pitch, float roll){
+    Quaternion qYaw = fromAxisAngle(0.0f, 0.0f, 1.0f, yaw);
+    Quaternion qPitch = fromAxisAngle(0.0f, 1.0f, 0.0f, pitch);
+    Quaternion qRoll = fromAxisAngle(0.0f, 0.0f, 1.0f, roll);
+    return (qYaw * qPitch * qRoll).normalized();
+}
+
+// Extracts Z-Y-Z angles, at pitch = 0 or 180 degrees the roll is folded into the yaw
+void Quaternion::toEuler(float& yaw, float& pitch, float& roll) const{
+
+    float R[3][3];
+    toRotationMatrix(R);
+
+    float sinPitch = sqrt(R[0][2] * R[0][2] + R[1][2] * R[1][2]);
+    pitch = atan2(sinPitch, R[2][2]);
+
+    if(sinPitch > 1e-6f){
+        yaw = atan2(R[1][2], R[0][2]);
+        roll = atan2(R[2][1], -R[2][0]);
+    }
+    else if(R[2][2] > 0.0f){
+        yaw = atan2(R[1][0], R[0][0]);
+        roll = 0.0f;
+    }
+    else{
+        yaw = atan2(-R[1][0], -R[0][0]);
+        roll = 0.0f;
+    }
+}
+
+// Fills a rotation matrix whose columns are the tool x, y and z axes
+void Quaternion::toRotationMatrix(float R[3][3]) const{
+
+    float xx = x * x, yy = y * y, zz = z * z;
+    float xy = x * y, xz = x * z, yz = y * z;
+    float wx = w * x, wy = w * y, wz = w * z;
+
+    R[0][0] = 1.0f - 2.0f * (yy + zz);
+    R[0][1] = 2.0f * (xy - wz);
+    R[0][2] = 2.0f * (xz + wy);
+
+    R[1][0] = 2.0f * (xy + wz);
+    R[1][1] = 1.0f - 2.0f * (xx + zz);
+    R[1][2] = 2.0f * (yz - wx);
+
+    R[2][0] = 2.0f * (xz - wy);
+    R[2][1] = 2.0f * (yz + wx);
+    R[2][2] = 1.0f - 2.0f * (xx + yy);
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Operations ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Hamilton product (applies other first, then this)
+Quaternion Quaternion::operator*(const Quaternion& o) const{
+    return Quaternion(
+        w * o.w - x * o.x - y * o.y - z * o.z,
+        w * o.x + x * o.w + y * o.z - z * o.y,
+        w * o.y - x * o.z + y * o.w + z * o.x,
+        w * o.z + x * o.y - y * o.x + z * o.w
+    );
+}
+
+// Inverse rotation for unit quaternions
+Quaternion Quaternion::conjugate() const{
+    return Quaternion(w, -x, -y, -z);
+}
+
+Quaternion Quaternion::normalized() const{
+    float norm = sqrt(w * w + x * x + y * y + z * z);
+    if(norm == 0.0f){
+        throw std::runtime_error("Cannot normalize a zero quaternion");
+    }
+    return Quaternion(w / norm, x / norm, y / norm, z / norm);
+}
+
+float Quaternion::dot(const Quaternion& o) const{
+    return w * o.w + x * o.x + y * o.y + z * o.z;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Interpolation ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Spherical linear interpolation along the shortest arc
+Quaternion Quaternion::slerp(const Quaternion& from, const Quaternion& to, float t){
+
+    Quaternion end = to;
+    float cosTheta = from.dot(to);
+
+    // q and -q are the same rotation, take the short way around
+    if(cosTheta < 0.0f){
+        end = Quaternion(-to.w, -to.x, -to.y, -to.z);
+        cosTheta = -cosTheta;
+    }
+
+    // Nearly parallel, linear interpolation is accurate and avoids dividing by ~0
+    float a, b;
+    if(cosTheta > 0.9995f){
+        a = 1.0f - t;
+        b = t;
+    }
+    else{
+        float theta = acos(cosTheta);
+        float sinTheta = sin(theta);
+        a = sin((1.0f - t) * theta) / sinTheta;
+        b = sin(t * theta) / sinTheta;
+    }
+
+    return Quaternion(a * from.w + b * end.w, a * from.x + b * end.x,
+                      a * from.y + b * end.y, a * from.z + b * end.z).normalized();
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ SlerpPath ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Precomputes the per-step rotation between two orientations
+SlerpPath::SlerpPath(const Quaternion& from, const Quaternion& to, int steps)
+        : current(from), target(to), stepsLeft(steps){
+
+    if(steps < 1){
+        throw std::runtime_error("SlerpPath needs at least 1 step");
+    }
+
+    // Shortest arc
+    if(from.dot(to) < 0.0f){
+        target = Quaternion(-to.w, -to.x, -to.y, -to.z);
+    }
+
+    // Relative rotation from -> to, split into equal angle increments
+    Quaternion relative = (from.conjugate() * target).normalized();
+    float halfAngle = acos(std::clamp(relative.w, -1.0f, 1.0f));
+    float sinHalf = sin(halfAngle);
+
+    if(sinHalf < 1e-6f){
+        delta = Quaternion();
+    }
+    else{
+        delta = Quaternion::fromAxisAngle(relative.x / sinHalf, relative.y / sinHalf, relative.z / sinHalf
+                                        , 2.0f * halfAngle / steps);
+    }
+}
+
+// Returns the next orientation along the path (the last step lands exactly on the target)
+Quaternion SlerpPath::next(){
+    if(stepsLeft <= 1){
+        stepsLeft = 0;
+        current = target;
+    }
+    else{
+        stepsLeft--;
+        current = (current * delta).normalized();
+    }
+    return current;
+}
+
+bool SlerpPath::done() const{
+    return stepsLeft == 0;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
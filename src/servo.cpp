@@ -2,8 +2,10 @@
 // ~~ Libraries ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
 #include "servo.h"
+#include "estop.h"
+#include "config.h"
 #include <cmath> // For round()
-#include <algorithm>  // For std::clamp
+#include <algorithm>  // For std::clamp, std::min, std::max
 #include <iostream>
 #include <unistd.h> // For sleep()
 
@@ -16,14 +18,49 @@ std::mutex Servo::pcaMutex;
 // Constructor: Creates and initializes object
 Servo::Servo(const ServoParams& params)
 		  : pca(params.pca9685), pcaChannel(params.pcaChannel)
-          , minPulse(params.minPulse), maxPulse(params.maxPulse)
-          , maxAngle(params.maxAngle), defaultAngle(params.defaultAngle)
-          , currentAngle(params.defaultAngle), rotationSpeed(params.rotationSpeed)
-          , updateResolution(params.updateResolution), running(false){
+          , maxAngle(params.maxAngle), minPulse(params.minPulse), maxPulse(params.maxPulse), defaultAngle(params.defaultAngle)
+          , targetAngle(params.defaultAngle), currentAngle(params.defaultAngle), lastCommand(params.defaultAngle), rising(true)
+          , rotationSpeed(params.rotationSpeed), updateResolution(params.updateResolution)
+          , engine(params.engine ? params.engine : MotionEngine::defaultEngine())
+          , stepped(false), stepStatus(I2CStatus::Ok), controller(nullptr){
     
     // Preprocessing for angle calculations based on servo motor characteristics
     angleToPwmSlope = ((maxPulse - minPulse) / maxAngle);
 
+    // Angle -> off time tables per direction of travel, so setting a position is a lookup instead of float pulse math
+    const ServoCalibration* calibration = params.calibration;
+    const PrebuiltTables* tables = params.tables;
+    tableStepSize = pca->getStepSize();
+    if(tables && tables->stepSize == tableStepSize){
+        risingTable.assign(tables->rising, tables->size, maxAngle);
+        fallingTable.assign(tables->falling, tables->size, maxAngle);
+    }
+    else if(calibration && !calibration->empty()){
+        const CalibrationCurve* up = &calibration->getRising();
+        const CalibrationCurve* down = &calibration->getFalling();
+        risingTable.build([up](float angle){ return up->pulseAt(angle); }
+                         , maxAngle, pca->getStepSize(), SERVO_PULSE_TABLE_SIZE);
+        fallingTable.build([down](float angle){ return down->pulseAt(angle); }
+                          , maxAngle, pca->getStepSize(), SERVO_PULSE_TABLE_SIZE);
+    }
+    else if(tables){
+        // Built for another prescaler and nothing to rebuild them from, same pulses in this board's ticks
+        risingTable.assign(tables->rising, tables->size, maxAngle);
+        fallingTable.assign(tables->falling, tables->size, maxAngle);
+        risingTable.rescale(tables->stepSize, tableStepSize);
+        fallingTable.rescale(tables->stepSize, tableStepSize);
+    }
+    else{
+        auto linear = [this](float angle){ return angleToPwmSlope * angle + minPulse; };
+        risingTable.build(linear, maxAngle, pca->getStepSize(), SERVO_PULSE_TABLE_SIZE);
+        fallingTable.build(linear, maxAngle, pca->getStepSize(), SERVO_PULSE_TABLE_SIZE);
+    }
+
+    // A pulse running into the next frame is cut short
+    if(!resolutionAt(pca->getPrescaler()).fits){
+        throw std::runtime_error("Servo pulses do not fit the PCA9685's " + std::to_string(pca->getFrequency()) + " Hz frame");
+    }
+
     // Sets Speed and update rotationStepPeriod variable
     setSpeed(params.rotationSpeed);
 
@@ -34,114 +71,121 @@ Servo::Servo(const ServoParams& params)
     pca -> setOnTime(pcaChannel, 0x0000);
 
     // Set servo to default angle
-    this->setPosition(defaultAngle);
+    I2CStatus status = this->setPosition(defaultAngle);
+    if(status != I2CStatus::Ok && status != I2CStatus::Refused){
+        throw std::runtime_error(std::string("Failed to set servo to its default angle: ") + i2cStatusName(status));
+    }
     
 }
 
 Servo::~Servo(){
 
     // Move to default position
-    this->moveToPosition(defaultAngle).join();
-
-}
-// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-// ~~ Thread Method ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-
-// Thread used to control movement toward the target position
-void Servo::velocityControlThread(){
-    while(true){
-
-        // This mutex prevents multiple threads from communicating with the PCA at the same time
-        std::unique_lock<std::mutex> lock(pcaMutex);
+    this->moveToPosition(defaultAngle).wait();
 
-        // Takes a step towards the target
-        step();
+    // Stop the engine from referencing this servo
+    engine->release(this);
 
-        // Unlock mutex
-        lock.unlock();
-
-        // Checks to see if we've reached the target
-        if(currentAngle == targetAngle){
-            break;
-        }
-        else{
-            // Pause this thread for (rotationStepPeriod)ms 
-            std::this_thread::sleep_for(std::chrono::milliseconds(rotationStepPeriod));
-        }
-    }
-    
-    running = false;
 }
-
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // ~~ Helper Methods ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
 // Takes one step towards the target position by calculating the delta time
-void Servo::step(){
+I2CStatus Servo::step(){
 
     // Calculates the amount of time passed
-    auto endTime = std::chrono::steady_clock::now();
+    auto endTime = engine->getClock()->now();
     auto deltaTime = endTime - startTime;
     startTime = endTime;
 
+    float seconds = std::chrono::duration_cast<std::chrono::duration<float>>(deltaTime).count();
+
     // Calculates new angle based on direction
     if(clockwise){
-        currentAngle = std::clamp(currentAngle + std::chrono::duration_cast<std::chrono::duration<float>>(deltaTime).count() * rotationSpeed,0.0f,targetAngle);
+        currentAngle = std::clamp(currentAngle + seconds * rotationSpeed,0.0f,targetAngle);
     }
     else{
-        currentAngle = std::clamp(currentAngle - std::chrono::duration_cast<std::chrono::duration<float>>(deltaTime).count() * rotationSpeed,targetAngle,maxAngle);
+        currentAngle = std::clamp(currentAngle - seconds * rotationSpeed,targetAngle,maxAngle);
     }
 
+    // Closed loop: the ramp is the reference, the controller trims what is commanded
+    float command = currentAngle;
+    if(controller){
+        float velocity = 0.0f;
+        if(currentAngle != targetAngle){
+            velocity = clockwise ? rotationSpeed : -rotationSpeed;
+        }
+
+        float measured;
+        if(feedback && feedback(measured)){
+            command = controller->update(currentAngle, velocity, measured, seconds);
+        }
+        else{
+            command = currentAngle + controller->getTrim(); // Hold the last correction without feedback
+        }
+    }
 
-    // Sets the angle
-    this->setPosition(currentAngle);
+    // Sets the angle, the engine writes it with the rest of the tick when it stages outputs
+    return this->setPosition(command, engine->isStaging());
 
 }
 
+// Reached the target, and settled (or timed out) when closed loop
+bool Servo::motionDone(){
+    if(currentAngle != targetAngle){
+        return false;
+    }
+    return !controller || controller->isSettled() || controller->isTimedOut();
+}
+
+// Time between steps, closed loop steps at least as often as the controller runs
+std::chrono::microseconds Servo::stepPeriod(){
+    std::chrono::microseconds period = std::chrono::milliseconds(rotationStepPeriod);
+    if(controller){
+        std::chrono::microseconds controlPeriod(static_cast<long>(controller->getPeriod() * 1e6f));
+        period = std::min(period, controlPeriod);
+    }
+    return period;
+}
+
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // ~~ Servo Control ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
 // Sets the angle of the servo motor in degrees (Private)
-void Servo::setPosition(float angle){
+I2CStatus Servo::setPosition(float angle, bool stage) noexcept{
 
-	// Clamp angle value
-	angle = std::clamp(angle, 0.0f, maxAngle);
+	// Outputs stay cut while the emergency stop is latched
+	if(EmergencyStop::isLatched()){
+		return I2CStatus::Refused;
+	}
 
-    //std::cout << "Setting angle to " << angle << std::endl;
-	
-	// Map angle to pulseWidth
-	float pulseWidth = angleToPwmSlope * angle + minPulse;
+	// Direction of travel, holding still keeps the last one
+	if(angle > lastCommand){
+		rising = true;
+	}
+	else if(angle < lastCommand){
+		rising = false;
+	}
+	lastCommand = angle;
 
-    //std::cout << "pulseWidth: " << pulseWidth << std::endl;
+	// Map angle to off time for that direction (the tables clamp to 0 - maxAngle)
+	uint16_t offTime = rising ? risingTable.ticksAt(angle) : fallingTable.ticksAt(angle);
 
     // Sets signal PWM signal up
-    pca -> setPulseWidth(pcaChannel, pulseWidth);
+    if(stage){
+        return pca -> stageOffTime(pcaChannel, offTime) ? I2CStatus::Ok : I2CStatus::Failed;
+    }
+    return pca -> trySetOffTime(pcaChannel, offTime);
     
 }
 
 /* Moves the servo position smoothly towards the input angle (Public)
- * The thread needs to be either joined or detached after running this function
- * moveToPosition().join() -> Start thread and wait until the motion is complete
- * moveToPostion().detach() -> Start thread and run in background
+ * The motion engine drives the move, the returned handle can be waited on or dropped
+ * moveToPosition().wait() -> Wait until the motion is complete
+ * moveToPosition() -> Run in background
  */
-std::thread Servo::moveToPosition(float angle){
-
-    // Sets global
-    targetAngle = angle;
-    running = true;
-    startTime = std::chrono::steady_clock::now();
-    if(targetAngle < currentAngle){ // CCW
-        clockwise = false;
-    }
-    else{ // CW
-        clockwise = true;
-    }
-
-    // Creates thread
-    std::thread workingThread(&Servo::velocityControlThread, this);
-    
-    return workingThread;
-
+MotionHandle Servo::moveToPosition(float angle){
+    return engine->move(this, angle);
 }
 
 // Sets the speed of the servo motor in degrees/second
@@ -168,9 +212,92 @@ void Servo::disable(){
 	pca -> switchOff(pcaChannel);
 }
 
-// Enables servo motor
+// Rewrites the current position, restoring the output after an emergency stop cut
+void Servo::refresh(){
+	std::lock_guard<std::mutex> lock(pcaMutex);
+	I2CStatus status = this->setPosition(currentAngle);
+	if(status != I2CStatus::Ok && status != I2CStatus::Refused){
+		throw std::runtime_error(std::string("Failed to refresh servo output: ") + i2cStatusName(status));
+	}
+}
+
+// Enables servo motor (ignored while the emergency stop is latched)
 void Servo::enable(){
+	if(EmergencyStop::isLatched()){
+		return;
+	}
 	pca -> switchOn(pcaChannel);
 }
 
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ PWM Frame Rate ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Converts the pulse tables to the PCA9685's step size after its frequency changed, and rewrites the last command in the new ticks
+void Servo::retime(){
+	std::lock_guard<std::mutex> lock(pcaMutex);
+	float stepSize = pca->getStepSize();
+	risingTable.rescale(tableStepSize, stepSize);
+	fallingTable.rescale(tableStepSize, stepSize);
+	tableStepSize = stepSize;
+
+	I2CStatus status = this->setPosition(lastCommand);
+	if(status != I2CStatus::Ok && status != I2CStatus::Refused){
+		throw std::runtime_error(std::string("Failed to rewrite servo output: ") + i2cStatusName(status));
+	}
+}
+
+/* Angular resolution of the servo's pulse range at a prescaler
+ * Faster frames have shorter ticks the same pulses are counted in, fewer of
+ * them span the servo's range. The worst case is the steepest part of either
+ * pulse table (a calibrated servo is not linear).
+ */
+ServoResolution Servo::resolutionAt(uint8_t prescaler){
+
+	ServoResolution resolution;
+	resolution.prescaler = prescaler;
+	resolution.stepSize = PCA9685::stepSizeFor(prescaler);
+	resolution.framePeriod = 4096.0f * resolution.stepSize;
+	resolution.frequency = 1e6f / resolution.framePeriod;
+
+	float shortest = risingTable.getTicks()[0] * tableStepSize;
+	float longest = shortest;
+	float steepest = 0.0f; // Degrees per microsecond
+	for(const PulseTable* table : {&risingTable, &fallingTable}){
+		const float* ticks = table->getTicks();
+		float entryAngle = maxAngle / (table->getSize() - 1);
+		for(int i = 0; i < table->getSize(); i++){
+			float pulse = ticks[i] * tableStepSize;
+			shortest = std::min(shortest, pulse);
+			longest = std::max(longest, pulse);
+			float change = i > 0 ? std::fabs(ticks[i] - ticks[i - 1]) * tableStepSize : 0.0f;
+			if(change > 0.0f){
+				steepest = std::max(steepest, entryAngle / change);
+			}
+		}
+	}
+
+	resolution.longestPulse = longest;
+	resolution.ticks = static_cast<int>(round((longest - shortest) / resolution.stepSize));
+	resolution.degreesPerTick = resolution.ticks > 0 ? maxAngle / resolution.ticks : maxAngle;
+	resolution.worstDegreesPerTick = std::max(steepest * resolution.stepSize, resolution.degreesPerTick);
+	resolution.fits = longest + PCA9685_FRAME_MARGIN_US <= resolution.framePeriod;
+	return resolution;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Closed Loop ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Closes the loop around the servo, nullptr controller opens it again (the engine swaps them between steps)
+void Servo::setFeedback(JointController* controller, std::function<bool(float&)> feedback){
+    engine->setFeedback(this, controller, std::move(feedback));
+}
+
+// True once the measured angle has settled on the target (always true open loop when not moving)
+bool Servo::atTarget(){
+    if(currentAngle != targetAngle){
+        return false;
+    }
+    return !controller || controller->isSettled();
+}
+
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
\ No newline at end of file
@@ -0,0 +1,501 @@
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Libraries ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+#include "servo_calibrator.h"
+
+#include <cmath>     // For std::round, std::ceil, std::floor, std::fabs, std::lround
+#include <thread>    // For std::this_thread::sleep_until
+#include <fstream>
+#include <algorithm> // For std::min, std::max, std::clamp
+#include <stdexcept> // For std::runtime_error
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Constructor ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+ServoCalibrator::ServoCalibrator(PCA9685* pca, uint8_t channel, AS5600* encoder, const CalibratorParams& params)
+    : pca(pca), channel(channel), encoder(encoder), params(params)
+    , phase(Phase::Start), started(false), commandPulse(0.0f), lastRawStep(-1), turns(0)
+    , direction(0), gallop(0.0f), inside{0.0f, 0.0f}, previousInside{0.0f, 0.0f}, outside(0.0f), endStopAngle(0.0f), probePulse(0.0f), approaching(false), fromInside(false), overshot(false)
+    , sampleMin(0.0f), sampleMax(0.0f), step(0.0f)
+    , minPulse(0.0f), maxPulse(0.0f), maxAngle(0.0f), commandCount(0), readCount(0), timeoutCount(0){
+
+    if(!pca || !encoder){
+        throw std::runtime_error("Calibrator needs a PCA9685 and an AS5600");
+    }
+    if(params.searchLow >= params.startPulse || params.startPulse >= params.searchHigh || params.gallopStep <= 0.0f
+       || params.endpointResolution < 1.0f || params.backlashMargin < 0.0f || params.minStep < 1.0f || params.maxStep < params.minStep
+       || params.settleWindow < 2 || params.settleTolerance < 0.0f || params.saturationTolerance <= 0.0f){
+        throw std::runtime_error("Invalid calibrator parameters");
+    }
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Polling ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Does the next due command or read, true once finished
+bool ServoCalibrator::poll(){
+
+    if(phase == Phase::Done){
+        return true;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if(!started){
+        started = true;
+        startTime = now;
+        command(params.startPulse);
+        return false;
+    }
+    if(now < nextTime){
+        return false;
+    }
+
+    // Read and unwrap
+    long raw = encoder->getStep();
+    readCount++;
+    if(lastRawStep >= 0 && raw - lastRawStep > 2048){
+        turns--;
+    }
+    else if(lastRawStep >= 0 && lastRawStep - raw > 2048){
+        turns++;
+    }
+    lastRawStep = raw;
+    window.push_back(static_cast<float>(raw + turns * 4096));
+    if(static_cast<int>(window.size()) > params.settleWindow){
+        window.pop_front();
+    }
+
+    // Still once the two halves of the window agree (at least minDwell after the command), or give up waiting
+    bool settled = false;
+    if(static_cast<int>(window.size()) == params.settleWindow && now - commandTime >= params.minDwell){
+        float older = 0.0f;
+        float newer = 0.0f;
+        int half = params.settleWindow / 2;
+        for(int i = 0; i < half; i++){
+            older += window[i];
+            newer += window[params.settleWindow - half + i];
+        }
+        settled = std::fabs(newer - older) / half <= params.settleTolerance;
+    }
+    if(!settled){
+        if(now - commandTime < params.settleTimeout){
+            nextTime = now + params.pollPeriod;
+            return false;
+        }
+        timeoutCount++;
+    }
+
+    float sum = 0.0f;
+    for(float reading : window){
+        sum += reading;
+    }
+    float mean = sum / window.size();
+    long wrapped = std::lround(mean) % 4096;
+    onSettled(mean * 360.0f / 4096.0f, static_cast<uint16_t>(wrapped < 0 ? wrapped + 4096 : wrapped));
+    return phase == Phase::Done;
+}
+
+// Polls until finished (blocking)
+void ServoCalibrator::run(){
+    while(!poll()){
+        std::this_thread::sleep_until(nextTime);
+    }
+}
+
+bool ServoCalibrator::isDone() const{
+    return phase == Phase::Done;
+}
+
+// When poll() next has work to do
+std::chrono::steady_clock::time_point ServoCalibrator::nextPollTime() const{
+    return nextTime;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Calibration Steps ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+/* Sets the pulse and restarts settle detection
+ * The pulse is rounded to a whole PCA9685 tick so the recorded pulse is the one on the wire.
+ * The first readings are timed so the window fills just as minDwell runs out.
+ */
+void ServoCalibrator::command(float pulse){
+    commandPulse = toTick(pulse);
+    pca->setPulseWidth(channel, commandPulse);
+    commandCount++;
+    commandTime = std::chrono::steady_clock::now();
+    auto lead = params.pollPeriod * (params.settleWindow - 1);
+    nextTime = commandTime + std::max(params.minDwell - lead, std::chrono::microseconds(0));
+    window.clear();
+}
+
+// Nearest pulse the PCA9685 can produce
+float ServoCalibrator::toTick(float pulse){
+    float stepSize = pca->getStepSize();
+    return std::round(pulse / stepSize) * stepSize;
+}
+
+// Advances the calibration with a settled reading
+void ServoCalibrator::onSettled(float angle, uint16_t encoderStep){
+
+    switch(phase){
+
+    case Phase::Start:
+        // Low end first, then back here for the high end
+        probes.clear();
+        probes.push_back({commandPulse, angle});
+        startEndpoint(direction == 0 ? -1 : 1);
+        break;
+
+    case Phase::Gallop: {
+        probes.push_back({commandPulse, angle});
+        float limit = direction < 0 ? params.searchLow : params.searchHigh;
+        if(commandPulse != toTick(limit)){
+            gallop *= 2.0f;
+            command(direction < 0 ? std::max(commandPulse - gallop, limit) : std::min(commandPulse + gallop, limit));
+            break;
+        }
+
+        // At the limit, so at the end stop. Bracket between the last probe that moved and the first that did not
+        endStopAngle = angle;
+        if(std::fabs(probes.front().angle - endStopAngle) <= params.saturationTolerance){
+            throw std::runtime_error("Calibration start pulse is at an end stop");
+        }
+        size_t first = 1;
+        while(std::fabs(probes[first].angle - endStopAngle) > params.saturationTolerance){
+            first++;
+        }
+        inside = probes[first - 1];
+        previousInside = first >= 2 ? probes[first - 2] : inside;
+        outside = probes[first].pulse;
+        fromInside = false;
+        overshot = false;
+        phase = Phase::Search;
+        nextProbe();
+        break;
+    }
+
+    case Phase::Search:
+        if(approaching){
+            approaching = false;
+            command(probePulse);
+            break;
+        }
+        if(std::fabs(angle - endStopAngle) <= params.saturationTolerance){
+            outside = commandPulse;
+            fromInside = false;
+            overshot = true;
+        }
+        else{
+            previousInside = inside;
+            inside = {commandPulse, angle};
+            fromInside = true;
+            overshot = false;
+        }
+        nextProbe();
+        break;
+
+    case Phase::SweepStart:
+        samples.clear();
+        pass.clear();
+        step = params.minStep;
+        phase = Phase::SweepDown;
+        nextSample(angle, encoderStep);
+        break;
+
+    case Phase::SweepDown:
+    case Phase::SweepUp:
+        nextSample(angle, encoderStep);
+        break;
+
+    case Phase::Done:
+        break;
+    }
+}
+
+// Begins galloping out towards one end
+void ServoCalibrator::startEndpoint(int direction){
+    this->direction = direction;
+    gallop = params.gallopStep;
+    phase = Phase::Gallop;
+    command(direction < 0 ? std::max(commandPulse - gallop, params.searchLow) : std::min(commandPulse + gallop, params.searchHigh));
+}
+
+// Next endpoint search probe, or finishes the end
+void ServoCalibrator::nextProbe(){
+
+    // Stops at the resolution, or when the bracket is down to adjacent ticks
+    float tick = pca->getStepSize();
+    float gap = std::fabs(inside.pulse - outside);
+    if(gap > std::max(params.endpointResolution, 1.5f * tick)){
+        probePulse = (inside.pulse + outside) / 2.0f;
+
+        // Unless the last probe overshot, aim just past where the line through the last two that
+        // moved reaches the end stop, but always cover at least an eighth of the bracket
+        if(!overshot && inside.angle != previousInside.angle){
+            float edge = endStopAngle + (inside.angle > endStopAngle ? params.saturationTolerance : -params.saturationTolerance);
+            float slope = (inside.angle - previousInside.angle) / (inside.pulse - previousInside.pulse);
+            float offset = direction * ((edge - inside.angle) / slope * direction + params.endpointResolution / 2.0f);
+            offset = direction * std::clamp(offset * direction, std::max(gap / 8.0f, tick), gap - tick);
+            probePulse = inside.pulse + offset;
+        }
+
+        // Every probe is reached moving outwards so backlash is taken up the same way,
+        // after a probe at the end stop that means backing off further inside first
+        approaching = !fromInside;
+        command(approaching ? probePulse - direction * params.backlashMargin : probePulse);
+        return;
+    }
+
+    if(direction < 0){
+        minPulse = inside.pulse;
+        phase = Phase::Start;
+        command(params.startPulse);
+        return;
+    }
+
+    maxPulse = inside.pulse;
+    float stepSize = pca->getStepSize();
+    sampleMin = std::ceil((minPulse + params.clip) / stepSize) * stepSize;
+    sampleMax = std::floor((maxPulse - params.clip) / stepSize) * stepSize;
+    if(sampleMax - sampleMin < 2.0f * params.maxStep){
+        throw std::runtime_error("Measured pulse range is too narrow to sample");
+    }
+    phase = Phase::SweepStart;
+    command(sampleMax);
+}
+
+/* Records a sweep reading and steps on
+ * The step doubles while the reading stays within half of curvatureTolerance of
+ * the line through the previous two, and halves where it departs by more.
+ */
+void ServoCalibrator::nextSample(float angle, uint16_t encoderStep){
+
+    float travel = phase == Phase::SweepDown ? -1.0f : 1.0f;
+    float passEnd = phase == Phase::SweepDown ? sampleMin : sampleMax;
+    float tick = pca->getStepSize(); // Steps are at least a tick so the pulse changes
+
+    samples.push_back({commandPulse, encoderStep});
+    pass.push_back({commandPulse, angle});
+
+    // Adapt the step to how far the reading departs from the line through the previous two
+    size_t count = pass.size();
+    if(count >= 3){
+        const Reading& a = pass[count - 3];
+        const Reading& b = pass[count - 2];
+        const Reading& c = pass[count - 1];
+        float predicted = b.angle + (b.angle - a.angle) * (c.pulse - b.pulse) / (b.pulse - a.pulse);
+        float departure = std::fabs(c.angle - predicted);
+        if(departure > params.curvatureTolerance){
+            step = std::max(step / 2.0f, params.minStep);
+        }
+        else if(departure < params.curvatureTolerance / 2.0f){
+            step = std::min(step * 2.0f, params.maxStep);
+        }
+    }
+
+    if(commandPulse != passEnd){
+        float next = commandPulse + travel * std::max(step, tick);
+        command(travel < 0.0f ? std::max(next, sampleMin) : std::min(next, sampleMax));
+        return;
+    }
+
+    // Turn around at the bottom
+    if(phase == Phase::SweepDown){
+        phase = Phase::SweepUp;
+        Reading bottom = pass.back();
+        pass.clear();
+        pass.push_back(bottom);
+        step = params.minStep;
+        command(std::min(commandPulse + std::max(step, tick), sampleMax));
+        return;
+    }
+
+    maxAngle = CalibrationCurve::fromSweep(samples).getMaxAngle();
+    endTime = std::chrono::steady_clock::now();
+    phase = Phase::Done;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Results ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Down then up sweep, in the order taken
+const std::vector<SweepSample>& ServoCalibrator::getSamples() const{
+    return samples;
+}
+
+// Direction dependent fit of the sweep
+ServoCalibration ServoCalibrator::getCalibration() const{
+    return ServoCalibration::fromSweep(samples);
+}
+
+float ServoCalibrator::getMinPulse() const{
+    return minPulse;
+}
+
+float ServoCalibrator::getMaxPulse() const{
+    return maxPulse;
+}
+
+float ServoCalibrator::getMaxAngle() const{
+    return maxAngle;
+}
+
+uint64_t ServoCalibrator::getCommandCount() const{
+    return commandCount;
+}
+
+uint64_t ServoCalibrator::getReadCount() const{
+    return readCount;
+}
+
+uint64_t ServoCalibrator::getTimeoutCount() const{
+    return timeoutCount;
+}
+
+std::chrono::milliseconds ServoCalibrator::getElapsed() const{
+    if(!started){
+        return std::chrono::milliseconds(0);
+    }
+    auto end = phase == Phase::Done ? endTime : std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(end - startTime);
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Multi Servo Calibrator ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+MultiServoCalibrator::MultiServoCalibrator(PCA9685* pca, const std::vector<CalibrationTarget>& targets)
+    : targets(targets), errors(targets.size()), started(false){
+
+    // Each servo needs its own channel and its own encoder (AS5600s share an address, so their own mux channel)
+    for(size_t i = 0; i < targets.size(); i++){
+        if(!targets[i].encoder){
+            throw std::runtime_error("Calibration target on channel " + std::to_string(targets[i].channel) + " has no encoder");
+        }
+        for(size_t j = 0; j < i; j++){
+            if(targets[j].channel == targets[i].channel){
+                throw std::runtime_error("Servo channel " + std::to_string(targets[i].channel) + " is calibrated twice");
+            }
+            if(targets[j].encoder == targets[i].encoder || targets[j].encoder->getChannel() == targets[i].encoder->getChannel()){
+                throw std::runtime_error("Servo channels " + std::to_string(targets[j].channel) + " and "
+                                       + std::to_string(targets[i].channel) + " share an encoder");
+            }
+        }
+    }
+
+    for(const CalibrationTarget& target : targets){
+        calibrators.emplace_back(new ServoCalibrator(pca, target.channel, target.encoder, target.params));
+    }
+}
+
+// Polls the calibrator that is due first, true once every servo is done or failed
+bool MultiServoCalibrator::poll(){
+
+    auto now = std::chrono::steady_clock::now();
+    if(!started){
+        started = true;
+        startTime = now;
+    }
+
+    // Earliest due calibrator still running
+    int due = -1;
+    for(size_t i = 0; i < calibrators.size(); i++){
+        if(calibrators[i]->isDone() || !errors[i].empty()){
+            continue;
+        }
+        if(due < 0 || calibrators[i]->nextPollTime() < calibrators[due]->nextPollTime()){
+            due = i;
+        }
+    }
+    if(due < 0){
+        endTime = now;
+        return true;
+    }
+
+    try{
+        calibrators[due]->poll();
+    }
+    catch(const std::exception& e){
+        errors[due] = e.what();
+    }
+    if(isDone()){
+        endTime = std::chrono::steady_clock::now();
+        return true;
+    }
+    return false;
+}
+
+// Polls until finished (blocking)
+void MultiServoCalibrator::run(){
+    while(!poll()){
+        std::this_thread::sleep_until(nextPollTime());
+    }
+}
+
+bool MultiServoCalibrator::isDone() const{
+    for(size_t i = 0; i < calibrators.size(); i++){
+        if(!calibrators[i]->isDone() && errors[i].empty()){
+            return false;
+        }
+    }
+    return true;
+}
+
+// When poll() next has work to do
+std::chrono::steady_clock::time_point MultiServoCalibrator::nextPollTime() const{
+    auto next = std::chrono::steady_clock::time_point::max();
+    for(size_t i = 0; i < calibrators.size(); i++){
+        if(!calibrators[i]->isDone() && errors[i].empty()){
+            next = std::min(next, calibrators[i]->nextPollTime());
+        }
+    }
+    return next;
+}
+
+size_t MultiServoCalibrator::size() const{
+    return targets.size();
+}
+
+uint8_t MultiServoCalibrator::getChannel(size_t target) const{
+    return targets.at(target).channel;
+}
+
+bool MultiServoCalibrator::succeeded(size_t target) const{
+    return calibrators.at(target)->isDone() && errors[target].empty();
+}
+
+const std::string& MultiServoCalibrator::getError(size_t target) const{
+    return errors.at(target);
+}
+
+const ServoCalibrator& MultiServoCalibrator::getCalibrator(size_t target) const{
+    return *calibrators.at(target);
+}
+
+// Combined sweep of every servo that succeeded, read back one channel at a time with readSweepCsv(path, channel)
+void MultiServoCalibrator::writeCsv(const std::string& path) const{
+
+    std::ofstream file(path);
+    if(!file.is_open()){
+        throw std::runtime_error("Failed to open calibration file for writing: " + path);
+    }
+
+    file << "Channel,Pulse Width (us),Absolute Step (0-4096)\n";
+    for(size_t i = 0; i < calibrators.size(); i++){
+        if(!succeeded(i)){
+            continue;
+        }
+        for(const SweepSample& sample : calibrators[i]->getSamples()){
+            file << static_cast<int>(targets[i].channel) << "," << std::lround(sample.pulse) << "," << sample.step << "\n";
+        }
+    }
+}
+
+std::chrono::milliseconds MultiServoCalibrator::getElapsed() const{
+    if(!started){
+        return std::chrono::milliseconds(0);
+    }
+    auto end = isDone() ? endTime : std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(end - startTime);
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -0,0 +1,574 @@
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Libraries ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+#include "sim_bus.h"
+#include "pca9685.h"
+#include "as5600.h"
+
+#include <cmath>     // For std::exp, std::floor, std::lround
+#include <algorithm> // For std::clamp, std::min, std::remove_if
+#include <stdexcept> // For std::runtime_error
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ SimBus ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+SimBus::SimBus(const SimBusParams& params)
+    : params(params), clock(params.clock ? params.clock : Clock::steady()), muxAddress(-1), muxControl(0x00), pendingNacks(0), jammed(false), nackRate(0.0), transactions(0), nacks(0), busTime(0)
+    , batchOps(nullptr), batchCount(0), stopping(false){
+    setClock(params.clockHz);
+}
+
+SimBus::~SimBus(){
+    {
+        std::lock_guard<std::mutex> lock(batchMutex);
+        stopping = true;
+    }
+    batchChanged.notify_all();
+    if(batchThread.joinable()){
+        batchThread.join();
+    }
+}
+
+// Hosts a device at an address, directly on the bus or behind a mux channel
+void SimBus::addDevice(SimDevice* device, uint8_t address, uint8_t channel){
+    std::lock_guard<std::mutex> lock(mutex);
+    if(channel != I2C_DIRECT && channel >= I2C_MUX_CHANNELS){
+        throw std::runtime_error("Mux channel does not exist: " + std::to_string(channel));
+    }
+    slots.push_back({device, address, channel});
+}
+
+// Adds a TCA9548A mux
+void SimBus::addMux(uint8_t address){
+    std::lock_guard<std::mutex> lock(mutex);
+    muxAddress = address;
+    muxControl = 0x00;
+}
+
+void SimBus::setClock(uint32_t clockHz){
+    if(clockHz == 0){
+        throw std::runtime_error("Bus clock must be above 0 Hz");
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    params.clockHz = clockHz;
+}
+
+// Device answering an address: on the bus itself, or behind an enabled mux channel
+SimDevice* SimBus::route(uint8_t addr){
+    SimDevice* found = nullptr;
+    for(const Slot& slot : slots){
+        if(slot.address != addr){
+            continue;
+        }
+        if(slot.channel != I2C_DIRECT && !(muxControl & (1 << slot.channel))){
+            continue;
+        }
+        if(found){
+            return nullptr; // Two devices answering at once
+        }
+        found = slot.device;
+    }
+    return found;
+}
+
+// Start, address byte, data bytes (8 bits + acknowledge each) and stop
+std::chrono::nanoseconds SimBus::transactionTime(int bytes){
+    double bits = (1 + bytes) * 9 + 2;
+    return std::chrono::nanoseconds(static_cast<long>(bits * 1e9 / params.clockHz));
+}
+
+// Counts the time on the wire, and sleeps for it on the bus clock in real time (bus lock held)
+void SimBus::occupy(int bytes){
+    std::chrono::nanoseconds duration = transactionTime(bytes);
+    busTime += duration;
+    transactions++;
+    if(params.realTime){
+        clock->sleepFor(duration);
+    }
+}
+
+int SimBus::read(uint8_t addr, uint8_t* buffer, int numBytes){
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if(faulted()){
+        return -1;
+    }
+
+    if(static_cast<int>(addr) == muxAddress){
+        for(int i = 0; i < numBytes; i++){
+            buffer[i] = muxControl;
+        }
+        occupy(numBytes);
+        return numBytes;
+    }
+
+    SimDevice* device = route(addr);
+    if(!device){
+        nacks++;
+        occupy(0);
+        return -1;
+    }
+    int transferred = device->read(buffer, numBytes);
+    occupy(transferred < 0 ? 0 : transferred);
+    return transferred;
+}
+
+int SimBus::write(uint8_t addr, const uint8_t* buffer, int numBytes){
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if(faulted()){
+        return -1;
+    }
+
+    if(static_cast<int>(addr) == muxAddress){
+        if(numBytes > 0){
+            muxControl = buffer[numBytes - 1];
+        }
+        occupy(numBytes);
+        return numBytes;
+    }
+
+    SimDevice* device = route(addr);
+    if(!device){
+        int transferred = broadcast(addr, buffer, numBytes);
+        if(transferred < 0){
+            nacks++;
+        }
+        occupy(transferred < 0 ? 0 : transferred);
+        return transferred;
+    }
+    int transferred = device->write(buffer, numBytes);
+    occupy(transferred < 0 ? 0 : transferred);
+    return transferred;
+}
+
+// Every reachable device taking writes on a shared address gets the bytes, as they all acknowledge together (bus lock held)
+int SimBus::broadcast(uint8_t addr, const uint8_t* buffer, int numBytes){
+    int transferred = -1;
+    for(const Slot& slot : slots){
+        if(slot.channel != I2C_DIRECT && !(muxControl & (1 << slot.channel))){
+            continue;
+        }
+        if(slot.device->answers(addr) && slot.device->write(buffer, numBytes) >= 0){
+            transferred = numBytes;
+        }
+    }
+    return transferred;
+}
+
+// Drops the transaction (not acknowledged) while jammed, with NACKs pending, or by chance on a noisy bus (bus lock held)
+bool SimBus::faulted(){
+    bool dropped = jammed || pendingNacks > 0;
+    if(!dropped && nackRate > 0.0){
+        dropped = std::uniform_real_distribution<double>(0.0, 1.0)(noise) < nackRate;
+    }
+    if(!dropped){
+        return false;
+    }
+    if(pendingNacks > 0){
+        pendingNacks--;
+    }
+    nacks++;
+    occupy(0);
+    return true;
+}
+
+// Clears a jam, as toggling SCL until the stuck slave lets go would
+bool SimBus::recover(){
+    std::lock_guard<std::mutex> lock(mutex);
+    jammed = false;
+    return true;
+}
+
+// ~~ Batches ~~
+
+// Hands the batch to the bus thread, or runs it now without asyncBatches
+bool SimBus::submitOps(I2CBusOp* ops, int count){
+    if(!params.asyncBatches){
+        return I2CBus::submitOps(ops, count);
+    }
+    std::lock_guard<std::mutex> lock(batchMutex);
+    if(batchOps){
+        return false; // One batch at a time
+    }
+    if(!batchThread.joinable()){
+        batchThread = std::thread(&SimBus::runBatches, this);
+    }
+    for(int i = 0; i < count; i++){
+        ops[i].result = -1;
+    }
+    aborting.store(false);
+    batchOps = ops;
+    batchCount = count;
+    batchChanged.notify_all();
+    return true;
+}
+
+void SimBus::waitOps(){
+    std::unique_lock<std::mutex> lock(batchMutex);
+    batchChanged.wait(lock, [this](){ return batchOps == nullptr; });
+}
+
+bool SimBus::pollOps(){
+    std::lock_guard<std::mutex> lock(batchMutex);
+    return batchOps == nullptr;
+}
+
+bool SimBus::isAsync(){
+    return params.asyncBatches;
+}
+
+// Runs each batch in order, as the kernel runs a linked io_uring chain
+void SimBus::runBatches(){
+    std::unique_lock<std::mutex> lock(batchMutex);
+    while(true){
+        batchChanged.wait(lock, [this](){ return batchOps != nullptr || stopping; });
+        if(!batchOps){
+            return;
+        }
+        I2CBusOp* ops = batchOps;
+        int count = batchCount;
+        lock.unlock();
+        runOps(ops, count);
+        lock.lock();
+        batchOps = nullptr;
+        batchChanged.notify_all();
+    }
+}
+
+// A device's handle is its address, so the transfer is addressed the same way
+int SimBus::openDevice(uint8_t addr){
+    return params.deviceHandles ? addr : -1;
+}
+
+int SimBus::readDevice(int handle, uint8_t* buffer, int numBytes){
+    return read(static_cast<uint8_t>(handle), buffer, numBytes);
+}
+
+int SimBus::writeDevice(int handle, const uint8_t* buffer, int numBytes){
+    return write(static_cast<uint8_t>(handle), buffer, numBytes);
+}
+
+void SimBus::injectNacks(int count){
+    std::lock_guard<std::mutex> lock(mutex);
+    pendingNacks = count;
+}
+
+void SimBus::setNackRate(double rate, unsigned seed){
+    std::lock_guard<std::mutex> lock(mutex);
+    nackRate = rate;
+    noise.seed(seed);
+}
+
+void SimBus::jam(){
+    std::lock_guard<std::mutex> lock(mutex);
+    jammed = true;
+}
+
+uint64_t SimBus::getTransactions(){
+    std::lock_guard<std::mutex> lock(mutex);
+    return transactions;
+}
+
+uint64_t SimBus::getNacks(){
+    std::lock_guard<std::mutex> lock(mutex);
+    return nacks;
+}
+
+std::chrono::nanoseconds SimBus::getBusTime(){
+    std::lock_guard<std::mutex> lock(mutex);
+    return busTime;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ SimPCA9685 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// PCA9685 register layout
+static const uint8_t LED0_ON_L = 0x06;
+static const int PCA_CHANNELS = 16;
+static const uint8_t FULL_BIT = 0x10; // Full ON/OFF in the high bytes
+
+// Power-on register values
+SimPCA9685::SimPCA9685() : pointer(0x00), nextWatcher(0){
+    for(int i = 0; i < 256; i++){
+        registers[i] = 0x00;
+    }
+    registers[MODE1_REG] = 0x11;   // Asleep, ALLCALL
+    registers[MODE2_REG] = 0x04;   // Totem pole outputs
+    for(int channel = 0; channel < PCA_CHANNELS; channel++){
+        registers[LED0_ON_L + 4 * channel + 3] = FULL_BIT; // Every channel starts full off
+    }
+    registers[PRESCALE_REG] = 0x1E; // 200 Hz
+    registers[SUBADR1_REG] = 0xE2;  // Addresses are held shifted left one
+    registers[SUBADR1_REG + 1] = 0xE4;
+    registers[SUBADR1_REG + 2] = 0xE8;
+    registers[ALLCALLADR_REG] = 0xE0;
+}
+
+// Register write with the side effects the chip has
+void SimPCA9685::store(uint8_t reg, uint8_t value){
+
+    if(reg == MODE1_REG){
+        registers[reg] = value & ~MODE1_RESTART; // RESTART clears itself
+    }
+    else if(reg == PRESCALE_REG){
+        if(registers[MODE1_REG] & MODE1_SLEEP){
+            registers[reg] = std::max<uint8_t>(value, 3); // Ignored while running, clamped to the minimum
+        }
+    }
+    else if(reg >= ALL_LED_ON_L && reg <= ALL_LED_OFF_H){
+        for(int channel = 0; channel < PCA_CHANNELS; channel++){
+            registers[LED0_ON_L + 4 * channel + (reg - ALL_LED_ON_L)] = value;
+        }
+    }
+    else if(reg >= LED0_ON_L && reg < LED0_ON_L + 4 * PCA_CHANNELS){
+        registers[reg] = (reg % 2) ? value & 0x1F : value; // High bytes hold 4 bits and the full ON/OFF bit
+    }
+    else{
+        registers[reg] = value;
+    }
+}
+
+// First byte sets the register pointer, the rest are written from there
+int SimPCA9685::write(const uint8_t* buffer, int numBytes){
+    {
+        // Watchers catch up on the outputs as they were before the write
+        std::lock_guard<std::mutex> lock(watchMutex);
+        for(const auto& watcher : watchers){
+            watcher.second();
+        }
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    if(numBytes < 1){
+        return numBytes;
+    }
+    pointer = buffer[0];
+    for(int i = 1; i < numBytes; i++){
+        store(pointer, buffer[i]);
+        if(registers[MODE1_REG] & MODE1_AI){
+            pointer++;
+        }
+    }
+    return numBytes;
+}
+
+int SimPCA9685::watch(std::function<void()> beforeWrite){
+    std::lock_guard<std::mutex> lock(watchMutex);
+    watchers.emplace_back(nextWatcher, std::move(beforeWrite));
+    return nextWatcher++;
+}
+
+void SimPCA9685::unwatch(int id){
+    std::lock_guard<std::mutex> lock(watchMutex);
+    watchers.erase(std::remove_if(watchers.begin(), watchers.end(), [id](const auto& watcher){ return watcher.first == id; })
+                 , watchers.end());
+}
+
+// Reads from the register pointer, ALL_LED registers read back as 0
+int SimPCA9685::read(uint8_t* buffer, int numBytes){
+    std::lock_guard<std::mutex> lock(mutex);
+    for(int i = 0; i < numBytes; i++){
+        bool allLed = pointer >= ALL_LED_ON_L && pointer <= ALL_LED_OFF_H;
+        buffer[i] = allLed ? 0x00 : registers[pointer];
+        if(registers[MODE1_REG] & MODE1_AI){
+            pointer++;
+        }
+    }
+    return numBytes;
+}
+
+// All-call when MODE1 ALLCALL is set, sub-address n when SUBn is
+bool SimPCA9685::answers(uint8_t addr){
+    std::lock_guard<std::mutex> lock(mutex);
+    uint8_t mode = registers[MODE1_REG];
+    if((mode & MODE1_ALLCALL) && registers[ALLCALLADR_REG] >> 1 == addr){
+        return true;
+    }
+    for(int index = 0; index < 3; index++){
+        if((mode & (MODE1_SUB1 >> index)) && registers[SUBADR1_REG + index] >> 1 == addr){
+            return true;
+        }
+    }
+    return false;
+}
+
+uint8_t SimPCA9685::getRegister(uint8_t reg){
+    std::lock_guard<std::mutex> lock(mutex);
+    return registers[reg];
+}
+
+bool SimPCA9685::isSleeping(){
+    std::lock_guard<std::mutex> lock(mutex);
+    return registers[MODE1_REG] & MODE1_SLEEP;
+}
+
+// 4096 ticks of (prescale + 1) / 25 MHz
+float SimPCA9685::getPeriod(){
+    std::lock_guard<std::mutex> lock(mutex);
+    return 4096.0f * (registers[PRESCALE_REG] + 1.0f) / 25.0f;
+}
+
+// Decodes a channel's ON/OFF registers, full OFF wins over full ON
+float SimPCA9685::getPulseWidth(uint8_t channel){
+    std::lock_guard<std::mutex> lock(mutex);
+    if(channel >= PCA_CHANNELS || (registers[MODE1_REG] & MODE1_SLEEP)){
+        return 0.0f;
+    }
+    const uint8_t* led = registers + LED0_ON_L + 4 * channel;
+    float tick = (registers[PRESCALE_REG] + 1.0f) / 25.0f;
+    if(led[3] & FULL_BIT){
+        return 0.0f;
+    }
+    if(led[1] & FULL_BIT){
+        return 4096.0f * tick;
+    }
+    int on = ((led[1] & 0x0F) << 8) | led[0];
+    int off = ((led[3] & 0x0F) << 8) | led[2];
+    return (((off - on) % 4096 + 4096) % 4096) * tick;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ SimAS5600 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+SimAS5600::SimAS5600(std::function<double()> magnetAngle, double noise, unsigned seed)
+    : magnetAngle(std::move(magnetAngle)), pointer(0x00), sample(0), noise(noise), rng(seed){
+    for(int i = 0; i < 256; i++){
+        registers[i] = 0x00;
+    }
+    registers[REG_MAGNET_STATUS] = 0x20; // Magnet detected
+    registers[REG_AGC] = 0x80;
+    registers[REG_MAGNITUDE_MSB] = 0x08;
+}
+
+// Magnet angle in 4096 steps per turn
+uint16_t SimAS5600::rawStep(){
+    double steps = magnetAngle() * 4096.0 / 360.0;
+    if(noise > 0.0){
+        steps += std::normal_distribution<double>(0.0, noise)(rng);
+    }
+    long step = std::lround(steps);
+    return static_cast<uint16_t>(((step % 4096) + 4096) % 4096);
+}
+
+// First byte sets the register pointer, only ZPOS/MPOS/MANG/CONF take writes
+int SimAS5600::write(const uint8_t* buffer, int numBytes){
+    std::lock_guard<std::mutex> lock(mutex);
+    if(numBytes < 1){
+        return numBytes;
+    }
+    pointer = buffer[0];
+    for(int i = 1; i < numBytes; i++){
+        if(pointer >= REG_ZPOS_MSB && pointer <= REG_CONF_LSB){
+            registers[pointer] = buffer[i];
+        }
+        pointer++;
+    }
+    return numBytes;
+}
+
+// Output high bytes sample the magnet, their low bytes finish the sample
+int SimAS5600::read(uint8_t* buffer, int numBytes){
+    std::lock_guard<std::mutex> lock(mutex);
+    for(int i = 0; i < numBytes; i++){
+        uint16_t zero = ((registers[REG_ZPOS_MSB] & 0x0F) << 8) | registers[REG_ZPOS_LSB];
+        switch(pointer){
+            case REG_RAW_ANGLE_MSB:
+                sample = rawStep();
+                buffer[i] = sample >> 8;
+                break;
+            case REG_ANGLE_MSB:
+                sample = (rawStep() - zero) & 0x0FFF;
+                buffer[i] = sample >> 8;
+                break;
+            case REG_MAGNITUDE_MSB:
+                sample = (registers[REG_MAGNITUDE_MSB] << 8) | registers[REG_MAGNITUDE_LSB];
+                buffer[i] = sample >> 8;
+                break;
+            case REG_RAW_ANGLE_LSB:
+            case REG_ANGLE_LSB:
+            case REG_MAGNITUDE_LSB:
+                buffer[i] = sample & 0xFF;
+                break;
+            default:
+                buffer[i] = registers[pointer];
+        }
+        pointer++;
+    }
+    return numBytes;
+}
+
+uint8_t SimAS5600::getRegister(uint8_t reg){
+    std::lock_guard<std::mutex> lock(mutex);
+    return registers[reg];
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ SimServo ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+static const double SIM_STEP_S = 0.0005; // Integration step
+
+SimServo::SimServo(SimPCA9685* pca, uint8_t channel, const SimServoParams& params, float startAngle, Clock* clock)
+    : pca(pca), channel(channel), params(params), clock(clock), start(clock->now())
+    , simTime(0.0), pulse(0.0), target(startAngle), angle(startAngle), watcher(-1){
+    if(params.maxAngle <= 0.0f || params.maxSpeed <= 0.0f || params.timeConstant <= 0.0f){
+        throw std::runtime_error("Invalid simulated servo parameters");
+    }
+
+    // Runs the old pulse up to the write that changes it
+    watcher = pca->watch([this](){
+        std::lock_guard<std::mutex> lock(mutex);
+        advance();
+    });
+}
+
+SimServo::~SimServo(){
+    pca->unwatch(watcher);
+}
+
+// Angle a pulse drives to, backlash keeps the target between the rising and falling curves
+double SimServo::pulseToAngle(double pulse){
+    double reached;
+    if(params.calibration && !params.calibration->empty()){
+        reached = std::clamp(target, static_cast<double>(params.calibration->getRising().angleAt(pulse))
+                           , static_cast<double>(params.calibration->getFalling().angleAt(pulse)));
+    }
+    else{
+        double fraction = (pulse - params.minPulse) / (params.maxPulse - params.minPulse);
+        reached = std::clamp(fraction, 0.0, 1.0) * params.maxAngle;
+    }
+    return std::fabs(reached - target) > params.deadBand ? reached : target;
+}
+
+// Frame pickup, then first order lag with a speed limit (servo lock held)
+void SimServo::advance(){
+    double now = std::chrono::duration<double>(clock->now() - start).count();
+    double frame = pca->getPeriod() / 1e6;
+    while(simTime < now){
+        double dt = std::min(SIM_STEP_S, now - simTime);
+        double frameBefore = std::floor(simTime / frame);
+        simTime += dt;
+
+        if(std::floor(simTime / frame) != frameBefore){
+            pulse = pca->getPulseWidth(channel);
+            if(pulse > 0.0){
+                target = pulseToAngle(pulse);
+            }
+        }
+        double move = (target - angle) * (1.0 - std::exp(-dt / params.timeConstant));
+        angle += std::clamp(move, -params.maxSpeed * dt, params.maxSpeed * dt);
+    }
+}
+
+double SimServo::getAngle(){
+    std::lock_guard<std::mutex> lock(mutex);
+    advance();
+    return angle;
+}
+
+double SimServo::getPulse(){
+    std::lock_guard<std::mutex> lock(mutex);
+    advance();
+    return pulse;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
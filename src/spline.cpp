@@ -0,0 +1,237 @@
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Libraries ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+#include "spline.h"
+
+#include <algorithm>  // For std::clamp, std::upper_bound
+#include <stdexcept>  // For std::runtime_error
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Constructor ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Constructor: Creates an empty spline of the given type
+JointSpline::JointSpline(SplineType type) : type(type), cursor(0){}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Fitting ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Fits the spline through the waypoints, one time per waypoint (seconds)
+void JointSpline::fit(const std::vector<float>& times, const std::vector<JointVector>& waypoints){
+
+    // Validate input
+    if(times.size() != waypoints.size()){
+        throw std::runtime_error("Spline needs exactly one time per waypoint");
+    }
+    if(waypoints.size() < 2){
+        throw std::runtime_error("Spline needs at least 2 waypoints");
+    }
+    for(size_t i = 1; i < times.size(); i++){
+        if(!(times[i] > times[i - 1])){
+            throw std::runtime_error("Spline waypoint times must be strictly increasing");
+        }
+    }
+
+    knots = times;
+    cursor = 0;
+    coeffs.assign((knots.size() - 1) * SPLINE_COEFFS * NUM_JOINTS, 0.0f);
+
+    // Knot velocities are shared by both spline types
+    std::vector<JointVector> velocities;
+    solveKnotVelocities(waypoints, velocities);
+
+    if(type == SplineType::Cubic){
+        fitCubic(waypoints, velocities);
+    }
+    else{
+        fitQuintic(waypoints, velocities);
+    }
+}
+
+/* Solves for the knot velocities of a C2 cubic spline with zero end velocities
+ * For each interior knot i (h = segment duration, d = segment slope):
+ * h[i] v[i-1] + 2 (h[i-1] + h[i]) v[i] + h[i-1] v[i+1] = 3 (h[i] d[i-1] + h[i-1] d[i])
+ * The system is tridiagonal and identical for every joint, so the forward sweep
+ * of the Thomas algorithm is shared and only the right hand side is per joint.
+ */
+void JointSpline::solveKnotVelocities(const std::vector<JointVector>& waypoints, std::vector<JointVector>& velocities){
+
+    size_t n = waypoints.size() - 1; // Number of segments
+    velocities.assign(n + 1, JointVector{});
+
+    // Only the end points, velocities are already zero
+    if(n < 2){
+        return;
+    }
+
+    std::vector<double> cPrime(n, 0.0);
+    std::vector<double> denom(n, 0.0);
+
+    // Forward sweep of the matrix (shared by all joints)
+    for(size_t i = 1; i < n; i++){
+        double hPrev = knots[i] - knots[i - 1];
+        double h = knots[i + 1] - knots[i];
+        double m = 2.0 * (hPrev + h) - (i > 1 ? h * cPrime[i - 1] : 0.0);
+        denom[i] = m;
+        cPrime[i] = hPrev / m;
+    }
+
+    // Right hand side and back substitution per joint
+    std::vector<double> dPrime(n, 0.0);
+    for(int j = 0; j < NUM_JOINTS; j++){
+        for(size_t i = 1; i < n; i++){
+            double hPrev = knots[i] - knots[i - 1];
+            double h = knots[i + 1] - knots[i];
+            double slopePrev = (waypoints[i][j] - waypoints[i - 1][j]) / hPrev;
+            double slope = (waypoints[i + 1][j] - waypoints[i][j]) / h;
+            double rhs = 3.0 * (h * slopePrev + hPrev * slope);
+            dPrime[i] = (rhs - (i > 1 ? h * dPrime[i - 1] : 0.0)) / denom[i];
+        }
+
+        double next = 0.0;
+        for(size_t i = n - 1; i >= 1; i--){
+            next = dPrime[i] - cPrime[i] * next;
+            velocities[i][j] = static_cast<float>(next);
+        }
+    }
+}
+
+// Cubic Hermite segments from the knot velocities (C2 by construction)
+void JointSpline::fitCubic(const std::vector<JointVector>& waypoints, const std::vector<JointVector>& velocities){
+
+    for(size_t s = 0; s + 1 < knots.size(); s++){
+        float* c = segment(s);
+        double h = knots[s + 1] - knots[s];
+
+        for(int j = 0; j < NUM_JOINTS; j++){
+            double p0 = waypoints[s][j], p1 = waypoints[s + 1][j];
+            double v0 = velocities[s][j], v1 = velocities[s + 1][j];
+            double slope = (p1 - p0) / h;
+
+            c[0 * NUM_JOINTS + j] = static_cast<float>(p0);
+            c[1 * NUM_JOINTS + j] = static_cast<float>(v0);
+            c[2 * NUM_JOINTS + j] = static_cast<float>((3.0 * slope - 2.0 * v0 - v1) / h);
+            c[3 * NUM_JOINTS + j] = static_cast<float>((v0 + v1 - 2.0 * slope) / (h * h));
+        }
+    }
+}
+
+/* Quintic Hermite segments
+ * Interior knot accelerations are taken from the C2 cubic through the same knots,
+ * so velocity and acceleration are continuous. Both ends start and stop at rest.
+ */
+void JointSpline::fitQuintic(const std::vector<JointVector>& waypoints, const std::vector<JointVector>& velocities){
+
+    size_t n = knots.size() - 1;
+
+    // Interior knot accelerations from the cubic (second derivative at u = 0)
+    std::vector<JointVector> accelerations(n + 1, JointVector{});
+    for(size_t i = 1; i < n; i++){
+        double h = knots[i + 1] - knots[i];
+        for(int j = 0; j < NUM_JOINTS; j++){
+            double slope = (waypoints[i + 1][j] - waypoints[i][j]) / h;
+            accelerations[i][j] = static_cast<float>(2.0 * (3.0 * slope - 2.0 * velocities[i][j] - velocities[i + 1][j]) / h);
+        }
+    }
+
+    for(size_t s = 0; s < n; s++){
+        float* c = segment(s);
+        double h = knots[s + 1] - knots[s];
+        double h2 = h * h, h3 = h2 * h, h4 = h3 * h, h5 = h4 * h;
+
+        for(int j = 0; j < NUM_JOINTS; j++){
+            double p0 = waypoints[s][j], p1 = waypoints[s + 1][j];
+            double v0 = velocities[s][j], v1 = velocities[s + 1][j];
+            double a0 = accelerations[s][j], a1 = accelerations[s + 1][j];
+            double dp = p1 - p0;
+
+            c[0 * NUM_JOINTS + j] = static_cast<float>(p0);
+            c[1 * NUM_JOINTS + j] = static_cast<float>(v0);
+            c[2 * NUM_JOINTS + j] = static_cast<float>(a0 / 2.0);
+            c[3 * NUM_JOINTS + j] = static_cast<float>((20.0 * dp - (8.0 * v1 + 12.0 * v0) * h - (3.0 * a0 - a1) * h2) / (2.0 * h3));
+            c[4 * NUM_JOINTS + j] = static_cast<float>((-30.0 * dp + (14.0 * v1 + 16.0 * v0) * h + (3.0 * a0 - 2.0 * a1) * h2) / (2.0 * h4));
+            c[5 * NUM_JOINTS + j] = static_cast<float>((12.0 * dp - 6.0 * (v1 + v0) * h + (a1 - a0) * h2) / (2.0 * h5));
+        }
+    }
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Evaluation ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Moves the cursor to the segment containing t (clamped to the spline)
+size_t JointSpline::findSegment(float t){
+
+    size_t last = knots.size() - 2;
+
+    // Ticks move forward, so usually we stay put or step one segment ahead
+    if(t >= knots[cursor]){
+        while(cursor < last && t >= knots[cursor + 1]){
+            cursor++;
+        }
+        return cursor;
+    }
+
+    // Time went backwards, search from scratch
+    auto it = std::upper_bound(knots.begin(), knots.end(), t);
+    cursor = (it == knots.begin()) ? 0 : std::min(static_cast<size_t>(it - knots.begin()) - 1, last);
+    return cursor;
+}
+
+// Returns a pointer to the coefficients of a segment
+float* JointSpline::segment(size_t index){
+    return coeffs.data() + index * SPLINE_COEFFS * NUM_JOINTS;
+}
+
+// Fills NUM_JOINTS positions at time t using Horner's method across all joints
+void JointSpline::evaluate(float t, float* positions){
+
+    size_t index = findSegment(t);
+    const float* c = segment(index);
+    float u = std::clamp(t, knots.front(), knots.back()) - knots[index];
+
+    for(int j = 0; j < NUM_JOINTS; j++){
+        positions[j] = c[(SPLINE_COEFFS - 1) * NUM_JOINTS + j];
+    }
+    for(int k = SPLINE_COEFFS - 2; k >= 0; k--){
+        for(int j = 0; j < NUM_JOINTS; j++){
+            positions[j] = positions[j] * u + c[k * NUM_JOINTS + j];
+        }
+    }
+}
+
+// Fills NUM_JOINTS velocities at time t (derivative of the segment polynomial)
+void JointSpline::evaluateVelocity(float t, float* velocities){
+
+    size_t index = findSegment(t);
+    const float* c = segment(index);
+    float u = std::clamp(t, knots.front(), knots.back()) - knots[index];
+
+    for(int j = 0; j < NUM_JOINTS; j++){
+        velocities[j] = (SPLINE_COEFFS - 1) * c[(SPLINE_COEFFS - 1) * NUM_JOINTS + j];
+    }
+    for(int k = SPLINE_COEFFS - 2; k >= 1; k--){
+        for(int j = 0; j < NUM_JOINTS; j++){
+            velocities[j] = velocities[j] * u + k * c[k * NUM_JOINTS + j];
+        }
+    }
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// ~~ Accessors ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+float JointSpline::startTime() const{
+    return knots.empty() ? 0.0f : knots.front();
+}
+
+float JointSpline::endTime() const{
+    return knots.empty() ? 0.0f : knots.back();
+}
+
+size_t JointSpline::numSegments() const{
+    return knots.empty() ? 0 : knots.size() - 1;
+}
+
+SplineType JointSpline::getType() const{
+    return type;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -0,0 +1,139 @@
+/*
+~~ Arm Calibration ~~
+
+Calibrates every joint servo that has an encoder (JnS_ENCODER_CHANNEL in config.h) in one run.
+The following happens when run:
+- Each servo is set to the middle of its configured pulse range
+- All servos are calibrated at once (MultiServoCalibrator): while one servo waits for its horn to
+  settle, the others are commanded and read, so the arm takes about as long as its slowest joint
+- The combined sweep is written to CALIBRATION_FILE (one "Channel,Pulse Width (us),Absolute Step"
+  row per reading, read back per channel with readSweepCsv(path, channel))
+- The measured range of each joint is printed in config.h form
+
+*/
+
+// Libraries
+#include "pca9685.h"
+#include "as5600.h"
+#include "i2c.h"
+#include "calibration.h"
+#include "servo_calibrator.h"
+#include "config.h"
+
+#include <chrono> // For time in ms
+#include <thread> // For sleeping
+#include <vector>
+#include <memory>
+#include <iostream>
+#include <cstdint>  // For uint8_t
+
+// AS5600 Config
+const uint16_t AS5600_CONFIG = 0x000C;           // Config of AS5600
+
+// Joints from config.h
+struct Joint{
+    uint8_t servoChannel;
+    int encoderChannel; // -1 without an encoder
+    float minPulse;
+    float maxPulse;
+};
+
+const Joint JOINTS[NUM_JOINTS] = {
+    {J1S_CHANNEL, J1S_ENCODER_CHANNEL, J1S_MIN_PULSE, J1S_MAX_PULSE},
+    {J2S_CHANNEL, J2S_ENCODER_CHANNEL, J2S_MIN_PULSE, J2S_MAX_PULSE},
+    {J3S_CHANNEL, J3S_ENCODER_CHANNEL, J3S_MIN_PULSE, J3S_MAX_PULSE},
+    {J4S_CHANNEL, J4S_ENCODER_CHANNEL, J4S_MIN_PULSE, J4S_MAX_PULSE},
+    {J5S_CHANNEL, J5S_ENCODER_CHANNEL, J5S_MIN_PULSE, J5S_MAX_PULSE},
+    {J6S_CHANNEL, J6S_ENCODER_CHANNEL, J6S_MIN_PULSE, J6S_MAX_PULSE},
+};
+
+int main() {
+
+    // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+    // ~~ Initialization ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+    std::cout << "Beginning arm calibration..." << std::endl;
+    std::cout << "Initializing objects..." << std::endl;
+
+    I2C i2c(I2C_DIRECTORY);
+    if(!i2c.attachMux(I2C_MUX_ADDRESS)){
+        std::cerr << "I2C mux not found!" << std::endl;
+        return 1;
+    }
+
+    PCA9685 pca9685(&i2c, PCA9685_SLAVE_ADDR);
+    pca9685.setPWMFrequency(PCA9685_FREQ);
+
+    const CalibratorParams defaults = {
+        0.0f, CALIBRATION_SEARCH_LOW, CALIBRATION_SEARCH_HIGH, CALIBRATION_GALLOP_STEP, CALIBRATION_ENDPOINT_RESOLUTION
+      , CALIBRATION_BACKLASH_MARGIN, CALIBRATION_SATURATION_TOLERANCE, CALIBRATION_CLIP, CALIBRATION_MIN_STEP
+      , CALIBRATION_MAX_STEP, CALIBRATION_CURVATURE_TOLERANCE, std::chrono::microseconds(CALIBRATION_POLL_PERIOD_US)
+      , std::chrono::microseconds(CALIBRATION_MIN_DWELL_US), std::chrono::microseconds(CALIBRATION_SETTLE_TIMEOUT_US)
+      , CALIBRATION_SETTLE_WINDOW, CALIBRATION_SETTLE_TOLERANCE};
+
+    // Joints with an encoder, each starting from the middle of its configured range
+    std::vector<std::unique_ptr<AS5600>> encoders; // Freed on every return
+    std::vector<CalibrationTarget> targets;
+    std::vector<int> jointOf;
+    for(int joint = 0; joint < NUM_JOINTS; joint++){
+        if(JOINTS[joint].encoderChannel < 0){
+            std::cout << "Joint " << joint + 1 << " has no encoder, skipping." << std::endl;
+            continue;
+        }
+        CalibratorParams params = defaults;
+        params.startPulse = (JOINTS[joint].minPulse + JOINTS[joint].maxPulse) / 2.0f;
+        pca9685.setPulseWidth(JOINTS[joint].servoChannel, params.startPulse);
+
+        encoders.emplace_back(new AS5600(&i2c, AS5600_CONFIG, JOINTS[joint].encoderChannel));
+        targets.push_back({JOINTS[joint].servoChannel, encoders.back().get(), params});
+        jointOf.push_back(joint);
+    }
+
+    // Give every servo time to reach its start pulse
+    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+
+    std::cout << "Initialization complete." << std::endl;
+
+    // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+    // ~~ Calibrate ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+    std::cout << "Calibrating " << targets.size() << " joints..." << std::endl;
+
+    MultiServoCalibrator calibrator(&pca9685, targets);
+    calibrator.run();
+
+    std::cout << "Calibration took " << calibrator.getElapsed().count() << "ms." << std::endl;
+
+    // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+    // ~~ Results ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+    bool allPassed = true;
+    for(size_t i = 0; i < calibrator.size(); i++){
+        int joint = jointOf[i] + 1;
+        if(!calibrator.succeeded(i)){
+            std::cerr << "Joint " << joint << " failed: " << calibrator.getError(i) << std::endl;
+            allPassed = false;
+            continue;
+        }
+        const ServoCalibrator& servo = calibrator.getCalibrator(i);
+        std::cout << "#define J" << joint << "S_MIN_PULSE " << servo.getMinPulse() + CALIBRATION_CLIP << " // microseconds" << std::endl;
+        std::cout << "#define J" << joint << "S_MAX_PULSE " << servo.getMaxPulse() - CALIBRATION_CLIP << " // microseconds" << std::endl;
+        std::cout << "#define J" << joint << "S_MAX_ANGLE " << servo.getMaxAngle() << " // degrees" << std::endl;
+        std::cout << "Joint " << joint << ": " << servo.getSamples().size() << " samples, hysteresis "
+                  << servo.getCalibration().getHysteresis() << " degrees, " << servo.getTimeoutCount()
+                  << " readings did not settle." << std::endl;
+    }
+
+    std::cout << "Writing dataset to file..." << std::endl;
+    try{
+        calibrator.writeCsv(CALIBRATION_FILE);
+    }
+    catch(const std::exception& e){
+        std::cerr << "Error writing file: " << e.what() << std::endl;
+        return 1;
+    }
+    std::cout << "Succesfully written dataset to " << CALIBRATION_FILE << std::endl;
+
+    std::cout << (allPassed ? "Calibration Successful!" : "Calibration finished with failures.") << std::endl;
+    return allPassed ? 0 : 1;
+}
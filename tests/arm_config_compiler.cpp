@@ -0,0 +1,55 @@
+/*
+~~ Arm Config Compiler ~~
+
+Compiles a text arm config (arm_config.txt) into the binary file the arm loads
+at startup (ARM_CONFIG_FILE), so a recalibrated arm only needs a new config
+file rather than a rebuilt binary. Calibration sweeps are fitted and the pulse
+tables built here, once, instead of every time the arm starts.
+
+Usage: ./testExe [input.txt] [output.bin]
+  input   text arm config (default: arm_config.txt in ARM_DATA_DIR)
+  output  binary arm config to write (default: ARM_CONFIG_FILE in ARM_DATA_DIR,
+          where the arm looks for it)
+
+The written file is loaded back and checked before reporting success.
+
+*/
+
+#include "arm_config.h"
+#include "RoboticArmBuilder.h"
+#include "config.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <iostream>
+
+int main(int argc, char* argv[]){
+
+    std::string input = argc > 1 ? argv[1] : RoboticArmBuilder::dataPath("arm_config.txt");
+    std::string output = argc > 2 ? argv[2] : RoboticArmBuilder::dataPath(ARM_CONFIG_FILE);
+
+    try{
+        auto start = std::chrono::steady_clock::now();
+        std::vector<uint8_t> blob = compileArmConfig(input);
+        writeArmConfig(output, blob);
+        double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        ArmConfig config(output);
+        const ArmConfigHeader& header = config.getHeader();
+        for(uint32_t i = 0; i < config.getNumJoints(); i++){
+            const JointConfig& joint = config.getJoint(i);
+            std::cout << "Joint " << i + 1 << ": channel " << static_cast<int>(joint.channel) << ", "
+                      << joint.minPulse << " - " << joint.maxPulse << " us, " << joint.maxAngle << " deg, "
+                      << (joint.calibrated ? "calibrated" : "linear map") << std::endl;
+        }
+        std::cout << "Compiled " << input << " into " << output << " (" << header.size << " bytes, version "
+                  << header.version << ", checksum " << std::hex << header.checksum << std::dec << ") in "
+                  << elapsedMs << " ms" << std::endl;
+    }
+    catch(const std::exception& e){
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
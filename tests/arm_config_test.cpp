@@ -0,0 +1,320 @@
+/*
+~~ Arm Config Test ~~
+
+Compiles arm_config.txt into a binary arm config and checks that:
+- it loads back with the config.h servo parameters and derived values
+- its pulse tables match the ones built from the calibration sweeps, and a
+  Servo given them commands the same off time as one building its own
+- servos on a PCA9685 at another prescaler ignore the stale tables
+- corrupted, truncated, wrong version and malformed files are refused
+- the config.h calibration paths and the arm config the arm looks for resolve
+  from any working directory, next to the text config the compiler reads
+
+Then benchmarks arm startup: fitting the sweeps and building the tables from
+the config.h parameters, against mapping the binary config.
+
+Run from the repository root so the sample paths resolve.
+*/
+
+#include "i2c.h"
+#include "pca9685.h"
+#include "servo.h"
+#include "motion.h"
+#include "calibration.h"
+#include "arm_config.h"
+#include "RoboticArmBuilder.h"
+#include "config.h"
+
+#include <cmath>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <unistd.h> // For chdir, getcwd, access
+#include <climits>  // For PATH_MAX
+
+// Test Config
+const char* TEXT_CONFIG = "arm_config.txt";
+const char* BINARY_CONFIG = "arm_config_test.bin";
+const char* TEMP_CONFIG = "arm_config_test_temp.bin";
+const char* TEMP_TEXT = "arm_config_test_temp.txt";
+const uint8_t PCA_ADDR = 0x40;
+const int STARTUP_RUNS = 20;
+
+// config.h joints
+struct DefinedJoint{
+    uint8_t channel;
+    int encoderChannel;
+    uint16_t minPulse;
+    uint16_t maxPulse;
+    float maxAngle;
+    float defaultAngle;
+    float jointOffset;
+    const char* calibration;
+};
+
+const DefinedJoint JOINTS[NUM_JOINTS] = {
+    {J1S_CHANNEL, J1S_ENCODER_CHANNEL, J1S_MIN_PULSE, J1S_MAX_PULSE, J1S_MAX_ANGLE, J1S_DEF_ANGLE, J1S_DEF_ANGLE, J1S_CALIBRATION},
+    {J2S_CHANNEL, J2S_ENCODER_CHANNEL, J2S_MIN_PULSE, J2S_MAX_PULSE, J2S_MAX_ANGLE, J2S_DEF_ANGLE, 90.0 + J2S_DEF_ANGLE, J2S_CALIBRATION},
+    {J3S_CHANNEL, J3S_ENCODER_CHANNEL, J3S_MIN_PULSE, J3S_MAX_PULSE, J3S_MAX_ANGLE, J3S_DEF_ANGLE, J3S_DEF_ANGLE, J3S_CALIBRATION},
+    {J4S_CHANNEL, J4S_ENCODER_CHANNEL, J4S_MIN_PULSE, J4S_MAX_PULSE, J4S_MAX_ANGLE, J4S_DEF_ANGLE, J4S_DEF_ANGLE, J4S_CALIBRATION},
+    {J5S_CHANNEL, J5S_ENCODER_CHANNEL, J5S_MIN_PULSE, J5S_MAX_PULSE, J5S_MAX_ANGLE, J5S_DEF_ANGLE, J5S_DEF_ANGLE, J5S_CALIBRATION},
+    {J6S_CHANNEL, J6S_ENCODER_CHANNEL, J6S_MIN_PULSE, J6S_MAX_PULSE, J6S_MAX_ANGLE, J6S_DEF_ANGLE, J6S_DEF_ANGLE, J6S_CALIBRATION},
+};
+
+// Fake PCA9685 bus: keeps the last off time written to each channel
+class OffTimeBus : public I2C
+{
+private:
+    uint8_t offLow[16] = {};
+
+protected:
+    int transferRead(uint8_t addr, uint8_t* buffer, int numBytes) override{
+        for(int i = 0; i < numBytes; i++){
+            buffer[i] = 0x00;
+        }
+        return numBytes;
+    }
+
+    int transferWrite(uint8_t addr, const uint8_t* buffer, int numBytes) override{
+        if(numBytes == 2 && buffer[0] >= 0x08 && buffer[0] < 0x48 && (buffer[0] - 0x08) % 4 == 0){
+            offLow[(buffer[0] - 0x08) / 4] = buffer[1];
+        }
+        else if(numBytes == 2 && buffer[0] >= 0x09 && buffer[0] < 0x49 && (buffer[0] - 0x09) % 4 == 0 && !(buffer[1] & 0x10)){
+            int channel = (buffer[0] - 0x09) / 4;
+            offTime[channel] = ((buffer[1] & 0x0F) << 8) | offLow[channel];
+        }
+        return numBytes;
+    }
+
+public:
+    uint16_t offTime[16] = {};
+};
+
+bool report(const std::string& name, bool passed){
+    std::cout << name << ": " << (passed ? "Passed!" : "Failed!") << std::endl;
+    return passed;
+}
+
+// Calibration as RoboticArmBuilder loads it from config.h
+ServoCalibration definedCalibration(int joint){
+    if(JOINTS[joint].calibration[0] == '\0'){
+        return ServoCalibration();
+    }
+    return ServoCalibration::fromSweepCsv(RoboticArmBuilder::dataPath(JOINTS[joint].calibration));
+}
+
+ServoParams definedParams(PCA9685* pca, int joint, MotionEngine* engine, const ServoCalibration* calibration){
+    const DefinedJoint& defined = JOINTS[joint];
+    return {pca, defined.channel, defined.minPulse, defined.maxPulse, defined.maxAngle, defined.defaultAngle
+          , 90.0f, 5.0f, engine, calibration->empty() ? nullptr : calibration};
+}
+
+// Loading must fail with a message containing expected
+bool refuses(const std::vector<uint8_t>& blob, const std::string& expected){
+    std::ofstream(TEMP_CONFIG, std::ios::binary).write(reinterpret_cast<const char*>(blob.data()), blob.size());
+    try{
+        ArmConfig config(TEMP_CONFIG);
+    }
+    catch(const std::runtime_error& e){
+        return std::string(e.what()).find(expected) != std::string::npos;
+    }
+    return false;
+}
+
+bool compileRefuses(const std::string& text, const std::string& expected){
+    std::ofstream(TEMP_TEXT) << text;
+    try{
+        compileArmConfig(TEMP_TEXT);
+    }
+    catch(const std::runtime_error& e){
+        return std::string(e.what()).find(expected) != std::string::npos;
+    }
+    return false;
+}
+
+// Rewrites the checksum after editing a blob
+void reseal(std::vector<uint8_t>& blob){
+    uint32_t checksum = crc32(blob.data() + 16, blob.size() - 16);
+    std::memcpy(blob.data() + 12, &checksum, sizeof(checksum));
+}
+
+int main(){
+
+    bool passed = true;
+    std::cout << std::fixed << std::setprecision(3);
+
+    // Servo constructors print their speed, keep the output readable
+    std::ostringstream servoLog;
+    std::streambuf* console = std::cout.rdbuf();
+
+    writeArmConfig(BINARY_CONFIG, compileArmConfig(TEXT_CONFIG));
+    ArmConfig config(BINARY_CONFIG);
+    const ArmConfigHeader& header = config.getHeader();
+
+    // Parameters and derived values match config.h
+    bool parameters = config.getNumJoints() == NUM_JOINTS && header.version == ARM_CONFIG_VERSION
+                   && header.prescaler == 0x79 && header.stepSize == 122.0f / 25.0f
+                   && header.servoSpeed == SERVO_SPEED && header.updateResolution == SERVO_UPDATE_RESOLUTION
+                   && header.tableSize == SERVO_PULSE_TABLE_SIZE;
+    for(int i = 0; parameters && i < NUM_JOINTS; i++){
+        const JointConfig& joint = config.getJoint(i);
+        const DefinedJoint& defined = JOINTS[i];
+        parameters = joint.channel == defined.channel && joint.encoderChannel == defined.encoderChannel
+                  && joint.minPulse == defined.minPulse && joint.maxPulse == defined.maxPulse
+                  && joint.maxAngle == defined.maxAngle && joint.defaultAngle == defined.defaultAngle
+                  && joint.jointOffset == defined.jointOffset
+                  && joint.calibrated == (defined.calibration[0] != '\0')
+                  && std::fabs(joint.angleToPwmSlope - (defined.maxPulse - defined.minPulse) / defined.maxAngle) < 1e-6f
+                  && std::fabs(joint.lowerLimit + defined.jointOffset * M_PI / 180.0) < 1e-5
+                  && std::fabs(joint.upperLimit - (defined.maxAngle - defined.jointOffset) * M_PI / 180.0) < 1e-5;
+    }
+    passed = report("Config loads with the config.h parameters", parameters) && passed;
+
+    // Calibration and arm config paths do not depend on the working directory
+    char root[PATH_MAX];
+    bool resolved = getcwd(root, sizeof(root)) != nullptr && chdir("/") == 0;
+    for(int i = 0; resolved && i < NUM_JOINTS; i++){
+        std::string path = RoboticArmBuilder::dataPath(JOINTS[i].calibration);
+        resolved = JOINTS[i].calibration[0] == '\0' ? path.empty() : path[0] == '/' && access(path.c_str(), R_OK) == 0;
+    }
+    std::string textPath = RoboticArmBuilder::dataPath(TEXT_CONFIG);
+    std::string configPath = RoboticArmBuilder::dataPath(ARM_CONFIG_FILE);
+    resolved = resolved && access(textPath.c_str(), R_OK) == 0
+            && configPath.substr(0, configPath.rfind('/')) == textPath.substr(0, textPath.rfind('/'));
+    resolved = chdir(root) == 0 && resolved;
+    passed = report("Calibration and arm config paths resolve outside the repository root", resolved) && passed;
+
+    // Tables match the ones built from the sweeps
+    bool tables = true;
+    for(int i = 0; tables && i < NUM_JOINTS; i++){
+        ServoCalibration calibration = definedCalibration(i);
+        PrebuiltTables prebuilt = config.getTables(i);
+        PulseTable rising, falling;
+        if(calibration.empty()){
+            float slope = (JOINTS[i].maxPulse - JOINTS[i].minPulse) / JOINTS[i].maxAngle;
+            float minPulse = JOINTS[i].minPulse;
+            auto linear = [slope, minPulse](float angle){ return slope * angle + minPulse; };
+            rising.build(linear, JOINTS[i].maxAngle, header.stepSize, SERVO_PULSE_TABLE_SIZE);
+            falling.build(linear, JOINTS[i].maxAngle, header.stepSize, SERVO_PULSE_TABLE_SIZE);
+        }
+        else{
+            const CalibrationCurve& up = calibration.getRising();
+            const CalibrationCurve& down = calibration.getFalling();
+            rising.build([&up](float angle){ return up.pulseAt(angle); }, JOINTS[i].maxAngle, header.stepSize, SERVO_PULSE_TABLE_SIZE);
+            falling.build([&down](float angle){ return down.pulseAt(angle); }, JOINTS[i].maxAngle, header.stepSize, SERVO_PULSE_TABLE_SIZE);
+        }
+        tables = prebuilt.size == rising.getSize()
+              && std::memcmp(prebuilt.rising, rising.getTicks(), prebuilt.size * sizeof(float)) == 0
+              && std::memcmp(prebuilt.falling, falling.getTicks(), prebuilt.size * sizeof(float)) == 0;
+    }
+    passed = report("Pulse tables match the ones built from the sweeps", tables) && passed;
+
+    // Servos given the tables command what servos building their own do, and ignore them at another prescaler
+    MotionEngine engine{std::chrono::microseconds(MOTION_TICK_PERIOD_US)};
+    bool commanded = true;
+    std::cout.rdbuf(servoLog.rdbuf());
+    for(uint8_t prescaler : {uint8_t(0x79), uint8_t(0x3C)}){
+        OffTimeBus builtBus, loadedBus;
+        PCA9685 builtPca(&builtBus, PCA_ADDR, prescaler);
+        PCA9685 loadedPca(&loadedBus, PCA_ADDR, prescaler);
+        for(int i = 0; commanded && i < NUM_JOINTS; i++){
+            ServoCalibration calibration = definedCalibration(i);
+            ServoParams builtParams = definedParams(&builtPca, i, &engine, &calibration);
+            ServoParams loadedParams = definedParams(&loadedPca, i, &engine, &calibration);
+            PrebuiltTables prebuilt = config.getTables(i);
+            loadedParams.tables = &prebuilt;
+            Servo built(builtParams);
+            Servo loaded(loadedParams);
+            commanded = builtBus.offTime[JOINTS[i].channel] != 0
+                     && builtBus.offTime[JOINTS[i].channel] == loadedBus.offTime[JOINTS[i].channel];
+        }
+    }
+    std::cout.rdbuf(console);
+    passed = report("Servos command the same off times, stale tables ignored", commanded) && passed;
+
+    // Damaged files are refused
+    std::vector<uint8_t> blob = compileArmConfig(TEXT_CONFIG);
+    std::vector<uint8_t> flipped = blob;
+    flipped[blob.size() / 2] ^= 0x01;
+    std::vector<uint8_t> truncated(blob.begin(), blob.end() - 4);
+    std::vector<uint8_t> magic = blob;
+    magic[0] = 'X';
+    std::vector<uint8_t> version = blob;
+    version[4] = ARM_CONFIG_VERSION + 1;
+    reseal(version);
+    std::vector<uint8_t> offset = blob;
+    uint32_t outside = blob.size();
+    std::memcpy(offset.data() + sizeof(ArmConfigHeader) + offsetof(JointConfig, fallingOffset), &outside, sizeof(outside));
+    reseal(offset);
+    bool damaged = refuses(flipped, "checksum") && refuses(truncated, "truncated") && refuses(magic, "Not an arm config")
+                && refuses(version, "version") && refuses(offset, "layout");
+    passed = report("Corrupted, truncated, foreign, wrong version and out of range files refused", damaged) && passed;
+
+    // Malformed text is refused with where it went wrong
+    bool malformed = compileRefuses("[arm]\npwm_frequency=50\nservo_speed\n", "line 3")
+                  && compileRefuses("[arm]\npwm_frequency=50\nservo_speed=90\nupdate_resolution=5\ntable_size=1024\n"
+                                    "[joint]\nchannel=0\nmin_pulse=500\nmax_pulse=2500\ndefault_angle=90\n", "missing max_angle")
+                  && compileRefuses("[arm]\ntable_size=1024\npwm_frequency=fifty\n", "pwm_frequency on line 3");
+    passed = report("Malformed text configs refused", malformed) && passed;
+
+    std::remove(TEMP_CONFIG);
+    std::remove(TEMP_TEXT);
+
+    // ~~ Startup Benchmark ~~
+    // Servo construction as RoboticArmBuilder does it, on a fake bus so only the config work is timed
+    OffTimeBus bus;
+    PCA9685 pca(&bus, PCA_ADDR);
+    std::cout.rdbuf(servoLog.rdbuf());
+
+    // Only construction is timed, tearing down moves the servos home through the motion engine
+    double definedMs = 0.0;
+    for(int run = 0; run < STARTUP_RUNS; run++){
+        Servo* servos[NUM_JOINTS];
+        auto start = std::chrono::steady_clock::now();
+        ServoCalibration calibrations[NUM_JOINTS];
+        for(int i = 0; i < NUM_JOINTS; i++){
+            calibrations[i] = definedCalibration(i);
+            servos[i] = new Servo(definedParams(&pca, i, &engine, &calibrations[i]));
+        }
+        definedMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / STARTUP_RUNS;
+        for(Servo* servo : servos){
+            delete servo;
+        }
+    }
+
+    double loadedMs = 0.0;
+    for(int run = 0; run < STARTUP_RUNS; run++){
+        Servo* servos[NUM_JOINTS];
+        auto start = std::chrono::steady_clock::now();
+        ArmConfig loaded(BINARY_CONFIG);
+        for(int i = 0; i < NUM_JOINTS; i++){
+            const JointConfig& joint = loaded.getJoint(i);
+            PrebuiltTables prebuilt = loaded.getTables(i);
+            ServoParams params = {&pca, joint.channel, joint.minPulse, joint.maxPulse, joint.maxAngle, joint.defaultAngle
+                                , loaded.getHeader().servoSpeed, loaded.getHeader().updateResolution, &engine, nullptr, &prebuilt};
+            servos[i] = new Servo(params);
+        }
+        loadedMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / STARTUP_RUNS;
+        for(Servo* servo : servos){
+            delete servo;
+        }
+    }
+    std::cout.rdbuf(console);
+
+    bool faster = loadedMs < definedMs;
+    passed = passed && faster;
+    std::cout << "Startup (" << NUM_JOINTS << " servos, mean of " << STARTUP_RUNS << "): config.h + sweeps " << definedMs
+              << " ms, binary config " << loadedMs << " ms (" << definedMs / loadedMs << "x): "
+              << (faster ? "Passed!" : "Failed!") << std::endl;
+
+    std::remove(BINARY_CONFIG);
+
+    std::cout << "Arm config: " << (passed ? "Passed!" : "Failed!") << std::endl;
+    return passed ? 0 : 1;
+}
@@ -1,5 +1,6 @@
 #include "as5600.h"
 #include "i2c.h"
+#include "encoder_sampler.h"
 
 #include <chrono> // For time in ms
 #include <thread> // For sleeping
@@ -10,6 +11,10 @@
 // I2C Config
 const std::string I2C_DIRECTORY = "/dev/i2c-1"; // Define I2C directory
 
+// Sampler Config
+const std::chrono::microseconds SAMPLE_PERIOD(1000); // Encoder read period
+const size_t SAMPLE_BUFFER_SIZE = 1024;
+
 // ~~ AS5600 Config ~~
 
 // Power Mode
@@ -61,14 +66,17 @@ int main() {
     I2C i2c(I2C_DIRECTORY);                  // Create I2C object
     AS5600 as5600(&i2c, CONF);      // AS5600 Object
 
-    uint16_t step;
-    float angle;
+    // Encoder is read in the background, printing never waits on the bus
+    EncoderSampler sampler(&as5600, SAMPLE_PERIOD, SAMPLE_BUFFER_SIZE);
+    sampler.start();
 
-    while(true){
-        step = as5600.getStep();
-        angle = as5600.getAngle();
+    EncoderSample sample;
 
-        std::cout << "Step: " << step << " Angle: " << std::fixed << std::setprecision(2) << angle << std::endl;
+    while(true){
+        if(sampler.latest(sample)){
+            std::cout << "Step: " << sample.step << " Angle: " << std::fixed << std::setprecision(2) << sample.angle()
+                      << " Samples: " << sampler.getSampleCount() << std::endl;
+        }
 
         std::this_thread::sleep_for(std::chrono::milliseconds(1));
     }
@@ -0,0 +1,255 @@
+/*
+~~ Calibration Fitter Test ~~
+
+Checks the zero-copy sweep parser against readSweepCsv() on every sample,
+that combined "Channel,..." files are split by channel, that malformed rows
+and missing files are reported without stopping the other files, that the
+fits match CalibrationCurve, and that the calibration file reads back.
+
+Then benchmarks on synthetic sweeps (repeated 1 us down/up passes of the
+sample_S1 curve with encoder noise): parsing with the zero-copy parser
+against readSweepCsv(), and fitting all files on one thread against one
+per core.
+
+Run from the repository root so the sample paths resolve.
+*/
+
+#include "calibration.h"
+#include "calibration_fitter.h"
+
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+
+// Test Config
+const char* SAMPLES[6] = {
+    "samples/sample_S1.csv", "samples/sample_S2.csv", "samples/sample_S3.csv",
+    "samples/sample_S4.csv", "samples/sample_S5.csv", "samples/sample_stepSize_1.csv",
+};
+const FitterParams PARAMS = {1000.0f, 2000.0f};
+const char* TEMP_PREFIX = "calibration_fitter_test_";
+
+// Benchmark
+const int BENCH_FILES = 16;
+const int BENCH_PASSES = 24;        // Down/up passes per synthetic file (about 100k rows)
+const double ENCODER_NOISE = 0.5;   // Encoder steps
+
+bool report(const std::string& name, bool passed){
+    std::cout << name << ": " << (passed ? "Passed!" : "Failed!") << std::endl;
+    return passed;
+}
+
+std::string tempPath(const std::string& name){
+    return TEMP_PREFIX + name;
+}
+
+bool sameSamples(const std::vector<SweepSample>& a, const std::vector<SweepSample>& b){
+    if(a.size() != b.size()){
+        return false;
+    }
+    for(size_t i = 0; i < a.size(); i++){
+        if(a[i].pulse != b[i].pulse || a[i].step != b[i].step){
+            return false;
+        }
+    }
+    return true;
+}
+
+bool sameCurve(const CalibrationCurve& a, const CalibrationCurve& b){
+    if(a.size() != b.size()){
+        return false;
+    }
+    for(size_t i = 0; i < a.size(); i++){
+        if(std::fabs(a.getPulses()[i] - b.getPulses()[i]) > 1e-3f || std::fabs(a.getAngles()[i] - b.getAngles()[i]) > 1e-3f){
+            return false;
+        }
+    }
+    return true;
+}
+
+// Synthetic sweep file: repeated 1 us down/up passes over the S1 curve, returns its size in bytes
+size_t writeSynthetic(const std::string& path, const CalibrationCurve& truth, unsigned seed){
+    std::mt19937 rng(seed);
+    std::normal_distribution<double> noise(0.0, ENCODER_NOISE);
+    std::ofstream file(path);
+    file << "Pulse Width (us),Absolute Step (0-4096)\n";
+    int low = static_cast<int>(truth.getMinPulse());
+    int high = static_cast<int>(truth.getMaxPulse());
+    for(int pass = 0; pass < BENCH_PASSES; pass++){
+        bool down = pass % 2 == 0;
+        for(int i = 0; i <= high - low; i++){
+            int pulse = down ? high - i : low + i;
+            long step = std::lround(2000.0 + truth.angleAt(pulse) * 4096.0 / 360.0 + noise(rng));
+            file << pulse << "," << ((step % 4096) + 4096) % 4096 << "\n";
+        }
+    }
+    return static_cast<size_t>(file.tellp());
+}
+
+int main(){
+
+    bool passed = true;
+    std::cout << std::fixed << std::setprecision(3);
+
+    // Parser matches readSweepCsv on every sample
+    bool parsed = true;
+    for(const char* path : SAMPLES){
+        MappedFile file(path);
+        std::vector<ChannelSweep> sweeps;
+        size_t rows = parseSweepCsv(file.begin(), file.end(), sweeps);
+        std::vector<SweepSample> reference = readSweepCsv(path);
+        parsed = parsed && sweeps.size() == 1 && sweeps[0].channel == -1 && rows == reference.size()
+                        && sameSamples(sweeps[0].samples, reference);
+    }
+    passed = report("Zero-copy parser matches readSweepCsv on the samples", parsed) && passed;
+
+    // Combined file with interleaved channels, no trailing newline, blank line and CRLF
+    const std::string combinedPath = tempPath("combined.csv");
+    {
+        std::ofstream file(combinedPath);
+        file << "Channel,Pulse Width (us),Absolute Step (0-4096)\r\n";
+        file << "4,1500,100\r\n3,1500.5,200\n\n4,1510,110\n3,1490,4095";
+    }
+    std::vector<ChannelSweep> combined;
+    {
+        MappedFile file(combinedPath);
+        parseSweepCsv(file.begin(), file.end(), combined);
+    }
+    bool split = combined.size() == 2 && combined[0].channel == 4 && combined[1].channel == 3
+              && sameSamples(combined[0].samples, {{1500.0f, 100}, {1510.0f, 110}})
+              && sameSamples(combined[1].samples, {{1500.5f, 200}, {1490.0f, 4095}})
+              && sameSamples(readSweepCsv(combinedPath, 3), {{1500.0f, 200}, {1490.0f, 4095}});
+    passed = report("Combined file split by channel", split) && passed;
+
+    // Malformed rows are refused
+    const std::string malformedPath = tempPath("malformed.csv");
+    {
+        std::ofstream file(malformedPath);
+        file << "Pulse Width (us),Absolute Step (0-4096)\n1500,100\n1510;110\n";
+    }
+    bool refused = false;
+    try{
+        MappedFile file(malformedPath);
+        std::vector<ChannelSweep> sweeps;
+        parseSweepCsv(file.begin(), file.end(), sweeps);
+    }
+    catch(const std::runtime_error& e){
+        refused = std::string(e.what()).find("line 3") != std::string::npos;
+    }
+    passed = report("Malformed row refused with its line number", refused) && passed;
+
+    // Fits match the curves, bad files are reported without stopping the rest
+    std::vector<std::string> paths(SAMPLES, SAMPLES + 6);
+    paths.insert(paths.begin() + 2, "samples/missing.csv");
+    paths.push_back(malformedPath);
+    std::vector<ServoFit> fits = fitSweepFiles(paths, PARAMS, 3);
+    bool fitted = fits.size() == paths.size();
+    for(size_t i = 0; fitted && i < fits.size(); i++){
+        bool bad = paths[i] == "samples/missing.csv" || paths[i] == malformedPath;
+        fitted = fits[i].source == paths[i] && fits[i].error.empty() != bad;
+        if(fitted && !bad){
+            CalibrationCurve curve = CalibrationCurve::fromSweepCsv(paths[i]);
+            ServoCalibration calibration = ServoCalibration::fromSweepCsv(paths[i]);
+            fitted = fits[i].maxAngle == curve.getMaxAngle() && fits[i].minPulse == curve.getMinPulse()
+                  && fits[i].maxPulse == curve.getMaxPulse() && fits[i].hysteresis == calibration.getHysteresis()
+                  && fits[i].dcMultiplier > 0.9f && fits[i].dcMultiplier < 1.1f
+                  && std::fabs(fits[i].pwmOffset - ((curve.getMinPulse() + curve.getMaxPulse()) / 2.0f - 1500.0f)) < 1e-3f;
+        }
+    }
+    passed = report("Fits match the curves, missing and malformed files reported", fitted) && passed;
+    for(const ServoFit& fit : fits){
+        if(fit.error.empty()){
+            std::cout << "  " << fit.source << ": " << fit.minPulse << " - " << fit.maxPulse << " us, " << fit.maxAngle
+                      << " deg, pwm " << fit.pwmOffset << " / " << fit.pwmMultiplier << ", dc " << fit.dcOffset
+                      << " / " << fit.dcMultiplier << std::endl;
+        }
+    }
+
+    // Calibration file round trip
+    const std::string outputPath = tempPath("output.txt");
+    writeCalibrationFile(outputPath, fits);
+    std::vector<ServoFit> read = readCalibrationFile(outputPath);
+    bool roundTrip = read.size() == fits.size();
+    for(size_t i = 0; roundTrip && i < read.size(); i++){
+        roundTrip = read[i].source == fits[i].source && read[i].channel == fits[i].channel && read[i].rows == fits[i].rows
+                 && read[i].error == fits[i].error;
+        if(roundTrip && fits[i].error.empty()){
+            roundTrip = read[i].maxAngle == fits[i].maxAngle && read[i].pwmMultiplier == fits[i].pwmMultiplier
+                     && read[i].dcOffset == fits[i].dcOffset
+                     && sameCurve(read[i].calibration.getRising(), fits[i].calibration.getRising())
+                     && sameCurve(read[i].calibration.getFalling(), fits[i].calibration.getFalling());
+        }
+    }
+    passed = report("Calibration file reads back", roundTrip) && passed;
+
+    std::remove(combinedPath.c_str());
+    std::remove(malformedPath.c_str());
+    std::remove(outputPath.c_str());
+
+    // ~~ Benchmark ~~
+    CalibrationCurve truth = CalibrationCurve::fromSweepCsv(SAMPLES[0]);
+    std::vector<std::string> benchPaths;
+    size_t bytes = 0;
+    for(int i = 0; i < BENCH_FILES; i++){
+        benchPaths.push_back(tempPath("bench_" + std::to_string(i) + ".csv"));
+        bytes += writeSynthetic(benchPaths.back(), truth, 100 + i);
+    }
+    double megabytes = bytes / 1e6;
+
+    // Parsing only: getline + strtol against the mapped parser
+    size_t referenceRows = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(const std::string& path : benchPaths){
+        referenceRows += readSweepCsv(path).size();
+    }
+    double referenceS = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    size_t mappedRows = 0;
+    start = std::chrono::steady_clock::now();
+    for(const std::string& path : benchPaths){
+        MappedFile file(path);
+        std::vector<ChannelSweep> sweeps;
+        mappedRows += parseSweepCsv(file.begin(), file.end(), sweeps);
+    }
+    double mappedS = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    bool parseFaster = mappedRows == referenceRows && mappedS < referenceS;
+    passed = passed && parseFaster;
+    std::cout << "Parse " << mappedRows << " rows (" << megabytes << " MB): readSweepCsv " << megabytes / referenceS
+              << " MB/s, zero-copy " << megabytes / mappedS << " MB/s (" << referenceS / mappedS << "x): "
+              << (parseFaster ? "Passed!" : "Failed!") << std::endl;
+
+    // Whole pipeline: one thread against one per core
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    start = std::chrono::steady_clock::now();
+    std::vector<ServoFit> serial = fitSweepFiles(benchPaths, PARAMS, 1);
+    double serialS = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    std::vector<ServoFit> parallel = fitSweepFiles(benchPaths, PARAMS, cores);
+    double parallelS = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    bool same = serial.size() == parallel.size();
+    for(size_t i = 0; same && i < serial.size(); i++){
+        same = serial[i].error.empty() && serial[i].maxAngle == parallel[i].maxAngle
+            && sameCurve(serial[i].calibration.getRising(), parallel[i].calibration.getRising());
+    }
+    passed = passed && same;
+    std::cout << "Fit " << BENCH_FILES << " files: 1 thread " << mappedRows / serialS / 1e6 << " M rows/s, " << cores
+              << " threads " << mappedRows / parallelS / 1e6 << " M rows/s (" << serialS / parallelS << "x), same results: "
+              << (same ? "Passed!" : "Failed!") << std::endl;
+
+    for(const std::string& path : benchPaths){
+        std::remove(path.c_str());
+    }
+
+    std::cout << "Calibration fitter: " << (passed ? "Passed!" : "Failed!") << std::endl;
+    return passed ? 0 : 1;
+}
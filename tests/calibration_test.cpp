@@ -0,0 +1,168 @@
+/*
+~~ Calibration Test ~~
+
+Fits CalibrationCurves to the measured sweeps in samples/ and checks that
+each is monotone, that it fits the measured data better than the linear
+minPulse/maxPulse/maxAngle map, and that a PulseTable built from it
+reaches each angle to within one PCA9685 tick. Then times the table lookup
+against the linear float pulse math and against searching the curve directly.
+
+Run from the repository root so the sample paths resolve.
+*/
+
+#include "calibration.h"
+
+#include <cmath>
+#include <chrono>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <iostream>
+#include <iomanip>
+
+// Test Config
+const float STEP_SIZE = 122.0f / 25.0f; // PCA9685 step size at the default prescaler (us)
+const int TABLE_SIZE = 1024;
+const int BENCH_ITERATIONS = 2000000;
+
+struct Sample{
+    const char* path;
+    float minPulse; // Linear map parameters (from config.h)
+    float maxPulse;
+    float maxAngle;
+};
+
+const Sample SAMPLES[5] = {
+    {"samples/sample_S1.csv", 540.0f, 2665.0f, 262.793f},
+    {"samples/sample_S2.csv", 535.0f, 2655.0f, 263.848f},
+    {"samples/sample_S3.csv", 400.0f, 2795.0f, 296.367f},
+    {"samples/sample_S4.csv", 400.0f, 2790.0f, 295.4f},
+    {"samples/sample_S5.csv", 395.0f, 2780.0f, 296.719f},
+};
+
+// Raw (pulse, angle) readings, angle relative to the reading at the lowest pulse
+bool readSweep(const char* path, std::vector<float>& pulses, std::vector<float>& angles){
+    std::ifstream file(path);
+    if(!file.is_open()){
+        return false;
+    }
+    std::string line;
+    std::getline(file, line);
+    float lowestPulse = 1e9f;
+    float zero = 0.0f;
+    while(std::getline(file, line)){
+        size_t comma = line.find(',');
+        if(comma == std::string::npos){
+            continue;
+        }
+        float pulse = std::stof(line.substr(0, comma));
+        float angle = std::stof(line.substr(comma + 1)) * 360.0f / 4096.0f;
+        pulses.push_back(pulse);
+        angles.push_back(angle);
+        if(pulse < lowestPulse){
+            lowestPulse = pulse;
+            zero = angle;
+        }
+    }
+    for(float& angle : angles){
+        angle -= zero;
+    }
+    return true;
+}
+
+int main(){
+
+    bool passed = true;
+    std::cout << std::fixed << std::setprecision(3);
+
+    for(const Sample& sample : SAMPLES){
+
+        std::vector<float> pulses, angles;
+        if(!readSweep(sample.path, pulses, angles)){
+            std::cout << "Could not open " << sample.path << ": Failed!" << std::endl;
+            return 1;
+        }
+        CalibrationCurve curve = CalibrationCurve::fromSweepCsv(sample.path);
+
+        // Monotone
+        bool monotone = true;
+        for(float pulse = curve.getMinPulse(); pulse < curve.getMaxPulse(); pulse += 1.0f){
+            if(curve.angleAt(pulse + 1.0f) < curve.angleAt(pulse)){
+                monotone = false;
+            }
+        }
+
+        // Fit against the measured readings: linear map vs curve
+        float slope = sample.maxAngle / (sample.maxPulse - sample.minPulse);
+        double linearSquares = 0.0;
+        double curveSquares = 0.0;
+        for(size_t i = 0; i < pulses.size(); i++){
+            double linear = (pulses[i] - sample.minPulse) * slope;
+            linearSquares += (linear - angles[i]) * (linear - angles[i]);
+            curveSquares += (curve.angleAt(pulses[i]) - angles[i]) * (curve.angleAt(pulses[i]) - angles[i]);
+        }
+        double linearRms = std::sqrt(linearSquares / pulses.size());
+        double curveRms = std::sqrt(curveSquares / pulses.size());
+
+        // Table round trip: the off time the table picks reaches the angle asked for
+        PulseTable table;
+        table.build([&curve](float angle){ return curve.pulseAt(angle); }, sample.maxAngle, STEP_SIZE, TABLE_SIZE);
+        double worstTable = 0.0;
+        for(float angle = 0.0f; angle <= curve.getMaxAngle(); angle += 0.05f){
+            double reached = curve.angleAt(table.ticksAt(angle) * STEP_SIZE);
+            worstTable = std::max(worstTable, std::fabs(reached - angle));
+        }
+        double tickAngle = 0.0; // Largest angle change of one tick, the best any off time can do
+        for(float pulse = curve.getMinPulse(); pulse + STEP_SIZE <= curve.getMaxPulse(); pulse += 1.0f){
+            tickAngle = std::max(tickAngle, static_cast<double>(curve.angleAt(pulse + STEP_SIZE) - curve.angleAt(pulse)));
+        }
+
+        // Inverse: the curve's pulse for an angle reaches that angle
+        double worstInverse = 0.0;
+        for(float angle = 0.0f; angle <= curve.getMaxAngle(); angle += 0.5f){
+            worstInverse = std::max(worstInverse, static_cast<double>(std::fabs(curve.angleAt(curve.pulseAt(angle)) - angle)));
+        }
+
+        bool ok = monotone && curveRms < linearRms && worstTable <= tickAngle && worstInverse < 0.01;
+        passed = passed && ok;
+        std::cout << sample.path << ": " << curve.size() << " knots, linear RMS " << linearRms << " deg, curve RMS "
+                  << curveRms << " deg, table error " << worstTable << " deg (one tick " << tickAngle << " deg), inverse error " << worstInverse
+                  << " deg: " << (ok ? "Passed!" : "Failed!") << std::endl;
+    }
+
+    // Benchmark: table lookup vs the linear float pulse math setPosition used, and vs searching the curve
+    PulseTable table;
+    const float minPulse = 540.0f;
+    const float slope = (2665.0f - 540.0f) / 262.793f;
+    table.build([&](float angle){ return slope * angle + minPulse; }, 262.793f, STEP_SIZE, TABLE_SIZE);
+    CalibrationCurve curve = CalibrationCurve::fromSweepCsv(SAMPLES[0].path);
+
+    volatile uint32_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < BENCH_ITERATIONS; i++){
+        float angle = (i % 2628) * 0.1f;
+        float pulse = slope * angle + minPulse;
+        sink = sink + static_cast<uint16_t>(std::round(pulse / STEP_SIZE));
+    }
+    double mathNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / BENCH_ITERATIONS;
+
+    start = std::chrono::steady_clock::now();
+    for(int i = 0; i < BENCH_ITERATIONS; i++){
+        float angle = (i % 2628) * 0.1f;
+        sink = sink + static_cast<uint16_t>(std::round(curve.pulseAt(angle) / STEP_SIZE));
+    }
+    double curveNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / BENCH_ITERATIONS;
+
+    start = std::chrono::steady_clock::now();
+    for(int i = 0; i < BENCH_ITERATIONS; i++){
+        float angle = (i % 2628) * 0.1f;
+        sink = sink + table.ticksAt(angle);
+    }
+    double tableNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / BENCH_ITERATIONS;
+
+    std::cout << "Linear pulse math: " << mathNs << " ns, curve search: " << curveNs << " ns, table lookup: "
+              << tableNs << " ns per angle" << std::endl;
+    std::cout << "Calibration curves: " << (passed ? "Passed!" : "Failed!") << std::endl;
+
+    return passed ? 0 : 1;
+}
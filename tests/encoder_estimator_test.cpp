@@ -0,0 +1,169 @@
+/*
+~~ Encoder Estimator Test ~~
+
+Feeds synthetic AS5600 readings (quantized to 4096 steps, with noise and
+timing jitter) into the EncoderEstimator and checks multi-turn unwrapping,
+angle/velocity tracking, outlier rejection, re-locking after a genuine jump
+and settle detection. Finishes with a per-update cost benchmark.
+*/
+
+#include "encoder_estimator.h"
+
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <iostream>
+#include <iomanip>
+#include <functional>
+
+// Test Config
+const double SAMPLE_PERIOD_S = 0.001;
+const double JITTER_S = 0.0001;         // Sample timing jitter (uniform +-)
+const double NOISE_DEG = 0.05;          // Reading noise (standard deviation)
+const double OUTLIER_RATE = 0.01;       // Fraction of readings replaced by garbage
+const int BENCH_ITERATIONS = 1000000;
+
+const EstimatorParams PARAMS = {0.06, 1.0e6, 6.0, 5};
+const double SETTLED_VELOCITY = 5.0;    // deg/s
+
+std::mt19937 rng(42);
+
+// Reading of a true multi-turn angle as the AS5600 would report it
+EncoderSample makeSample(double seconds, double angle){
+    std::normal_distribution<double> noise(0.0, NOISE_DEG);
+    double wrapped = std::fmod(angle + noise(rng), 360.0);
+    if(wrapped < 0.0){
+        wrapped += 360.0;
+    }
+    EncoderSample sample;
+    sample.timestamp = static_cast<uint64_t>(seconds * 1e9);
+    sample.step = static_cast<uint16_t>(std::lround(wrapped * 4096.0 / 360.0)) & 0x0FFF;
+    return sample;
+}
+
+struct Errors{
+    double angle;
+    double velocity;
+    uint64_t rejected;
+};
+
+// Runs a trajectory (angle and velocity as functions of time), returns the worst errors after a warm-up
+Errors track(EncoderEstimator& estimator, double start, double duration, double outlierRate,
+             std::function<double(double)> angle, std::function<double(double)> velocity){
+
+    std::uniform_real_distribution<double> jitter(-JITTER_S, JITTER_S);
+    std::uniform_real_distribution<double> chance(0.0, 1.0);
+    std::uniform_int_distribution<int> garbage(0, 4095);
+
+    Errors errors = {0.0, 0.0, 0};
+    uint64_t rejectedBefore = estimator.getRejectedCount();
+
+    for(double t = start; t < start + duration; t += SAMPLE_PERIOD_S){
+        double sampleTime = t + jitter(rng);
+        EncoderSample sample = makeSample(sampleTime, angle(sampleTime));
+        if(chance(rng) < outlierRate){
+            sample.step = garbage(rng);
+        }
+        estimator.update(sample);
+
+        if(t > start + 0.1){
+            EncoderState state = estimator.getState();
+            errors.angle = std::max(errors.angle, std::fabs(state.angle - angle(sampleTime)));
+            errors.velocity = std::max(errors.velocity, std::fabs(state.velocity - velocity(sampleTime)));
+        }
+    }
+    errors.rejected = estimator.getRejectedCount() - rejectedBefore;
+    return errors;
+}
+
+bool check(const std::string& name, bool passed, const Errors& errors){
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << name << ": max angle error " << errors.angle << " deg, max velocity error " << errors.velocity
+              << " deg/s, " << errors.rejected << " rejected: " << (passed ? "Passed!" : "Failed!") << std::endl;
+    return passed;
+}
+
+int main(){
+
+    bool passed = true;
+
+    // Constant velocity through many turns
+    {
+        EncoderEstimator estimator(PARAMS);
+        Errors errors = track(estimator, 1.0, 5.0, 0.0,
+                              [](double t){ return 100.0 + 720.0 * (t - 1.0); },
+                              [](double t){ return 720.0; });
+        bool ok = errors.angle < 0.5 && errors.velocity < 20.0 && estimator.getTurns() == 10;
+        passed = check("Constant 720 deg/s, 10 turns", ok, errors) && passed;
+    }
+
+    // Reversing sinusoid across the wrap point
+    {
+        EncoderEstimator estimator(PARAMS);
+        Errors errors = track(estimator, 1.0, 3.0, 0.0,
+                              [](double t){ return 10.0 + 90.0 * std::sin(2.0 * M_PI * t); },
+                              [](double t){ return 180.0 * M_PI * std::cos(2.0 * M_PI * t); });
+        bool ok = errors.angle < 0.5 && errors.velocity < 20.0;
+        passed = check("1 Hz +-90 deg sinusoid through 0", ok, errors) && passed;
+    }
+
+    // Garbage readings are rejected without losing a turn
+    {
+        EncoderEstimator estimator(PARAMS);
+        Errors errors = track(estimator, 1.0, 5.0, OUTLIER_RATE,
+                              [](double t){ return 100.0 + 720.0 * (t - 1.0); },
+                              [](double t){ return 720.0; });
+        bool ok = errors.angle < 1.0 && errors.velocity < 30.0 && errors.rejected > 0 && estimator.getTurns() == 10;
+        passed = check("1% garbage readings", ok, errors) && passed;
+    }
+
+    // A genuine jump is followed after maxRejections readings
+    {
+        EncoderEstimator estimator(PARAMS);
+        track(estimator, 1.0, 0.5, 0.0, [](double t){ return 45.0; }, [](double t){ return 0.0; });
+        Errors errors = track(estimator, 1.5, 0.5, 0.0, [](double t){ return 135.0; }, [](double t){ return 0.0; });
+        EncoderState state = estimator.getState();
+        bool ok = std::fabs(state.angle - 135.0) < 0.2 && errors.rejected == static_cast<uint64_t>(PARAMS.maxRejections);
+        std::cout << "Jump 45 -> 135 deg: estimate " << state.angle << " deg, " << errors.rejected << " rejected: "
+                  << (ok ? "Passed!" : "Failed!") << std::endl;
+        passed = passed && ok;
+    }
+
+    // Settle detection after a constant speed move stops
+    {
+        EncoderEstimator estimator(PARAMS);
+        auto angle = [](double t){ return t < 1.5 ? 180.0 * (t - 1.0) : 90.0; };
+        double settleTime = -1.0;
+        for(double t = 1.0; t < 2.0; t += SAMPLE_PERIOD_S){
+            estimator.update(makeSample(t, angle(t)));
+            if(t > 1.5 && settleTime < 0.0 && estimator.isSettled(SETTLED_VELOCITY)){
+                settleTime = t - 1.5;
+            }
+        }
+        bool ok = settleTime >= 0.0 && settleTime < 0.05 && estimator.isSettled(SETTLED_VELOCITY);
+        std::cout << "Settle after stop: " << settleTime * 1000.0 << " ms: " << (ok ? "Passed!" : "Failed!") << std::endl;
+        passed = passed && ok;
+    }
+
+    // Per-update cost
+    {
+        EncoderEstimator estimator(PARAMS);
+        std::vector<EncoderSample> samples;
+        for(int i = 0; i < 4096; i++){
+            samples.push_back(makeSample(1.0 + i * SAMPLE_PERIOD_S, 300.0 * i * SAMPLE_PERIOD_S));
+        }
+
+        double checksum = 0.0;
+        auto start = std::chrono::steady_clock::now();
+        for(int i = 0; i < BENCH_ITERATIONS; i++){
+            EncoderSample sample = samples[i & 4095];
+            sample.timestamp += (i >> 12) * 4096ull * 1000000ull; // Keep time moving forward
+            estimator.update(sample);
+            checksum += estimator.getState().velocity;
+        }
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / BENCH_ITERATIONS;
+        std::cout << std::setprecision(1) << "Update cost: " << ns << " ns (checksum " << checksum << ")" << std::endl;
+    }
+
+    return passed ? 0 : 1;
+}
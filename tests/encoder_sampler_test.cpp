@@ -0,0 +1,214 @@
+/*
+~~ Encoder Sampler Test ~~
+
+Checks the lock-free encoder ring for torn or out of order samples under
+concurrent readers, runs an EncoderSampler against a fake AS5600 on a fake
+bus, and compares the cost of reading the latest sample against a direct
+(blocking) bus read.
+*/
+
+#include "i2c.h"
+#include "as5600.h"
+#include "encoder_sampler.h"
+
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <iostream>
+#include <iomanip>
+
+// Test Config
+const int BUS_BYTE_TIME_US = 23;        // ~9 clocks per byte at 400 kHz
+const int SAMPLE_PERIOD_US = 1000;
+const size_t RING_SIZE = 256;
+const size_t SNAPSHOT_SIZE = 64;
+const int NUM_READERS = 4;
+const int STRESS_TIME_MS = 300;
+const int BENCH_ITERATIONS = 1000000;
+
+// Fake AS5600: every angle read returns the next step, so consecutive samples differ by exactly 1
+class FakeEncoderBus : public I2C
+{
+private:
+    uint8_t reg = 0x00;
+    uint16_t counter = 0;
+    uint16_t latched = 0;
+
+    void transfer(int numBytes){
+        auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(BUS_BYTE_TIME_US * (numBytes + 1));
+        while(std::chrono::steady_clock::now() < end){}
+    }
+
+protected:
+    int transferRead(uint8_t addr, uint8_t* buffer, int numBytes) override{
+        transfer(numBytes);
+        if(reg == REG_MAGNET_STATUS){
+            buffer[0] = 0x20; // Magnet detected
+        }
+        else if(reg == REG_ANGLE_MSB){
+            latched = counter++ & 0x0FFF;
+            buffer[0] = latched >> 8;
+        }
+        else if(reg == REG_ANGLE_LSB){
+            buffer[0] = latched & 0xFF;
+        }
+        else{
+            buffer[0] = 0x00;
+        }
+        return numBytes;
+    }
+
+    int transferWrite(uint8_t addr, const uint8_t* buffer, int numBytes) override{
+        transfer(numBytes);
+        reg = buffer[0];
+        return numBytes;
+    }
+};
+
+// True if b directly follows a
+bool follows(const EncoderSample& a, const EncoderSample& b){
+    return b.step == ((a.step + 1) & 0x0FFF) && b.timestamp > a.timestamp;
+}
+
+// Readers verify every snapshot is contiguous while a writer pushes as fast as it can
+bool ringStressTest(){
+
+    EncoderRing ring(RING_SIZE);
+    std::atomic<bool> running(true);
+    std::atomic<uint64_t> failures(0), snapshots(0);
+
+    std::vector<std::thread> readers;
+    for(int i = 0; i < NUM_READERS; i++){
+        readers.emplace_back([&]{
+            EncoderSample buffer[SNAPSHOT_SIZE];
+            EncoderSample latest;
+            while(running){
+                size_t count = ring.snapshot(buffer, SNAPSHOT_SIZE);
+                for(size_t j = 1; j < count; j++){
+                    if(!follows(buffer[j - 1], buffer[j])){
+                        failures++;
+                    }
+                }
+                // The writer stores sample number + 1 as the timestamp
+                if(ring.latest(latest) && latest.step != ((latest.timestamp - 1) & 0x0FFF)){
+                    failures++;
+                }
+                snapshots++;
+            }
+        });
+    }
+
+    auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(STRESS_TIME_MS);
+    uint64_t pushed = 0;
+    while(std::chrono::steady_clock::now() < end){
+        EncoderSample sample;
+        sample.timestamp = pushed + 1;
+        sample.step = pushed & 0x0FFF;
+        ring.push(sample);
+        pushed++;
+    }
+    running = false;
+    for(auto& reader : readers){
+        reader.join();
+    }
+
+    bool passed = failures == 0 && ring.getCount() == pushed;
+    std::cout << "Ring stress: " << pushed << " pushes, " << snapshots << " snapshots, "
+              << failures << " torn/out of order: " << (passed ? "Passed!" : "Failed!") << std::endl;
+    return passed;
+}
+
+// Samples the fake encoder at a fixed rate while readers check the published samples
+bool samplerTest(AS5600& encoder){
+
+    EncoderSampler sampler(&encoder, std::chrono::microseconds(SAMPLE_PERIOD_US), RING_SIZE);
+    std::atomic<bool> running(true);
+    std::atomic<uint64_t> failures(0);
+
+    sampler.start();
+    std::vector<std::thread> readers;
+    for(int i = 0; i < NUM_READERS; i++){
+        readers.emplace_back([&]{
+            EncoderSample buffer[SNAPSHOT_SIZE];
+            while(running){
+                size_t count = sampler.snapshot(buffer, SNAPSHOT_SIZE);
+                for(size_t j = 1; j < count; j++){
+                    if(!follows(buffer[j - 1], buffer[j])){
+                        failures++;
+                    }
+                }
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(STRESS_TIME_MS));
+    running = false;
+    for(auto& reader : readers){
+        reader.join();
+    }
+    sampler.stop();
+
+    // Average period from the timestamps
+    EncoderSample buffer[SNAPSHOT_SIZE];
+    size_t count = sampler.snapshot(buffer, SNAPSHOT_SIZE);
+    double averagePeriod = (buffer[count - 1].timestamp - buffer[0].timestamp) / 1000.0 / (count - 1);
+
+    uint64_t expected = STRESS_TIME_MS * 1000 / SAMPLE_PERIOD_US;
+    bool passed = failures == 0 && sampler.getErrorCount() == 0 && sampler.getSampleCount() >= expected * 9 / 10
+                  && averagePeriod < SAMPLE_PERIOD_US * 1.1;
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "Sampler: " << sampler.getSampleCount() << " samples (expected ~" << expected << "), average period "
+              << averagePeriod << "us, " << sampler.getOverrunCount() << " overruns, " << failures
+              << " bad snapshots: " << (passed ? "Passed!" : "Failed!") << std::endl;
+    return passed;
+}
+
+// Latest sample vs a direct bus read
+void benchmark(AS5600& encoder){
+
+    EncoderSampler sampler(&encoder, std::chrono::microseconds(SAMPLE_PERIOD_US), RING_SIZE);
+    sampler.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    EncoderSample sample;
+    uint64_t checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < BENCH_ITERATIONS; i++){
+        sampler.latest(sample);
+        checksum += sample.step;
+    }
+    double latestNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / BENCH_ITERATIONS;
+
+    EncoderSample buffer[SNAPSHOT_SIZE];
+    start = std::chrono::steady_clock::now();
+    for(int i = 0; i < BENCH_ITERATIONS / 10; i++){
+        checksum += sampler.snapshot(buffer, SNAPSHOT_SIZE);
+    }
+    double snapshotNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / (BENCH_ITERATIONS / 10);
+    sampler.stop();
+
+    const int directReads = 200;
+    start = std::chrono::steady_clock::now();
+    for(int i = 0; i < directReads; i++){
+        checksum += encoder.getStep();
+    }
+    double directNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / directReads;
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "latest(): " << latestNs << " ns, snapshot(" << SNAPSHOT_SIZE << "): " << snapshotNs
+              << " ns, direct getStep(): " << directNs << " ns (checksum " << checksum << ")" << std::endl;
+}
+
+int main(){
+
+    FakeEncoderBus bus;
+    AS5600 encoder(&bus, 0x0000);
+
+    bool passed = ringStressTest();
+    passed = samplerTest(encoder) && passed;
+    benchmark(encoder);
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,162 @@
+/*
+~~ Emergency Stop Latency Test ~~
+
+Runs six servos in continuous motion against a fake I2C bus that models the
+transfer time of a 400 kHz bus, then triggers the emergency stop and measures
+the time from the trigger to the last write on the bus (which must be the
+ALL_LED_OFF_H cut). Triggers from the calling thread (EmergencyStop::stop) and
+from a signal handler (EmergencyStop::trigger via SIGUSR1).
+*/
+
+#include "i2c.h"
+#include "pca9685.h"
+#include "servo.h"
+#include "motion.h"
+#include "estop.h"
+
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <mutex>
+#include <csignal>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+// Test Config
+const uint8_t PCA9685_ADDR = 0x40;
+const int BUS_BYTE_TIME_US = 23;      // ~9 clocks per byte at 400 kHz
+const int TICK_PERIOD_US = 2000;      // Motion engine tick
+const int NUM_SERVOS = 6;
+const int NUM_TRIALS = 20;            // Trials per trigger method
+const int LOAD_TIME_MS = 50;          // Motion before each trigger
+const int SETTLE_TIME_MS = 20;        // Time allowed for stray writes after the trigger
+
+// Fake bus: records every write and spins for the modeled transfer time
+class FakeBus : public I2C
+{
+public:
+    struct Write{
+        std::chrono::steady_clock::time_point time;
+        bool cut; // ALL_LED_OFF_H full OFF
+    };
+
+    std::mutex logMutex;
+    std::vector<Write> writes;
+
+    void clear(){
+        std::lock_guard<std::mutex> lock(logMutex);
+        writes.clear();
+    }
+
+protected:
+    void transfer(int numBytes){
+        auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(BUS_BYTE_TIME_US * (numBytes + 1));
+        while(std::chrono::steady_clock::now() < end){} // Spin so the fake never oversleeps the modeled time
+    }
+
+    int transferRead(uint8_t addr, uint8_t* buffer, int numBytes) override{
+        transfer(numBytes);
+        for(int i = 0; i < numBytes; i++){
+            buffer[i] = 0x00;
+        }
+        return numBytes;
+    }
+
+    int transferWrite(uint8_t addr, const uint8_t* buffer, int numBytes) override{
+        transfer(numBytes);
+        std::lock_guard<std::mutex> lock(logMutex);
+        writes.push_back({std::chrono::steady_clock::now(), numBytes == 2 && buffer[0] == ALL_LED_OFF_H && buffer[1] == 0x10});
+        return numBytes;
+    }
+};
+
+// Runs one trial, returns the trigger to last write latency in microseconds (negative on failure)
+double runTrial(FakeBus& bus, Servo* servos[], bool useSignal){
+
+    // Keep every servo moving back and forth until the emergency stop latches
+    std::thread load([&]{
+        bool high = true;
+        while(!EmergencyStop::isLatched()){
+            std::vector<MotionHandle> moves;
+            for(int i = 0; i < NUM_SERVOS; i++){
+                moves.push_back(servos[i]->moveToPosition(high ? 170.0f : 10.0f));
+            }
+            MotionHandle::whenAll(moves).waitFor(std::chrono::milliseconds(100));
+            high = !high;
+        }
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(LOAD_TIME_MS));
+    bus.clear();
+
+    auto triggerTime = std::chrono::steady_clock::now();
+    if(useSignal){
+        std::raise(SIGUSR1);
+    }
+    else{
+        EmergencyStop::stop();
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(SETTLE_TIME_MS));
+    load.join();
+
+    // The last write after the trigger must be the cut
+    std::lock_guard<std::mutex> lock(bus.logMutex);
+    if(bus.writes.empty() || !bus.writes.back().cut){
+        std::cout << "Write after the emergency stop cut!" << std::endl;
+        return -1.0;
+    }
+    return std::chrono::duration<double, std::micro>(bus.writes.back().time - triggerTime).count();
+}
+
+// Prints min/median/max for a set of trials, passes if the cut always landed last and every trial was within a tick
+bool report(const std::string& name, std::vector<double> latencies){
+    bool passed = true;
+    for(double latency : latencies){
+        passed = passed && latency >= 0.0;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    double median = latencies[latencies.size() / 2];
+    passed = passed && latencies.back() < TICK_PERIOD_US;
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << name << ": min " << latencies.front() << "us, median " << median << "us, max " << latencies.back()
+              << "us (tick " << TICK_PERIOD_US << "us) " << (passed ? "Passed!" : "Failed!") << std::endl;
+    return passed;
+}
+
+int main(){
+
+    FakeBus bus;
+    PCA9685 pca(&bus, PCA9685_ADDR);
+    MotionEngine engine{std::chrono::microseconds(TICK_PERIOD_US)};
+    EmergencyStop::installSignalHandler(SIGUSR1);
+
+    Servo* servos[NUM_SERVOS];
+    for(int i = 0; i < NUM_SERVOS; i++){
+        ServoParams params = {&pca, static_cast<uint8_t>(i), 500, 2500, 180.0f, 90.0f, 90.0f, 5.0f, &engine};
+        servos[i] = new Servo(params);
+    }
+
+    bool passed = true;
+    for(int method = 0; method < 2; method++){
+        std::vector<double> latencies;
+        for(int trial = 0; trial < NUM_TRIALS; trial++){
+            latencies.push_back(runTrial(bus, servos, method == 1));
+            EmergencyStop::reset();
+            for(int i = 0; i < NUM_SERVOS; i++){
+                servos[i]->refresh();
+            }
+        }
+        passed = report(method == 0 ? "EmergencyStop::stop()" : "SIGUSR1 trigger", latencies) && passed;
+    }
+
+    // Leave latched so teardown does not move the servos home
+    EmergencyStop::stop();
+    for(int i = 0; i < NUM_SERVOS; i++){
+        delete servos[i];
+    }
+
+    return passed ? 0 : 1;
+}
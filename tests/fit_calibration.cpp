@@ -0,0 +1,92 @@
+/*
+~~ Fit Calibration ~~
+
+Command line fitter for calibration sweeps, replacing fitting them by hand.
+Each sweep CSV (single servo "Pulse Width (us),Absolute Step (0-4096)" files
+like samples/, or combined "Channel,..." files from the arm calibration) is
+memory mapped, parsed in place and fitted on its own worker thread. Every
+servo gets its measured pulse range and max angle, the pwm/dc correction
+terms, and rising/falling curve tables, written to one calibration file.
+
+Usage: ./testExe [-j threads] [-o output] [-n nominalMin nominalMax] sweep.csv...
+  -j  worker threads (default: one per core)
+  -o  calibration file to write (default: calibration.txt)
+  -n  nominal pulse range the pwm terms are relative to (default: 1000 2000 us)
+
+*/
+
+#include "calibration_fitter.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdlib>  // For std::atoi, std::atof
+#include <iostream>
+#include <iomanip>
+
+int main(int argc, char* argv[]){
+
+    unsigned threads = 0;
+    std::string output = "calibration.txt";
+    FitterParams params = {1000.0f, 2000.0f};
+    std::vector<std::string> paths;
+
+    for(int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+        if(arg == "-j" && i + 1 < argc){
+            threads = std::atoi(argv[++i]);
+        }
+        else if(arg == "-o" && i + 1 < argc){
+            output = argv[++i];
+        }
+        else if(arg == "-n" && i + 2 < argc){
+            params.nominalMinPulse = std::atof(argv[++i]);
+            params.nominalMaxPulse = std::atof(argv[++i]);
+        }
+        else if(!arg.empty() && arg[0] == '-'){
+            std::cerr << "Unknown option " << arg << std::endl;
+            return 1;
+        }
+        else{
+            paths.push_back(arg);
+        }
+    }
+    if(paths.empty()){
+        std::cerr << "Usage: " << argv[0] << " [-j threads] [-o output] [-n nominalMin nominalMax] sweep.csv..." << std::endl;
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<ServoFit> fits = fitSweepFiles(paths, params, threads);
+    double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    size_t rows = 0;
+    int failed = 0;
+    std::cout << std::fixed << std::setprecision(3);
+    for(const ServoFit& fit : fits){
+        rows += fit.rows;
+        std::cout << fit.source;
+        if(fit.channel >= 0){
+            std::cout << " channel " << fit.channel;
+        }
+        if(!fit.error.empty()){
+            std::cout << ": " << fit.error << std::endl;
+            failed++;
+            continue;
+        }
+        std::cout << ": " << fit.rows << " rows, " << fit.minPulse << " - " << fit.maxPulse << " us, "
+                  << fit.maxAngle << " deg, hysteresis " << fit.hysteresis << " deg, pwm " << fit.pwmOffset
+                  << " / " << fit.pwmMultiplier << ", dc " << fit.dcOffset << " / " << fit.dcMultiplier << std::endl;
+    }
+
+    try{
+        writeCalibrationFile(output, fits);
+    }
+    catch(const std::exception& e){
+        std::cerr << "Error writing file: " << e.what() << std::endl;
+        return 1;
+    }
+    std::cout << "Fitted " << fits.size() - failed << " of " << fits.size() << " servos (" << rows << " rows) in "
+              << elapsedMs << " ms, written to " << output << std::endl;
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,174 @@
+/*
+~~ Hysteresis Test ~~
+
+Fits a ServoCalibration to each bidirectional sweep in samples/ and checks
+that the rising and falling curves explain the readings of their own pass
+better than the single averaged curve.
+
+Then drives a Servo through a SimPCA9685 into a SimServo with backlash (its
+angle only moves once the pulse leaves the band between the rising and
+falling curves of sample_S2), on a virtual clock, and approaches targets from
+both sides, once with the averaged curve and once with the direction dependent
+calibration. The error on first approach should drop to the table resolution.
+
+Run from the repository root so the sample paths resolve.
+*/
+
+#include "i2c.h"
+#include "sim_bus.h"
+#include "pca9685.h"
+#include "servo.h"
+#include "motion.h"
+#include "calibration.h"
+#include "clock.h"
+
+#include <cmath>
+#include <chrono>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+
+// Test Config
+const uint8_t PCA_ADDR = 0x40;
+const uint8_t CHANNEL = 0;
+const float TICK_US_PER_STEP = 122.0f / 25.0f; // PCA9685 step size at the default prescaler (us)
+const char* PLANT_SAMPLE = "samples/sample_S2.csv";
+const float MAX_ANGLE = 263.848f;
+const float SPEED = 400.0f;      // deg/s
+const float RESOLUTION = 5.0f;   // updates/degree
+
+// Plant
+const float PLANT_TAU = 0.008f;          // First-order lag (s)
+const float PLANT_MAX_SPEED = 500.0f;    // deg/s
+const std::chrono::milliseconds SETTLE(200); // Virtual time the plant is left to settle after a move
+
+const char* SAMPLES[5] = {
+    "samples/sample_S1.csv", "samples/sample_S2.csv", "samples/sample_S3.csv",
+    "samples/sample_S4.csv", "samples/sample_S5.csv",
+};
+
+// Raw readings tagged by pass, angles relative to the mean reading at the lowest pulse
+bool readSweep(const char* path, std::vector<float>& pulses, std::vector<float>& angles, std::vector<bool>& rising){
+    std::ifstream file(path);
+    if(!file.is_open()){
+        return false;
+    }
+    std::string line;
+    std::getline(file, line);
+    while(std::getline(file, line)){
+        size_t comma = line.find(',');
+        if(comma == std::string::npos){
+            continue;
+        }
+        float pulse = std::stof(line.substr(0, comma));
+        bool up = pulses.empty() || pulse > pulses.back() || (pulse == pulses.back() && rising.back());
+        if(pulses.size() == 1){
+            rising[0] = up;
+        }
+        pulses.push_back(pulse);
+        angles.push_back(std::stof(line.substr(comma + 1)) * 360.0f / 4096.0f);
+        rising.push_back(up);
+    }
+    float lowest = *std::min_element(pulses.begin(), pulses.end());
+    double sum = 0.0;
+    int count = 0;
+    for(size_t i = 0; i < pulses.size(); i++){
+        if(pulses[i] == lowest){
+            sum += angles[i];
+            count++;
+        }
+    }
+    for(float& angle : angles){
+        angle -= static_cast<float>(sum / count);
+    }
+    return true;
+}
+
+// Worst first approach error over targets reached from above and below
+float approachError(const ServoCalibration& truth, const ServoCalibration* calibration){
+
+    const float moves[6][2] = {{60.0f, 120.0f}, {180.0f, 120.0f}, {30.0f, 200.0f}
+                             , {240.0f, 200.0f}, {100.0f, 45.0f}, {10.0f, 45.0f}};
+
+    VirtualClock clock;
+    MotionEngine engine(std::chrono::microseconds(2000), &clock);
+    SimBus bus({I2C_FAST_MODE, true, &clock});
+    SimPCA9685 pcaModel;
+    bus.addDevice(&pcaModel, PCA_ADDR);
+    SimServo plant(&pcaModel, CHANNEL, {0.0f, 0.0f, MAX_ANGLE, PLANT_MAX_SPEED, PLANT_TAU, &truth}, 131.0f, &clock);
+    I2C i2c(&bus);
+    PCA9685 pca(&i2c, PCA_ADDR);
+    ServoParams params = {&pca, CHANNEL, 535, 2655, MAX_ANGLE, 131.0f, SPEED, RESOLUTION, &engine, calibration};
+    Servo servo(params);
+
+    float worst = 0.0f;
+    for(const auto& move : moves){
+        servo.moveToPosition(move[0]).wait();
+        servo.moveToPosition(move[1]).wait();
+        clock.advance(SETTLE); // Last pulse picked up and the lag run out
+        float error = std::fabs(plant.getAngle() - move[1]);
+        worst = std::max(worst, error);
+        std::cout << "  " << move[0] << " -> " << move[1] << ": reached " << plant.getAngle() << std::endl;
+    }
+    servo.moveToPosition(131.0f).wait();
+    return worst;
+}
+
+int main(){
+
+    bool passed = true;
+    std::cout << std::fixed << std::setprecision(3);
+
+    // Fit quality per direction
+    for(const char* path : SAMPLES){
+        std::vector<float> pulses, angles;
+        std::vector<bool> rising;
+        if(!readSweep(path, pulses, angles, rising)){
+            std::cout << "Could not open " << path << ": Failed!" << std::endl;
+            return 1;
+        }
+        CalibrationCurve averaged = CalibrationCurve::fromSweepCsv(path);
+        ServoCalibration directional = ServoCalibration::fromSweepCsv(path);
+
+        double averagedSquares = 0.0;
+        double directionalSquares = 0.0;
+        for(size_t i = 0; i < pulses.size(); i++){
+            const CalibrationCurve& curve = rising[i] ? directional.getRising() : directional.getFalling();
+            averagedSquares += std::pow(averaged.angleAt(pulses[i]) - angles[i], 2);
+            directionalSquares += std::pow(curve.angleAt(pulses[i]) - angles[i], 2);
+        }
+        double averagedRms = std::sqrt(averagedSquares / pulses.size());
+        double directionalRms = std::sqrt(directionalSquares / pulses.size());
+
+        bool ok = directional.getHysteresis() > 0.0f && directionalRms < averagedRms;
+        passed = passed && ok;
+        std::cout << path << ": hysteresis " << directional.getHysteresis() << " deg, averaged RMS " << averagedRms
+                  << " deg, directional RMS " << directionalRms << " deg: " << (ok ? "Passed!" : "Failed!") << std::endl;
+    }
+
+    // Runtime compensation against a backlash plant
+    ServoCalibration truth = ServoCalibration::fromSweepCsv(PLANT_SAMPLE);
+    ServoCalibration averaged(CalibrationCurve::fromSweepCsv(PLANT_SAMPLE));
+
+    std::cout << "Averaged curve:" << std::endl;
+    float averagedError = approachError(truth, &averaged);
+    std::cout << "Direction dependent curves:" << std::endl;
+    float compensatedError = approachError(truth, &truth);
+
+    // One table step of the steepest part of the curve is the best an off time can do
+    float tickAngle = 0.0f;
+    for(float pulse = truth.getRising().getMinPulse(); pulse + TICK_US_PER_STEP <= truth.getRising().getMaxPulse(); pulse += 1.0f){
+        tickAngle = std::max(tickAngle, truth.getRising().angleAt(pulse + TICK_US_PER_STEP) - truth.getRising().angleAt(pulse));
+    }
+
+    bool runtime = compensatedError < averagedError && compensatedError <= tickAngle;
+    passed = passed && runtime;
+    std::cout << "Worst first approach error: averaged " << averagedError << " deg, compensated " << compensatedError
+              << " deg (one tick " << tickAngle << " deg): " << (runtime ? "Passed!" : "Failed!") << std::endl;
+
+    std::cout << "Hysteresis compensation: " << (passed ? "Passed!" : "Failed!") << std::endl;
+    return passed ? 0 : 1;
+}
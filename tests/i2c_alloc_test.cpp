@@ -0,0 +1,189 @@
+/*
+~~ I2C Allocation Test ~~
+
+Counts heap allocations (global operator new, every thread) on the simulated
+bus once the devices have been seen:
+- A vector read allocates, the same read into a caller-owned buffer or as a
+  fixed-size std::array does not
+- PCA9685 output writes, AS5600 register reads (throwing and status paths) and
+  angle reads allocate nothing
+- A servo move driven by the motion engine and an encoder sampling thread
+  allocate nothing while they run
+*/
+
+#include "i2c.h"
+#include "sim_bus.h"
+#include "pca9685.h"
+#include "as5600.h"
+#include "servo.h"
+#include "motion.h"
+#include "encoder_sampler.h"
+
+#include <new>
+#include <cstdlib>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <iostream>
+
+// Test Config
+const uint8_t PCA_ADDR = 0x40;
+const uint8_t SERVO_CHANNEL = 3;
+const uint8_t LED0_OFF_L = 0x08;
+const uint16_t AS5600_CONFIG = 0x000C;
+const int CALLS = 1000;
+const int WINDOW_MS = 100;
+
+// ~~ Allocation counting ~~
+
+static std::atomic<uint64_t> allocations{0};
+
+void* operator new(size_t size){
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void* memory = std::malloc(size ? size : 1);
+    if(!memory){
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void* operator new[](size_t size){
+    return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return std::malloc(size ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t& tag) noexcept{
+    return operator new(size, tag);
+}
+
+void operator delete(void* memory) noexcept{
+    std::free(memory);
+}
+
+void operator delete[](void* memory) noexcept{
+    std::free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept{
+    std::free(memory);
+}
+
+void operator delete[](void* memory, size_t) noexcept{
+    std::free(memory);
+}
+
+// Allocations made while running f
+template <typename F>
+uint64_t counted(F f){
+    uint64_t before = allocations.load();
+    f();
+    return allocations.load() - before;
+}
+
+bool report(const std::string& name, bool passed){
+    std::cout << name << ": " << (passed ? "Passed!" : "Failed!") << std::endl;
+    return passed;
+}
+
+int main(){
+
+    bool passed = true;
+
+    SimBus bus({I2C_FAST_MODE, false});
+    SimPCA9685 pcaModel;
+    SimAS5600 encoderModel([](){ return 42.0; });
+    bus.addDevice(&pcaModel, PCA_ADDR);
+    bus.addDevice(&encoderModel, AS5600_ADDRESS);
+    I2C i2c(&bus);
+    PCA9685 pca(&i2c, PCA_ADDR);
+    AS5600 encoder(&i2c, AS5600_CONFIG);
+    MotionEngine engine(std::chrono::microseconds(2000));
+
+    // Servo constructors print their speed
+    std::ostringstream servoLog;
+    std::streambuf* console = std::cout.rdbuf(servoLog.rdbuf());
+    Servo* servo = new Servo({&pca, SERVO_CHANNEL, 500, 2500, 180.0f, 90.0f, 200.0f, 5.0f, &engine});
+    std::cout.rdbuf(console);
+
+    // ~~ Buffer APIs ~~
+    {
+        uint8_t reg = LED0_OFF_L;
+        uint64_t vectorReads = counted([&](){
+            for(int i = 0; i < CALLS; i++){
+                i2c.writeRead(PCA_ADDR, &reg, 1, 2);
+            }
+        });
+        uint8_t buffer[2];
+        uint64_t spanReads = counted([&](){
+            for(int i = 0; i < CALLS; i++){
+                i2c.writeRead(PCA_ADDR, ConstByteSpan(&reg, 1), buffer);
+                i2c.read(PCA_ADDR, buffer);
+            }
+        });
+        std::array<uint8_t, 2> registers = {0, 0};
+        uint64_t arrayReads = counted([&](){
+            for(int i = 0; i < CALLS; i++){
+                registers = i2c.readRegisters<2>(I2C_DIRECT, PCA_ADDR, LED0_OFF_L);
+                registers = i2c.read<2>(I2C_DIRECT, PCA_ADDR);
+            }
+        });
+        std::cout << "  " << CALLS << " register reads: " << vectorReads << " allocations as vectors, " << spanReads
+                  << " into a buffer, " << arrayReads << " as std::array" << std::endl;
+        passed = report("Buffer and std::array reads do not allocate", vectorReads >= CALLS && spanReads == 0 && arrayReads == 0) && passed;
+    }
+
+    // ~~ Driver paths ~~
+    {
+        uint64_t output = counted([&](){
+            for(int i = 0; i < CALLS; i++){
+                pca.trySetOffTime(SERVO_CHANNEL, 200 + i % 100);
+                pca.setOffTime(SERVO_CHANNEL, 300 + i % 100);
+            }
+        });
+        uint16_t step = 0;
+        float angle = 0.0f;
+        uint64_t feedback = counted([&](){
+            for(int i = 0; i < CALLS; i++){
+                step = encoder.getRawStep();
+                encoder.tryGetStep(step);
+                angle = encoder.getAngle();
+            }
+        });
+        std::cout << "  " << CALLS << " iterations: " << output << " allocations on the output path, " << feedback
+                  << " on the encoder path (angle " << angle << " deg)" << std::endl;
+        passed = report("PCA9685 output and encoder reads do not allocate", output == 0 && feedback == 0) && passed;
+    }
+
+    // ~~ Steady state threads ~~
+    {
+        // Starting a move and a sampler allocates, running them must not
+        MotionHandle move = servo->moveToPosition(10.0f);
+        EncoderSampler sampler(&encoder, std::chrono::microseconds(1000), 256);
+        sampler.start();
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+        uint64_t samples = sampler.getSampleCount();
+        uint64_t running = counted([](){ std::this_thread::sleep_for(std::chrono::milliseconds(WINDOW_MS)); });
+        samples = sampler.getSampleCount() - samples;
+        bool moving = move.status() == MotionStatus::Running;
+
+        sampler.stop();
+        move.wait();
+        std::cout << "  " << WINDOW_MS << " ms of a servo move and " << samples << " encoder samples: " << running << " allocations" << std::endl;
+        passed = report("Motion engine and encoder sampler run without allocating", moving && samples > 0 && running == 0) && passed;
+    }
+
+    console = std::cout.rdbuf(servoLog.rdbuf());
+    delete servo;
+    std::cout.rdbuf(console);
+
+    std::cout << "I2C allocation: " << (passed ? "Passed!" : "Failed!") << std::endl;
+    return passed ? 0 : 1;
+}
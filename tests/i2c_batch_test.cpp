@@ -0,0 +1,343 @@
+/*
+~~ I2C Batch Test ~~
+
+Checks batched bus submission:
+- The io_uring queue runs a chain of pipe writes and reads in order from one
+  submit, and an op that fails only skips the op linked to it, not the ones
+  after it; cancel() stops a chain blocked on an empty pipe and skips the rest
+  (skipped when the kernel has no io_uring)
+- A frame of six servo outputs and two encoder reads behind the mux goes out
+  as one batch with the channel selects in between, every status Ok
+- A channel select that is not acknowledged fails its transaction, which
+  never goes out, and the rest of the batch still runs
+- On a bus that runs batches in the background, submitBatch returns before the
+  frame is on the wire, the caller computes meanwhile, and a transaction issued
+  while the batch is in flight runs after it
+- Batched writes are refused while the emergency stop is latched, reads still
+  go out
+- An emergency stop latched while a long batch is on the wire reaches the bus
+  within a motion tick, the rest of the batch is refused
+*/
+
+#include "i2c.h"
+#include "i2c_batch.h"
+#include "io_uring_queue.h"
+#include "sim_bus.h"
+#include "pca9685.h"
+#include "as5600.h"
+#include "estop.h"
+#include "config.h"
+
+#include <cmath>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <unistd.h> // For pipe, close
+
+// Test Config
+const uint8_t PCA_ADDR = 0x40;
+const uint8_t MUX_ADDR = 0x70;
+const uint8_t ENCODER_CHANNELS[2] = {1, 4};
+const double MAGNET_ANGLES[2] = {45.0, 300.0};
+const double TURN = 30.0; // Magnets turn after the encoders are zeroed
+const uint16_t AS5600_CONFIG = 0x000C;
+const int JOINTS = 6;
+const int PIPE_BYTES = 16;
+const uint8_t LED0_OFF_L = 0x08;
+const std::chrono::milliseconds ON_THE_WIRE(5); // Into a full batch (about 9 ms on a standard mode bus) when the stop latches
+
+bool report(const std::string& name, bool passed){
+    std::cout << name << ": " << (passed ? "Passed!" : "Failed!") << std::endl;
+    return passed;
+}
+
+double us(std::chrono::nanoseconds duration){
+    return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+uint16_t offTimeOf(SimPCA9685& model, int channel){
+    return model.getRegister(LED0_OFF_L + 4 * channel) | ((model.getRegister(LED0_OFF_L + 4 * channel + 1) & 0x0F) << 8);
+}
+
+int main(){
+
+    bool passed = true;
+    std::cout << std::fixed << std::setprecision(1);
+
+    // ~~ io_uring queue ~~
+    {
+        IoUringQueue queue(IoUringQueue::DEFAULT_ENTRIES);
+        int ends[2];
+        if(!queue.isOpen() || pipe(ends) != 0){
+            std::cout << "  io_uring unavailable, the bus falls back to blocking transfers" << std::endl;
+            passed = report("io_uring chain runs in order", true) && passed;
+        }
+        else{
+            // Each byte written then read back, with a write to a closed descriptor in the middle linked to a
+            // second write of the byte (which would shift every read after it)
+            uint8_t written[PIPE_BYTES];
+            uint8_t read[PIPE_BYTES];
+            std::vector<I2CBusOp> ops;
+            for(int i = 0; i < PIPE_BYTES; i++){
+                written[i] = static_cast<uint8_t>(0xA0 + i);
+                read[i] = 0x00;
+                ops.push_back({ends[1], 0x00, false, &written[i], 1, 0});
+                ops.push_back({ends[0], 0x00, true, &read[i], 1, 0});
+                if(i == PIPE_BYTES / 2){
+                    ops.push_back({-1, 0x00, false, &written[i], 1, 0, true});
+                    ops.push_back({ends[1], 0x00, false, &written[i], 1, 0});
+                }
+            }
+            bool submitted = queue.submit(ops.data(), static_cast<int>(ops.size()));
+            bool busy = !queue.submit(ops.data(), 1); // One batch at a time
+            queue.wait();
+
+            bool ordered = true;
+            for(int i = 0; i < PIPE_BYTES; i++){
+                ordered = ordered && read[i] == written[i];
+            }
+            int failed = 0;
+            int skipped = 0;
+            for(const I2CBusOp& op : ops){
+                failed += op.result == -1;
+                skipped += op.result == I2C_OP_SKIPPED;
+            }
+            close(ends[0]);
+            close(ends[1]);
+            std::cout << "  " << ops.size() << " ops from one submit, " << failed << " failed (the bad descriptor), "
+                      << skipped << " skipped (linked to it)" << std::endl;
+            passed = report("io_uring chain runs in order", submitted && busy && ordered && failed == 1 && skipped == 1
+                                                           && queue.poll()) && passed;
+        }
+    }
+
+    // ~~ io_uring cancel ~~
+    {
+        IoUringQueue queue(IoUringQueue::DEFAULT_ENTRIES);
+        int ends[2];
+        if(!queue.isOpen() || pipe(ends) != 0){
+            passed = report("io_uring chain cancelled", true) && passed;
+        }
+        else{
+            // A read of the empty pipe never completes on its own, the writes behind it wait for it
+            uint8_t first = 0x11;
+            uint8_t read = 0x00;
+            uint8_t rest[4] = {0x21, 0x22, 0x23, 0x24};
+            std::vector<I2CBusOp> ops = {{ends[1], 0x00, false, &first, 1, 0}, {ends[0], 0x00, true, &read, 1, 0}
+                                       , {ends[0], 0x00, true, &read, 1, 0}};
+            for(uint8_t& byte : rest){
+                ops.push_back({ends[1], 0x00, false, &byte, 1, 0});
+            }
+            bool submitted = queue.submit(ops.data(), static_cast<int>(ops.size()));
+            std::this_thread::sleep_for(ON_THE_WIRE);
+            bool blocked = !queue.poll();
+
+            auto start = std::chrono::steady_clock::now();
+            std::thread canceller([&queue](){ queue.cancel(); });
+            queue.wait();
+            std::chrono::nanoseconds stopped = std::chrono::steady_clock::now() - start;
+            canceller.join();
+
+            bool skipped = true;
+            for(size_t i = 2; i < ops.size(); i++){
+                skipped = skipped && ops[i].result == I2C_OP_SKIPPED;
+            }
+            close(ends[0]);
+            close(ends[1]);
+            std::cout << "  Blocked chain cancelled after " << us(stopped) << " us" << std::endl;
+            passed = report("io_uring chain cancelled", submitted && blocked && ops[0].result == 1 && ops[1].result == 1 && skipped
+                                                      && stopped < std::chrono::microseconds(MOTION_TICK_PERIOD_US)) && passed;
+        }
+    }
+
+    // ~~ Frame ~~
+    {
+        SimBus bus({I2C_FAST_MODE, false});
+        SimPCA9685 pcaModel;
+        double magnets[2] = {MAGNET_ANGLES[0], MAGNET_ANGLES[1]};
+        SimAS5600 encoderModels[2] = {SimAS5600([&magnets](){ return magnets[0]; }), SimAS5600([&magnets](){ return magnets[1]; })};
+        bus.addMux(MUX_ADDR);
+        bus.addDevice(&pcaModel, PCA_ADDR);
+        bus.addDevice(&encoderModels[0], AS5600_ADDRESS, ENCODER_CHANNELS[0]);
+        bus.addDevice(&encoderModels[1], AS5600_ADDRESS, ENCODER_CHANNELS[1]);
+        I2C i2c(&bus);
+        i2c.attachMux(MUX_ADDR);
+        PCA9685 pca(&i2c, PCA_ADDR);
+        AS5600 first(&i2c, AS5600_CONFIG, ENCODER_CHANNELS[0]);
+        AS5600 second(&i2c, AS5600_CONFIG, ENCODER_CHANNELS[1]);
+        magnets[0] += TURN;
+        magnets[1] += 2 * TURN;
+        uint16_t expected[2] = {first.getStep(), second.getStep()};
+
+        I2CBatch batch;
+        uint8_t angles[2][2];
+        bool queued = true;
+        for(int joint = 0; joint < JOINTS; joint++){
+            queued = pca.queueOffTime(batch, joint, 300 + 10 * joint) && queued;
+        }
+        queued = first.queueStep(batch, angles[0]) && second.queueStep(batch, angles[1]) && queued;
+
+        uint64_t switches = i2c.getChannelSwitches();
+        bool submitted = i2c.submitBatch(batch) == I2CStatus::Ok;
+        i2c.waitBatch(batch);
+
+        bool outputs = true;
+        for(int joint = 0; joint < JOINTS; joint++){
+            outputs = outputs && offTimeOf(pcaModel, joint) == 300 + 10 * joint;
+        }
+        bool feedback = AS5600::stepOf(angles[0]) == expected[0] && AS5600::stepOf(angles[1]) == expected[1];
+        std::cout << "  " << batch.size() << " transactions, " << i2c.getChannelSwitches() - switches << " channel selects, steps "
+                  << AS5600::stepOf(angles[0]) << " and " << AS5600::stepOf(angles[1]) << std::endl;
+        passed = report("A frame of outputs and encoder reads goes out as one batch", queued && submitted && batch.ok() && !batch.isPending()
+                                                                                     && outputs && feedback && expected[0] > 0
+                                                                                     && i2c.getChannelSwitches() - switches == 2) && passed;
+    }
+
+    // ~~ Failed channel select ~~
+    for(bool async : {false, true}){
+        SimBus bus({I2C_FAST_MODE, false, nullptr, false, async});
+        SimPCA9685 pcaModel;
+        SimAS5600 encoderModels[2] = {SimAS5600([](){ return MAGNET_ANGLES[0]; }), SimAS5600([](){ return MAGNET_ANGLES[1]; })};
+        bus.addMux(MUX_ADDR);
+        bus.addDevice(&pcaModel, PCA_ADDR);
+        bus.addDevice(&encoderModels[0], AS5600_ADDRESS, ENCODER_CHANNELS[0]);
+        bus.addDevice(&encoderModels[1], AS5600_ADDRESS, ENCODER_CHANNELS[1]);
+        I2C i2c(&bus);
+        i2c.attachMux(MUX_ADDR);
+        I2CDevice board = i2c.bind(PCA_ADDR);
+        I2CDevice encoders[2] = {i2c.bind(ENCODER_CHANNELS[0], AS5600_ADDRESS), i2c.bind(ENCODER_CHANNELS[1], AS5600_ADDRESS)};
+
+        uint8_t reg = REG_ANGLE_MSB;
+        uint8_t angles[2][2] = {};
+        uint8_t write[2] = {LED0_OFF_L, 0x55};
+        I2CBatch batch;
+        batch.writeRead(encoders[0], ConstByteSpan(&reg, 1), angles[0]);
+        batch.writeRead(encoders[1], ConstByteSpan(&reg, 1), angles[1]);
+        batch.write(board, write);
+
+        // The first channel select is not acknowledged, its register read must not go out on the old channel
+        uint64_t before = bus.getTransactions();
+        bus.injectNacks(1);
+        i2c.submitBatch(batch);
+        i2c.waitBatch(batch);
+        uint64_t sent = bus.getTransactions() - before;
+
+        // Failed select, then select, write and read of the second encoder, then the output write
+        bool skipped = batch.status(0) == I2CStatus::MuxError && batch.status(1) == I2CStatus::Ok && batch.status(2) == I2CStatus::Ok
+                    && sent == 5 && pcaModel.getRegister(LED0_OFF_L) == 0x55;
+        std::cout << "  " << (async ? "Background" : "Blocking") << " bus: " << sent << " transactions on the wire" << std::endl;
+        passed = report("A failed channel select keeps its transaction off the bus", skipped) && passed;
+    }
+
+    // ~~ Asynchronous ~~
+    {
+        SimBus bus({I2C_STANDARD_MODE, true, nullptr, false, true});
+        SimPCA9685 model;
+        bus.addDevice(&model, PCA_ADDR);
+        I2C i2c(&bus);
+        PCA9685 pca(&i2c, PCA_ADDR);
+
+        I2CBatch batch;
+        for(int joint = 0; joint < JOINTS; joint++){
+            pca.queueOffTime(batch, joint, 1000 + joint);
+        }
+        std::chrono::nanoseconds frame = bus.transactionTime(2) * batch.size();
+
+        auto start = std::chrono::steady_clock::now();
+        bool submitted = i2c.submitBatch(batch) == I2CStatus::Ok;
+        std::chrono::nanoseconds returned = std::chrono::steady_clock::now() - start;
+        bool inFlight = batch.isPending() && !i2c.pollBatch(batch);
+
+        // The next tick's computation, while the bus is busy
+        double work = 0.0;
+        for(int i = 0; i < 100000; i++){
+            work += std::sin(i * 0.001);
+        }
+
+        // A read of the last register the batch writes waits for the batch
+        uint8_t reg = LED0_OFF_L + 4 * (JOINTS - 1);
+        uint8_t value = 0x00;
+        bool read = i2c.tryWriteRead(I2C_DIRECT, PCA_ADDR, &reg, 1, &value, 1) == I2CStatus::Ok;
+        std::chrono::nanoseconds completed = std::chrono::steady_clock::now() - start;
+        bool ordered = read && value == ((1000 + JOINTS - 1) & 0xFF) && !batch.isPending() && batch.ok();
+
+        std::cout << "  " << batch.size() << " writes (" << us(frame) << " us on the wire): submit returned after " << us(returned)
+                  << " us, frame completed after " << us(completed) << " us (work " << work << ")" << std::endl;
+        passed = report("Batch runs in the background, later transactions wait for it", submitted && inFlight && returned * 4 < frame
+                                                                                       && completed >= frame && ordered) && passed;
+    }
+
+    // ~~ Emergency stop ~~
+    {
+        SimBus bus({I2C_FAST_MODE, false});
+        SimPCA9685 model;
+        bus.addDevice(&model, PCA_ADDR);
+        I2C i2c(&bus);
+        I2CDevice board = i2c.bind(PCA_ADDR);
+
+        uint8_t write[2] = {LED0_OFF_L, 0x77};
+        uint8_t reg = LED0_OFF_L;
+        uint8_t value = 0x00;
+        I2CBatch batch;
+        batch.write(board, write);
+        batch.writeRead(board, ConstByteSpan(&reg, 1), ByteSpan(&value, 1));
+
+        EmergencyStop::stop();
+        i2c.submitBatch(batch);
+        i2c.waitBatch(batch);
+        EmergencyStop::reset();
+
+        bool refused = batch.status(0) == I2CStatus::Refused && batch.status(1) == I2CStatus::Ok && model.getRegister(LED0_OFF_L) != 0x77;
+        passed = report("Batched writes refused while latched, reads go out", refused) && passed;
+    }
+
+    // ~~ Emergency stop during a batch ~~
+    {
+        SimBus bus({I2C_STANDARD_MODE, true, nullptr, false, true});
+        SimPCA9685 model;
+        bus.addDevice(&model, PCA_ADDR);
+        I2C i2c(&bus);
+        PCA9685 pca(&i2c, PCA_ADDR);
+
+        I2CBatch batch;
+        for(int i = 0; i < I2C_BATCH_OPS; i++){
+            pca.queueOffTime(batch, i % JOINTS, 1000 + i);
+        }
+        std::chrono::nanoseconds frame = bus.transactionTime(2) * batch.size();
+
+        i2c.submitBatch(batch);
+        std::this_thread::sleep_for(ON_THE_WIRE);
+        bool inFlight = batch.isPending();
+
+        // stop() returns once the cut is on the bus
+        auto start = std::chrono::steady_clock::now();
+        EmergencyStop::stop();
+        std::chrono::nanoseconds cut = std::chrono::steady_clock::now() - start;
+        bool off = true;
+        for(int joint = 0; joint < JOINTS; joint++){
+            off = off && model.getPulseWidth(joint) == 0.0f;
+        }
+        i2c.waitBatch(batch);
+        EmergencyStop::reset();
+
+        int sent = 0;
+        int refused = 0;
+        bool ordered = true;
+        for(int i = 0; i < batch.size(); i++){
+            sent += batch.status(i) == I2CStatus::Ok;
+            refused += batch.status(i) == I2CStatus::Refused;
+            ordered = ordered && (i < sent || batch.status(i) == I2CStatus::Refused); // A run that went out, then the refused rest
+        }
+        std::cout << "  Stop latched " << ON_THE_WIRE.count() << " ms into a " << us(frame) / 1000.0 << " ms batch: cut on the bus after "
+                  << us(cut) << " us, " << sent << " writes sent, " << refused << " refused" << std::endl;
+        passed = report("An emergency stop does not wait for the batch in flight", inFlight && off && sent > 0 && refused > 0
+                                                                                  && sent + refused == batch.size() && ordered
+                                                                                  && cut < std::chrono::microseconds(MOTION_TICK_PERIOD_US)) && passed;
+    }
+
+    std::cout << "I2C batch: " << (passed ? "Passed!" : "Failed!") << std::endl;
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,160 @@
+/*
+~~ I2C Device Test ~~
+
+Checks the bound device handles on the simulated bus:
+- bind returns a bound device for a slave that answers, an unbound one
+  (NotRegistered on every transaction) for one that does not, and binding a
+  registered slave again hands out another handle to it
+- Bound devices behind the mux reach their own channel
+- With a dedicated handle per device, alternating between two boards never
+  readdresses the bus, on the shared handle every transaction does
+- The per-transaction overhead stays the same with one registered device and
+  with a full bus of them
+*/
+
+#include "i2c.h"
+#include "i2c_stats.h"
+#include "sim_bus.h"
+#include "as5600.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+
+// Test Config
+const uint8_t PCA_ADDRS[2] = {0x40, 0x41};
+const uint8_t MISSING_ADDR = 0x42;
+const uint8_t MUX_ADDR = 0x70;
+const uint8_t ENCODER_CHANNELS[2] = {2, 5};
+const uint8_t LED0_OFF_L = 0x08;
+const uint8_t RAW_ANGLE_H = 0x0C;
+const int ITERATIONS = 100;
+const int CALLS = 200000;
+const int RUNS = 5;
+
+bool report(const std::string& name, bool passed){
+    std::cout << name << ": " << (passed ? "Passed!" : "Failed!") << std::endl;
+    return passed;
+}
+
+// Transport that acknowledges every address at no cost, only the bookkeeping is timed
+class AckAllI2C : public I2C
+{
+protected:
+    int transferRead(uint8_t addr, uint8_t* buffer, int numBytes) override { return numBytes; }
+    int transferWrite(uint8_t addr, const uint8_t* buffer, int numBytes) override { return numBytes; }
+};
+
+// Slave switches counted on both boards after alternating writes to them
+uint64_t alternate(bool deviceHandles){
+
+    SimBus bus({I2C_FAST_MODE, false, nullptr, deviceHandles});
+    SimPCA9685 models[2];
+    bus.addDevice(&models[0], PCA_ADDRS[0]);
+    bus.addDevice(&models[1], PCA_ADDRS[1]);
+    I2C i2c(&bus);
+    I2CDevice boards[2] = {i2c.bind(PCA_ADDRS[0]), i2c.bind(PCA_ADDRS[1])};
+    i2c.resetStats();
+
+    for(int i = 0; i < ITERATIONS; i++){
+        uint8_t write[2] = {LED0_OFF_L, static_cast<uint8_t>(i)};
+        boards[i & 1].tryWrite(write, 2);
+    }
+
+    uint64_t switches = 0;
+    for(const I2CDeviceStats& device : i2c.getStats()){
+        switches += device.slaveSwitches;
+    }
+    return switches;
+}
+
+// Fastest of a few runs of one bound write, in ns
+double perWrite(I2CDevice device){
+    uint8_t write[2] = {LED0_OFF_L, 0x00};
+    double best = 1e9;
+    for(int run = 0; run < RUNS; run++){
+        auto start = std::chrono::steady_clock::now();
+        for(int i = 0; i < CALLS; i++){
+            device.tryWrite(write, 2);
+        }
+        std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, static_cast<double>(elapsed.count()) / CALLS);
+    }
+    return best;
+}
+
+int main(){
+
+    bool passed = true;
+    std::cout << std::fixed << std::setprecision(1);
+
+    // ~~ Binding ~~
+    {
+        SimBus bus({I2C_FAST_MODE, false});
+        SimPCA9685 model;
+        SimAS5600 encoders[2] = {SimAS5600([](){ return 90.0; }), SimAS5600([](){ return 270.0; })};
+        bus.addMux(MUX_ADDR);
+        bus.addDevice(&model, PCA_ADDRS[0]);
+        bus.addDevice(&encoders[0], AS5600_ADDRESS, ENCODER_CHANNELS[0]);
+        bus.addDevice(&encoders[1], AS5600_ADDRESS, ENCODER_CHANNELS[1]);
+        I2C i2c(&bus);
+        i2c.attachMux(MUX_ADDR);
+
+        I2CDevice board = i2c.bind(PCA_ADDRS[0]);
+        I2CDevice again = i2c.bind(PCA_ADDRS[0]);
+        I2CDevice missing = i2c.bind(MISSING_ADDR);
+        uint8_t write[2] = {LED0_OFF_L, 0x5A};
+        uint8_t value = 0x00;
+        bool bound = board.isBound() && again.isBound() && board.getAddress() == PCA_ADDRS[0]
+                  && board.tryWrite(write, 2) == I2CStatus::Ok && model.getRegister(LED0_OFF_L) == 0x5A
+                  && !i2c.registerSlave(PCA_ADDRS[0]);
+        bool unbound = !missing.isBound() && missing.tryWrite(write, 2) == I2CStatus::NotRegistered
+                    && missing.tryRead(&value, 1) == I2CStatus::NotRegistered && I2CDevice().tryRead(&value, 1) == I2CStatus::NotRegistered;
+        passed = report("Bound device for a slave that answers, unbound for one that does not", bound && unbound) && passed;
+
+        // Raw angle high byte, 90 deg is 0x400 and 270 deg 0xC00
+        uint8_t reg = RAW_ANGLE_H;
+        uint8_t high[2] = {0x00, 0x00};
+        I2CDevice first = i2c.bind(ENCODER_CHANNELS[0], AS5600_ADDRESS);
+        I2CDevice second = i2c.bind(ENCODER_CHANNELS[1], AS5600_ADDRESS);
+        bool routed = first.tryWriteRead(&reg, 1, &high[0], 1) == I2CStatus::Ok && second.tryWriteRead(&reg, 1, &high[1], 1) == I2CStatus::Ok
+                   && high[0] == 0x04 && high[1] == 0x0C && first.getChannel() == ENCODER_CHANNELS[0];
+        passed = report("Bound devices behind the mux reach their channel", routed) && passed;
+    }
+
+    // ~~ Dedicated handles ~~
+    {
+        uint64_t shared = alternate(false);
+        uint64_t dedicated = alternate(true);
+        std::cout << "  " << ITERATIONS << " writes alternating between two boards: " << shared << " slave switches shared, "
+                  << dedicated << " with a handle each" << std::endl;
+        passed = report("A handle per device never readdresses the bus", shared == ITERATIONS && dedicated == 0) && passed;
+    }
+
+    // ~~ Constant overhead ~~
+    {
+        AckAllI2C few;
+        I2CDevice lone = few.bind(PCA_ADDRS[0]);
+
+        // Every 7-bit address but the reserved ones, the device timed is the last one registered
+        AckAllI2C full;
+        int registered = 0;
+        I2CDevice last;
+        for(int addr = 0x08; addr < 0x78; addr++){
+            last = full.bind(addr);
+            registered += last.isBound();
+        }
+        double loneWrite = perWrite(lone);
+        double fullWrite = perWrite(last);
+
+        std::cout << "  Bound write with 1 device " << loneWrite << " ns, with " << registered << " devices " << fullWrite << " ns" << std::endl;
+        passed = report("Per-transaction overhead does not grow with the devices", lone.isBound() && registered == 0x70
+                                                                                  && fullWrite < loneWrite * 1.5 + 20.0) && passed;
+    }
+
+    std::cout << "I2C device: " << (passed ? "Passed!" : "Failed!") << std::endl;
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,234 @@
+/*
+~~ I2C Mux Test ~~
+
+Puts six AS5600 encoders (all at address 0x36) behind a fake TCA9548A mux and
+checks that reads are routed to the right channel, that the I2C channel cache
+skips redundant channel selects, and that the MultiEncoderSampler orders its
+reads to minimize channel switches. Finishes with a full six-encoder sweep
+time benchmark on a bus modeled at 400 kHz.
+*/
+
+#include "i2c.h"
+#include "as5600.h"
+#include "encoder_sampler.h"
+
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+
+// Test Config
+const uint8_t MUX_ADDR = 0x70;
+const uint8_t DIRECT_ADDR = 0x40;          // A device on the bus itself (like the PCA9685)
+const int BUS_BYTE_TIME_US = 23;           // ~9 clocks per byte at 400 kHz
+const uint8_t CHANNELS[6] = {3, 0, 5, 1, 4, 2}; // Encoder i is on CHANNELS[i], deliberately out of order
+const int NUM_SWEEPS = 100;
+const int SAMPLE_PERIOD_US = 5000;
+const int SAMPLE_TIME_MS = 200;
+
+// Fake TCA9548A with an AS5600 on each of its channels
+class FakeMuxBus : public I2C
+{
+private:
+    struct FakeEncoder{
+        bool present = false;
+        uint8_t reg = 0x00;
+        uint16_t reads = 0;
+        uint16_t latched = 0;
+    };
+
+    FakeEncoder encoders[I2C_MUX_CHANNELS];
+    uint8_t control = 0x00; // Mux control register (one bit per channel)
+
+    void transfer(int numBytes){
+        auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(BUS_BYTE_TIME_US * (numBytes + 1));
+        while(std::chrono::steady_clock::now() < end){}
+    }
+
+    // The single encoder visible through the mux, nullptr if none or several (address collision)
+    FakeEncoder* routed(){
+        FakeEncoder* found = nullptr;
+        for(int channel = 0; channel < I2C_MUX_CHANNELS; channel++){
+            if((control & (1 << channel)) && encoders[channel].present){
+                if(found){
+                    collisions++;
+                    return nullptr;
+                }
+                found = &encoders[channel];
+            }
+        }
+        return found;
+    }
+
+protected:
+    int transferRead(uint8_t addr, uint8_t* buffer, int numBytes) override{
+        transfer(numBytes);
+        transactions++;
+        if(addr == MUX_ADDR){
+            buffer[0] = control;
+            return numBytes;
+        }
+        if(addr == DIRECT_ADDR){
+            buffer[0] = 0x00;
+            return numBytes;
+        }
+
+        FakeEncoder* encoder = routed();
+        if(addr != AS5600_ADDRESS || !encoder){
+            return -1; // NACK
+        }
+
+        // Step encodes the channel, so a misrouted read is visible
+        int channel = encoder - encoders;
+        if(encoder->reg == REG_MAGNET_STATUS){
+            buffer[0] = 0x20; // Magnet detected
+        }
+        else if(encoder->reg == REG_ANGLE_MSB){
+            encoder->latched = (channel * 600 + encoder->reads++ % 600) & 0x0FFF;
+            buffer[0] = encoder->latched >> 8;
+        }
+        else if(encoder->reg == REG_ANGLE_LSB){
+            buffer[0] = encoder->latched & 0xFF;
+        }
+        else{
+            buffer[0] = 0x00;
+        }
+        return numBytes;
+    }
+
+    int transferWrite(uint8_t addr, const uint8_t* buffer, int numBytes) override{
+        transfer(numBytes);
+        transactions++;
+        if(addr == MUX_ADDR){
+            control = buffer[0];
+            muxWrites++;
+            return numBytes;
+        }
+        if(addr == DIRECT_ADDR){
+            return numBytes;
+        }
+
+        FakeEncoder* encoder = routed();
+        if(addr != AS5600_ADDRESS || !encoder){
+            return -1; // NACK
+        }
+        encoder->reg = buffer[0];
+        return numBytes;
+    }
+
+public:
+    uint64_t muxWrites = 0;
+    uint64_t transactions = 0;
+    uint64_t collisions = 0;
+
+    FakeMuxBus(){
+        for(uint8_t channel : CHANNELS){
+            encoders[channel].present = true;
+        }
+    }
+};
+
+// Channel an encoder reading came from
+int channelOf(uint16_t step){
+    return step / 600;
+}
+
+bool report(const std::string& name, bool passed){
+    std::cout << name << ": " << (passed ? "Passed!" : "Failed!") << std::endl;
+    return passed;
+}
+
+int main(){
+
+    bool passed = true;
+
+    FakeMuxBus bus;
+    if(!bus.attachMux(MUX_ADDR)){
+        std::cout << "Failed to attach mux" << std::endl;
+        return 1;
+    }
+    bus.registerSlave(DIRECT_ADDR);
+
+    std::vector<AS5600*> encoders;
+    for(uint8_t channel : CHANNELS){
+        encoders.push_back(new AS5600(&bus, 0x0000, channel));
+    }
+    passed = report("Six AS5600s at one address, collisions " + std::to_string(bus.collisions), bus.collisions == 0) && passed;
+
+    // Every read lands on the encoder's own channel
+    bool routedOk = true;
+    for(size_t i = 0; i < encoders.size(); i++){
+        routedOk = routedOk && channelOf(encoders[i]->getStep()) == CHANNELS[i];
+    }
+    passed = report("Reads routed by channel", routedOk) && passed;
+
+    // Repeated reads on one channel select it once, direct devices never switch it
+    uint64_t switchesBefore = bus.getChannelSwitches();
+    for(int i = 0; i < 10; i++){
+        encoders[0]->getStep();
+        bus.read(DIRECT_ADDR, 1);
+    }
+    uint64_t switches = bus.getChannelSwitches() - switchesBefore;
+    passed = report("Channel cache (" + std::to_string(switches) + " switch for 10 reads + 10 direct reads)",
+                    switches <= 1 && bus.getActiveChannel() == CHANNELS[0]) && passed;
+
+    // Naive sweep: encoders in index order
+    uint64_t muxBefore = bus.muxWrites;
+    uint64_t transactionsBefore = bus.transactions;
+    auto start = std::chrono::steady_clock::now();
+    for(int sweep = 0; sweep < NUM_SWEEPS; sweep++){
+        for(AS5600* encoder : encoders){
+            encoder->getStep();
+        }
+    }
+    double naiveUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / NUM_SWEEPS;
+    double naiveSwitches = double(bus.muxWrites - muxBefore) / NUM_SWEEPS;
+    double readTransactions = double(bus.transactions - transactionsBefore - (bus.muxWrites - muxBefore)) / NUM_SWEEPS;
+
+    // Batched sweep: channel order, alternating direction
+    MultiEncoderSampler sampler(encoders, std::chrono::microseconds(SAMPLE_PERIOD_US), 256);
+    sampler.sweep();
+    muxBefore = bus.muxWrites;
+    start = std::chrono::steady_clock::now();
+    for(int sweep = 0; sweep < NUM_SWEEPS; sweep++){
+        sampler.sweep();
+    }
+    double batchedUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / NUM_SWEEPS;
+    double batchedSwitches = double(bus.muxWrites - muxBefore) / NUM_SWEEPS;
+
+    bool sampledOk = sampler.getErrorCount() == 0;
+    for(size_t i = 0; i < sampler.size(); i++){
+        EncoderSample sample;
+        sampledOk = sampledOk && sampler.latest(i, sample) && channelOf(sample.step) == CHANNELS[i];
+    }
+    passed = report("Batched sweep switches " + std::to_string(batchedSwitches) + " per sweep (naive "
+                    + std::to_string(naiveSwitches) + ")", sampledOk && batchedSwitches == encoders.size() - 1
+                    && batchedSwitches < naiveSwitches) && passed;
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "Six-encoder sweep: batched " << batchedUs << " us, naive order " << naiveUs << " us, "
+              << readTransactions << " read transactions per sweep (without the channel cache every one would add a select)"
+              << std::endl;
+
+    // Threaded sampling keeps each encoder's ring separate
+    uint64_t sweepsBefore = sampler.getSweepCount();
+    sampler.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(SAMPLE_TIME_MS));
+    sampler.stop();
+
+    bool threadedOk = sampler.getErrorCount() == 0 && sampler.getSweepCount() - sweepsBefore >= SAMPLE_TIME_MS * 1000 / SAMPLE_PERIOD_US * 9 / 10;
+    EncoderSample buffer[64];
+    for(size_t i = 0; i < sampler.size(); i++){
+        size_t count = sampler.snapshot(i, buffer, 64);
+        for(size_t j = 0; j < count; j++){
+            threadedOk = threadedOk && channelOf(buffer[j].step) == CHANNELS[i];
+        }
+    }
+    passed = report("Threaded sampling, " + std::to_string(sampler.getSweepCount() - sweepsBefore) + " sweeps", threadedOk) && passed;
+
+    for(AS5600* encoder : encoders){
+        delete encoder;
+    }
+    return passed ? 0 : 1;
+}
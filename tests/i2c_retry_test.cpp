@@ -0,0 +1,303 @@
+/*
+~~ I2C Retry Test ~~
+
+Runs the non-throwing transaction path on the simulated bus with injected
+faults:
+- Status codes for a good read, an unregistered slave and a missing device,
+  and the throwing wrappers naming the device
+- A write that is not acknowledged twice goes through on the third attempt,
+  one not acknowledged three times fails with Nack, retries are counted
+- Backoff doubles up to its cap between attempts
+- An emergency write queued while a retry backs off on the scheduler's bus
+  thread goes out at once, and a failed emergency write retries without
+  backing off
+- A jammed bus is recovered (bus recovery, then a recovery hook) and the
+  transaction goes through
+- A servo move on a noisy bus completes with retries, and is cancelled (not
+  thrown through the engine) without them
+- A failed transaction costs less through the status path than through an
+  exception
+*/
+
+#include "i2c.h"
+#include "i2c_scheduler.h"
+#include "sim_bus.h"
+#include "pca9685.h"
+#include "servo.h"
+#include "motion.h"
+#include "clock.h"
+
+#include <cmath>
+#include <chrono>
+#include <future>
+#include <thread>
+#include <sstream>
+#include <string>
+#include <stdexcept>
+#include <iostream>
+#include <iomanip>
+
+// Test Config
+const uint8_t PCA_ADDR = 0x40;
+const uint8_t MISSING_ADDR = 0x41;
+const uint8_t LED3_OFF_L = 0x08 + 4 * 3;
+const uint8_t SERVO_CHANNEL = 3;
+const double NOISE = 0.05; // Chance of any transaction being dropped
+const int FAILED_CALLS = 20000;
+
+// Retry policies
+const I2CRetryPolicy THREE_TRIES = {3, std::chrono::microseconds(50), std::chrono::microseconds(200), 0};
+const I2CRetryPolicy BACKOFF = {4, std::chrono::microseconds(1000), std::chrono::microseconds(2000), 0};
+const I2CRetryPolicy LONG_BACKOFF = {2, std::chrono::microseconds(20000), std::chrono::microseconds(20000), 0};
+const I2CRetryPolicy RECOVERING = {3, std::chrono::microseconds(0), std::chrono::microseconds(0), 1};
+const I2CRetryPolicy NOISY_BUS = {5, std::chrono::microseconds(0), std::chrono::microseconds(0), 0};
+const I2CRetryPolicy NO_RETRIES = {1, std::chrono::microseconds(0), std::chrono::microseconds(0), 0};
+
+bool report(const std::string& name, bool passed){
+    std::cout << name << ": " << (passed ? "Passed!" : "Failed!") << std::endl;
+    return passed;
+}
+
+double ms(std::chrono::nanoseconds duration){
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+uint64_t retriesOf(I2C& i2c, uint8_t address){
+    for(const I2CDeviceStats& device : i2c.getStats()){
+        if(device.channel == I2C_DIRECT && device.address == address){
+            return device.retries;
+        }
+    }
+    return 0;
+}
+
+// Moves a servo on a noisy bus in virtual time, returns how the move ended
+MotionStatus noisyMove(const I2CRetryPolicy& policy, float& horn){
+
+    VirtualClock clock;
+    SimBus bus({I2C_FAST_MODE, true, &clock});
+    SimPCA9685 model;
+    SimServo simServo(&model, SERVO_CHANNEL, {500.0f, 2500.0f, 180.0f, 400.0f, 0.01f, nullptr}, 90.0f, &clock);
+    bus.addDevice(&model, PCA_ADDR);
+    I2C i2c(&bus);
+    PCA9685 pca(&i2c, PCA_ADDR);
+    MotionEngine engine(std::chrono::microseconds(2000), &clock);
+
+    // Servo constructors print their speed
+    std::ostringstream servoLog;
+    std::streambuf* console = std::cout.rdbuf(servoLog.rdbuf());
+    Servo* servo = new Servo({&pca, SERVO_CHANNEL, 500, 2500, 180.0f, 90.0f, 200.0f, 5.0f, &engine});
+    std::cout.rdbuf(console);
+
+    i2c.setRetryPolicy(policy);
+    bus.setNackRate(NOISE, 3);
+    MotionHandle move = servo->moveToPosition(150.0f);
+    move.wait();
+    MotionStatus status = move.status();
+    clock.advance(std::chrono::milliseconds(300));
+    horn = simServo.getAngle();
+
+    bus.setNackRate(0.0);
+    console = std::cout.rdbuf(servoLog.rdbuf());
+    delete servo;
+    std::cout.rdbuf(console);
+    return status;
+}
+
+int main(){
+
+    bool passed = true;
+    std::cout << std::fixed << std::setprecision(3);
+
+    // ~~ Status codes ~~
+    {
+        SimBus bus({I2C_FAST_MODE, false});
+        SimPCA9685 model;
+        bus.addDevice(&model, PCA_ADDR);
+        I2C i2c(&bus);
+        bool registered = i2c.registerSlave(PCA_ADDR) && !i2c.registerSlave(MISSING_ADDR);
+
+        uint8_t reg = LED3_OFF_L;
+        uint8_t value = 0xFF;
+        uint8_t write[2] = {LED3_OFF_L, 0x5A};
+        bool ok = i2c.tryWrite(I2C_DIRECT, PCA_ADDR, write, 2) == I2CStatus::Ok
+               && i2c.tryWriteRead(I2C_DIRECT, PCA_ADDR, &reg, 1, &value, 1) == I2CStatus::Ok && value == 0x5A;
+        bool unregistered = i2c.tryRead(I2C_DIRECT, MISSING_ADDR, &value, 1) == I2CStatus::NotRegistered;
+
+        std::string message;
+        try{
+            i2c.read(MISSING_ADDR, 1);
+        }
+        catch(const std::runtime_error& e){
+            message = e.what();
+        }
+        std::cout << "  " << message << std::endl;
+        passed = report("Status codes, and the throwing wrappers name the device"
+                      , registered && ok && unregistered && message.find("0x41") != std::string::npos) && passed;
+    }
+
+    // ~~ Bounded retries ~~
+    {
+        SimBus bus({I2C_FAST_MODE, false});
+        SimPCA9685 model;
+        bus.addDevice(&model, PCA_ADDR);
+        I2C i2c(&bus);
+        i2c.registerSlave(PCA_ADDR);
+        i2c.setRetryPolicy(THREE_TRIES);
+        i2c.resetStats();
+
+        uint8_t first[2] = {LED3_OFF_L, 0x11};
+        bus.injectNacks(2);
+        bool recovered = i2c.tryWrite(I2C_DIRECT, PCA_ADDR, first, 2) == I2CStatus::Ok && model.getRegister(LED3_OFF_L) == 0x11;
+
+        uint8_t second[2] = {LED3_OFF_L, 0x22};
+        bus.injectNacks(3);
+        bool bounded = i2c.tryWrite(I2C_DIRECT, PCA_ADDR, second, 2) == I2CStatus::Nack && model.getRegister(LED3_OFF_L) == 0x11;
+
+        // Pings probe, they are never retried
+        bus.injectNacks(1);
+        bool probed = !i2c.pingSlave(PCA_ADDR);
+
+        uint64_t retries = retriesOf(i2c, PCA_ADDR);
+        std::cout << "  " << retries << " retries counted" << std::endl;
+        passed = report("Two NACKs retried through, three fail with Nack, pings not retried"
+                      , recovered && bounded && probed && retries == 4) && passed;
+    }
+
+    // ~~ Backoff ~~
+    {
+        SimBus bus({I2C_FAST_MODE, false});
+        SimPCA9685 model;
+        bus.addDevice(&model, PCA_ADDR);
+        I2C i2c(&bus);
+        i2c.registerSlave(PCA_ADDR);
+        i2c.setRetryPolicy(BACKOFF);
+
+        uint8_t write[2] = {LED3_OFF_L, 0x33};
+        bus.injectNacks(BACKOFF.maxAttempts);
+        auto start = std::chrono::steady_clock::now();
+        bool failed = i2c.tryWrite(I2C_DIRECT, PCA_ADDR, write, 2) == I2CStatus::Nack;
+        std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - start;
+
+        // 1 ms, then 2 ms, then capped at 2 ms
+        std::chrono::nanoseconds expected = std::chrono::milliseconds(5);
+        std::cout << "  " << BACKOFF.maxAttempts << " attempts took " << ms(elapsed) << " ms (backoff " << ms(expected) << " ms)" << std::endl;
+        passed = report("Backoff doubles up to its cap", failed && elapsed >= expected && elapsed < expected * 3) && passed;
+    }
+
+    // ~~ Emergency during a backoff ~~
+    {
+        SimBus bus({I2C_FAST_MODE, false});
+        SimPCA9685 model;
+        bus.addDevice(&model, PCA_ADDR);
+        I2C i2c(&bus);
+        i2c.registerSlave(PCA_ADDR);
+        i2c.setRetryPolicy(LONG_BACKOFF);
+        i2c.startScheduler(std::chrono::microseconds(5000));
+
+        // An output write not acknowledged once, backing off on the bus thread
+        bus.injectNacks(1);
+        auto start = std::chrono::steady_clock::now();
+        std::future<I2CResult> retried = i2c.submit({I2COp::Write, I2CPriority::Output, I2C_DIRECT, PCA_ADDR, {LED3_OFF_L, 0x66}, 0});
+        std::this_thread::sleep_for(LONG_BACKOFF.backoff / 4);
+
+        uint8_t cut[2] = {LED3_OFF_L, 0x00};
+        auto queued = std::chrono::steady_clock::now();
+        bool cutOk = i2c.writeEmergency(PCA_ADDR, cut, 2) && model.getRegister(LED3_OFF_L) == 0x00;
+        std::chrono::nanoseconds cutLatency = std::chrono::steady_clock::now() - queued;
+        bool retriedOk = retried.get().ok && model.getRegister(LED3_OFF_L) == 0x66;
+        std::chrono::nanoseconds retryTime = std::chrono::steady_clock::now() - start;
+
+        // A cut not acknowledged once retries straight away
+        bus.injectNacks(1);
+        queued = std::chrono::steady_clock::now();
+        bool recut = i2c.writeEmergency(PCA_ADDR, cut, 2) && model.getRegister(LED3_OFF_L) == 0x00;
+        std::chrono::nanoseconds recutLatency = std::chrono::steady_clock::now() - queued;
+
+        std::cout << "  Cut during a " << ms(LONG_BACKOFF.backoff) << " ms backoff landed after " << ms(cutLatency) << " ms, the retry after "
+                  << ms(retryTime) << " ms; a NACKed cut landed after " << ms(recutLatency) << " ms" << std::endl;
+        passed = report("Emergency writes do not wait for a backoff", cutOk && retriedOk && recut
+                                                                    && cutLatency < LONG_BACKOFF.backoff / 4
+                                                                    && retryTime >= LONG_BACKOFF.backoff
+                                                                    && recutLatency < LONG_BACKOFF.backoff / 4) && passed;
+    }
+
+    // ~~ Recovery ~~
+    {
+        SimBus bus({I2C_FAST_MODE, false});
+        SimPCA9685 model;
+        bus.addDevice(&model, PCA_ADDR);
+        I2C i2c(&bus);
+        i2c.registerSlave(PCA_ADDR);
+        i2c.setRetryPolicy(RECOVERING);
+
+        // The bus's own recovery
+        uint8_t first[2] = {LED3_OFF_L, 0x44};
+        bus.jam();
+        bool recovered = i2c.tryWrite(I2C_DIRECT, PCA_ADDR, first, 2) == I2CStatus::Ok && i2c.getRecoveries() == 1;
+
+        // A hook that cannot recover, the transaction fails once its attempts run out
+        int hookCalls = 0;
+        i2c.setRecoveryHook([&hookCalls](){ hookCalls++; return false; });
+        uint8_t second[2] = {LED3_OFF_L, 0x55};
+        bus.jam();
+        bool stuck = i2c.tryWrite(I2C_DIRECT, PCA_ADDR, second, 2) == I2CStatus::Nack && hookCalls == RECOVERING.maxAttempts - 1;
+
+        // A hook that does
+        i2c.setRecoveryHook([&bus, &hookCalls](){ hookCalls++; return bus.recover(); });
+        bool hooked = i2c.tryWrite(I2C_DIRECT, PCA_ADDR, second, 2) == I2CStatus::Ok && model.getRegister(LED3_OFF_L) == 0x55;
+
+        std::cout << "  " << i2c.getRecoveries() << " recoveries, " << hookCalls << " by the hook" << std::endl;
+        passed = report("Jammed bus recovered by the bus, then by the hook", recovered && stuck && hooked) && passed;
+    }
+
+    // ~~ Servo on a noisy bus ~~
+    {
+        float retriedHorn;
+        float plainHorn;
+        MotionStatus retried = noisyMove(NOISY_BUS, retriedHorn);
+        MotionStatus plain = noisyMove(NO_RETRIES, plainHorn);
+        std::cout << "  " << NOISE * 100 << " % dropped: with retries the horn reached " << retriedHorn << " deg, without it stopped at "
+                  << plainHorn << " deg" << std::endl;
+        passed = report("Move completes on a noisy bus with retries, is cancelled without"
+                      , retried == MotionStatus::Completed && std::fabs(retriedHorn - 150.0f) < 1.0f
+                     && plain == MotionStatus::Cancelled) && passed;
+    }
+
+    // ~~ Status against exceptions ~~
+    {
+        SimBus bus({I2C_FAST_MODE, false});
+        SimPCA9685 model;
+        bus.addDevice(&model, PCA_ADDR);
+        I2C i2c(&bus);
+        i2c.registerSlave(PCA_ADDR);
+        uint8_t value;
+        uint8_t reg = LED3_OFF_L;
+
+        bus.setNackRate(1.0);
+        auto start = std::chrono::steady_clock::now();
+        int failures = 0;
+        for(int i = 0; i < FAILED_CALLS; i++){
+            failures += i2c.tryWriteRead(I2C_DIRECT, PCA_ADDR, &reg, 1, &value, 1) != I2CStatus::Ok;
+        }
+        std::chrono::nanoseconds statusPath = (std::chrono::steady_clock::now() - start) / FAILED_CALLS;
+
+        start = std::chrono::steady_clock::now();
+        for(int i = 0; i < FAILED_CALLS; i++){
+            try{
+                i2c.writeRead(PCA_ADDR, &reg, 1, 1);
+            }
+            catch(const std::runtime_error&){
+                failures++;
+            }
+        }
+        std::chrono::nanoseconds throwingPath = (std::chrono::steady_clock::now() - start) / FAILED_CALLS;
+
+        std::cout << "  Failed register read: " << statusPath.count() << " ns as a status, " << throwingPath.count()
+                  << " ns as an exception" << std::endl;
+        passed = report("Status path is cheaper than the exception", failures == 2 * FAILED_CALLS && statusPath < throwingPath) && passed;
+    }
+
+    std::cout << "I2C retry: " << (passed ? "Passed!" : "Failed!") << std::endl;
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,244 @@
+/*
+~~ I2C Scheduler Test ~~
+
+Runs the bus owner thread against the simulated bus at 100 kHz, where every
+transaction really takes its time on the wire:
+- Requests queued behind a long transfer run emergency first, then output,
+  feedback and diagnostic
+- Writes queued back to back to one register reach the bus once, with the
+  newest value, and every request completes
+- A diagnostic request behind an endless flood of output writes still runs
+  shortly after maxWait
+- PCA9685 writes and AS5600 reads from two threads stay correct (the register
+  pointer write and its read are one request), and an emergency cut under that
+  load waits for at most the transaction on the wire
+*/
+
+#include "i2c.h"
+#include "i2c_scheduler.h"
+#include "sim_bus.h"
+#include "pca9685.h"
+#include "as5600.h"
+
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <deque>
+#include <future>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+
+// Test Config
+const uint8_t PCA_ADDR = 0x40;
+const uint8_t MUX_ADDR = 0x70;
+const uint8_t ENCODER_CHANNEL = 1;
+const uint16_t AS5600_CONFIG = 0x000C;
+const std::chrono::microseconds MAX_WAIT(5000);
+const int LONG_READ_BYTES = 200; // About 18 ms at 100 kHz
+const int COALESCED_WRITES = 10;
+const int LOAD_ITERATIONS = 200;
+const int FLOOD_DEPTH = 8; // Output writes kept queued, about 3 ms of bus time at 100 kHz (under maxWait)
+
+// PCA9685 channel registers
+const uint8_t LED0_ON_L = 0x06;
+const uint8_t LED0_OFF_L = 0x08;
+const uint8_t LED0_OFF_H = 0x09;
+
+bool report(const std::string& name, bool passed){
+    std::cout << name << ": " << (passed ? "Passed!" : "Failed!") << std::endl;
+    return passed;
+}
+
+double us(std::chrono::nanoseconds duration){
+    return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+I2CRequest writeRequest(I2CPriority priority, uint8_t reg, uint8_t value){
+    return {I2COp::Write, priority, I2C_DIRECT, PCA_ADDR, {reg, value}, 0};
+}
+
+I2CRequest readRequest(I2CPriority priority, int numBytes){
+    return {I2COp::Read, priority, I2C_DIRECT, PCA_ADDR, {}, numBytes};
+}
+
+int main(){
+
+    bool passed = true;
+    std::cout << std::fixed << std::setprecision(1);
+
+    // ~~ Priority order ~~
+    {
+        SimBus bus({I2C_STANDARD_MODE, true});
+        SimPCA9685 model;
+        bus.addDevice(&model, PCA_ADDR);
+        I2C i2c(&bus);
+        i2c.startScheduler(std::chrono::milliseconds(100)); // Longer than the blocker, nothing gets promoted
+
+        // Occupies the bus while the rest queue up, lowest class first
+        std::vector<int> order;
+        std::future<I2CResult> blocker = i2c.submit(readRequest(I2CPriority::Diagnostic, LONG_READ_BYTES));
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        std::vector<std::future<I2CResult>> queued;
+        const I2CPriority classes[] = {I2CPriority::Diagnostic, I2CPriority::Feedback, I2CPriority::Output, I2CPriority::Emergency};
+        for(I2CPriority priority : classes){
+            std::promise<I2CResult>* promise = new std::promise<I2CResult>();
+            queued.push_back(promise->get_future());
+            i2c.submit(priority == I2CPriority::Feedback || priority == I2CPriority::Diagnostic
+                       ? readRequest(priority, 1) : writeRequest(priority, LED0_ON_L, static_cast<uint8_t>(priority))
+                     , [&order, priority, promise](const I2CResult& result){
+                           order.push_back(static_cast<int>(priority));
+                           promise->set_value(result);
+                           delete promise;
+                       });
+        }
+        bool ok = blocker.get().ok;
+        for(auto& result : queued){
+            ok = result.get().ok && ok;
+        }
+        bool ordered = order == std::vector<int>{0, 1, 2, 3};
+        passed = report("Queued requests run emergency, output, feedback, diagnostic", ok && ordered) && passed;
+    }
+
+    // ~~ Coalescing ~~
+    {
+        SimBus bus({I2C_STANDARD_MODE, true});
+        SimPCA9685 model;
+        bus.addDevice(&model, PCA_ADDR);
+        I2C i2c(&bus);
+        i2c.startScheduler(MAX_WAIT);
+
+        uint64_t before = bus.getTransactions();
+        std::future<I2CResult> blocker = i2c.submit(readRequest(I2CPriority::Feedback, LONG_READ_BYTES));
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        std::vector<std::future<I2CResult>> writes;
+        for(int i = 0; i < COALESCED_WRITES; i++){
+            writes.push_back(i2c.submit(writeRequest(I2CPriority::Output, LED0_OFF_L + 4 * 2, 10 + i)));
+        }
+        writes.push_back(i2c.submit(writeRequest(I2CPriority::Output, LED0_OFF_H + 4 * 2, 0x01))); // Other register, not folded
+
+        bool ok = blocker.get().ok;
+        for(auto& result : writes){
+            ok = result.get().ok && ok;
+        }
+        uint64_t transactions = bus.getTransactions() - before - 1; // Without the blocker
+        I2CClassStats stats = i2c.getScheduler()->getStats(I2CPriority::Output);
+        bool folded = transactions == 2 && stats.coalesced == COALESCED_WRITES - 1 && stats.completed == COALESCED_WRITES + 1
+                   && model.getRegister(LED0_OFF_L + 4 * 2) == 10 + COALESCED_WRITES - 1;
+        std::cout << "  " << COALESCED_WRITES + 1 << " writes queued, " << transactions << " reached the bus" << std::endl;
+        passed = report("Back to back writes to one register coalesce to the newest", ok && folded) && passed;
+    }
+
+    // ~~ Bounded wait ~~
+    {
+        SimBus bus({I2C_STANDARD_MODE, true});
+        SimPCA9685 model;
+        bus.addDevice(&model, PCA_ADDR);
+        I2C i2c(&bus);
+        i2c.startScheduler(MAX_WAIT);
+
+        // Keeps the output queue busy until the diagnostic read is done, without aging it would never run
+        std::atomic<bool> flooding{true};
+        std::thread flood([&](){
+            std::deque<std::future<I2CResult>> inFlight;
+            uint8_t value = 0;
+            while(flooding){
+                inFlight.push_back(i2c.submit(writeRequest(I2CPriority::Output, LED0_OFF_L + 4 * (value % 16), value)));
+                value++;
+                if(inFlight.size() > FLOOD_DEPTH){
+                    inFlight.front().wait();
+                    inFlight.pop_front();
+                }
+            }
+            for(auto& result : inFlight){
+                result.wait();
+            }
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+        auto start = std::chrono::steady_clock::now();
+        bool ok = i2c.submit(readRequest(I2CPriority::Diagnostic, 1)).get().ok;
+        std::chrono::nanoseconds waited = std::chrono::steady_clock::now() - start;
+        flooding = false;
+        flood.join();
+
+        // Queued to completed on the bus thread, without the caller's wake up
+        I2CClassStats stats = i2c.getScheduler()->getStats(I2CPriority::Diagnostic);
+        std::chrono::nanoseconds bound = MAX_WAIT + std::chrono::milliseconds(5); // Transfer in flight plus scheduling slack
+        std::cout << "  Diagnostic read behind the flood: " << us(stats.maxLatency) << " us on the bus thread, " << us(waited)
+                  << " us to the caller (maxWait " << us(MAX_WAIT) << " us)" << std::endl;
+        passed = report("Lower classes wait at most maxWait", ok && stats.maxLatency <= bound && stats.promoted == 1) && passed;
+    }
+
+    // ~~ Drivers on two threads ~~
+    {
+        SimBus bus({I2C_STANDARD_MODE, true});
+        SimPCA9685 pcaModel;
+        std::atomic<double> magnet{123.0};
+        SimAS5600 encoderModel([&magnet](){ return magnet.load(); });
+        bus.addMux(MUX_ADDR);
+        bus.addDevice(&pcaModel, PCA_ADDR);
+        bus.addDevice(&encoderModel, AS5600_ADDRESS, ENCODER_CHANNEL);
+        I2C i2c(&bus);
+        i2c.attachMux(MUX_ADDR);
+        i2c.startScheduler(MAX_WAIT);
+
+        PCA9685 pca(&i2c, PCA_ADDR);
+        AS5600 encoder(&i2c, AS5600_CONFIG, ENCODER_CHANNEL);
+        i2c.getScheduler()->resetStats();
+
+        std::atomic<bool> readsOk{true};
+        std::atomic<bool> running{true};
+        std::thread feedback([&](){
+            while(running){
+                uint16_t raw = encoder.getRawStep();
+                if(std::fabs(raw - 123.0 * 4096 / 360) > 1.0){
+                    readsOk = false;
+                }
+            }
+        });
+
+        bool writesOk = true;
+        for(int i = 0; i < LOAD_ITERATIONS; i++){
+            pca.setOffTime(i % 16, 300 + i);
+            uint8_t reg = LED0_OFF_L + 4 * (i % 16);
+            if(pcaModel.getRegister(reg) != ((300 + i) & 0xFF)){
+                writesOk = false;
+            }
+        }
+
+        // Emergency cut while both threads keep the bus busy
+        std::thread output([&](){
+            for(int i = 0; running && i < LOAD_ITERATIONS; i++){
+                pca.setOffTime(i % 16, 300 + i);
+            }
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        auto start = std::chrono::steady_clock::now();
+        bool cut = pca.emergencyOff();
+        std::chrono::nanoseconds cutLatency = std::chrono::steady_clock::now() - start;
+        running = false;
+        output.join();
+        feedback.join();
+
+        I2CScheduler* scheduler = i2c.getScheduler();
+        const char* names[] = {"Emergency", "Output", "Feedback", "Diagnostic"};
+        for(int i = 0; i < I2C_PRIORITIES; i++){
+            I2CClassStats stats = scheduler->getStats(static_cast<I2CPriority>(i));
+            std::cout << "  " << std::setw(10) << names[i] << ": " << stats.completed << " requests, mean " << us(stats.meanLatency)
+                      << " us, max " << us(stats.maxLatency) << " us" << std::endl;
+        }
+
+        // The cut waits behind one transaction on the wire at most (the longest is a 3 byte channel write)
+        std::chrono::nanoseconds bound = bus.transactionTime(3) + bus.transactionTime(2) + std::chrono::milliseconds(1);
+        std::cout << "  Emergency cut under load: " << us(cutLatency) << " us (one transaction " << us(bus.transactionTime(3))
+                  << " us)" << std::endl;
+        passed = report("Drivers share the bus from two threads, emergency cut goes first"
+                      , readsOk && writesOk && cut && cutLatency <= bound) && passed;
+    }
+
+    std::cout << "I2C scheduler: " << (passed ? "Passed!" : "Failed!") << std::endl;
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,195 @@
+/*
+~~ I2C Stats Test ~~
+
+Checks the per-device bus instrumentation on the simulated bus:
+- The latency histogram reports percentiles within its 1/16 bucket precision
+  of the exact ones, from nanoseconds to seconds
+- A PCA9685 and two AS5600s behind the mux get exact transaction, byte and
+  slave switch counts, with the mux channel selects counted on the mux
+- Reads and writes to a missing device count as errors, and the error names
+  the device
+- Recording costs a small fraction of a transaction on the wire
+- The periodic dump prints every device
+*/
+
+#include "i2c.h"
+#include "i2c_stats.h"
+#include "sim_bus.h"
+#include "pca9685.h"
+#include "as5600.h"
+
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+
+// Test Config
+const uint8_t PCA_ADDR = 0x40;
+const uint8_t MISSING_ADDR = 0x41;
+const uint8_t MUX_ADDR = 0x70;
+const uint8_t ENCODER_CHANNELS[2] = {2, 3};
+const uint16_t AS5600_CONFIG = 0x000C;
+const int HISTOGRAM_VALUES = 100000;
+const int ITERATIONS = 50;
+const int RECORD_CALLS = 1000000;
+const int DUMP_PERIOD_MS = 20;
+
+bool report(const std::string& name, bool passed){
+    std::cout << name << ": " << (passed ? "Passed!" : "Failed!") << std::endl;
+    return passed;
+}
+
+double us(std::chrono::nanoseconds duration){
+    return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+// Counters of one device in a snapshot, nullptr if it was never addressed
+const I2CDeviceStats* find(const std::vector<I2CDeviceStats>& devices, uint8_t channel, uint8_t address){
+    for(const I2CDeviceStats& device : devices){
+        if(device.channel == channel && device.address == address){
+            return &device;
+        }
+    }
+    return nullptr;
+}
+
+bool counts(const I2CDeviceStats* device, uint64_t transactions, uint64_t written, uint64_t read, uint64_t switches){
+    return device && device->transactions == transactions && device->bytesWritten == written && device->bytesRead == read
+        && device->slaveSwitches == switches && device->errors == 0;
+}
+
+int main(){
+
+    bool passed = true;
+    std::cout << std::fixed << std::setprecision(3);
+
+#if !I2C_STATS
+    std::cout << "Built with I2C_STATS=0, nothing to test" << std::endl;
+    std::cout << "I2C stats: Passed!" << std::endl;
+    return 0;
+#else
+
+    // ~~ Histogram precision ~~
+    {
+        // Log-uniform from 1 ns to 10 s
+        std::mt19937_64 random(7);
+        std::uniform_real_distribution<double> exponent(0.0, 10.0);
+        LatencyHistogram histogram;
+        std::vector<int64_t> values;
+        int64_t total = 0;
+        for(int i = 0; i < HISTOGRAM_VALUES; i++){
+            int64_t value = static_cast<int64_t>(std::pow(10.0, exponent(random)));
+            values.push_back(value);
+            total += value;
+            histogram.record(std::chrono::nanoseconds(value));
+        }
+        std::sort(values.begin(), values.end());
+
+        double worst = 0.0;
+        const double percentiles[] = {1, 10, 50, 90, 99, 99.9};
+        for(double percentile : percentiles){
+            int64_t exact = values[static_cast<size_t>(std::ceil(percentile / 100.0 * values.size())) - 1];
+            int64_t reported = histogram.getPercentile(percentile).count();
+            worst = std::max(worst, std::fabs(static_cast<double>(reported - exact)) / exact);
+        }
+        bool exact = histogram.getCount() == HISTOGRAM_VALUES && histogram.getMin().count() == values.front()
+                  && histogram.getMax().count() == values.back() && histogram.getMean().count() == total / HISTOGRAM_VALUES;
+        std::cout << "  Worst percentile error " << worst * 100.0 << " % (bucket precision 6.25 %)" << std::endl;
+        passed = report("Histogram percentiles within a bucket, exact count, min, max and mean", exact && worst <= 1.0 / 16) && passed;
+    }
+
+    // ~~ Per-device counters ~~
+    {
+        SimBus bus({I2C_FAST_MODE, true});
+        SimPCA9685 pcaModel;
+        SimAS5600 encoderModels[2] = {SimAS5600([](){ return 10.0; }), SimAS5600([](){ return 20.0; })};
+        bus.addMux(MUX_ADDR);
+        bus.addDevice(&pcaModel, PCA_ADDR);
+        bus.addDevice(&encoderModels[0], AS5600_ADDRESS, ENCODER_CHANNELS[0]);
+        bus.addDevice(&encoderModels[1], AS5600_ADDRESS, ENCODER_CHANNELS[1]);
+        I2C i2c(&bus);
+        i2c.attachMux(MUX_ADDR);
+
+        PCA9685 pca(&i2c, PCA_ADDR);
+        AS5600 first(&i2c, AS5600_CONFIG, ENCODER_CHANNELS[0]);
+        AS5600 second(&i2c, AS5600_CONFIG, ENCODER_CHANNELS[1]);
+        i2c.resetStats();
+
+        // Per iteration: two PCA9685 register writes, then two register reads from each encoder
+        for(int i = 0; i < ITERATIONS; i++){
+            pca.setOffTime(0, 300 + i);
+            first.getRawStep();
+            second.getRawStep();
+        }
+
+        std::vector<I2CDeviceStats> devices = i2c.getStats();
+        I2CStats::print(devices, std::cout);
+        const I2CDeviceStats* encoder = find(devices, ENCODER_CHANNELS[0], AS5600_ADDRESS);
+        bool exact = devices.size() == 4
+                  && counts(find(devices, I2C_DIRECT, PCA_ADDR), 2 * ITERATIONS, 4 * ITERATIONS, 0, ITERATIONS)
+                  && counts(find(devices, I2C_DIRECT, MUX_ADDR), 2 * ITERATIONS, 2 * ITERATIONS, 0, 2 * ITERATIONS)
+                  && counts(encoder, 2 * ITERATIONS, 2 * ITERATIONS, 2 * ITERATIONS, ITERATIONS)
+                  && counts(find(devices, ENCODER_CHANNELS[1], AS5600_ADDRESS), 2 * ITERATIONS, 2 * ITERATIONS, 2 * ITERATIONS, ITERATIONS);
+        passed = report("Transactions, bytes and slave switches counted per device", exact) && passed;
+
+        // A register read is a pointer write and a read on the wire
+        std::chrono::nanoseconds modeled = bus.transactionTime(1) + bus.transactionTime(1);
+        std::chrono::nanoseconds median = encoder ? encoder->readLatency.getPercentile(50) : std::chrono::nanoseconds(0);
+        std::cout << "  Encoder register read p50 " << us(median) << " us (modeled " << us(modeled) << " us)" << std::endl;
+        passed = report("Read latency covers the time on the wire", encoder && encoder->writeLatency.getCount() == 0
+                                                                  && median >= modeled * 15 / 16) && passed;
+
+        // Missing device, not acknowledged
+        I2CResult missing = i2c.submit({I2COp::Read, I2CPriority::Feedback, I2C_DIRECT, MISSING_ADDR, {}, 1}).get();
+        uint8_t data[2] = {0x00, 0x00};
+        I2CResult refused = i2c.submit({I2COp::Write, I2CPriority::Output, I2C_DIRECT, MISSING_ADDR, {data, data + 2}, 0}).get();
+        const I2CDeviceStats* absent = find(i2c.getStats(), I2C_DIRECT, MISSING_ADDR);
+        bool errors = !missing.ok && !refused.ok && absent && absent->errors == 2 && absent->transactions == 2
+                   && missing.error.find("0x41") != std::string::npos;
+        std::cout << "  " << missing.error << std::endl;
+        passed = report("Missing device counts errors, the error names the device", errors) && passed;
+
+        // Periodic dump
+        std::ostringstream out;
+        {
+            I2CStatsDump dump(&i2c, std::chrono::milliseconds(DUMP_PERIOD_MS), out);
+            std::this_thread::sleep_for(std::chrono::milliseconds(3 * DUMP_PERIOD_MS + DUMP_PERIOD_MS / 2));
+        }
+        std::string dumped = out.str();
+        size_t dumps = 0;
+        for(size_t at = dumped.find("I2C bus statistics"); at != std::string::npos; at = dumped.find("I2C bus statistics", at + 1)){
+            dumps++;
+        }
+        bool listed = dumped.find(" 0x40 ") != std::string::npos && dumped.find(" 0x36 ") != std::string::npos
+                   && dumped.find(" 0x70 ") != std::string::npos && dumped.find(" 0x41 ") != std::string::npos;
+        std::cout << "  " << dumps << " dumps in " << 3 * DUMP_PERIOD_MS + DUMP_PERIOD_MS / 2 << " ms" << std::endl;
+        passed = report("Periodic dump lists every device", dumps >= 2 && dumps <= 4 && listed) && passed;
+    }
+
+    // ~~ Overhead ~~
+    {
+        I2CStats stats;
+        auto start = std::chrono::steady_clock::now();
+        for(int i = 0; i < RECORD_CALLS; i++){
+            stats.record(i & 1 ? I2C_DIRECT : 2, i & 1 ? PCA_ADDR : AS5600_ADDRESS, i & 1, 2, 0, true, false
+                       , std::chrono::nanoseconds(50000 + i % 1000));
+        }
+        std::chrono::nanoseconds perRecord = (std::chrono::steady_clock::now() - start) / RECORD_CALLS;
+
+        SimBus bus({I2C_FAST_MODE, false});
+        std::chrono::nanoseconds transaction = bus.transactionTime(2);
+        std::cout << "  " << perRecord.count() << " ns per record, " << 100.0 * perRecord.count() / transaction.count()
+                  << " % of a 2 byte transaction at 400 kHz" << std::endl;
+        passed = report("Recording costs under 1 % of a transaction", stats.snapshot().size() == 2 && perRecord * 100 < transaction) && passed;
+    }
+
+    std::cout << "I2C stats: " << (passed ? "Passed!" : "Failed!") << std::endl;
+    return passed ? 0 : 1;
+#endif
+}
@@ -0,0 +1,174 @@
+/*
+~~ Joint Control Test ~~
+
+Drives a Servo through a SimPCA9685 into a SimServo with a nonlinear, offset
+pulse -> angle map, a dead band and a first-order lag, and reads it back
+through a SimAS5600 on the same SimBus (4096 step quantization plus noise).
+The board runs 333 Hz frames so the servo picks up pulses about as often as
+the loop updates. Runs the same moves open loop and with a JointController
+closing the loop, and compares tracking error during the ramp and error
+after settling.
+*/
+
+#include "i2c.h"
+#include "sim_bus.h"
+#include "pca9685.h"
+#include "as5600.h"
+#include "servo.h"
+#include "motion.h"
+#include "joint_controller.h"
+#include "calibration.h"
+
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <iostream>
+#include <iomanip>
+
+// Test Config
+const uint8_t PCA_ADDR = 0x40;
+const uint8_t CHANNEL = 0;
+const uint16_t MIN_PULSE = 500;
+const uint16_t MAX_PULSE = 2500;
+const float MAX_ANGLE = 270.0f;
+const float START_ANGLE = 90.0f;
+const float SPEED = 60.0f;                // deg/s
+const float RESOLUTION = 5.0f;            // updates/degree
+const int PWM_RATE = 333;                 // Hz, the servo picks up a new pulse every frame
+
+// Plant
+const float PLANT_TAU = 0.04f;            // First-order lag (s)
+const float PLANT_MAX_SPEED = 1000.0f;    // deg/s, well above SPEED so the lag dominates
+const float PLANT_DEAD_BAND = 0.5f;       // Servo ignores commands closer than this (degrees)
+const double ENCODER_NOISE = 0.03;        // degrees
+
+const ControllerParams GAINS = {0.6f, 8.0f, 0.04f, 15.0f, 0.002f, 0.3f, 0.05f, 0.5f};
+
+// Nonlinear, offset map from pulse to the angle the servo actually reaches
+CalibrationCurve plantMap(){
+    std::vector<float> pulses, angles;
+    for(float pulse = MIN_PULSE; pulse <= MAX_PULSE; pulse += 10.0f){
+        double nominal = (pulse - MIN_PULSE) * MAX_ANGLE / (MAX_PULSE - MIN_PULSE);
+        pulses.push_back(pulse);
+        angles.push_back(static_cast<float>(0.96 * nominal + 3.0 + 4.0 * std::sin(nominal * M_PI / 180.0)));
+    }
+    return CalibrationCurve(pulses, angles);
+}
+
+struct Result{
+    double rampRms;     // Tracking error against the ramp while moving
+    double finalError;  // Error once the move has completed
+    double settleMs;    // Move start to completion
+};
+
+// Moves and samples the true angle against the reference ramp
+Result runMove(Servo& servo, SimServo& plant, float from, float to){
+
+    std::atomic<bool> moving(true);
+    double sumSquares = 0.0;
+    int samples = 0;
+    auto start = std::chrono::steady_clock::now();
+    double rampTime = std::fabs(to - from) / SPEED;
+
+    std::thread monitor([&]{
+        while(moving){
+            double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if(t < rampTime){
+                double reference = from + (to > from ? 1.0 : -1.0) * SPEED * t;
+                double error = plant.getAngle() - reference;
+                sumSquares += error * error;
+                samples++;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+
+    servo.moveToPosition(to).wait();
+    double settleMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    moving = false;
+    monitor.join();
+
+    // Let the plant finish its lag before judging the final error
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    return {std::sqrt(sumSquares / std::max(samples, 1)), std::fabs(plant.getAngle() - to), settleMs};
+}
+
+Result runMoves(Servo& servo, SimServo& plant){
+    Result total = {0.0, 0.0, 0.0};
+    const float moves[3][2] = {{90.0f, 150.0f}, {150.0f, 60.0f}, {60.0f, 200.0f}};
+    for(const auto& move : moves){
+        Result result = runMove(servo, plant, move[0], move[1]);
+        total.rampRms = std::max(total.rampRms, result.rampRms);
+        total.finalError = std::max(total.finalError, result.finalError);
+        total.settleMs = std::max(total.settleMs, result.settleMs);
+    }
+    return total;
+}
+
+void print(const std::string& name, const Result& result){
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << name << ": worst ramp RMS error " << result.rampRms << " deg, worst final error "
+              << result.finalError << " deg, slowest move " << result.settleMs << " ms" << std::endl;
+}
+
+int main(){
+
+    MotionEngine engine{std::chrono::microseconds(2000)};
+    ServoParams params = {nullptr, CHANNEL, MIN_PULSE, MAX_PULSE, MAX_ANGLE, START_ANGLE, SPEED, RESOLUTION, &engine};
+    ServoCalibration map(plantMap());
+    const SimServoParams plantParams = {MIN_PULSE, MAX_PULSE, MAX_ANGLE, PLANT_MAX_SPEED, PLANT_TAU, &map, PLANT_DEAD_BAND};
+
+    // Open loop
+    Result open;
+    {
+        SimBus bus({I2C_FAST_MODE, true});
+        SimPCA9685 pcaModel;
+        bus.addDevice(&pcaModel, PCA_ADDR);
+        I2C i2c(&bus);
+        PCA9685 pca(&i2c, PCA_ADDR, PCA9685::prescalerFor(PWM_RATE));
+        SimServo plant(&pcaModel, CHANNEL, plantParams, START_ANGLE);
+        params.pca9685 = &pca;
+        Servo servo(params);
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        open = runMoves(servo, plant);
+        servo.moveToPosition(START_ANGLE).wait();
+    }
+
+    // Closed loop, reading the horn through an AS5600 on the same bus
+    Result closed;
+    bool settled;
+    {
+        SimBus bus({I2C_FAST_MODE, true});
+        SimPCA9685 pcaModel;
+        SimServo plant(&pcaModel, CHANNEL, plantParams, START_ANGLE);
+        SimAS5600 encoderModel([&plant](){ return plant.getAngle(); }, ENCODER_NOISE * 4096.0 / 360.0, 7);
+        bus.addDevice(&pcaModel, PCA_ADDR);
+        bus.addDevice(&encoderModel, AS5600_ADDRESS);
+        I2C i2c(&bus);
+        PCA9685 pca(&i2c, PCA_ADDR, PCA9685::prescalerFor(PWM_RATE));
+        AS5600 encoder(&i2c, 0x000C);
+        params.pca9685 = &pca;
+        Servo servo(params);
+        JointController controller(GAINS);
+        servo.setFeedback(&controller, [&encoder](float& angle){
+            angle = encoder.getRawStep() * 360.0f / 4096.0f; // Raw angle, the magnet reads the horn angle
+            return true;
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        closed = runMoves(servo, plant);
+        settled = servo.atTarget();
+        servo.setFeedback(nullptr, nullptr);
+        servo.moveToPosition(START_ANGLE).wait();
+    }
+
+    print("Open loop  ", open);
+    print("Closed loop", closed);
+
+    bool passed = settled && closed.finalError < GAINS.settleTolerance + 0.2 && closed.finalError < open.finalError
+                  && closed.rampRms < open.rampRms;
+    std::cout << "Closed loop improves tracking and settles at target: " << (passed ? "Passed!" : "Failed!") << std::endl;
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,139 @@
+#include "kinematics.h"
+#include "config.h"
+
+#include <chrono> // For benchmarking
+#include <cmath>
+#include <random>
+#include <iostream>
+#include <iomanip>
+
+// Test Config
+const int NUM_POSES = 2000;        // Random poses for the closed form/cold start tests
+const int PATH_STEPS = 2000;       // Ticks along the warm start path
+const float PATH_STEP_SIZE = 0.2f; // mm per tick along the path
+const float MIN_CLOSED_FORM_RATE = 0.8f;  // Closed form misses poses it has no branch for
+const float MIN_COLD_START_RATE = 0.25f;  // Cold starts from mid-range often stall in a local minimum
+
+// Joint limits matching RoboticArmBuilder (servo range shifted by each joint's offset)
+const float JOINT_OFFSET[NUM_JOINTS] = {J1S_DEF_ANGLE, 90.0 + J2S_DEF_ANGLE, J3S_DEF_ANGLE
+                                      , J4S_DEF_ANGLE, J5S_DEF_ANGLE, J6S_DEF_ANGLE};
+const float MAX_ANGLE[NUM_JOINTS] = {J1S_MAX_ANGLE, J2S_MAX_ANGLE, J3S_MAX_ANGLE
+                                   , J4S_MAX_ANGLE, J5S_MAX_ANGLE, J6S_MAX_ANGLE};
+
+// Accumulates solver statistics
+struct Stats{
+    int solves = 0;
+    int converged = 0;
+    long iterations = 0;
+    double micros = 0.0;
+
+    void add(const IKResult& result, double elapsed){
+        solves++;
+        converged += (result.status == IKStatus::Converged);
+        iterations += result.iterations;
+        micros += elapsed;
+    }
+
+    void print(const std::string& name){
+        std::cout << std::fixed << std::setprecision(2);
+        std::cout << name << ": " << converged << "/" << solves << " converged, "
+                  << static_cast<double>(iterations) / solves << " iterations/solve, "
+                  << micros / solves << " us/solve" << std::endl;
+    }
+};
+
+// Times a single solve in microseconds
+double timeSolve(Kinematics& kinematics, IKMode mode, const Position& position, const Quaternion& orientation, float theta[NUM_JOINTS], IKResult& result){
+    auto start = std::chrono::steady_clock::now();
+    result = kinematics.solve(mode, position, orientation, theta);
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::micro>(end - start).count();
+}
+
+int main(){
+
+    float lower[NUM_JOINTS];
+    float upper[NUM_JOINTS];
+    for(int i = 0; i < NUM_JOINTS; i++){
+        lower[i] = -JOINT_OFFSET[i] * M_PI / 180.0;
+        upper[i] = (MAX_ANGLE[i] - JOINT_OFFSET[i]) * M_PI / 180.0;
+    }
+
+    Kinematics kinematics(lower, upper);
+    std::mt19937 rng(7);
+    bool passed = true;
+
+    // ~~ Random reachable poses: closed form vs cold-started numerical ~~
+
+    Stats closedForm, cold;
+    float theta[NUM_JOINTS];
+    IKResult result;
+
+    for(int n = 0; n < NUM_POSES; n++){
+
+        // Random elbow-up configuration away from the wrist singularity
+        float truth[NUM_JOINTS];
+        for(int i = 0; i < NUM_JOINTS; i++){
+            std::uniform_real_distribution<float> joint(lower[i], upper[i]);
+            truth[i] = joint(rng);
+        }
+        truth[2] = std::uniform_real_distribution<float>(0.1f, std::min(upper[2], 3.0f))(rng);
+        truth[4] = std::uniform_real_distribution<float>(0.2f, std::min(upper[4], 2.9f))(rng);
+
+        Position position;
+        Quaternion orientation;
+        kinematics.forward(truth, position, orientation);
+
+        closedForm.add(result, timeSolve(kinematics, IKMode::ClosedForm, position, orientation, theta, result));
+
+        float middle[NUM_JOINTS];
+        for(int i = 0; i < NUM_JOINTS; i++){
+            middle[i] = (lower[i] + upper[i]) / 2.0f;
+        }
+        kinematics.setWarmStart(middle);
+        cold.add(result, timeSolve(kinematics, IKMode::Numerical, position, orientation, theta, result));
+    }
+
+    closedForm.print("Closed form");
+    cold.print("Numerical (cold start)");
+    if(closedForm.converged < MIN_CLOSED_FORM_RATE * closedForm.solves || cold.converged < MIN_COLD_START_RATE * cold.solves){
+        passed = false;
+    }
+
+    // ~~ Smooth path: warm-started numerical ~~
+
+    Stats warm;
+    float start[NUM_JOINTS] = {0.2f, 0.3f, 1.2f, 0.5f, 1.0f, 0.3f};
+    Position position;
+    Quaternion orientation;
+    kinematics.forward(start, position, orientation);
+    kinematics.setWarmStart(start);
+
+    for(int n = 0; n < PATH_STEPS; n++){
+        position.x += PATH_STEP_SIZE * cos(n * 0.01f);
+        position.y += PATH_STEP_SIZE * sin(n * 0.01f);
+        warm.add(result, timeSolve(kinematics, IKMode::Numerical, position, orientation, theta, result));
+    }
+    warm.print("Numerical (warm start)");
+    if(warm.converged != warm.solves){
+        passed = false;
+    }
+
+    // ~~ Out of reach: Auto must fall back and never hand out NaNs ~~
+
+    Position unreachable = {1000.0f, 0.0f, 200.0f};
+    double elapsed = timeSolve(kinematics, IKMode::Auto, unreachable, orientation, theta, result);
+    bool finite = true;
+    for(int i = 0; i < NUM_JOINTS; i++){
+        finite = finite && std::isfinite(theta[i]);
+    }
+    std::cout << "Out of reach: " << (result.numerical ? "numerical fallback" : "closed form")
+              << ", status " << static_cast<int>(result.status) << ", " << result.iterations << " iterations, "
+              << elapsed << " us, position error " << result.positionError << "mm" << std::endl;
+    if(!finite || !result.numerical || result.status == IKStatus::Converged){
+        passed = false;
+    }
+
+    std::cout << (passed ? "Passed!" : "Failed!") << std::endl;
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,198 @@
+/*
+~~ Multi Servo Calibrator Test ~~
+
+Calibrates five simulated servos (sim_plant.h) at once through one SimBus
+carrying a SimPCA9685 and a TCA9548A mux with a SimAS5600 on each of its
+channels. Servo i follows the measured rising/falling curves of sample_S(i+1)
+with backlash, 20 ms frame pickup, lag and encoder noise.
+
+Checks that every servo's endpoints and curves match its own simulated
+servo (so channels and encoders are not crossed), that the combined CSV
+reads back per channel, that a channel -> encoder map reusing an encoder is
+refused, and that the run takes little longer than the slowest servo alone
+instead of the sum of all of them.
+
+Run from the repository root so the sample paths resolve.
+*/
+
+#include "i2c.h"
+#include "sim_bus.h"
+#include "sim_plant.h"
+#include "pca9685.h"
+#include "as5600.h"
+#include "calibration.h"
+#include "servo_calibrator.h"
+
+#include <cmath>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <stdexcept>
+#include <iostream>
+#include <iomanip>
+
+// Test Config
+const uint8_t PCA_ADDR = 0x40;
+const uint8_t MUX_ADDR = 0x70;
+const float TICK_US_PER_STEP = 122.0f / 25.0f; // PCA9685 step size at the default prescaler (us)
+const char* COMBINED_FILE = "multi_calibrator_test.csv";
+
+// Servo i: sample it follows, PCA9685 channel, encoder mux channel, start pulse (middle of its config range)
+const int NUM_SERVOS = 5;
+const char* PLANT_SAMPLES[NUM_SERVOS] = {
+    "samples/sample_S1.csv", "samples/sample_S2.csv", "samples/sample_S3.csv",
+    "samples/sample_S4.csv", "samples/sample_S5.csv",
+};
+const uint8_t SERVO_CHANNELS[NUM_SERVOS] = {0, 1, 4, 5, 6};
+const uint8_t ENCODER_CHANNELS[NUM_SERVOS] = {2, 0, 1, 4, 3}; // Deliberately not in servo order
+const float START_PULSES[NUM_SERVOS] = {1602.5f, 1595.0f, 1597.5f, 1595.0f, 1587.5f};
+
+// Fitted curves against the simulated ones (deg), looser than servo_calibrator_test for the steeper S3/S4
+// (a crossed channel or encoder is off by tens of degrees)
+const double CURVE_RMS = 0.75;
+
+// Parallel run against the slowest servo's own time
+const double MAX_OVERHEAD = 1.25;
+
+const CalibratorParams PARAMS = PLANT_PARAMS; // startPulse per servo
+
+// Pulse where a curve leaves its end stop value by more than tolerance, scanning from one end
+float departure(const CalibrationCurve& curve, bool fromLow, float tolerance){
+    float end = fromLow ? curve.angleAt(curve.getMinPulse()) : curve.angleAt(curve.getMaxPulse());
+    float pulse = fromLow ? curve.getMinPulse() : curve.getMaxPulse();
+    while(std::fabs(curve.angleAt(pulse) - end) <= tolerance){
+        pulse += fromLow ? 1.0f : -1.0f;
+    }
+    return pulse;
+}
+
+// RMS difference between a fitted curve and the truth over the fitted range
+double compare(const CalibrationCurve& fitted, const CalibrationCurve& truth, float offset){
+    double squares = 0.0;
+    int count = 0;
+    for(float pulse = fitted.getMinPulse(); pulse <= fitted.getMaxPulse(); pulse += 1.0f){
+        double error = fitted.angleAt(pulse) - (truth.angleAt(pulse) - offset);
+        squares += error * error;
+        count++;
+    }
+    return std::sqrt(squares / count);
+}
+
+bool report(const std::string& name, bool passed){
+    std::cout << name << ": " << (passed ? "Passed!" : "Failed!") << std::endl;
+    return passed;
+}
+
+int main(){
+
+    bool passed = true;
+    std::cout << std::fixed << std::setprecision(3);
+
+    std::vector<ServoCalibration> truths;
+    for(const char* path : PLANT_SAMPLES){
+        truths.push_back(ServoCalibration::fromSweepCsv(path));
+    }
+
+    SimBus bus({I2C_FAST_MODE, true});
+    SimPCA9685 pcaModel;
+    bus.addDevice(&pcaModel, PCA_ADDR);
+    bus.addMux(MUX_ADDR);
+    std::vector<std::unique_ptr<SimPlant>> plants;
+    for(int i = 0; i < NUM_SERVOS; i++){
+        plants.emplace_back(new SimPlant(&pcaModel, SERVO_CHANNELS[i], &truths[i], START_PULSES[i], 11 + i));
+        bus.addDevice(&plants[i]->getEncoder(), AS5600_ADDRESS, ENCODER_CHANNELS[i]);
+    }
+    I2C i2c(&bus);
+    if(!i2c.attachMux(MUX_ADDR)){
+        std::cout << "Failed to attach mux" << std::endl;
+        return 1;
+    }
+    PCA9685 pca(&i2c, PCA_ADDR);
+
+    std::vector<std::unique_ptr<AS5600>> encoders;
+    std::vector<CalibrationTarget> targets;
+    for(int i = 0; i < NUM_SERVOS; i++){
+        encoders.emplace_back(new AS5600(&i2c, 0x000C, ENCODER_CHANNELS[i]));
+        CalibratorParams params = PARAMS;
+        params.startPulse = START_PULSES[i];
+        targets.push_back({SERVO_CHANNELS[i], encoders[i].get(), params});
+    }
+
+    // A map that reads two servos off one encoder is refused
+    std::vector<CalibrationTarget> crossed = targets;
+    crossed[1].encoder = crossed[0].encoder;
+    bool refused = false;
+    try{
+        MultiServoCalibrator invalid(&pca, crossed);
+    }
+    catch(const std::runtime_error& e){
+        refused = true;
+    }
+    passed = report("Shared encoder refused", refused) && passed;
+
+    MultiServoCalibrator calibrator(&pca, targets);
+    calibrator.run();
+
+    // Each servo against its own simulated servo
+    double slowest = 0.0;
+    double total = 0.0;
+    for(int i = 0; i < NUM_SERVOS; i++){
+        if(!calibrator.succeeded(i)){
+            passed = report("Channel " + std::to_string(SERVO_CHANNELS[i]) + " failed (" + calibrator.getError(i) + ")", false);
+            continue;
+        }
+        const ServoCalibrator& servo = calibrator.getCalibrator(i);
+        const ServoCalibration& truth = truths[i];
+
+        float trueMin = departure(truth.getFalling(), true, PARAMS.saturationTolerance);
+        float trueMax = departure(truth.getRising(), false, PARAMS.saturationTolerance);
+        bool endpoints = std::fabs(servo.getMinPulse() - trueMin) <= PARAMS.endpointResolution + TICK_US_PER_STEP
+                      && std::fabs(servo.getMaxPulse() - trueMax) <= PARAMS.endpointResolution + TICK_US_PER_STEP;
+
+        ServoCalibration fitted = servo.getCalibration();
+        float offset = truth.getFalling().angleAt(fitted.getFalling().getMinPulse());
+        double risingRms = compare(fitted.getRising(), truth.getRising(), offset);
+        double fallingRms = compare(fitted.getFalling(), truth.getFalling(), offset);
+        bool curves = risingRms < CURVE_RMS && fallingRms < CURVE_RMS;
+
+        double elapsedS = servo.getElapsed().count() / 1000.0;
+        slowest = std::max(slowest, elapsedS);
+        total += elapsedS;
+
+        bool ok = endpoints && curves;
+        passed = passed && ok;
+        std::cout << "Channel " << static_cast<int>(SERVO_CHANNELS[i]) << " (" << PLANT_SAMPLES[i] << "): endpoints "
+                  << servo.getMinPulse() << " - " << servo.getMaxPulse() << " us (simulated " << trueMin << " - " << trueMax
+                  << "), RMS rising " << risingRms << " falling " << fallingRms << " deg, " << servo.getSamples().size()
+                  << " samples in " << elapsedS << " s: " << (ok ? "Passed!" : "Failed!") << std::endl;
+    }
+
+    // One combined file, read back by channel
+    calibrator.writeCsv(COMBINED_FILE);
+    bool combined = true;
+    for(int i = 0; i < NUM_SERVOS; i++){
+        if(!calibrator.succeeded(i)){
+            continue;
+        }
+        std::vector<SweepSample> read = readSweepCsv(COMBINED_FILE, SERVO_CHANNELS[i]);
+        const std::vector<SweepSample>& taken = calibrator.getCalibrator(i).getSamples();
+        combined = combined && read.size() == taken.size();
+        for(size_t j = 0; combined && j < read.size(); j++){
+            combined = read[j].step == taken[j].step && std::fabs(read[j].pulse - taken[j].pulse) <= 0.5f;
+        }
+    }
+    std::remove(COMBINED_FILE);
+    passed = report("Combined CSV reads back per channel", combined) && passed;
+
+    // Settle waits overlap: the whole run is close to the slowest servo, not the sum
+    double elapsedS = calibrator.getElapsed().count() / 1000.0;
+    bool overlapped = elapsedS <= slowest * MAX_OVERHEAD;
+    passed = passed && overlapped;
+    std::cout << "Time: " << elapsedS << " s for all, slowest servo " << slowest << " s, one after another " << total
+              << " s (" << total / elapsedS << "x): " << (overlapped ? "Passed!" : "Failed!") << std::endl;
+
+    std::cout << "Multi servo calibrator: " << (passed ? "Passed!" : "Failed!") << std::endl;
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,290 @@
+/*
+~~ PCA9685 Router Test ~~
+
+Checks joints routed over several PCA9685 boards on a simulated bus:
+- Routes map joints to (board, channel), repeated addresses, unknown boards and
+  channels already in use are rejected
+- Staged off times go out as one auto-increment burst per run of neighbouring
+  channels, keeping the ON times that were written before and leaving the
+  channels in between alone
+- With an all-call address sleep and wake reach every board in one write (board
+  by board once their MODE1s differ), all-off cuts every channel in one write,
+  and a sub-address reaches only the boards given it
+- Servos on two boards driven by a motion engine with the router's flush reach
+  their targets with half the transactions of servos writing their own outputs
+- Benchmark: bus time and transactions of one control tick against the number
+  of boards, six joints per board on the arm's channels
+*/
+
+#include "pca9685_router.h"
+#include "sim_bus.h"
+#include "servo.h"
+#include "motion.h"
+#include "clock.h"
+
+#include <cmath>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <stdexcept>
+#include <functional>
+
+// Test Config
+const uint8_t FIRST_ADDR = 0x40;
+const uint8_t ALL_CALL_ADDR = 0x6F;
+const uint8_t GROUP_ADDR = 0x6E;
+const uint8_t LED0_OFF_L = 0x08;
+const uint8_t ARM_CHANNELS[6] = {0, 1, 4, 5, 6, 8}; // As config.h routes the arm
+const int BENCH_BOARDS[4] = {1, 2, 4, 8};
+const float START_ANGLE = 90.0f;
+const float TARGET_ANGLE = 150.0f;
+
+bool report(const std::string& name, bool passed){
+    std::cout << name << ": " << (passed ? "Passed!" : "Failed!") << std::endl;
+    return passed;
+}
+
+double us(std::chrono::nanoseconds duration){
+    return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+uint16_t offTimeOf(SimPCA9685& model, int channel){
+    return model.getRegister(LED0_OFF_L + 4 * channel) | ((model.getRegister(LED0_OFF_L + 4 * channel + 1) & 0x0F) << 8);
+}
+
+uint16_t onTimeOf(SimPCA9685& model, int channel){
+    return model.getRegister(LED0_ON_L_REG + 4 * channel) | ((model.getRegister(LED0_ON_L_REG + 4 * channel + 1) & 0x0F) << 8);
+}
+
+bool throws(const std::function<void()>& call){
+    try{
+        call();
+    }
+    catch(const std::runtime_error& e){
+        return true;
+    }
+    return false;
+}
+
+// Moves one servo on each of two boards in virtual time, returns the bus transactions the moves took
+uint64_t moveTwoBoards(bool bursts, double& first, double& second){
+
+    VirtualClock clock;
+    SimBus bus({I2C_FAST_MODE, true, &clock});
+    SimPCA9685 models[2];
+    SimServo simServos[2] = {SimServo(&models[0], 3, {500.0f, 2500.0f, 180.0f, 400.0f, 0.01f, nullptr}, START_ANGLE, &clock)
+                           , SimServo(&models[1], 3, {500.0f, 2500.0f, 180.0f, 400.0f, 0.01f, nullptr}, START_ANGLE, &clock)};
+    bus.addDevice(&models[0], FIRST_ADDR);
+    bus.addDevice(&models[1], FIRST_ADDR + 1);
+    I2C i2c(&bus);
+    PCA9685Router router(&i2c);
+    router.addBoard(FIRST_ADDR);
+    router.addBoard(FIRST_ADDR + 1);
+    router.route(0, 0, 3);
+    router.route(1, 1, 3);
+    MotionEngine engine(std::chrono::microseconds(2000), &clock);
+    if(bursts){
+        engine.setOutputFlush([&router]{ return router.flush(); });
+    }
+
+    // Servo constructors print their speed
+    std::ostringstream servoLog;
+    std::streambuf* console = std::cout.rdbuf(servoLog.rdbuf());
+    Servo* servos[2];
+    for(int joint = 0; joint < 2; joint++){
+        servos[joint] = new Servo({router.boardOf(joint), router.channelOf(joint), 500, 2500, 180.0f, START_ANGLE, 200.0f, 5.0f, &engine});
+    }
+    std::cout.rdbuf(console);
+
+    uint64_t before = bus.getTransactions();
+    MotionHandle::whenAll({servos[0]->moveToPosition(TARGET_ANGLE), servos[1]->moveToPosition(TARGET_ANGLE)}).wait();
+    uint64_t transactions = bus.getTransactions() - before;
+    clock.advance(std::chrono::milliseconds(300));
+    first = simServos[0].getAngle();
+    second = simServos[1].getAngle();
+
+    console = std::cout.rdbuf(servoLog.rdbuf());
+    delete servos[0];
+    delete servos[1];
+    std::cout.rdbuf(console);
+    engine.setOutputFlush(nullptr);
+    return transactions;
+}
+
+int main(){
+
+    bool passed = true;
+    std::cout << std::fixed << std::setprecision(1);
+
+    // ~~ Routes ~~
+    {
+        SimBus bus({I2C_FAST_MODE, false});
+        SimPCA9685 models[3];
+        for(int board = 0; board < 3; board++){
+            bus.addDevice(&models[board], FIRST_ADDR + board);
+        }
+        I2C i2c(&bus);
+        PCA9685Router router(&i2c);
+        for(int board = 0; board < 3; board++){
+            router.addBoard(FIRST_ADDR + board);
+        }
+        router.route(0, 0, 0);
+        router.route(7, 2, 15);
+        router.route(3, 1, 0);
+
+        bool mapped = router.getNumBoards() == 3 && router.boardOf(7) == router.getBoard(2) && router.channelOf(7) == 15
+                   && router.boardOf(3)->getAddress() == FIRST_ADDR + 1;
+        bool rejected = throws([&]{ router.addBoard(FIRST_ADDR + 1); }) && throws([&]{ router.route(1, 3, 0); })
+                     && throws([&]{ router.route(1, 2, 15); }) && throws([&]{ router.route(1, 0, 16); })
+                     && throws([&]{ router.boardOf(1); }) && !router.stage(1, 300);
+        passed = report("Joints map to (board, channel), bad routes are rejected", mapped && rejected) && passed;
+    }
+
+    // ~~ Bursts ~~
+    {
+        SimBus bus({I2C_FAST_MODE, false});
+        SimPCA9685 model;
+        bus.addDevice(&model, FIRST_ADDR);
+        I2C i2c(&bus);
+        PCA9685 pca(&i2c, FIRST_ADDR);
+        pca.setOnTime(1, 100);
+
+        // Channels 0 - 2 and 5: two runs
+        uint16_t offTimes[4] = {300, 400, 500, 600};
+        uint8_t channels[4] = {0, 1, 2, 5};
+        for(int i = 0; i < 4; i++){
+            pca.stageOffTime(channels[i], offTimes[i] - 1);
+            pca.stageOffTime(channels[i], offTimes[i]); // The later one wins
+        }
+        uint64_t before = bus.getTransactions();
+        bool flushed = pca.hasStaged() && pca.flush() == I2CStatus::Ok && !pca.hasStaged();
+        uint64_t transactions = bus.getTransactions() - before;
+
+        bool written = true;
+        for(int i = 0; i < 4; i++){
+            written = written && offTimeOf(model, channels[i]) == offTimes[i];
+        }
+        bool kept = onTimeOf(model, 1) == 100 && onTimeOf(model, 0) == 0 && model.getRegister(LED0_OFF_L + 4 * 3 + 1) == 0x10 && !pca.stageOffTime(16, 0);
+        std::cout << "  4 channels in " << transactions << " transactions" << std::endl;
+        passed = report("Staged off times go out as one burst per run", flushed && written && kept && transactions == 2) && passed;
+    }
+
+    // ~~ All-call ~~
+    {
+        SimBus bus({I2C_FAST_MODE, false});
+        SimPCA9685 models[3];
+        for(int board = 0; board < 3; board++){
+            bus.addDevice(&models[board], FIRST_ADDR + board);
+        }
+        I2C i2c(&bus);
+        PCA9685Router router(&i2c);
+        for(int board = 0; board < 3; board++){
+            router.addBoard(FIRST_ADDR + board);
+            router.route(board, board, 2);
+            router.getBoard(board)->setOffTime(2, 300);
+        }
+        router.enableAllCall(ALL_CALL_ADDR);
+
+        // Three MODE1 reads (pointer write, then the byte), then one write
+        uint64_t before = bus.getTransactions();
+        router.sleepAll();
+        uint64_t sleepTransactions = bus.getTransactions() - before;
+        bool asleep = models[0].isSleeping() && models[1].isSleeping() && models[2].isSleeping();
+        router.wakeAll();
+        bool awake = !models[0].isSleeping() && !models[1].isSleeping() && !models[2].isSleeping();
+
+        before = bus.getTransactions();
+        router.allOff();
+        uint64_t offTransactions = bus.getTransactions() - before;
+        bool off = models[0].getPulseWidth(2) == 0.0f && models[1].getPulseWidth(2) == 0.0f && models[2].getPulseWidth(2) == 0.0f;
+
+        // A sub-address on the middle board only, the boards' MODE1s now differ
+        router.getBoard(1)->setSubAddress(1, GROUP_ADDR);
+        router.sleepAll();
+        bool fallback = models[0].isSleeping() && models[1].isSleeping() && models[2].isSleeping();
+        router.wakeAll();
+        for(int board = 0; board < 3; board++){
+            router.getBoard(board)->setOffTime(2, 300);
+        }
+        I2CDevice group = i2c.bindBroadcast(GROUP_ADDR);
+        uint8_t cut[2] = {ALL_LED_OFF_H, 0x10};
+        bool grouped = group.tryWrite(cut) == I2CStatus::Ok && models[1].getPulseWidth(2) == 0.0f
+                    && models[0].getPulseWidth(2) > 0.0f && models[2].getPulseWidth(2) > 0.0f;
+
+        std::cout << "  sleep " << sleepTransactions << " transactions, all-off " << offTransactions << std::endl;
+        passed = report("All-call sleeps, wakes and cuts every board in one write", router.hasAllCall() && asleep && awake && off
+                                                                                  && sleepTransactions == 7 && offTransactions == 1
+                                                                                  && fallback && grouped) && passed;
+    }
+
+    // ~~ Motion engine ~~
+    {
+        double direct[2];
+        double burst[2];
+        uint64_t directTransactions = moveTwoBoards(false, direct[0], direct[1]);
+        uint64_t burstTransactions = moveTwoBoards(true, burst[0], burst[1]);
+        bool reached = std::fabs(direct[0] - TARGET_ANGLE) < 1.0 && std::fabs(direct[1] - TARGET_ANGLE) < 1.0
+                    && std::fabs(burst[0] - TARGET_ANGLE) < 1.0 && std::fabs(burst[1] - TARGET_ANGLE) < 1.0;
+        std::cout << "  two boards: " << directTransactions << " transactions writing each servo, " << burstTransactions
+                  << " with the flush (horns at " << burst[0] << " and " << burst[1] << " deg)" << std::endl;
+        passed = report("Engine ticks flush the servos' outputs together", reached && burstTransactions * 2 <= directTransactions + 2) && passed;
+    }
+
+    // ~~ Benchmark ~~
+    {
+        std::cout << "  boards  joints  per write (tx / us)  bursts (tx / us)" << std::endl;
+        bool faster = true;
+        for(int boards : BENCH_BOARDS){
+            SimBus bus({I2C_FAST_MODE, false});
+            std::vector<SimPCA9685> models(boards);
+            for(int board = 0; board < boards; board++){
+                bus.addDevice(&models[board], FIRST_ADDR + board);
+            }
+            I2C i2c(&bus);
+            PCA9685Router router(&i2c);
+            for(int board = 0; board < boards; board++){
+                router.addBoard(FIRST_ADDR + board);
+                for(int i = 0; i < 6; i++){
+                    router.route(6 * board + i, board, ARM_CHANNELS[i]);
+                }
+            }
+            int joints = 6 * boards;
+
+            // One tick with every joint writing its own off time
+            uint64_t transactions = bus.getTransactions();
+            std::chrono::nanoseconds busTime = bus.getBusTime();
+            for(int joint = 0; joint < joints; joint++){
+                router.boardOf(joint)->trySetOffTime(router.channelOf(joint), 300 + joint);
+            }
+            uint64_t writeTransactions = bus.getTransactions() - transactions;
+            std::chrono::nanoseconds writeTime = bus.getBusTime() - busTime;
+
+            // The same tick staged and flushed
+            transactions = bus.getTransactions();
+            busTime = bus.getBusTime();
+            for(int joint = 0; joint < joints; joint++){
+                router.stage(joint, 400 + joint);
+            }
+            bool flushed = router.flush() == I2CStatus::Ok;
+            uint64_t burstTransactions = bus.getTransactions() - transactions;
+            std::chrono::nanoseconds burstTime = bus.getBusTime() - busTime;
+
+            bool written = true;
+            for(int joint = 0; joint < joints; joint++){
+                written = written && offTimeOf(models[joint / 6], ARM_CHANNELS[joint % 6]) == 400 + joint;
+            }
+            std::cout << "  " << std::setw(6) << boards << "  " << std::setw(6) << joints << "  " << std::setw(8) << writeTransactions
+                      << " / " << std::setw(7) << us(writeTime) << "  " << std::setw(6) << burstTransactions << " / " << std::setw(7)
+                      << us(burstTime) << std::endl;
+            faster = faster && flushed && written && burstTime < writeTime && burstTransactions == 3 * static_cast<uint64_t>(boards)
+                  && writeTransactions == 2 * static_cast<uint64_t>(joints);
+        }
+        passed = report("Bursts take less bus time per tick at every board count", faster) && passed;
+    }
+
+    std::cout << "PCA9685 router: " << (passed ? "Passed!" : "Failed!") << std::endl;
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,237 @@
+/*
+~~ PWM Rate Test ~~
+
+Checks the high-rate PWM mode on a simulated bus:
+- Prescalers for 50, 200 and 333 Hz frames are the ones setPWMFrequency writes,
+  and rates the prescaler cannot reach are refused
+- A servo retimed after its board moved from 50 to 333 Hz drives the same pulse
+  as one built at 333 Hz, within a tick; tables built for another prescaler
+  with no curve to rebuild from are converted instead of dropped
+- A servo whose longest pulse runs into the next frame is refused
+- The arm switched to 333 Hz keeps every joint's pulse, leaves the boards
+  awake, refuses a rate one of its servos does not fit (nothing changes), and
+  a move writes one setpoint per frame where 50 Hz writes several
+
+Then prints the angular resolution of every config.h servo at each frame rate.
+
+Run from the repository root so the sample paths resolve.
+*/
+
+#include "i2c.h"
+#include "sim_bus.h"
+#include "pca9685.h"
+#include "servo.h"
+#include "motion.h"
+#include "clock.h"
+#include "RoboticArmBuilder.h"
+#include "config.h"
+
+#include <cmath>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <stdexcept>
+
+// Test Config
+const uint8_t PCA_ADDR = 0x40;
+const uint8_t SERVO_CHANNEL = 3;
+const int HIGH_RATE = 333;
+const int TOO_FAST = 400; // 2500 us frames, shorter than the arm's longest pulses
+const float MOVE_ANGLE = 60.0f;
+const std::vector<int> REPORT_RATES = {50, 100, 200, 250, 333};
+
+bool report(const std::string& name, bool passed){
+    std::cout << name << ": " << (passed ? "Passed!" : "Failed!") << std::endl;
+    return passed;
+}
+
+double seconds(std::chrono::nanoseconds duration){
+    return std::chrono::duration<double>(duration).count();
+}
+
+// Silences the Servo and arm constructors' prints
+class Quiet
+{
+private:
+    std::ostringstream sink;
+    std::streambuf* console;
+
+public:
+    Quiet() : console(std::cout.rdbuf(sink.rdbuf())) {}
+    ~Quiet(){ std::cout.rdbuf(console); }
+};
+
+ServoParams servoParams(PCA9685* pca, MotionEngine* engine, uint16_t maxPulse = 2500){
+    return {pca, SERVO_CHANNEL, 500, maxPulse, 180.0f, 90.0f, 120.0f, 5.0f, engine, nullptr, nullptr};
+}
+
+int main(){
+
+    bool passed = true;
+    std::cout << std::fixed << std::setprecision(2);
+
+    // ~~ Prescaler ~~
+    {
+        bool refused = false;
+        try{
+            PCA9685::prescalerFor(2000.0f);
+        }
+        catch(const std::runtime_error&){
+            refused = true;
+        }
+        std::cout << "  333 Hz: prescaler " << static_cast<int>(PCA9685::prescalerFor(HIGH_RATE)) << ", "
+                  << PCA9685::stepSizeFor(PCA9685::prescalerFor(HIGH_RATE)) << " us ticks" << std::endl;
+        passed = report("Prescalers for the frame rates", PCA9685::prescalerFor(50) == 0x79 && PCA9685::prescalerFor(200) == 30
+                                                         && PCA9685::prescalerFor(HIGH_RATE) == 17
+                                                         && PCA9685::stepSizeFor(0x79) == 122.0f / 25.0f && refused) && passed;
+    }
+
+    // ~~ Retime ~~
+    {
+        VirtualClock clock;
+        MotionEngine engine(std::chrono::microseconds(MOTION_TICK_PERIOD_US), &clock);
+        float before, retimed, built, converted, tick;
+        {
+            Quiet quiet;
+
+            // Built at 50 Hz, then the board moves to 333 Hz
+            SimBus bus({I2C_FAST_MODE, false, &clock});
+            SimPCA9685 model;
+            bus.addDevice(&model, PCA_ADDR);
+            I2C i2c(&bus);
+            PCA9685 pca(&i2c, PCA_ADDR);
+            Servo servo(servoParams(&pca, &engine));
+            before = model.getPulseWidth(SERVO_CHANNEL);
+            pca.setPWMFrequency(HIGH_RATE);
+            servo.retime();
+            retimed = model.getPulseWidth(SERVO_CHANNEL);
+            tick = pca.getStepSize();
+
+            // Built at 333 Hz
+            SimBus freshBus({I2C_FAST_MODE, false, &clock});
+            SimPCA9685 freshModel;
+            freshBus.addDevice(&freshModel, PCA_ADDR);
+            I2C freshI2c(&freshBus);
+            PCA9685 freshPca(&freshI2c, PCA_ADDR, PCA9685::prescalerFor(HIGH_RATE));
+            Servo fresh(servoParams(&freshPca, &engine));
+            built = freshModel.getPulseWidth(SERVO_CHANNEL);
+
+            // Tables built at 50 Hz handed to a 333 Hz board, with no curve to rebuild them from
+            PulseTable table;
+            table.build([](float angle){ return 500.0f + angle * 2000.0f / 180.0f; }, 180.0f, PCA9685::stepSizeFor(0x79), SERVO_PULSE_TABLE_SIZE);
+            PrebuiltTables tables = {table.getTicks(), table.getTicks(), table.getSize(), PCA9685::stepSizeFor(0x79)};
+            SimBus tablesBus({I2C_FAST_MODE, false, &clock});
+            SimPCA9685 tablesModel;
+            tablesBus.addDevice(&tablesModel, PCA_ADDR);
+            I2C tablesI2c(&tablesBus);
+            PCA9685 tablesPca(&tablesI2c, PCA_ADDR, PCA9685::prescalerFor(HIGH_RATE));
+            ServoParams params = servoParams(&tablesPca, &engine);
+            params.tables = &tables;
+            Servo fromTables(params);
+            converted = tablesModel.getPulseWidth(SERVO_CHANNEL);
+        }
+        std::cout << "  1500 us pulse: " << before << " us at 50 Hz, " << retimed << " us retimed to 333 Hz, " << built
+                  << " us built at 333 Hz, " << converted << " us from 50 Hz tables" << std::endl;
+        passed = report("Retimed servo drives the pulse of one built at 333 Hz", std::fabs(before - 1500.0f) < PCA9685::stepSizeFor(0x79)
+                                                                                 && std::fabs(built - 1500.0f) <= tick
+                                                                                 && std::fabs(retimed - built) <= tick
+                                                                                 && std::fabs(converted - built) <= tick) && passed;
+    }
+
+    // ~~ Frame fit ~~
+    {
+        VirtualClock clock;
+        MotionEngine engine(std::chrono::microseconds(MOTION_TICK_PERIOD_US), &clock);
+        bool refused = false;
+        bool fits = false;
+        {
+            Quiet quiet;
+            SimBus bus({I2C_FAST_MODE, false, &clock});
+            SimPCA9685 model;
+            bus.addDevice(&model, PCA_ADDR);
+            I2C i2c(&bus);
+            PCA9685 pca(&i2c, PCA_ADDR, PCA9685::prescalerFor(TOO_FAST));
+            try{
+                Servo servo(servoParams(&pca, &engine, 2800));
+            }
+            catch(const std::runtime_error&){
+                refused = true;
+            }
+            Servo servo(servoParams(&pca, &engine, 2300));
+            fits = servo.resolutionAt(pca.getPrescaler()).fits && !servo.resolutionAt(PCA9685::prescalerFor(500)).fits;
+        }
+        passed = report("Pulses running into the next frame are refused", refused && fits) && passed;
+    }
+
+    // ~~ Arm ~~
+    {
+        VirtualClock clock;
+        SimBus bus({I2C_FAST_MODE, true, &clock});
+        SimPCA9685 model;
+        bus.addDevice(&model, PCA9685_SLAVE_ADDR);
+        const uint8_t channels[NUM_JOINTS] = {J1S_CHANNEL, J2S_CHANNEL, J3S_CHANNEL, J4S_CHANNEL, J5S_CHANNEL, J6S_CHANNEL};
+
+        float low[NUM_JOINTS], high[NUM_JOINTS];
+        uint64_t writes[2];
+        double frames[2];
+        uint8_t prescaler = 0;
+        bool awake = false;
+        bool refused = false;
+        std::ostringstream resolution;
+        {
+            Quiet quiet;
+            RoboticArmBuilder arm(&bus, &clock);
+
+            // Output writes of a move, and the frames it took
+            auto move = [&](float angle, int rate){
+                uint64_t transactions = bus.getTransactions();
+                Clock::TimePoint start = clock.now();
+                arm.setAngle(0, angle);
+                writes[rate] = bus.getTransactions() - transactions;
+                frames[rate] = seconds(clock.now() - start) * 1e6 / (4096.0 * PCA9685::stepSizeFor(model.getRegister(PRESCALE_REG)));
+            };
+
+            for(int i = 0; i < NUM_JOINTS; i++){
+                low[i] = model.getPulseWidth(channels[i]);
+            }
+            move(J1S_DEF_ANGLE - MOVE_ANGLE, 0);
+            arm.setAngle(0, J1S_DEF_ANGLE);
+
+            arm.setPWMFrequency(HIGH_RATE);
+            for(int i = 0; i < NUM_JOINTS; i++){
+                high[i] = model.getPulseWidth(channels[i]);
+            }
+            prescaler = model.getRegister(PRESCALE_REG);
+            awake = !model.isSleeping();
+            move(J1S_DEF_ANGLE - MOVE_ANGLE, 1);
+
+            try{
+                arm.setPWMFrequency(TOO_FAST);
+            }
+            catch(const std::runtime_error&){
+                refused = model.getRegister(PRESCALE_REG) == prescaler;
+            }
+            arm.reportResolution(resolution, REPORT_RATES);
+        }
+
+        bool kept = true;
+        for(int i = 0; i < NUM_JOINTS; i++){
+            kept = kept && low[i] > 0.0f && std::fabs(high[i] - low[i]) <= PCA9685::stepSizeFor(0x79);
+        }
+        std::cout << "  " << MOVE_ANGLE << " degree move: " << writes[0] << " output writes over " << frames[0] << " frames at 50 Hz, "
+                  << writes[1] << " over " << frames[1] << " frames at " << HIGH_RATE << " Hz" << std::endl;
+        passed = report("Arm switches to 333 Hz frames, one setpoint per frame", kept && prescaler == PCA9685::prescalerFor(HIGH_RATE) && awake
+                                                                                && writes[0] > 2 * frames[0]
+                                                                                && std::fabs(writes[1] - frames[1]) < 0.1 * frames[1]) && passed;
+        passed = report("A rate the arm's pulses do not fit changes nothing", refused) && passed;
+
+        // ~~ Resolution report ~~
+        std::cout << std::endl << "Angular resolution of the config.h servos:" << std::endl << resolution.str() << std::endl;
+    }
+
+    std::cout << "PWM rate: " << (passed ? "Passed!" : "Failed!") << std::endl;
+    return passed ? 0 : 1;
+}
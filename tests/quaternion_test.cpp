@@ -0,0 +1,184 @@
+/*
+~~ Quaternion Test ~~
+
+Checks the end effector orientation math:
+- Quaternion -> Z-Y-Z Euler -> quaternion gives back the same rotation, for
+  random orientations and next to the wrist singularity (pitch ~0 and ~180)
+- Euler -> quaternion -> Euler gives back the angles away from the singularity
+- The rotation matrix is orthonormal (unit columns, orthogonal, det +1) and
+  matches a known yaw
+- SlerpPath starts next to the start, lands exactly on the target, steps in
+  equal angles along slerp(), and takes the short way round when q.p < 0
+*/
+
+#include "quaternion.h"
+
+#include <cmath>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <iostream>
+#include <iomanip>
+
+// Test Config
+const int NUM_ORIENTATIONS = 10000;  // Random orientations per check
+const int PATH_STEPS = 50;           // Steps along each SlerpPath
+const int NUM_PATHS = 200;
+const float ANGLE_TOLERANCE = 1e-5f; // Radians
+const float MATRIX_TOLERANCE = 1e-5f;
+
+bool report(const std::string& name, bool passed){
+    std::cout << name << ": " << (passed ? "Passed!" : "Failed!") << std::endl;
+    return passed;
+}
+
+// Angle of the rotation between two orientations (q and -q are the same rotation)
+// From the relative rotation's vector part, acos of the dot product is too coarse near 1
+float angleBetween(const Quaternion& a, const Quaternion& b){
+    Quaternion relative = a.conjugate() * b;
+    float sinHalf = sqrt(relative.x * relative.x + relative.y * relative.y + relative.z * relative.z);
+    return 2.0f * atan2(sinHalf, std::fabs(relative.w));
+}
+
+// Uniformly distributed random orientation
+Quaternion randomOrientation(std::mt19937& rng){
+    std::normal_distribution<float> normal(0.0f, 1.0f);
+    return Quaternion(normal(rng), normal(rng), normal(rng), normal(rng)).normalized();
+}
+
+// Wraps an angle to -pi - pi
+float wrap(float angle){
+    return atan2(sin(angle), cos(angle));
+}
+
+int main(){
+
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<float> anyAngle(-M_PI, M_PI);
+    bool passed = true;
+
+    // ~~ Quaternion -> Euler -> quaternion ~~
+    {
+        float worst = 0.0f;
+        for(int n = 0; n < NUM_ORIENTATIONS; n++){
+            Quaternion q = randomOrientation(rng);
+            float yaw, pitch, roll;
+            q.toEuler(yaw, pitch, roll);
+            worst = std::max(worst, angleBetween(q, Quaternion::fromEuler(yaw, pitch, roll)));
+        }
+        std::cout << "  Random orientations: worst round trip error " << worst << " rad" << std::endl;
+        passed = report("Quaternion -> Euler -> quaternion", worst < ANGLE_TOLERANCE) && passed;
+    }
+
+    // ~~ Round trip next to the singularity ~~
+    {
+        const float PITCHES[] = {0.0f, 1e-7f, 1e-5f, 1e-3f, static_cast<float>(M_PI) - 1e-3f
+                               , static_cast<float>(M_PI) - 1e-5f, static_cast<float>(M_PI) - 1e-7f, static_cast<float>(M_PI)};
+        float worst = 0.0f;
+        bool folded = true;
+        for(float pitchIn : PITCHES){
+            for(int n = 0; n < NUM_ORIENTATIONS / 10; n++){
+                Quaternion q = Quaternion::fromEuler(anyAngle(rng), pitchIn, anyAngle(rng));
+                float yaw, pitch, roll;
+                q.toEuler(yaw, pitch, roll);
+                worst = std::max(worst, angleBetween(q, Quaternion::fromEuler(yaw, pitch, roll)));
+                folded = folded && std::isfinite(yaw) && std::isfinite(pitch) && std::isfinite(roll);
+                if(pitchIn == 0.0f || pitchIn == static_cast<float>(M_PI)){
+                    folded = folded && roll == 0.0f; // Exactly on the singularity the roll is folded into the yaw
+                }
+            }
+        }
+        std::cout << "  Pitch near 0 and 180: worst round trip error " << worst << " rad" << std::endl;
+        passed = report("Round trip at the wrist singularity", worst < ANGLE_TOLERANCE && folded) && passed;
+    }
+
+    // ~~ Euler -> quaternion -> Euler ~~
+    {
+        std::uniform_real_distribution<float> pitchAngle(0.05f, M_PI - 0.05f);
+        float worst = 0.0f;
+        for(int n = 0; n < NUM_ORIENTATIONS; n++){
+            float yawIn = anyAngle(rng), pitchIn = pitchAngle(rng), rollIn = anyAngle(rng);
+            float yaw, pitch, roll;
+            Quaternion::fromEuler(yawIn, pitchIn, rollIn).toEuler(yaw, pitch, roll);
+            worst = std::max({worst, std::fabs(wrap(yaw - yawIn)), std::fabs(pitch - pitchIn), std::fabs(wrap(roll - rollIn))});
+        }
+        std::cout << "  Worst angle error " << worst << " rad" << std::endl;
+        passed = report("Euler -> quaternion -> Euler", worst < ANGLE_TOLERANCE) && passed;
+    }
+
+    // ~~ Rotation matrix ~~
+    {
+        float worst = 0.0f;
+        for(int n = 0; n < NUM_ORIENTATIONS; n++){
+            float R[3][3];
+            randomOrientation(rng).toRotationMatrix(R);
+            for(int i = 0; i < 3; i++){
+                for(int j = 0; j < 3; j++){
+                    float dot = R[0][i] * R[0][j] + R[1][i] * R[1][j] + R[2][i] * R[2][j];
+                    worst = std::max(worst, std::fabs(dot - (i == j ? 1.0f : 0.0f)));
+                }
+            }
+            float det = R[0][0] * (R[1][1] * R[2][2] - R[1][2] * R[2][1])
+                      - R[0][1] * (R[1][0] * R[2][2] - R[1][2] * R[2][0])
+                      + R[0][2] * (R[1][0] * R[2][1] - R[1][1] * R[2][0]);
+            worst = std::max(worst, std::fabs(det - 1.0f));
+        }
+
+        // A yaw of 30 degrees turns the tool x axis towards y
+        float R[3][3];
+        Quaternion::fromEuler(M_PI / 6.0, 0.0f, 0.0f).toRotationMatrix(R);
+        bool yawed = std::fabs(R[0][0] - cos(M_PI / 6.0)) < MATRIX_TOLERANCE && std::fabs(R[1][0] - sin(M_PI / 6.0)) < MATRIX_TOLERANCE
+                  && std::fabs(R[2][2] - 1.0f) < MATRIX_TOLERANCE;
+
+        std::cout << "  Worst deviation from orthonormal " << worst << std::endl;
+        passed = report("Rotation matrix is orthonormal", worst < MATRIX_TOLERANCE && yawed) && passed;
+    }
+
+    // ~~ SlerpPath ~~
+    {
+        float worstStart = 0.0f, worstSlerp = 0.0f, worstStep = 0.0f;
+        bool landed = true;
+        bool shortest = true;
+        for(int n = 0; n < NUM_PATHS; n++){
+            Quaternion from = randomOrientation(rng);
+            Quaternion to = randomOrientation(rng);
+
+            // Half the paths have q.p < 0, the same rotations as q.p > 0 with the target negated
+            if((n % 2 == 0) == (from.dot(to) > 0.0f)){
+                to = Quaternion(-to.w, -to.x, -to.y, -to.z);
+            }
+            float arc = angleBetween(from, to); // Short way round, at most 180 degrees
+            float step = arc / PATH_STEPS;
+
+            SlerpPath path(from, to, PATH_STEPS);
+            Quaternion previous = from;
+            float travelled = 0.0f;
+            for(int i = 1; i <= PATH_STEPS; i++){
+                Quaternion current = path.next();
+                if(i == 1){
+                    worstStart = std::max(worstStart, std::fabs(angleBetween(from, current) - step));
+                }
+                worstSlerp = std::max(worstSlerp, angleBetween(current, Quaternion::slerp(from, to, static_cast<float>(i) / PATH_STEPS)));
+                worstStep = std::max(worstStep, std::fabs(angleBetween(previous, current) - step));
+                travelled += angleBetween(previous, current);
+                landed = landed && (i == PATH_STEPS) == path.done();
+                previous = current;
+            }
+
+            // The last step is the target itself (negated on the short way round)
+            float sign = from.dot(to) < 0.0f ? -1.0f : 1.0f;
+            landed = landed && previous.w == sign * to.w && previous.x == sign * to.x
+                            && previous.y == sign * to.y && previous.z == sign * to.z;
+            shortest = shortest && std::fabs(travelled - arc) < ANGLE_TOLERANCE;
+        }
+
+        std::cout << "  Worst first step error " << worstStart << " rad, worst step error " << worstStep
+                  << " rad, worst distance from slerp " << worstSlerp << " rad" << std::endl;
+        passed = report("SlerpPath endpoints", landed && worstStart < ANGLE_TOLERANCE) && passed;
+        passed = report("SlerpPath equal steps along slerp", worstStep < ANGLE_TOLERANCE && worstSlerp < ANGLE_TOLERANCE) && passed;
+        passed = report("SlerpPath takes the shortest path", shortest) && passed;
+    }
+
+    std::cout << "Quaternion: " << (passed ? "Passed!" : "Failed!") << std::endl;
+    return passed ? 0 : 1;
+}
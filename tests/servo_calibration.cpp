@@ -1,21 +1,18 @@
 /*
 ~~ Servo Calibration ~~
 
-This calibrator measures the actual angle of a servo motor as we move throughout the PWM range. 
-The following happens when run:
+This calibrator measures the actual angle of a servo motor as we move throughout the PWM range.
+The following happens when run (see ServoCalibrator):
 - Servo is set to the midpoint between the specified range
-- PWM pulse is incrementally moved downward, monitoring the angle along the way.
-- Once the angle no longer changes, we move back into the working range, and then move in finer increments
-  until the motor no longer moves. The PWM signal before it stopped is recorded as the new MIN_PULSE
-- AS5600 MUST BE ZERO'D AT NEW MIN_PULSE
-- Then the motor moves to the other end of the range, performing the same steps as before to determine
-  the other end of the PWM range; MAX_PULSE
-calibratePwm():
-- pwmOffset and pwmMultiplier are calculated using the new min and max pulses
-calibrateError():
-- The servo starts at one end of the SPECIFIED range and works it's way towards the other end of the SPECIFIED
-  range, taking samples of the actual angle, and then comparing it to the supposed angle, to get the error.
-- Then we create an error function, and then pull the dcOffset and dcMultiplier out of that.
+- The pulse gallops downward in doubling steps until the motor stops at its end stop, then a search
+  narrows down the lowest pulse that still moves it; this is recorded as the new MIN_PULSE
+- The same is done upwards for MAX_PULSE
+- The clipped range is swept down and back up, with the step growing where the response is straight
+  and shrinking where it bends
+- After every command the encoder is polled and the next step is taken as soon as the reading is
+  still, instead of waiting a fixed time
+The sweep is written to SAMPLE_FILENAME and fitted with direction dependent curves (ServoCalibration).
+Validation then drives a calibrated Servo through the range and checks the encoder.
 
 */
 
@@ -24,11 +21,11 @@ calibrateError():
 #include "as5600.h"
 #include "i2c.h"
 #include "servo.h"
+#include "calibration.h"
+#include "servo_calibrator.h"
 
 #include <chrono> // For time in ms
 #include <thread> // For sleeping
-#include <vector>
-#include <fstream>
 #include <iostream>
 #include <cstdint>  // For uint8_t and system
 
@@ -52,9 +49,20 @@ const float SERVO_STEP_FREQ = 50;         // hz
 const uint16_t AS5600_CONFIG = 0x000C;           // Config of AS5600
 
 // Calibration Config
-const uint8_t ROUGH_PWM_STEP = 10; // When moving towards the endpoints, this will determine the rough step width (us)
-const uint8_t FINE_PWM_STEP = 5;   // When moving towards the endpoints, this will determine the fine step width (us)
-const uint8_t SAMPLE_PWM_STEP = 5; // When sampling, this is the amount we will increment the PWM signal in us
+const float SEARCH_LOW_PULSE = 300;     // The endpoint search never commands below this (us)
+const float SEARCH_HIGH_PULSE = 3000;   // The endpoint search never commands above this (us)
+const float GALLOP_PWM_STEP = 40;       // First step out towards each end, doubles every step (us)
+const float ENDPOINT_RESOLUTION = 2;    // Endpoints are narrowed down to this (us)
+const float BACKLASH_MARGIN = 40;       // Endpoint probes are approached from this far inside (us)
+const float SATURATION_TOLERANCE = 0.5; // Readings this close to the end stop count as at the end stop (degrees)
+const float MIN_SAMPLE_STEP = 5;        // Sampling step where the response bends (us)
+const float MAX_SAMPLE_STEP = 80;       // Sampling step where the response is straight (us)
+const float CURVATURE_TOLERANCE = 1;    // Departure from a straight line that halves the sampling step (degrees)
+const int SETTLE_POLL_US = 2000;        // Encoder read period while waiting for the motor to settle
+const int MIN_DWELL_US = 22000;         // Shortest wait after a command (one PWM frame plus margin)
+const int SETTLE_TIMEOUT_US = 500000;   // Take the reading anyway after this long
+const int SETTLE_WINDOW = 6;            // Readings compared to decide the motor is still
+const float SETTLE_TOLERANCE = 0.5;     // Encoder steps the window may still be drifting by
 const std::string SAMPLE_FILENAME = "sample.csv"; // Filename for sampling
 const float PULSE_CLIP_THRESHOLD = 10; // This is the amount in us to clip from each of the measured max/mins
 
@@ -64,9 +72,7 @@ const float VALID_THRESHOLD = 1; // Number of degrees error in tests to pass
 
 // Output Variables
 float measuredMinPulse;
-uint16_t measuredMinStep;
 float measuredMaxPulse;
-uint16_t measuredMaxStep;
 float measuredMaxAngle;
 float pwmOffset;
 float pwmMultiplier;
@@ -98,294 +104,51 @@ int main() {
     std::cout << "Initialization complete." << std::endl;
 
     // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-    // ~~ Determine Lower End ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-    
-    std::cout << "Measuring lower pulse width..." << std::endl;
-
-    // Gets the current rotational step (0 - 4095)
-    uint16_t lastAbsoluteStep = as5600.getStep();
-    uint16_t absoluteStep;
-    uint8_t stepsOver = 0;
-
-    float currentPulseWidth;
-    
-    // // Rough Measurement - moves downward until motor stops
-    // // Increments currentPulseWidth downward with the end condition being that currentPulseWidth can't be less than 0
-    // for(currentPulseWidth = MID_PULSE - ROUGH_PWM_STEP; currentPulseWidth > 0; currentPulseWidth -= ROUGH_PWM_STEP){
-      
-    //   // Sets channel one ROUGH increment down
-    //   pca9685.setPulseWidth(CHANNEL, currentPulseWidth);
-
-    //   // Give motor time to move and settle
-    //   // ~4.5ms to move motor (BASED ON 10us STEPS) + 2.2ms ASM5600 delay + 3.3ms buffer = 10ms
-    //   std::this_thread::sleep_for(std::chrono::milliseconds(50));
-
-    //   // Gets the absolute rotation
-    //   absoluteStep = as5600.getStep();
-
-    //   // This condition triggers if the absolute step does NOT change
-    //   if(absoluteStep == lastAbsoluteStep){
-    //     break;
-    //   }
-    //   else{
-    //     lastAbsoluteStep = absoluteStep;
-    //   }
-    // }
-
-    // // Now we go back 10 steps and then move in finer steps
-    // currentPulseWidth = currentPulseWidth + (10 * ROUGH_PWM_STEP);
-    // pca9685.setPulseWidth(CHANNEL, currentPulseWidth);
-    // std::this_thread::sleep_for(std::chrono::milliseconds(100));
-    // lastAbsoluteStep = as5600.getStep();
-    
-    // Fine Measurement - moves downward until motor stops
-    
-    // Increments currentPulseWidth downward with the end condition being that currentPulseWidth can't be less than 0
-    for(currentPulseWidth = MID_PULSE - FINE_PWM_STEP; currentPulseWidth > 0; currentPulseWidth -= FINE_PWM_STEP){
-      
-      // Sets channel one ROUGH increment down
-      pca9685.setPulseWidth(CHANNEL, currentPulseWidth);
-
-      // Give motor time to move and settle
-      // ~1.35ms to move motor (BASED ON 3us STEPS) + 2.2ms ASM5600 delay + 1.45ms buffer = 5ms
-      std::this_thread::sleep_for(std::chrono::milliseconds(50));
-
-      // Gets the absolute rotation
-      absoluteStep = as5600.getStep();
-
-      // This condition triggers if the absolute step does NOT change
-      if(absoluteStep == lastAbsoluteStep){
-        if(stepsOver > 3){
-          break;
-        }
-        else{
-          stepsOver++;
-        }
-      }
-      else{
-        lastAbsoluteStep = absoluteStep;
-        stepsOver = 0;
-      }
-    }
-
-    // Now we go back 2 steps and record that as the minimum pulse width
-    currentPulseWidth = currentPulseWidth + ((stepsOver + 1) * FINE_PWM_STEP);
-    pca9685.setPulseWidth(CHANNEL, currentPulseWidth);
-    
-    measuredMinPulse = currentPulseWidth;
+    // ~~ Calibrate ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
-    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    std::cout << "Measuring pulse range and sampling..." << std::endl;
 
-    std::cout << "Lower pulse width measured to be " << measuredMinPulse << "us." << std::endl;
-
-    // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-    // ~~ Zero AS5600 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-
-    std::cout << "Zeroing AS5600..." << std::endl;
-    as5600.zero();
-    std::cout << "Zeroing successful." << std::endl;
-
-    // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-    // ~~ Determine Higher End ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-
-    std::cout << "Measuring upper pulse width..." << std::endl;
-
-    // Set to midpoint
-    pca9685.setPulseWidth(CHANNEL, MID_PULSE);
-    currentPulseWidth = MID_PULSE;
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
-
-    // Gets the current rotational step (0 - 4095)
-    lastAbsoluteStep = as5600.getStep();
-    
-    // // Rough Measurement - moves downward until motor stops
-    // // Increments currentPulseWidth downward with the end condition being that currentPulseWidth can't greater than MAX_PULSE + 1000
-    // for(currentPulseWidth = MID_PULSE + ROUGH_PWM_STEP; currentPulseWidth < SERVO_MAX_PULSE + 1000; currentPulseWidth += ROUGH_PWM_STEP){
-      
-    //   // Sets channel one ROUGH increment down
-    //   pca9685.setPulseWidth(CHANNEL, currentPulseWidth);
-
-    //   // Give motor time to move and settle
-    //   // ~4.5ms to move motor (BASED ON 10us STEPS) + 2.2ms ASM5600 delay + 3.3ms buffer = 10ms
-    //   std::this_thread::sleep_for(std::chrono::milliseconds(50));
-
-    //   // Gets the absolute rotation
-    //   absoluteStep = as5600.getStep();
-
-    //   // This condition triggers if the absolute step does NOT change
-    //   if(absoluteStep == lastAbsoluteStep){
-    //     break;
-    //   }
-    //   else{
-    //     lastAbsoluteStep = absoluteStep;
-    //   }
-    // }
-
-    // // Now we go back 10 steps and then move in finer steps
-    // currentPulseWidth = currentPulseWidth - (10 * ROUGH_PWM_STEP);
-    // pca9685.setPulseWidth(CHANNEL, currentPulseWidth);
-    // std::this_thread::sleep_for(std::chrono::milliseconds(100));
-    // lastAbsoluteStep = as5600.getStep();
-
-    // Fine Measurement - moves downward until motor stops
-    
-    // Increments currentPulseWidth downward with the end condition being that currentPulseWidth can't be less than 0
-    for(currentPulseWidth = MID_PULSE + FINE_PWM_STEP; currentPulseWidth < SERVO_MAX_PULSE + 1000; currentPulseWidth += FINE_PWM_STEP){
-      
-      // Sets channel one ROUGH increment down
-      pca9685.setPulseWidth(CHANNEL, currentPulseWidth);
-
-      // Give motor time to move and settle
-      // ~1.35ms to move motor (BASED ON 3us STEPS) + 2.2ms ASM5600 delay + 1.45ms buffer = 5ms
-      std::this_thread::sleep_for(std::chrono::milliseconds(50));
-
-      // Gets the absolute rotation
-      absoluteStep = as5600.getStep();
-
-      // This condition triggers if the absolute step does NOT change
-      if(absoluteStep == lastAbsoluteStep){
-        if(stepsOver > 3){
-          break;
-        }
-        else{
-          stepsOver++;
-        }
-      }
-      else{
-        lastAbsoluteStep = absoluteStep;
-        stepsOver = 0;
-      }
-    }
-
-    // Now we go back 2 steps and record that as the maximum pulse width
-    currentPulseWidth = currentPulseWidth - ((stepsOver + 1) * FINE_PWM_STEP);
-    pca9685.setPulseWidth(CHANNEL, currentPulseWidth);
-    
-    measuredMaxPulse = currentPulseWidth;
-
-    std::this_thread::sleep_for(std::chrono::milliseconds(50));
-
-    std::cout << "Upper pulse width measured to be " << measuredMaxPulse << "us" << std::endl;
-
-    // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-    // ~~ Calculate New maxAngle/adjustedMax/adjustedMin ~~~~~~~~~~~~~~~~~~~~
+    CalibratorParams calibratorParams = {
+        static_cast<float>(MID_PULSE), SEARCH_LOW_PULSE, SEARCH_HIGH_PULSE, GALLOP_PWM_STEP, ENDPOINT_RESOLUTION
+      , BACKLASH_MARGIN, SATURATION_TOLERANCE, PULSE_CLIP_THRESHOLD, MIN_SAMPLE_STEP, MAX_SAMPLE_STEP, CURVATURE_TOLERANCE
+      , std::chrono::microseconds(SETTLE_POLL_US), std::chrono::microseconds(MIN_DWELL_US)
+      , std::chrono::microseconds(SETTLE_TIMEOUT_US), SETTLE_WINDOW, SETTLE_TOLERANCE};
 
-    std::cout << "Calculating adjusted max/min/angle..." << std::endl;
+    ServoCalibrator calibrator(&pca9685, CHANNEL, &as5600, calibratorParams);
+    calibrator.run();
 
     // Clipping ends of range
-    measuredMaxPulse -= PULSE_CLIP_THRESHOLD;
-    measuredMinPulse += PULSE_CLIP_THRESHOLD;
-
-    // Move to adjusted minRange and get step
-    pca9685.setPulseWidth(CHANNEL, measuredMinPulse);
-    std::this_thread::sleep_for(std::chrono::milliseconds(2000));
-
-    measuredMinStep = as5600.getStep();
-
-    // Move to adjusted maxRange and get step
-    pca9685.setPulseWidth(CHANNEL, measuredMaxPulse);
-    std::this_thread::sleep_for(std::chrono::milliseconds(2000));
-
-    measuredMaxStep = as5600.getStep();
-
-    // Calculate new angle range
-    measuredMaxAngle = (measuredMaxStep - measuredMinStep) * 360.0f / 4096.0f;
+    measuredMinPulse = calibrator.getMinPulse() + PULSE_CLIP_THRESHOLD;
+    measuredMaxPulse = calibrator.getMaxPulse() - PULSE_CLIP_THRESHOLD;
+    measuredMaxAngle = calibrator.getMaxAngle();
 
+    std::cout << "Lower pulse width measured to be " << calibrator.getMinPulse() << "us." << std::endl;
+    std::cout << "Upper pulse width measured to be " << calibrator.getMaxPulse() << "us." << std::endl;
     std::cout << "Adjusted measuredMaxPulse: " << measuredMaxPulse << std::endl;
     std::cout << "Adjusted measuredMinPulse: " << measuredMinPulse << std::endl;
     std::cout << "measuredMaxAngle: " << measuredMaxAngle << std::endl;
-
-    // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-    // ~~ Calculate pwmOffset and pwmMultiplier ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-    
-    // std::cout << "Calculating pwm calibration variables..." << std::endl;
-
-    // float measuredMidPulse = (measuredMaxPulse + measuredMinPulse) / 2;
-
-    // pwmOffset = measuredMidPulse - MID_PULSE;
-    // pwmMultiplier = measuredMaxPulse / (SERVO_MAX_PULSE + pwmOffset);
-
-    // std::cout << "pwmOffset measured to be: " << pwmOffset << std::endl;
-    // std::cout << "pwmMultiplier measured to be: " << pwmMultiplier << std::endl;
-    // std::cout << "Succesfully calculated pwm calibration variables." << std::endl;
-
-    // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-    // ~~ Sample Entire Range ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-
-    std::cout << "Sampling measured range..." << std::endl;
-
-    // This will be the dataset containing (pulseWidth, absoluteStep)
-    std::vector<std::pair<float, uint16_t>> sampleData;
-
-    // Sampling from measuredMaxPulse down:
-    for(currentPulseWidth -= SAMPLE_PWM_STEP; currentPulseWidth > measuredMinPulse; currentPulseWidth -= SAMPLE_PWM_STEP){
-     
-      // Sets channel one sample increment down
-      pca9685.setPulseWidth(CHANNEL, currentPulseWidth);
-
-      // Give motor time to move and settle
-      // ~2.35ms to move motor (BASED ON 5us STEPS) + 2.2ms ASM5600 delay + 1.45ms buffer = 6ms
-      std::this_thread::sleep_for(std::chrono::milliseconds(50));
-
-      // Gets the absolute rotation
-      absoluteStep = as5600.getStep();
-
-      // Add data to dataset
-      sampleData.emplace_back(currentPulseWidth, absoluteStep);
-    }
-
-    // Exits when currentPulseWidth steps over measuredMinPulse, so now we need to go to measuredMinPulse
-    pca9685.setPulseWidth(CHANNEL, measuredMinPulse + 5 * SAMPLE_PWM_STEP);
-    std::this_thread::sleep_for(std::chrono::milliseconds(50));
-    pca9685.setPulseWidth(CHANNEL, measuredMinPulse);
-    currentPulseWidth = measuredMinPulse;
-
-    // Sampling from measuredMinPulse up:
-    for(currentPulseWidth += SAMPLE_PWM_STEP; currentPulseWidth < measuredMaxPulse; currentPulseWidth += SAMPLE_PWM_STEP){
-     
-      // Sets channel one sample increment down
-      pca9685.setPulseWidth(CHANNEL, currentPulseWidth);
-
-      // Give motor time to move and settle
-      // ~2.35ms to move motor (BASED ON 5us STEPS) + 2.2ms ASM5600 delay + 1.45ms buffer = 6ms
-      std::this_thread::sleep_for(std::chrono::milliseconds(50));
-
-      // Gets the absolute rotation
-      absoluteStep = as5600.getStep();
-
-      // Add data to dataset
-      sampleData.emplace_back(currentPulseWidth, absoluteStep);
-    }
-
-    std::cout << "Succesfully sampled measured range." << std::endl;
+    std::cout << "Took " << calibrator.getSamples().size() << " samples in " << calibrator.getElapsed().count()
+              << "ms (" << calibrator.getTimeoutCount() << " readings did not settle)." << std::endl;
 
     // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
     // ~~ Write dataset to CSV ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
     std::cout << "Writing dataset to file..." << std::endl;
 
-    // Open file
-    std::ofstream file(SAMPLE_FILENAME);
-    
-    // Check to ensure file is open
-    if(!file.is_open()){
-      std::cerr << "Error opening file!" << std::endl;
-      return 1;
+    try{
+      writeSweepCsv(SAMPLE_FILENAME, calibrator.getSamples());
     }
-
-    // Write header
-    file << "Pulse Width (us),Absolute Step (0-4096)\n";
-
-    // Write data
-    for (const auto& entry : sampleData) {
-      file << entry.first << "," << entry.second << "\n";
+    catch(const std::exception& e){
+      std::cerr << "Error writing file: " << e.what() << std::endl;
+      return 1;
     }
 
-    // Close file
-    file.close();
-
     std::cout << "Succesfully written dataset to " << SAMPLE_FILENAME << std::endl;
 
+    // Fit the direction dependent curves from the down/up sweep
+    ServoCalibration calibration = calibrator.getCalibration();
+    std::cout << "Hysteresis measured to be " << calibration.getHysteresis() << " degrees." << std::endl;
+
 
     std::cout << "Calibration Successful!" << std::endl;
 
@@ -396,13 +159,13 @@ int main() {
 
     // Create calibrated servo object
     ServoParams servoParams = {&pca9685, CHANNEL, measuredMinPulse, measuredMaxPulse
-							 , measuredMaxAngle, measuredMaxAngle/2.0f, SERVO_SPEED, SERVO_STEP_FREQ};
+							 , measuredMaxAngle, measuredMaxAngle/2.0f, SERVO_SPEED, SERVO_STEP_FREQ, nullptr, &calibration};
     
     Servo servo(servoParams);
 
     // Move to position 0 and zero encoder
     std::cout << "Zeroing..." << std::endl;
-    servo.moveToPosition(0).join();
+    servo.moveToPosition(0).wait();
     std::this_thread::sleep_for(std::chrono::milliseconds(500));
     as5600.zero();
     std::cout << "Successfully zeroed" << std::endl;
@@ -413,7 +176,7 @@ int main() {
       std::cout << "Testing: " << angle << " degrees..." << std::endl;
 
       // Move servo to position
-      servo.moveToPosition(angle).join();
+      servo.moveToPosition(angle).wait();
       std::this_thread::sleep_for(std::chrono::milliseconds(500));
 
       // Get actual angle:
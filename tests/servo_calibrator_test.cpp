@@ -0,0 +1,130 @@
+/*
+~~ Servo Calibrator Test ~~
+
+Calibrates a simulated servo (sim_plant.h) through a SimPCA9685 and
+SimAS5600 on one SimBus. The servo follows the measured rising/falling curves
+of sample_S1 with backlash between them, only picks up a new pulse on its
+20 ms PWM frame, slews at a limited speed with a first-order lag, and sits on
+end stops outside the measured range. The encoder quantizes to 4096 steps with noise
+and wraps through 0 inside the range.
+
+Checks that the measured endpoints and fitted curves match the simulated
+servo, and that the run is at least 10x faster than the fixed dwell procedure
+servo_calibration.cpp used (50 ms per 5 us step, 2 s at each end) over the
+same range.
+
+Run from the repository root so the sample paths resolve.
+*/
+
+#include "i2c.h"
+#include "sim_bus.h"
+#include "sim_plant.h"
+#include "pca9685.h"
+#include "as5600.h"
+#include "calibration.h"
+#include "servo_calibrator.h"
+
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+
+// Test Config
+const uint8_t PCA_ADDR = 0x40;
+const uint8_t CHANNEL = 0;
+const float TICK_US_PER_STEP = 122.0f / 25.0f; // PCA9685 step size at the default prescaler (us)
+const char* PLANT_SAMPLE = "samples/sample_S1.csv";
+
+// Legacy procedure (servo_calibration.cpp)
+const double LEGACY_DWELL_S = 0.050;
+const double LEGACY_END_DWELL_S = 2.0;
+const double LEGACY_STEP_US = 5.0;
+const double LEGACY_CLIP_US = 10.0;
+
+// Fitted curves against the simulated ones (deg), servo_calibration.cpp validates to 1 deg
+const double CURVE_RMS = 0.5;
+const double CURVE_WORST = 1.5;
+
+const CalibratorParams PARAMS = PLANT_PARAMS;
+
+// Pulse where a curve leaves its end stop value by more than tolerance, scanning from one end
+float departure(const CalibrationCurve& curve, bool fromLow, float tolerance){
+    float end = fromLow ? curve.angleAt(curve.getMinPulse()) : curve.angleAt(curve.getMaxPulse());
+    float pulse = fromLow ? curve.getMinPulse() : curve.getMaxPulse();
+    while(std::fabs(curve.angleAt(pulse) - end) <= tolerance){
+        pulse += fromLow ? 1.0f : -1.0f;
+    }
+    return pulse;
+}
+
+// Worst and RMS difference between a fitted curve and the truth over the fitted range
+void compare(const CalibrationCurve& fitted, const CalibrationCurve& truth, float offset, double& rms, double& worst){
+    double squares = 0.0;
+    int count = 0;
+    worst = 0.0;
+    for(float pulse = fitted.getMinPulse(); pulse <= fitted.getMaxPulse(); pulse += 1.0f){
+        double error = fitted.angleAt(pulse) - (truth.angleAt(pulse) - offset);
+        squares += error * error;
+        worst = std::max(worst, std::fabs(error));
+        count++;
+    }
+    rms = std::sqrt(squares / count);
+}
+
+int main(){
+
+    std::cout << std::fixed << std::setprecision(3);
+
+    ServoCalibration truth = ServoCalibration::fromSweepCsv(PLANT_SAMPLE);
+    SimBus bus({I2C_FAST_MODE, true});
+    SimPCA9685 pcaModel;
+    SimPlant plant(&pcaModel, CHANNEL, &truth, PARAMS.startPulse, 11);
+    bus.addDevice(&pcaModel, PCA_ADDR);
+    bus.addDevice(&plant.getEncoder(), AS5600_ADDRESS);
+    I2C i2c(&bus);
+    PCA9685 pca(&i2c, PCA_ADDR);
+    AS5600 encoder(&i2c, 0x000C);
+
+    ServoCalibrator calibrator(&pca, CHANNEL, &encoder, PARAMS);
+    calibrator.run();
+
+    // Endpoints: where the simulated servo leaves its end stops when approached from inside
+    float trueMin = departure(truth.getFalling(), true, PARAMS.saturationTolerance);
+    float trueMax = departure(truth.getRising(), false, PARAMS.saturationTolerance);
+    float minError = std::fabs(calibrator.getMinPulse() - trueMin);
+    float maxError = std::fabs(calibrator.getMaxPulse() - trueMax);
+    bool endpoints = minError <= PARAMS.endpointResolution + TICK_US_PER_STEP
+                  && maxError <= PARAMS.endpointResolution + TICK_US_PER_STEP;
+    std::cout << "Endpoints: measured " << calibrator.getMinPulse() << " - " << calibrator.getMaxPulse()
+              << " us, simulated " << trueMin << " - " << trueMax << " us: " << (endpoints ? "Passed!" : "Failed!") << std::endl;
+
+    // Curves: same zero as the fit (the falling curve's reading at the bottom of the sweep)
+    ServoCalibration fitted = calibrator.getCalibration();
+    float offset = truth.getFalling().angleAt(fitted.getFalling().getMinPulse());
+    double risingRms, risingWorst, fallingRms, fallingWorst;
+    compare(fitted.getRising(), truth.getRising(), offset, risingRms, risingWorst);
+    compare(fitted.getFalling(), truth.getFalling(), offset, fallingRms, fallingWorst);
+    bool curves = risingRms < CURVE_RMS && fallingRms < CURVE_RMS && risingWorst < CURVE_WORST && fallingWorst < CURVE_WORST;
+    std::cout << "Curves (" << calibrator.getSamples().size() << " samples): rising RMS " << risingRms << " worst "
+              << risingWorst << " deg, falling RMS " << fallingRms << " worst " << fallingWorst << " deg, hysteresis "
+              << fitted.getHysteresis() << " deg (simulated " << truth.getHysteresis() << "): "
+              << (curves ? "Passed!" : "Failed!") << std::endl;
+
+    // Time against the fixed dwell procedure over the same range
+    double start = PARAMS.startPulse;
+    // Steps out to each end (plus four past it and one back), both sample passes and the turn around,
+    // with 1 s at the start and 100 ms back at the middle before the upper end
+    double legacySteps = (start - trueMin) / LEGACY_STEP_US + 6 + (trueMax - start) / LEGACY_STEP_US + 6
+                       + 2.0 * (trueMax - trueMin - 2.0 * LEGACY_CLIP_US) / LEGACY_STEP_US + 1;
+    double legacyS = 1.1 + legacySteps * LEGACY_DWELL_S + 2.0 * LEGACY_END_DWELL_S;
+    double elapsedS = calibrator.getElapsed().count() / 1000.0;
+    bool faster = elapsedS * 10.0 <= legacyS;
+    std::cout << "Time: " << elapsedS << " s (" << calibrator.getCommandCount() << " commands, " << calibrator.getReadCount()
+              << " reads, " << calibrator.getTimeoutCount() << " timeouts), fixed dwell procedure " << legacyS << " s, "
+              << legacyS / elapsedS << "x faster: " << (faster ? "Passed!" : "Failed!") << std::endl;
+
+    bool passed = endpoints && curves && faster;
+    std::cout << "Servo calibrator: " << (passed ? "Passed!" : "Failed!") << std::endl;
+    return passed ? 0 : 1;
+}
@@ -42,11 +42,11 @@ int main() {
 	Servo servo2(servo2Params);
 
 
-	servo1.moveToPosition(0).join();
+	servo1.moveToPosition(0).wait();
 	servo1.setSpeed(10);
-	servo1.moveToPosition(260).join();
+	servo1.moveToPosition(260).wait();
 	servo1.setSpeed(90);
-	servo1.moveToPosition(0).join();
+	servo1.moveToPosition(0).wait();
 
 	std::cout << "Terminating Program" << std::endl;
     
@@ -0,0 +1,244 @@
+/*
+~~ Simulated Bus Test ~~
+
+Runs the real PCA9685, AS5600 and Servo drivers on the simulated bus, with no
+hardware:
+- PCA9685: the prescaler, sleep and full ON/OFF bits the driver writes
+  decode to the expected frame and pulse widths, ALL_LED writes reach every
+  channel (the emergency stop cut)
+- AS5600 behind the mux: each encoder only answers on its own channel, zero()
+  makes ANGLE relative to the angle at construction, unpopulated channels are
+  not acknowledged
+- Servo dynamics: a Servo move drives the simulated horn, which the encoder
+  reads back; a pulse inside the servo's dead band leaves the horn where it is
+- Bus timing: the modeled time per transaction at 100 and 400 kHz, and that a
+  real time bus blocks for it
+*/
+
+#include "i2c.h"
+#include "sim_bus.h"
+#include "pca9685.h"
+#include "as5600.h"
+#include "servo.h"
+#include "motion.h"
+#include "clock.h"
+
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <sstream>
+#include <string>
+#include <iostream>
+#include <iomanip>
+
+// Test Config
+const uint8_t PCA_ADDR = 0x40;
+const uint8_t MUX_ADDR = 0x70;
+const uint16_t AS5600_CONFIG = 0x000C;
+const float TICK_US = 122.0f / 25.0f; // PCA9685 tick at the driver's default prescaler (us)
+const int TIMING_WRITES = 200;
+
+// Simulated servo on channel 3: linear 500 - 2500 us over 180 degrees
+const uint8_t SERVO_CHANNEL = 3;
+const uint8_t ENCODER_CHANNEL = 5;
+const SimServoParams SERVO = {500.0f, 2500.0f, 180.0f, 400.0f, 0.01f, nullptr};
+const float MOUNT_OFFSET = 40.0f; // Magnet angle at servo angle 0 (degrees)
+const float ANGLE_TOLERANCE = 0.5f; // Encoder against commanded angle after settling (degrees)
+const float DEAD_BAND = 1.0f; // degrees
+
+bool report(const std::string& name, bool passed){
+    std::cout << name << ": " << (passed ? "Passed!" : "Failed!") << std::endl;
+    return passed;
+}
+
+bool near(double value, double expected, double tolerance){
+    return std::fabs(value - expected) <= tolerance;
+}
+
+int main(){
+
+    bool passed = true;
+    std::cout << std::fixed << std::setprecision(3);
+
+    // ~~ PCA9685 ~~
+    {
+        SimBus bus({I2C_FAST_MODE, false});
+        SimPCA9685 model;
+        bus.addDevice(&model, PCA_ADDR);
+        I2C i2c(&bus);
+        PCA9685 pca(&i2c, PCA_ADDR);
+
+        bool configured = model.getRegister(PRESCALE_REG) == 0x79 && !model.isSleeping()
+                       && near(model.getPeriod(), 4096 * TICK_US, 0.01) && model.getPulseWidth(SERVO_CHANNEL) == 0.0f;
+        pca.setPulseWidth(SERVO_CHANNEL, 1500.0f);
+        bool pulse = near(model.getPulseWidth(SERVO_CHANNEL), 1500.0f, TICK_US / 2);
+        pca.switchOff(SERVO_CHANNEL);
+        bool off = model.getPulseWidth(SERVO_CHANNEL) == 0.0f;
+        pca.switchOn(SERVO_CHANNEL);
+        bool on = near(model.getPulseWidth(SERVO_CHANNEL), 1500.0f, TICK_US / 2);
+        pca.setPWM(7, 1000, 3048);
+        bool shifted = near(model.getPulseWidth(7), 2048 * TICK_US, 0.01);
+        pca.emergencyOff();
+        bool cut = model.getPulseWidth(SERVO_CHANNEL) == 0.0f && model.getPulseWidth(7) == 0.0f;
+        pca.setPWMFrequency(200);
+        bool frequency = model.getRegister(PRESCALE_REG) == 30 && near(model.getPeriod(), 4096 * 31 / 25.0, 0.01); // 196.9 Hz, the nearest to 200
+
+        passed = report("PCA9685 prescaler, pulse width, full OFF, ON/OFF phase, ALL_LED cut and frequency"
+                      , configured && pulse && off && on && shifted && cut && frequency) && passed;
+    }
+
+    // ~~ AS5600 behind the mux ~~
+    {
+        SimBus bus({I2C_FAST_MODE, false});
+        std::atomic<double> angleA{100.0};
+        std::atomic<double> angleB{250.0};
+        SimAS5600 encoderA([&angleA](){ return angleA.load(); });
+        SimAS5600 encoderB([&angleB](){ return angleB.load(); });
+        bus.addMux(MUX_ADDR);
+        bus.addDevice(&encoderA, AS5600_ADDRESS, 2);
+        bus.addDevice(&encoderB, AS5600_ADDRESS, 6);
+        I2C i2c(&bus);
+        bool attached = i2c.attachMux(MUX_ADDR);
+
+        AS5600 a(&i2c, AS5600_CONFIG, 2);
+        AS5600 b(&i2c, AS5600_CONFIG, 6);
+        bool zeroed = a.getStep() == 0 && b.getStep() == 0;
+        angleA = 130.0;
+        angleB = 200.0;
+        bool routed = near(a.getAngle(), 30.0, 0.1) && near(b.getAngle(), 310.0, 0.1)
+                   && near(a.getRawStep(), 130.0 * 4096 / 360, 1.0) && near(b.getRawStep(), 200.0 * 4096 / 360, 1.0);
+        bool config = encoderA.getRegister(REG_CONF_MSB) == (AS5600_CONFIG >> 8);
+
+        bool refused = false;
+        try{
+            AS5600 missing(&i2c, AS5600_CONFIG, 3);
+        }
+        catch(const std::runtime_error&){
+            refused = true;
+        }
+
+        passed = report("AS5600 routing by mux channel, zero, raw angle, config and missing encoder"
+                      , attached && zeroed && routed && config && refused) && passed;
+    }
+
+    // ~~ Servo dynamics ~~
+    {
+        SimBus bus({I2C_FAST_MODE, true});
+        SimPCA9685 pcaModel;
+        SimServo horn(&pcaModel, SERVO_CHANNEL, SERVO, 90.0f);
+        SimAS5600 encoderModel([&horn](){ return horn.getAngle() + MOUNT_OFFSET; });
+        bus.addMux(MUX_ADDR);
+        bus.addDevice(&pcaModel, PCA_ADDR);
+        bus.addDevice(&encoderModel, AS5600_ADDRESS, ENCODER_CHANNEL);
+
+        I2C i2c(&bus);
+        i2c.attachMux(MUX_ADDR);
+        PCA9685 pca(&i2c, PCA_ADDR);
+        MotionEngine engine{std::chrono::microseconds(2000)};
+
+        // Servo constructors print their speed
+        std::ostringstream servoLog;
+        std::streambuf* console = std::cout.rdbuf(servoLog.rdbuf());
+        ServoParams params = {&pca, SERVO_CHANNEL, 500, 2500, 180.0f, 90.0f, 200.0f, 5.0f, &engine};
+        Servo* servo = new Servo(params);
+        std::cout.rdbuf(console);
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        AS5600 encoder(&i2c, AS5600_CONFIG, ENCODER_CHANNEL); // Zeroed at servo angle 90
+
+        bool tracked = true;
+        for(float target : {150.0f, 30.0f, 100.0f}){
+            auto start = std::chrono::steady_clock::now();
+            servo->moveToPosition(target).wait();
+            std::this_thread::sleep_for(std::chrono::milliseconds(150));
+            double moveMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            double measured = std::fmod(encoder.getAngle() + 90.0 + 360.0, 360.0);
+            bool ok = near(measured, target, ANGLE_TOLERANCE) && near(horn.getAngle(), target, ANGLE_TOLERANCE);
+            tracked = tracked && ok;
+            std::cout << "  -> " << target << ": encoder " << measured << " deg, horn " << horn.getAngle()
+                      << " deg after " << moveMs << " ms" << std::endl;
+        }
+        passed = report("Servo move read back through the encoder", tracked) && passed;
+
+        console = std::cout.rdbuf(servoLog.rdbuf());
+        delete servo;
+        std::cout.rdbuf(console);
+    }
+
+    // ~~ Servo dead band ~~
+    {
+        VirtualClock clock;
+        SimBus bus({I2C_FAST_MODE, false, &clock});
+        SimPCA9685 pcaModel;
+        bus.addDevice(&pcaModel, PCA_ADDR);
+        I2C i2c(&bus);
+        PCA9685 pca(&i2c, PCA_ADDR);
+        SimServoParams params = SERVO;
+        params.deadBand = DEAD_BAND;
+        SimServo horn(&pcaModel, SERVO_CHANNEL, params, 90.0f, &clock);
+
+        // Horn angle once a pulse for angle has had time to be picked up
+        auto settle = [&](float angle){
+            pca.setPulseWidth(SERVO_CHANNEL, 500.0f + angle * 2000.0f / 180.0f);
+            clock.advance(std::chrono::milliseconds(200));
+            return horn.getAngle();
+        };
+        double inside = settle(90.0f + 0.6f * DEAD_BAND);
+        double outside = settle(90.0f + 2.0f * DEAD_BAND);
+        std::cout << "  Dead band " << DEAD_BAND << " deg: " << 0.6f * DEAD_BAND << " deg away stays at " << inside << ", "
+                  << 2.0f * DEAD_BAND << " deg away reaches " << outside << std::endl;
+        passed = report("Servo ignores pulses inside its dead band", near(inside, 90.0, 0.01)
+                      && near(outside, 90.0f + 2.0f * DEAD_BAND, TICK_US * 180.0f / 2000.0f)) && passed;
+    }
+
+    // ~~ Bus timing ~~
+    {
+        bool timed = true;
+        double elapsed[2];
+        for(int speed = 0; speed < 2; speed++){
+            uint32_t clock = speed == 0 ? I2C_STANDARD_MODE : I2C_FAST_MODE;
+            SimBus bus({clock, true});
+            SimPCA9685 model;
+            bus.addDevice(&model, PCA_ADDR);
+            I2C i2c(&bus);
+            PCA9685 pca(&i2c, PCA_ADDR);
+
+            std::chrono::nanoseconds before = bus.getBusTime();
+            auto start = std::chrono::steady_clock::now();
+            for(int i = 0; i < TIMING_WRITES; i++){
+                pca.setOffTime(SERVO_CHANNEL, 300 + i);
+            }
+            elapsed[speed] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            double modeled = std::chrono::duration<double, std::milli>(bus.getBusTime() - before).count();
+
+            // Two 2 byte register writes per off time: 29 clocks each
+            double expected = 2 * TIMING_WRITES * 29.0 * 1e3 / clock;
+            bool ok = near(modeled, expected, 0.01) && elapsed[speed] >= modeled;
+            timed = timed && ok;
+            std::cout << "  " << clock / 1000 << " kHz: " << 2 * TIMING_WRITES << " writes modeled " << modeled
+                      << " ms, took " << elapsed[speed] << " ms" << std::endl;
+        }
+        timed = timed && elapsed[0] > 2.0 * elapsed[1];
+        passed = report("Transactions take their modeled time, 400 kHz faster than 100 kHz", timed) && passed;
+
+        // Without real time the bus is only bounded by the models
+        SimBus bus({I2C_FAST_MODE, false});
+        SimPCA9685 model;
+        bus.addDevice(&model, PCA_ADDR);
+        I2C i2c(&bus);
+        PCA9685 pca(&i2c, PCA_ADDR);
+        uint64_t before = bus.getTransactions();
+        auto start = std::chrono::steady_clock::now();
+        for(int i = 0; i < 20 * TIMING_WRITES; i++){
+            pca.setOffTime(SERVO_CHANNEL, 300 + i % 1000);
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        double rate = (bus.getTransactions() - before) / seconds;
+        std::cout << "  Unthrottled: " << rate << " transactions/s (" << rate * bus.transactionTime(2).count() / 1e9
+                  << "x a 400 kHz bus)" << std::endl;
+    }
+
+    std::cout << "Simulated bus: " << (passed ? "Passed!" : "Failed!") << std::endl;
+    return passed ? 0 : 1;
+}
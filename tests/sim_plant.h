@@ -0,0 +1,69 @@
+#ifndef SIM_PLANT_H
+#define SIM_PLANT_H
+
+/*
+~~ Simulated Calibration Plant ~~
+
+Servo and encoder the calibrator tests run against, shared by
+servo_calibrator_test.cpp and multi_calibrator_test.cpp.
+*/
+
+#include "sim_bus.h"
+#include "calibration.h"
+#include "servo_calibrator.h"
+
+#include <chrono>
+#include <cstdint>
+
+// Simulated servo
+const float PLANT_TAU_S = 0.008f;         // First-order lag
+const float PLANT_MAX_SPEED = 500.0f;     // deg/s
+const double PLANT_ENCODER_NOISE = 0.4;   // Encoder steps
+const int PLANT_ENCODER_OFFSET = 3600;    // Step at angle 0, the range wraps through 4095 -> 0
+
+const CalibratorParams PLANT_PARAMS = {
+    1600.0f,  // startPulse
+    300.0f,   // searchLow
+    3000.0f,  // searchHigh
+    40.0f,    // gallopStep
+    2.0f,     // endpointResolution
+    40.0f,    // backlashMargin
+    0.5f,     // saturationTolerance
+    10.0f,    // clip
+    5.0f,     // minStep
+    80.0f,    // maxStep
+    1.0f,     // curvatureTolerance
+    std::chrono::microseconds(2000),   // pollPeriod
+    std::chrono::microseconds(22000),  // minDwell
+    std::chrono::microseconds(500000), // settleTimeout
+    6,        // settleWindow
+    0.5f,     // settleTolerance
+};
+
+/* Servo following a measured sweep, with an encoder on its horn
+ * A SimServo on a SimPCA9685 channel following the rising/falling curves of
+ * truth with backlash between them (picking up a new pulse once per PWM
+ * frame, lag and speed limit), resting where startPulse leaves it on the
+ * rising curve. The SimAS5600 reads the horn with noise, PLANT_ENCODER_OFFSET
+ * steps round so the range wraps through 0. Add the encoder to the bus.
+ */
+class SimPlant
+{
+private:
+    SimServo servo;
+    SimAS5600 encoder;
+
+public:
+    SimPlant(SimPCA9685* pca, uint8_t channel, const ServoCalibration* truth, float startPulse, unsigned seed)
+        : servo(pca, channel, {0.0f, 0.0f, truth->getFalling().getMaxAngle(), PLANT_MAX_SPEED, PLANT_TAU_S, truth}
+              , truth->getRising().angleAt(startPulse))
+        , encoder([this](){ return servo.getAngle() + PLANT_ENCODER_OFFSET * 360.0 / 4096.0; }, PLANT_ENCODER_NOISE, seed){}
+
+    SimPlant(const SimPlant&) = delete;
+    SimPlant& operator=(const SimPlant&) = delete;
+
+    SimServo& getServo(){ return servo; }
+    SimAS5600& getEncoder(){ return encoder; }
+};
+
+#endif
@@ -0,0 +1,117 @@
+#include "spline.h"
+#include "config.h"
+
+#include <chrono> // For benchmarking
+#include <cmath>
+#include <vector>
+#include <random>
+#include <iostream>
+#include <iomanip>
+
+// Test Config
+const int NUM_WAYPOINTS = 12;          // Waypoints per test spline
+const float WAYPOINT_SPACING = 0.5f;   // seconds
+const float KNOT_TOLERANCE = 1e-3f;    // degrees
+const float CONTINUITY_TOLERANCE = 1e-2f; // degrees/second
+const int BENCHMARK_TICKS = 1000000;   // Number of ticks to evaluate
+const float TICK_PERIOD = 0.002f;      // seconds (500 hz)
+
+// Checks waypoint interpolation and velocity continuity at each interior knot
+bool checkSpline(JointSpline& spline, const std::vector<float>& times, const std::vector<JointVector>& waypoints){
+
+    bool passed = true;
+    float positions[NUM_JOINTS];
+    float before[NUM_JOINTS];
+    float after[NUM_JOINTS];
+
+    for(size_t i = 0; i < times.size(); i++){
+        spline.evaluate(times[i], positions);
+        for(int j = 0; j < NUM_JOINTS; j++){
+            if(std::fabs(positions[j] - waypoints[i][j]) > KNOT_TOLERANCE){
+                std::cout << "Waypoint " << i << " joint " << j << " missed by " << positions[j] - waypoints[i][j] << std::endl;
+                passed = false;
+            }
+        }
+
+        // Velocity continuity at interior knots
+        if(i == 0 || i == times.size() - 1){
+            continue;
+        }
+        spline.evaluateVelocity(times[i] - 1e-5f, before);
+        spline.evaluateVelocity(times[i] + 1e-5f, after);
+        for(int j = 0; j < NUM_JOINTS; j++){
+            if(std::fabs(before[j] - after[j]) > CONTINUITY_TOLERANCE * (1.0f + std::fabs(before[j]))){
+                std::cout << "Velocity jump at knot " << i << " joint " << j << ": " << before[j] << " -> " << after[j] << std::endl;
+                passed = false;
+            }
+        }
+    }
+
+    // Motion must start and end at rest
+    spline.evaluateVelocity(times.front(), before);
+    spline.evaluateVelocity(times.back(), after);
+    for(int j = 0; j < NUM_JOINTS; j++){
+        if(std::fabs(before[j]) > CONTINUITY_TOLERANCE || std::fabs(after[j]) > CONTINUITY_TOLERANCE){
+            std::cout << "Joint " << j << " does not start/end at rest" << std::endl;
+            passed = false;
+        }
+    }
+
+    return passed;
+}
+
+// Returns the average time of one tick in nanoseconds
+double benchmarkSpline(JointSpline& spline){
+
+    float positions[NUM_JOINTS];
+    float checksum = 0.0f;
+    float duration = spline.endTime() - spline.startTime();
+
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < BENCHMARK_TICKS; i++){
+        spline.evaluate(std::fmod(i * TICK_PERIOD, duration), positions);
+        checksum += positions[i % NUM_JOINTS];
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    // Keeps the loop from being optimized away
+    if(std::isnan(checksum)){
+        std::cout << "NaN in benchmark" << std::endl;
+    }
+
+    return std::chrono::duration<double, std::nano>(end - start).count() / BENCHMARK_TICKS;
+}
+
+int main(){
+
+    // Build random waypoints within a realistic servo range
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> angle(0.0f, 260.0f);
+
+    std::vector<float> times;
+    std::vector<JointVector> waypoints;
+    for(int i = 0; i < NUM_WAYPOINTS; i++){
+        times.push_back(i * WAYPOINT_SPACING);
+        JointVector waypoint;
+        for(int j = 0; j < NUM_JOINTS; j++){
+            waypoint[j] = angle(rng);
+        }
+        waypoints.push_back(waypoint);
+    }
+
+    bool passed = true;
+
+    JointSpline cubic(SplineType::Cubic);
+    cubic.fit(times, waypoints);
+    std::cout << "Cubic spline: " << (checkSpline(cubic, times, waypoints) ? "Passed!" : (passed = false, "Failed!")) << std::endl;
+
+    JointSpline quintic(SplineType::Quintic);
+    quintic.fit(times, waypoints);
+    std::cout << "Quintic spline: " << (checkSpline(quintic, times, waypoints) ? "Passed!" : (passed = false, "Failed!")) << std::endl;
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "Cubic evaluate: " << benchmarkSpline(cubic) << " ns/tick (" << NUM_JOINTS << " joints)" << std::endl;
+    std::cout << "Quintic evaluate: " << benchmarkSpline(quintic) << " ns/tick (" << NUM_JOINTS << " joints)" << std::endl;
+
+    return passed ? 0 : 1;
+}
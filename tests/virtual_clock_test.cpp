@@ -0,0 +1,204 @@
+/*
+~~ Virtual Clock Test ~~
+
+Runs motion on a virtual clock with the simulated bus, no hardware and no
+sleeping:
+- A servo move takes its ramp time in virtual time (angle / speed), the
+  clock only moves in whole motion engine ticks plus bus time, and the wall
+  time is a small fraction of it
+- waitFor() on a virtual engine runs the motion for the timeout (to within
+  the bus time of the last tick)
+- A motion program on the full arm replayed twice gives bit-identical
+  horn angles and times
+*/
+
+#include "clock.h"
+#include "i2c.h"
+#include "sim_bus.h"
+#include "pca9685.h"
+#include "servo.h"
+#include "motion.h"
+#include "RoboticArmBuilder.h"
+#include "config.h"
+
+#include <cmath>
+#include <chrono>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+
+// Test Config
+const uint8_t PCA_ADDR = 0x40;
+const uint8_t SERVO_CHANNEL = 3;
+const float SERVO_SPEED_DPS = 90.0f;
+const std::chrono::microseconds TICK(2000);
+const int REPLAYS = 3;
+
+bool report(const std::string& name, bool passed){
+    std::cout << name << ": " << (passed ? "Passed!" : "Failed!") << std::endl;
+    return passed;
+}
+
+double seconds(std::chrono::nanoseconds duration){
+    return std::chrono::duration<double>(duration).count();
+}
+
+// Silences the Servo and arm constructors' prints
+class Quiet
+{
+private:
+    std::ostringstream sink;
+    std::streambuf* console;
+
+public:
+    Quiet() : console(std::cout.rdbuf(sink.rdbuf())) {}
+    ~Quiet(){ std::cout.rdbuf(console); }
+};
+
+// ~~ Arm replay ~~
+
+// Trace of a motion program: virtual time and every horn angle after each step
+struct Trace{
+    std::vector<double> samples;
+    double wallSeconds;
+    double virtualSeconds;
+};
+
+Trace runProgram(){
+
+    Trace trace;
+    auto wallStart = std::chrono::steady_clock::now();
+
+    VirtualClock clock;
+    SimBus bus({I2C_FAST_MODE, true, &clock});
+    SimPCA9685 pca;
+    bus.addDevice(&pca, PCA9685_SLAVE_ADDR);
+
+    const uint8_t channels[NUM_JOINTS] = {J1S_CHANNEL, J2S_CHANNEL, J3S_CHANNEL, J4S_CHANNEL, J5S_CHANNEL, J6S_CHANNEL};
+    const float minPulses[NUM_JOINTS] = {J1S_MIN_PULSE, J2S_MIN_PULSE, J3S_MIN_PULSE, J4S_MIN_PULSE, J5S_MIN_PULSE, J6S_MIN_PULSE};
+    const float maxPulses[NUM_JOINTS] = {J1S_MAX_PULSE, J2S_MAX_PULSE, J3S_MAX_PULSE, J4S_MAX_PULSE, J5S_MAX_PULSE, J6S_MAX_PULSE};
+    const float maxAngles[NUM_JOINTS] = {J1S_MAX_ANGLE, J2S_MAX_ANGLE, J3S_MAX_ANGLE, J4S_MAX_ANGLE, J5S_MAX_ANGLE, J6S_MAX_ANGLE};
+    const float defaults[NUM_JOINTS] = {J1S_DEF_ANGLE, J2S_DEF_ANGLE, J3S_DEF_ANGLE, J4S_DEF_ANGLE, J5S_DEF_ANGLE, J6S_DEF_ANGLE};
+    std::vector<std::unique_ptr<SimServo>> horns;
+    for(int i = 0; i < NUM_JOINTS; i++){
+        SimServoParams params = {minPulses[i], maxPulses[i], maxAngles[i], 400.0f, 0.02f, nullptr};
+        horns.emplace_back(new SimServo(&pca, channels[i], params, defaults[i], &clock));
+    }
+
+    auto sample = [&](){
+        trace.samples.push_back(seconds(clock.elapsed()));
+        for(auto& horn : horns){
+            trace.samples.push_back(horn->getAngle());
+        }
+    };
+
+    {
+        Quiet quiet;
+        RoboticArmBuilder arm(&bus, &clock);
+        sample();
+
+        // One joint at a time
+        arm.setAngle(0, 60.0f);
+        sample();
+        arm.setAngle(2, 200.0f);
+        sample();
+
+        // Several at once, then a retarget mid-move
+        std::vector<MotionHandle> moves;
+        moves.push_back(arm.setAngle(1, 90.0f, false));
+        moves.push_back(arm.setAngle(3, 100.0f, false));
+        moves.push_back(arm.setAngle(4, 20.0f, false));
+        moves[0].waitFor(std::chrono::milliseconds(150));
+        sample();
+        moves[1] = arm.setAngle(3, 180.0f, false);
+        MotionHandle::whenAll(moves).wait();
+        sample();
+
+        // Dwell: the horns finish settling on the last pulses
+        clock.advance(std::chrono::milliseconds(200));
+        sample();
+    }
+    sample(); // Back home after the arm's shutdown
+
+    trace.virtualSeconds = seconds(clock.elapsed());
+    trace.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+    return trace;
+}
+
+int main(){
+
+    bool passed = true;
+    std::cout << std::fixed << std::setprecision(4);
+
+    // ~~ Single servo ~~
+    {
+        VirtualClock clock;
+        SimBus bus({I2C_FAST_MODE, true, &clock});
+        SimPCA9685 model;
+        bus.addDevice(&model, PCA_ADDR);
+        I2C i2c(&bus);
+        PCA9685 pca(&i2c, PCA_ADDR);
+        SimServo horn(&model, SERVO_CHANNEL, {500.0f, 2500.0f, 180.0f, 400.0f, 0.01f, nullptr}, 90.0f, &clock);
+        MotionEngine engine(TICK, &clock);
+
+        Servo* servo;
+        {
+            Quiet quiet;
+            ServoParams params = {&pca, SERVO_CHANNEL, 500, 2500, 180.0f, 90.0f, SERVO_SPEED_DPS, 5.0f, &engine};
+            servo = new Servo(params);
+        }
+
+        // 90 -> 180 at 90 deg/s
+        Clock::TimePoint start = clock.now();
+        auto wallStart = std::chrono::steady_clock::now();
+        servo->moveToPosition(180.0f).wait();
+        double moveTime = seconds(clock.now() - start);
+        double wallTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+        engine.runFor(std::chrono::milliseconds(100));
+        bool reached = std::fabs(horn.getAngle() - 180.0) < 0.5;
+        bool ramp = std::fabs(moveTime - 1.0) <= 0.01;
+        std::cout << "  90 -> 180 at " << SERVO_SPEED_DPS << " deg/s: " << moveTime << " s virtual, " << wallTime * 1e3
+                  << " ms wall (" << moveTime / wallTime << "x real time), horn at " << horn.getAngle() << std::endl;
+        passed = report("Servo move takes its ramp time in virtual time", reached && ramp && wallTime < moveTime) && passed;
+
+        // waitFor runs the motion for the timeout, the last tick's bus writes may run past it
+        start = clock.now();
+        MotionHandle move = servo->moveToPosition(0.0f);
+        bool early = !move.waitFor(std::chrono::milliseconds(500));
+        std::chrono::nanoseconds waited = clock.now() - start;
+        bool timed = waited >= std::chrono::milliseconds(500) && waited < std::chrono::milliseconds(500) + TICK;
+        bool finished = move.waitFor(std::chrono::milliseconds(5000)) && move.status() == MotionStatus::Completed;
+        std::cout << "  180 -> 0: timed out after " << seconds(waited) << " s, done after " << seconds(clock.now() - start)
+                  << " s virtual" << std::endl;
+        passed = report("waitFor times out on the virtual clock", early && timed && finished) && passed;
+
+        Quiet quiet;
+        delete servo;
+    }
+
+    // ~~ Arm replay ~~
+    {
+        std::vector<Trace> traces;
+        for(int i = 0; i < REPLAYS; i++){
+            traces.push_back(runProgram());
+        }
+
+        bool identical = true;
+        for(int i = 1; i < REPLAYS; i++){
+            identical = identical && traces[i].samples == traces[0].samples;
+        }
+        bool moved = traces[0].samples.size() > 2 * (NUM_JOINTS + 1)
+                  && std::fabs(traces[0].samples[NUM_JOINTS + 2] - 60.0) < 5.0; // Joint 1 after its move (calibrated servo, linear model)
+        for(const Trace& trace : traces){
+            std::cout << "  Program: " << trace.virtualSeconds << " s virtual, " << trace.wallSeconds * 1e3
+                      << " ms wall (" << trace.virtualSeconds / trace.wallSeconds << "x real time)" << std::endl;
+        }
+        passed = report("Arm motion program replays bit-identically", identical && moved) && passed;
+    }
+
+    std::cout << "Virtual clock: " << (passed ? "Passed!" : "Failed!") << std::endl;
+    return passed ? 0 : 1;
+}